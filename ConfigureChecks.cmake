@@ -3,6 +3,7 @@ include(CheckSymbolExists)
 include(CheckFunctionExists)
 include(CheckLibraryExists)
 include(CheckTypeSize)
+include(CheckStructHasMember)
 include(CheckCXXSourceCompiles)
 
 set(PACKAGE ${APPLICATION_NAME})
@@ -17,6 +18,9 @@ set(SOURCEDIR ${CMAKE_SOURCE_DIR})
 
 # HEADER FILES
 check_include_file(argp.h HAVE_ARGP_H)
+check_include_file(sys/inotify.h HAVE_SYS_INOTIFY_H)
+check_include_file(sys/sendfile.h HAVE_SYS_SENDFILE_H)
+check_symbol_exists(FICLONE linux/fs.h HAVE_FICLONE)
 
 # FUNCTIONS
 if (NOT LINUX)
@@ -31,6 +35,12 @@ if (HAVE_LIBRT OR HAVE_CLOCK_GETTIME)
     set(CMAKE_REQUIRED_LIBRARIES ${CMAKE_REQUIRED_LIBRARIES} rt)
 endif (HAVE_LIBRT OR HAVE_CLOCK_GETTIME)
 
+find_package(Threads)
+if (CMAKE_USE_PTHREADS_INIT)
+    set(HAVE_PTHREAD 1)
+    set(CMAKE_REQUIRED_LIBRARIES ${CMAKE_REQUIRED_LIBRARIES} ${CMAKE_THREAD_LIBS_INIT})
+endif (CMAKE_USE_PTHREADS_INIT)
+
 check_library_exists(dl dlopen "" HAVE_LIBDL)
 if (HAVE_LIBDL)
     find_library(DLFCN_LIBRARY dl)
@@ -52,6 +62,10 @@ endif()
 check_function_exists(strerror_r HAVE_STRERROR_R)
 check_function_exists(utimes HAVE_UTIMES)
 check_function_exists(lstat HAVE_LSTAT)
+check_function_exists(fstatat HAVE_FSTATAT)
+check_function_exists(statx HAVE_STATX)
+check_function_exists(copy_file_range HAVE_COPY_FILE_RANGE)
+check_struct_has_member("struct stat" st_mtim sys/stat.h HAVE_STRUCT_STAT_ST_MTIM)
 check_function_exists(asprintf HAVE_ASPRINTF)
 if (UNIX AND HAVE_ASPRINTF)
     add_definitions(-D_GNU_SOURCE)
@@ -38,12 +38,14 @@
 #include "csync_auth.h"
 #include "../src/std/c_private.h"
 #include "../src/csync_misc.h"
+#include "../src/csync_watch.h"
 
 const char *csync_program_version = "csync commandline client "
   CSYNC_STRINGIFY(LIBCSYNC_VERSION);
 
 /* Program documentation. */
 static char doc[] = "Usage: csync [OPTION...] LOCAL REMOTE\n\
+       csync --watch LOCAL\n\
 csync -- a user level file synchronizer which synchronizes the files\n\
 at LOCAL with the ones at REMOTE.\n\
 \n\
@@ -56,6 +58,9 @@ at LOCAL with the ones at REMOTE.\n\
     --test-statedb         Test creation of the statedb. Runs update\n\
                            detection.\n\
     --test-update          Test the update detection\n\
+    --watch                Record the changes of LOCAL in a journal till\n\
+                           interrupted. The update detection uses it if\n\
+                           incremental_update is enabled.\n\
 -?, --help                 Give this help list\n\
     --usage                Give a short usage message\n\
 -V, --version              Print program version\n\
@@ -70,6 +75,7 @@ static const struct option long_options[] =
     {"test-statedb",    no_argument,       0,  0  },
     {"conflict-copies", no_argument,       0, 'c' },
     {"test-update",     no_argument,       0,  0  },
+    {"watch",           no_argument,       0,  0  },
     {"version",         no_argument,       0, 'V' },
     {"usage",           no_argument,       0, 'h' },
     {0, 0, 0, 0}
@@ -84,6 +90,7 @@ struct argument_s {
   int update;
   int reconcile;
   int propagate;
+  int watch;
   bool with_conflict_copys;
 };
 
@@ -150,6 +157,8 @@ static int parse_args(struct argument_s *csync_args, int argc, char **argv)
                 csync_args->reconcile = 0;
                 csync_args->propagate = 0;
                 /* printf("Argument: test-statedb\n"); */
+            } else if(c_streq(opt->name, "watch")) {
+                csync_args->watch = 1;
             } else {
                 fprintf(stderr, "Argument: No idea what!\n");
 
@@ -162,6 +171,34 @@ static int parse_args(struct argument_s *csync_args, int argc, char **argv)
     return optind;
 }
 
+static int watch(const char *local)
+{
+    CSYNC *csync;
+    csync_watch_t *w;
+    int rc = 0;
+
+    if (csync_create(&csync, local, local) < 0) {
+        fprintf(stderr, "csync_create: failed\n");
+        return 1;
+    }
+
+    w = csync_watch_start(csync);
+    if (w == NULL) {
+        perror("csync_watch_start");
+        csync_destroy(csync);
+        return 1;
+    }
+
+    while (csync_watch_poll(w, -1) >= 0);
+
+    perror("csync_watch_poll");
+    rc = 1;
+
+    csync_watch_stop(w);
+    csync_destroy(csync);
+
+    return rc;
+}
 
 int main(int argc, char **argv) {
   int rc = 0;
@@ -178,9 +215,18 @@ int main(int argc, char **argv) {
   arguments.update = 1;
   arguments.reconcile = 1;
   arguments.propagate = 1;
+  arguments.watch = 0;
   arguments.with_conflict_copys = false;
 
   parse_args(&arguments, argc, argv);
+
+  if (arguments.watch) {
+    if (argc - optind < 1) {
+      print_help();
+    }
+    return watch(argv[optind]);
+  }
+
   /* two options must remain as source and target       */
   /* printf("ARGC: %d -> optind: %d\n", argc, optind ); */
   if( argc - optind < 2 ) {
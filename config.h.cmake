@@ -9,13 +9,21 @@
 #cmakedefine SOURCEDIR "${SOURCEDIR}"
 
 #cmakedefine HAVE_CLOCK_GETTIME
+#cmakedefine HAVE_PTHREAD 1
 
 #cmakedefine WITH_LOG4C 1
 
 #cmakedefine HAVE_ARGP_H 1
+#cmakedefine HAVE_SYS_INOTIFY_H 1
+#cmakedefine HAVE_SYS_SENDFILE_H 1
+#cmakedefine HAVE_FICLONE 1
 
 #cmakedefine HAVE_STRERROR_R 1
 #cmakedefine HAVE_UTIMES 1
 #cmakedefine HAVE_LSTAT 1
+#cmakedefine HAVE_FSTATAT 1
+#cmakedefine HAVE_STATX 1
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+#cmakedefine HAVE_STRUCT_STAT_ST_MTIM 1
 #cmakedefine HAVE_FNMATCH 1
 
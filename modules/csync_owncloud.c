@@ -1435,7 +1435,9 @@ csync_vio_method_t _method = {
     .unlink = owncloud_unlink,
     .chmod = owncloud_chmod,
     .chown = owncloud_chown,
-    .utimes = owncloud_utimes
+    .utimes = owncloud_utimes,
+    /* DELETE on a collection removes everything in it */
+    .rmdirs = owncloud_rmdir
 };
 
 csync_vio_method_t *vio_module_init(const char *method_name, const char *args,
@@ -34,6 +34,7 @@
 
 #include "c_lib.h"
 #include "csync_private.h"
+#include "csync_buffer.h"
 #include "csync_config.h"
 #include "csync_exclude.h"
 #include "csync_lock.h"
@@ -41,8 +42,12 @@
 #include "csync_time.h"
 #include "csync_util.h"
 #include "csync_misc.h"
+#ifndef _WIN32
+#include "csync_watch.h"
+#endif
 
 #include "csync_update.h"
+#include "csync_checksum.h"
 #include "csync_reconcile.h"
 #include "csync_propagate.h"
 
@@ -51,37 +56,6 @@
 #define CSYNC_LOG_CATEGORY_NAME "csync.api"
 #include "csync_log.h"
 
-static int _key_cmp(const void *key, const void *data) {
-  uint64_t a;
-  csync_file_stat_t *b;
-
-  a = *(uint64_t *) (key);
-  b = (csync_file_stat_t *) data;
-
-  if (a < b->phash) {
-    return -1;
-  } else if (a > b->phash) {
-    return 1;
-  }
-
-  return 0;
-}
-
-static int _data_cmp(const void *key, const void *data) {
-  csync_file_stat_t *a, *b;
-
-  a = (csync_file_stat_t *) key;
-  b = (csync_file_stat_t *) data;
-
-  if (a->phash < b->phash) {
-    return -1;
-  } else if (a->phash > b->phash) {
-    return 1;
-  }
-
-  return 0;
-}
-
 int csync_create(CSYNC **csync, const char *local, const char *remote) {
   CSYNC *ctx;
   size_t len = 0;
@@ -116,6 +90,15 @@ int csync_create(CSYNC **csync, const char *local, const char *remote) {
 
   ctx->options.max_depth = MAX_DEPTH;
   ctx->options.max_time_difference = MAX_TIME_DIFFERENCE;
+  ctx->options.update_threads = 1;
+  ctx->options.reconcile_threads = 1;
+  ctx->options.propagate_threads = 1;
+  ctx->options.transfer_buffer_size = CSYNC_BUFFER_MAX_SIZE / 1024;
+  ctx->options.transfer_pipeline = true;
+  ctx->options.preload_statedb = true;
+  ctx->options.incremental_update = false;
+  ctx->options.concurrent_update = false;
+  ctx->options.checksum = false;
   ctx->options.unix_extensions = 0;
   ctx->options.with_conflict_copys=false;
   ctx->options.local_only_mode = false;
@@ -142,6 +125,16 @@ int csync_create(CSYNC **csync, const char *local, const char *remote) {
     return -1;
   }
 
+  ctx->buffers = csync_buffer_pool_new();
+  if (ctx->buffers == NULL) {
+    SAFE_FREE(ctx->local.uri);
+    SAFE_FREE(ctx->remote.uri);
+    SAFE_FREE(ctx->options.config_dir);
+    SAFE_FREE(ctx);
+    errno = ENOMEM;
+    return -1;
+  }
+
   *csync = ctx;
   return 0;
 }
@@ -316,12 +309,19 @@ retry_vio_init:
       }
   }
 
-  if (c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp) < 0) {
+  ctx->local.arena = c_arena_new(0);
+  ctx->remote.arena = c_arena_new(0);
+  if (ctx->local.arena == NULL || ctx->remote.arena == NULL) {
+    rc = -1;
+    goto out;
+  }
+
+  if (c_htable_create(&ctx->local.tree, csync_file_stat_cmp) < 0) {
     rc = -1;
     goto out;
   }
 
-  if (c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp) < 0) {
+  if (c_htable_create(&ctx->remote.tree, csync_file_stat_cmp) < 0) {
     rc = -1;
     goto out;
   }
@@ -341,30 +341,143 @@ out:
   return rc;
 }
 
+/* Walk a replica and add its files to its tree */
+static int _csync_update_walk(csync_walk_t *walk) {
+  CSYNC *ctx = walk->ctx;
+  struct timespec start, finish;
+  int rc;
+
+  csync_gettime(&start);
+
+  /* modules are not required to be thread safe */
+  if (walk->replica == LOCAL_REPLICA && ctx->options.update_threads > 1) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Walking %s with %d threads",
+        walk->uri, ctx->options.update_threads);
+    rc = csync_ftw_parallel(walk, walk->uri, csync_walker, MAX_DEPTH,
+        ctx->options.update_threads);
+  } else {
+    rc = csync_ftw(walk, walk->uri, csync_walker, MAX_DEPTH);
+  }
+
+  /* downgrade the modified files with an unchanged content */
+  if (rc == 0) {
+    rc = csync_checksum_detect(walk);
+  }
+
+  csync_gettime(&finish);
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "Update detection for %s replica took %.2f seconds walking %zu files.",
+      walk->current == LOCAL_REPLICA ? "local" : "remote",
+      c_secdiff(finish, start), c_htable_size(walk->tree));
+
+  return rc;
+}
+
+#ifdef HAVE_PTHREAD
+struct _csync_update_thread_s {
+  csync_walk_t *walk;
+  int rc;
+};
+
+static void *_csync_update_thread(void *arg) {
+  struct _csync_update_thread_s *t = arg;
+
+  t->rc = _csync_update_walk(t->walk);
+
+  return NULL;
+}
+
+/*
+ * Walk the local replica on a thread of its own while the remote replica is
+ * walked on the calling thread, modules are not required to be thread safe.
+ * The walker functions of both walks share a lock, so the statedb is never
+ * accessed by both at once.
+ */
+static int _csync_update_concurrent(csync_walk_t *local,
+    csync_walk_t *remote) {
+  struct _csync_update_thread_s t;
+  pthread_mutex_t lock;
+  pthread_t thread;
+  int rc;
+
+  pthread_mutex_init(&lock, NULL);
+  local->lock = &lock;
+  remote->lock = &lock;
+
+  t.walk = local;
+  t.rc = -1;
+  if (pthread_create(&thread, NULL, _csync_update_thread, &t) != 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "Unable to start update thread, walking the replicas one by one");
+    rc = _csync_update_walk(local);
+    if (rc == 0) {
+      rc = _csync_update_walk(remote);
+    }
+  } else {
+    rc = _csync_update_walk(remote);
+    pthread_join(thread, NULL);
+    if (t.rc < 0) {
+      rc = t.rc;
+    }
+  }
+
+  local->lock = NULL;
+  remote->lock = NULL;
+  pthread_mutex_destroy(&lock);
+
+  return rc;
+}
+#endif /* HAVE_PTHREAD */
+
 int csync_update(CSYNC *ctx) {
+  csync_walk_t local;
+  csync_walk_t remote;
   int rc = -1;
-  struct timespec start, finish;
 
   if (ctx == NULL) {
     errno = EBADF;
     return -1;
   }
 
-  csync_memstat_check();
+  csync_memstat_check(ctx);
 
-  /* update detection for local replica */
-  csync_gettime(&start);
-  ctx->current = LOCAL_REPLICA;
-  ctx->replica = ctx->local.type;
+  ctx->local.update_start = time(NULL);
+  csync_walk_init(&local, ctx, LOCAL_REPLICA);
+  csync_walk_init(&remote, ctx, REMOTE_REPLICA);
 
-  rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+#ifndef _WIN32
+  if (ctx->options.incremental_update && ! csync_is_statedb_disabled(ctx)) {
+    csync_watch_journal_load(ctx);
+  }
+#endif
 
-  csync_gettime(&finish);
+#ifdef HAVE_PTHREAD
+  /* update detection for both replicas at the same time */
+  if (ctx->options.concurrent_update && ! ctx->options.local_only_mode) {
+    rc = _csync_update_concurrent(&local, &remote);
 
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-      "Update detection for local replica took %.2f seconds walking %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
-  csync_memstat_check();
+    if (ctx->statedb.db != NULL) {
+      csync_statedb_log_stats(ctx);
+    }
+    csync_memstat_check(ctx);
+
+    if (rc < 0) {
+      return -1;
+    }
+    ctx->status |= CSYNC_STATUS_UPDATE;
+
+    return 0;
+  }
+#endif
+
+  /* update detection for local replica */
+  rc = _csync_update_walk(&local);
+
+  if (ctx->statedb.db != NULL) {
+    csync_statedb_log_stats(ctx);
+  }
+  csync_memstat_check(ctx);
 
   if (rc < 0) {
     return -1;
@@ -372,19 +485,9 @@ int csync_update(CSYNC *ctx) {
 
   /* update detection for remote replica */
   if( ! ctx->options.local_only_mode ) {
-      csync_gettime(&start);
-      ctx->current = REMOTE_REPLICA;
-      ctx->replica = ctx->remote.type;
-
-      rc = csync_ftw(ctx, ctx->remote.uri, csync_walker, MAX_DEPTH);
+      rc = _csync_update_walk(&remote);
 
-      csync_gettime(&finish);
-
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-                "Update detection for remote replica took %.2f seconds "
-                "walking %zu files.",
-                c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
-      csync_memstat_check();
+      csync_memstat_check(ctx);
 
       if (rc < 0) {
           return -1;
@@ -404,37 +507,20 @@ int csync_reconcile(CSYNC *ctx) {
     return -1;
   }
 
-  /* Reconciliation for local replica */
+  /* Reconciliation for both replicas at once */
   csync_gettime(&start);
 
-  ctx->current = LOCAL_REPLICA;
-  ctx->replica = ctx->local.type;
-
-  rc = csync_reconcile_updates(ctx);
-
-  csync_gettime(&finish);
-
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-      "Reconciliation for local replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
-
-  if (rc < 0) {
-    return -1;
+  rc = csync_reconcile_merge(ctx);
+  if (rc == 0) {
+    rc = csync_reconcile_subtrees(ctx);
   }
 
-  /* Reconciliation for local replica */
-  csync_gettime(&start);
-
-  ctx->current = REMOTE_REPLICA;
-  ctx->replica = ctx->remote.type;
-
-  rc = csync_reconcile_updates(ctx);
-
   csync_gettime(&finish);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-      "Reconciliation for remote replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+      "Reconciliation took %.2f seconds merging %zu local and %zu remote files.",
+      c_secdiff(finish, start), c_htable_size(ctx->local.tree),
+      c_htable_size(ctx->remote.tree));
 
   if (rc < 0) {
     return -1;
@@ -466,7 +552,7 @@ int csync_propagate(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Propagation for local replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+      c_secdiff(finish, start), c_htable_size(ctx->local.tree));
 
   if (rc < 0) {
     return -1;
@@ -484,7 +570,7 @@ int csync_propagate(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Propagation for remote replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+      c_secdiff(finish, start), c_htable_size(ctx->remote.tree));
 
   if (rc < 0) {
     return -1;
@@ -501,7 +587,7 @@ int csync_propagate(CSYNC *ctx) {
 static int _csync_treewalk_visitor( void *obj, void *data ) {
     csync_file_stat_t *cur;
     CSYNC *ctx;
-    c_rbtree_visit_func *visitor;
+    c_htable_visit_func *visitor;
     _csync_treewalk_context *twctx;
     TREE_WALK_FILE trav;
 
@@ -522,12 +608,14 @@ static int _csync_treewalk_visitor( void *obj, void *data ) {
         return 0;
     }
 
-    visitor = (c_rbtree_visit_func*)(twctx->user_visitor);
+    visitor = (c_htable_visit_func*)(twctx->user_visitor);
     if (visitor != NULL) {
-      trav.path =   cur->path;
+      char path[cur->pathlen + 1];
+
+      trav.path =   csync_file_stat_path(cur, path);
       trav.modtime = cur->modtime;
-      trav.uid =    cur->uid;
-      trav.gid =    cur->gid;
+      trav.uid =    csync_owner_uid(ctx, cur->owner);
+      trav.gid =    csync_owner_gid(ctx, cur->owner);
       trav.mode =   cur->mode;
       trav.type =   cur->type;
       trav.instruction = cur->instruction;
@@ -542,11 +630,11 @@ static int _csync_treewalk_visitor( void *obj, void *data ) {
  * treewalk function, called from its wrappers below.
  *
  * it encapsulates the user visitor function, the filter and the userdata
- * into a treewalk_context structure and calls the rb treewalk function,
+ * into a treewalk_context structure and calls the table walk function,
  * which calls the local _csync_treewalk_visitor in this module.
  * The user visitor is called from there.
  */
-static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_func *visitor, int filter)
+static int _csync_walk_tree(CSYNC *ctx, c_htable_t *tree, csync_treewalk_visit_func *visitor, int filter)
 {
     _csync_treewalk_context tw_ctx;
     int rc = -1;
@@ -559,7 +647,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
 
     ctx->userdata = &tw_ctx;
 
-    rc = c_rbtree_walk(tree, (void*) ctx, _csync_treewalk_visitor);
+    rc = c_htable_walk(tree, (void*) ctx, _csync_treewalk_visitor);
 
     ctx->userdata = tw_ctx.userdata;
 
@@ -571,7 +659,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
  */
 int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_htable_t *tree = NULL;
 
     if( ctx ) {
         tree = ctx->remote.tree;
@@ -584,7 +672,7 @@ int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int
  */
 int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_htable_t *tree = NULL;
 
     if( ctx ) {
         tree = ctx->local.tree;
@@ -592,13 +680,6 @@ int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int fi
     return _csync_walk_tree(ctx, tree, visitor, filter);
 }
 
-static void _tree_destructor(void *data) {
-  csync_file_stat_t *freedata = NULL;
-
-  freedata = (csync_file_stat_t *) data;
-  SAFE_FREE(freedata);
-}
-
 int csync_destroy(CSYNC *ctx) {
   struct timespec start, finish;
   char *lock = NULL;
@@ -626,10 +707,17 @@ int csync_destroy(CSYNC *ctx) {
         /* write the statedb to disk */
         if (csync_statedb_write(ctx) == 0) {
           jwritten = 1;
+#ifndef _WIN32
+          if (csync_watch_journal_commit(ctx) < 0) {
+            strerror_r(errno, errbuf, sizeof(errbuf));
+            CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+                "Unable to update the change journal: %s", errbuf);
+          }
+#endif
           csync_gettime(&finish);
           CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
               "Writing the statedb of %zu files to disk took %.2f seconds",
-              c_rbtree_size(ctx->local.tree), c_secdiff(finish, start));
+              c_htable_size(ctx->local.tree), c_secdiff(finish, start));
         } else {
           strerror_r(errno, errbuf, sizeof(errbuf));
           CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Unable to write statedb: %s",
@@ -643,6 +731,10 @@ int csync_destroy(CSYNC *ctx) {
   /* clear exclude list */
   csync_exclude_destroy(ctx);
 
+#ifndef _WIN32
+  csync_watch_journal_free(ctx);
+#endif
+
 #ifndef _WIN32
   /* remove the lock file */
   if (asprintf(&lock, "%s/%s", ctx->options.config_dir, CSYNC_LOCK_FILE) > 0) {
@@ -650,23 +742,19 @@ int csync_destroy(CSYNC *ctx) {
   }
 #endif
 
+  csync_buffer_pool_free(ctx->buffers);
+
   /* stop logging */
   csync_log_fini();
 
-  /* destroy the rbtrees */
-  if (c_rbtree_size(ctx->local.tree) > 0) {
-    c_rbtree_destroy(ctx->local.tree, _tree_destructor);
-  }
-
-  if (c_rbtree_size(ctx->remote.tree) > 0) {
-    c_rbtree_destroy(ctx->remote.tree, _tree_destructor);
-  }
-
-  /* free memory */
-  c_rbtree_free(ctx->local.tree);
+  /* free memory, the file stats are freed with the arenas */
+  c_htable_free(ctx->local.tree);
+  c_arena_free(ctx->local.arena);
   c_list_free(ctx->local.list);
-  c_rbtree_free(ctx->remote.tree);
+  c_htable_free(ctx->remote.tree);
+  c_arena_free(ctx->remote.arena);
   c_list_free(ctx->remote.list);
+  SAFE_FREE(ctx->owners.list);
   SAFE_FREE(ctx->local.uri);
   SAFE_FREE(ctx->remote.uri);
   SAFE_FREE(ctx->options.config_dir);
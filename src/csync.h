@@ -89,7 +89,11 @@ enum csync_instructions_e {
   CSYNC_INSTRUCTION_ERROR      = 0x00000100,
   /* instructions for the propagator */
   CSYNC_INSTRUCTION_DELETED    = 0x00000200,
-  CSYNC_INSTRUCTION_UPDATED    = 0x00000400
+  CSYNC_INSTRUCTION_UPDATED    = 0x00000400,
+  /* the content is unchanged, only the metadata has to be synced */
+  CSYNC_INSTRUCTION_METADATA   = 0x00000800,
+  /* the directory is removed with everything in it at once */
+  CSYNC_INSTRUCTION_REMOVE_TREE = 0x00001000
 };
 
 /**
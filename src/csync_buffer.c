@@ -0,0 +1,193 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008      by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "c_lib.h"
+
+#include "csync_private.h"
+#include "csync_buffer.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.buffer"
+#include "csync_log.h"
+
+/* size classes from CSYNC_BUFFER_MIN_SIZE up to 64 MB */
+#define CSYNC_BUFFER_CLASSES 13
+
+/* buffers kept per size class, about one per propagation thread */
+#define CSYNC_BUFFER_KEEP 4
+
+/* calls a transfer takes at most, fewer through the module, each is a round trip */
+#define CSYNC_BUFFER_LOCAL_CALLS 16
+#define CSYNC_BUFFER_MODULE_CALLS 4
+
+struct csync_buffer_pool_s {
+  void *free[CSYNC_BUFFER_CLASSES][CSYNC_BUFFER_KEEP];
+  int count[CSYNC_BUFFER_CLASSES];
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
+#endif
+  /* statistics */
+  size_t allocated;
+  size_t reused;
+};
+
+/* Get the size class of a buffer size, -1 if it is too large */
+static int _csync_buffer_class(size_t size) {
+  size_t s = CSYNC_BUFFER_MIN_SIZE;
+  int i;
+
+  for (i = 0; i < CSYNC_BUFFER_CLASSES; i++, s <<= 1) {
+    if (s == size) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+csync_buffer_pool_t *csync_buffer_pool_new(void) {
+  csync_buffer_pool_t *pool;
+
+  pool = c_malloc(sizeof(csync_buffer_pool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&pool->lock, NULL);
+#endif
+
+  return pool;
+}
+
+void csync_buffer_pool_free(csync_buffer_pool_t *pool) {
+  int i, j;
+
+  if (pool == NULL) {
+    return;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "Transfer buffers: %zu allocated, %zu reused",
+      pool->allocated, pool->reused);
+
+  for (i = 0; i < CSYNC_BUFFER_CLASSES; i++) {
+    for (j = 0; j < pool->count[i]; j++) {
+      SAFE_FREE(pool->free[i][j]);
+    }
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&pool->lock);
+#endif
+  SAFE_FREE(pool);
+}
+
+size_t csync_buffer_size(enum csync_replica_e srep, enum csync_replica_e drep,
+    int64_t size, size_t max) {
+  size_t bufsize = CSYNC_BUFFER_MIN_SIZE;
+  int64_t want;
+
+  if (srep == LOCAL_REPLICA && drep == LOCAL_REPLICA) {
+    want = size / CSYNC_BUFFER_LOCAL_CALLS;
+    if (max > CSYNC_BUFFER_LOCAL_MAX_SIZE) {
+      max = CSYNC_BUFFER_LOCAL_MAX_SIZE;
+    }
+  } else {
+    want = size / CSYNC_BUFFER_MODULE_CALLS;
+  }
+
+  /* the next power of two, in the size classes of the pool */
+  while ((int64_t) bufsize < want && bufsize * 2 <= max &&
+      _csync_buffer_class(bufsize * 2) >= 0) {
+    bufsize *= 2;
+  }
+
+  return bufsize;
+}
+
+void *csync_buffer_get(csync_buffer_pool_t *pool, size_t size) {
+  void *buf = NULL;
+  int i;
+
+  i = _csync_buffer_class(size);
+  if (i < 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (pool == NULL) {
+    goto alloc;
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&pool->lock);
+#endif
+  if (pool->count[i] > 0) {
+    buf = pool->free[i][--pool->count[i]];
+    pool->reused++;
+  } else {
+    pool->allocated++;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&pool->lock);
+#endif
+
+alloc:
+  if (buf == NULL) {
+    buf = c_malloc(size);
+  }
+
+  return buf;
+}
+
+void csync_buffer_put(csync_buffer_pool_t *pool, void *buf, size_t size) {
+  int i;
+
+  if (buf == NULL) {
+    return;
+  }
+
+  i = _csync_buffer_class(size);
+  if (pool == NULL) {
+    goto out;
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&pool->lock);
+#endif
+  if (i >= 0 && pool->count[i] < CSYNC_BUFFER_KEEP) {
+    pool->free[i][pool->count[i]++] = buf;
+    buf = NULL;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&pool->lock);
+#endif
+
+out:
+  SAFE_FREE(buf);
+}
+
+/* vim: set ts=8 sw=2 et cindent: */
@@ -0,0 +1,119 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008      by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _CSYNC_BUFFER_H
+#define _CSYNC_BUFFER_H
+
+/**
+ * @file csync_buffer.h
+ *
+ * @brief Transfer buffers
+ *
+ * Files are transferred through a buffer sized for the file and the replicas
+ * involved. Small files get a small one, large files a larger one, up to
+ * the transfer_buffer_size option for transfers through the module, which
+ * pays a round trip per call. The sizes are powers of two and the buffers
+ * are kept in a pool for the next files of the same size class, which the
+ * propagation threads share.
+ *
+ * @defgroup csyncBufferInternals csync transfer buffer internals
+ * @ingroup csyncInternalAPI
+ *
+ * @{
+ */
+
+#include <stdint.h>
+
+#include "csync_private.h"
+
+/**
+ * The smallest transfer buffer.
+ */
+#define CSYNC_BUFFER_MIN_SIZE MAX_XFER_BUF_SIZE
+
+/**
+ * The largest transfer buffer between local files, it stays in the cache.
+ */
+#define CSYNC_BUFFER_LOCAL_MAX_SIZE (1024 * 1024)
+
+/**
+ * The default of the largest transfer buffer through the module.
+ */
+#define CSYNC_BUFFER_MAX_SIZE (4 * 1024 * 1024)
+
+typedef struct csync_buffer_pool_s csync_buffer_pool_t;
+
+/**
+ * @brief Create a pool of transfer buffers.
+ *
+ * @return  The pool, NULL if an error occured with errno set.
+ */
+csync_buffer_pool_t *csync_buffer_pool_new(void);
+
+/**
+ * @brief Free a pool and the buffers kept in it.
+ *
+ * The buffers taken from the pool have to be put back before.
+ *
+ * @param pool    The pool to free.
+ */
+void csync_buffer_pool_free(csync_buffer_pool_t *pool);
+
+/**
+ * @brief Get the size of the buffer to transfer a file with.
+ *
+ * @param srep    The replica the file is read from.
+ * @param drep    The replica the file is written to.
+ * @param size    The size of the file.
+ * @param max     The largest buffer through the module.
+ *
+ * @return  A power of two between CSYNC_BUFFER_MIN_SIZE and the largest
+ *          buffer for the replicas.
+ */
+size_t csync_buffer_size(enum csync_replica_e srep, enum csync_replica_e drep,
+    int64_t size, size_t max);
+
+/**
+ * @brief Take a buffer from the pool or allocate it.
+ *
+ * @param pool    The pool, NULL allocates the buffer.
+ * @param size    The size of the buffer, from csync_buffer_size().
+ *
+ * @return  The buffer, NULL if an error occured with errno set.
+ */
+void *csync_buffer_get(csync_buffer_pool_t *pool, size_t size);
+
+/**
+ * @brief Put a buffer back into the pool for the next files.
+ *
+ * The buffer is freed if the pool keeps enough of its size.
+ *
+ * @param pool    The pool, NULL frees the buffer.
+ * @param buf     The buffer from csync_buffer_get(), NULL is ignored.
+ * @param size    The size it was taken with.
+ */
+void csync_buffer_put(csync_buffer_pool_t *pool, void *buf, size_t size);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_BUFFER_H */
+
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -0,0 +1,179 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008      by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+#include "c_lib.h"
+
+#include "csync_private.h"
+#include "csync_checksum.h"
+#include "csync_statedb.h"
+#include "csync_time.h"
+#include "csync_util.h"
+
+#include "vio/csync_vio_local.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.checksum"
+#include "csync_log.h"
+
+struct _csync_checksum_detect_s {
+  csync_walk_t *walk;
+  char *buf;
+  size_t files;
+  size_t cached;
+  size_t unchanged;
+  uint64_t bytes;
+};
+
+void csync_checksum_init(csync_checksum_t *cs) {
+  c_xxhash64_reset(cs, 0);
+}
+
+void csync_checksum_update(csync_checksum_t *cs, const void *buf, size_t len) {
+  c_xxhash64_update(cs, buf, len);
+}
+
+uint64_t csync_checksum_digest(const csync_checksum_t *cs) {
+  uint64_t checksum = c_xxhash64_digest(cs);
+
+  /* 0 means unknown */
+  return checksum != CSYNC_CHECKSUM_NONE ? checksum : 1;
+}
+
+static int _csync_checksum_read(const char *uri, char *buf,
+    uint64_t *checksum, uint64_t *bytes) {
+  csync_vio_method_handle_t *fh;
+  csync_checksum_t cs;
+  ssize_t n;
+  int flags = O_RDONLY;
+
+#ifdef O_NOFOLLOW
+  flags |= O_NOFOLLOW;
+#endif
+  fh = csync_vio_local_open(uri, flags, 0);
+  if (fh == NULL) {
+    return -1;
+  }
+
+  csync_checksum_init(&cs);
+  while ((n = csync_vio_local_read(fh, buf, CSYNC_CHECKSUM_BUF_SIZE)) > 0) {
+    csync_checksum_update(&cs, buf, n);
+    *bytes += n;
+  }
+  csync_vio_local_close(fh);
+  if (n < 0) {
+    return -1;
+  }
+
+  *checksum = csync_checksum_digest(&cs);
+
+  return 0;
+}
+
+int csync_checksum_file(const char *uri, uint64_t *checksum) {
+  uint64_t bytes = 0;
+  char *buf;
+  int rc;
+
+  buf = c_malloc(CSYNC_CHECKSUM_BUF_SIZE);
+  if (buf == NULL) {
+    return -1;
+  }
+  rc = _csync_checksum_read(uri, buf, checksum, &bytes);
+  SAFE_FREE(buf);
+
+  return rc;
+}
+
+static int _csync_checksum_detect_visitor(void *obj, void *data) {
+  csync_file_stat_t *st = obj;
+  struct _csync_checksum_detect_s *d = data;
+  char errbuf[256] = {0};
+  char *uri = NULL;
+  uint64_t checksum;
+
+  if (st->type != CSYNC_FTW_TYPE_FILE ||
+      st->instruction != CSYNC_INSTRUCTION_EVAL ||
+      st->checksum == CSYNC_CHECKSUM_NONE) {
+    return 0;
+  }
+
+  if (csync_file_stat_uri(st, d->walk->uri, &uri) < 0) {
+    return -1;
+  }
+
+  d->files++;
+  /* inodes of the other replica could match a cached local file */
+  if (d->walk->current == LOCAL_REPLICA &&
+      csync_statedb_checksum_get(d->walk->ctx, st, &checksum)) {
+    d->cached++;
+  } else if (_csync_checksum_read(uri, d->buf, &checksum, &d->bytes) < 0) {
+    /* the file is transferred and checked again */
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "file: %s, checksum failed: %s",
+        uri, errbuf);
+    SAFE_FREE(uri);
+    return 0;
+  }
+
+  if (checksum == st->checksum) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "file: %s, content unchanged", uri);
+    st->instruction = CSYNC_INSTRUCTION_METADATA;
+    d->unchanged++;
+  }
+  st->checksum = checksum;
+  SAFE_FREE(uri);
+
+  return 0;
+}
+
+int csync_checksum_detect(csync_walk_t *walk) {
+  struct _csync_checksum_detect_s d;
+  struct timespec start, finish;
+  int rc;
+
+  if (! walk->ctx->options.checksum || walk->replica != LOCAL_REPLICA) {
+    return 0;
+  }
+
+  ZERO_STRUCT(d);
+  d.walk = walk;
+  d.buf = c_malloc(CSYNC_CHECKSUM_BUF_SIZE);
+  if (d.buf == NULL) {
+    return -1;
+  }
+
+  csync_gettime(&start);
+  rc = c_htable_walk(walk->tree, &d, _csync_checksum_detect_visitor);
+  csync_gettime(&finish);
+  SAFE_FREE(d.buf);
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "Checksummed %zu modified files (%zu cached, %llu bytes read) of the "
+      "%s replica in %.2f seconds, %zu unchanged",
+      d.files, d.cached, (unsigned long long) d.bytes,
+      walk->current == LOCAL_REPLICA ? "local" : "remote",
+      c_secdiff(finish, start), d.unchanged);
+
+  return rc;
+}
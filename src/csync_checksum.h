@@ -0,0 +1,113 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008      by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _CSYNC_CHECKSUM_H
+#define _CSYNC_CHECKSUM_H
+
+/**
+ * @file csync_checksum.h
+ *
+ * @brief Content checksums
+ *
+ * The checksum of a file is the xxhash64 of its content. It is recorded in
+ * the statedb when a file is synchronized. If the mtime of a file changed
+ * but its content is the one recorded, only the metadata has to be synced.
+ *
+ * @defgroup csyncChecksumInternals csync checksum internals
+ * @ingroup csyncInternalAPI
+ *
+ * @{
+ */
+
+#include <stdint.h>
+
+#include "c_xxhash.h"
+#include "csync_update.h"
+
+/**
+ * The checksum of a file which hasn't been checksummed.
+ */
+#define CSYNC_CHECKSUM_NONE 0
+
+/**
+ * Size of the buffer files are read with.
+ */
+#define CSYNC_CHECKSUM_BUF_SIZE (64 * 1024)
+
+typedef c_xxhash64_state_t csync_checksum_t;
+
+/**
+ * @brief Start the checksum of a file.
+ *
+ * @param cs      The checksum to initialize.
+ */
+void csync_checksum_init(csync_checksum_t *cs);
+
+/**
+ * @brief Add the next part of the content to the checksum of a file.
+ *
+ * @param cs      The checksum.
+ * @param buf     The content.
+ * @param len     The length of the content.
+ */
+void csync_checksum_update(csync_checksum_t *cs, const void *buf, size_t len);
+
+/**
+ * @brief Get the checksum of the content added so far.
+ *
+ * @param cs      The checksum.
+ *
+ * @return  The checksum, never CSYNC_CHECKSUM_NONE.
+ */
+uint64_t csync_checksum_digest(const csync_checksum_t *cs);
+
+/**
+ * @brief Compute the checksum of a file on the local filesystem.
+ *
+ * @param uri       The path of the file.
+ * @param checksum  A pointer to store the checksum.
+ *
+ * @return  0 on success, -1 if an error occured with errno set.
+ */
+int csync_checksum_file(const char *uri, uint64_t *checksum);
+
+/**
+ * @brief Check the content of the files modified since the last
+ *        synchronization.
+ *
+ * Files with a mtime newer than the one in the statedb and a checksum
+ * recorded are read, unless the checksum cache of the statedb has their
+ * checksum. If the content is the same, their instruction is changed from
+ * CSYNC_INSTRUCTION_EVAL to CSYNC_INSTRUCTION_METADATA.
+ * Only replicas on the local filesystem are checked, reading a remote file
+ * costs as much as transferring it.
+ *
+ * @param walk    The walk which detected the updates of the replica.
+ *
+ * @return  0 on success, -1 if an error occured with errno set.
+ */
+int csync_checksum_detect(csync_walk_t *walk);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_CHECKSUM_H */
+
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -25,6 +25,7 @@
 #include "c_lib.h"
 #include "c_private.h"
 #include "csync_private.h"
+#include "csync_buffer.h"
 #include "csync_config.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.config"
@@ -68,6 +69,21 @@ static int _csync_config_copy_default (const char *config) {
     return re;
 }
 
+/* Get a number of threads, at least 1 and at most MAX_THREADS */
+static int _csync_config_threads(dictionary *dict, const char *key) {
+  int n;
+
+  n = iniparser_getint(dict, key, 1);
+  if (n < 1 || n > MAX_THREADS) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "Config: %s = %d is out of range, using %d",
+        key, n, n < 1 ? 1 : MAX_THREADS);
+    n = n < 1 ? 1 : MAX_THREADS;
+  }
+
+  return n;
+}
+
 int csync_config_load(CSYNC *ctx, const char *config) {
   dictionary *dict;
 
@@ -92,6 +108,51 @@ int csync_config_load(CSYNC *ctx, const char *config) {
   CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: max_time_difference = %d",
       ctx->options.max_time_difference);
 
+  ctx->options.update_threads = _csync_config_threads(dict,
+      "global:update_threads");
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: update_threads = %d",
+      ctx->options.update_threads);
+
+  ctx->options.reconcile_threads = _csync_config_threads(dict,
+      "global:reconcile_threads");
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: reconcile_threads = %d",
+      ctx->options.reconcile_threads);
+
+  ctx->options.propagate_threads = _csync_config_threads(dict,
+      "global:propagate_threads");
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: propagate_threads = %d",
+      ctx->options.propagate_threads);
+
+  ctx->options.transfer_buffer_size = iniparser_getint(dict,
+      "global:transfer_buffer_size", CSYNC_BUFFER_MAX_SIZE / 1024);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: transfer_buffer_size = %d",
+      ctx->options.transfer_buffer_size);
+
+  ctx->options.transfer_pipeline = iniparser_getboolean(dict,
+      "global:transfer_pipeline", 1);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: transfer_pipeline = %d",
+      ctx->options.transfer_pipeline);
+
+  ctx->options.preload_statedb = iniparser_getboolean(dict,
+      "global:preload_statedb", 1);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: preload_statedb = %d",
+      ctx->options.preload_statedb);
+
+  ctx->options.incremental_update = iniparser_getboolean(dict,
+      "global:incremental_update", 0);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: incremental_update = %d",
+      ctx->options.incremental_update);
+
+  ctx->options.concurrent_update = iniparser_getboolean(dict,
+      "global:concurrent_update", 0);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: concurrent_update = %d",
+      ctx->options.concurrent_update);
+
+  ctx->options.checksum = iniparser_getboolean(dict,
+      "global:checksum", 0);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: checksum = %d",
+      ctx->options.checksum);
+
   ctx->options.sync_symbolic_links = iniparser_getboolean(dict,
       "global:sync_symbolic_links", 0);
   CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: sync_symbolic_links = %d",
@@ -20,12 +20,17 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "c_lib.h"
+#include "c_arena.h"
 
 #include "csync_private.h"
 #include "csync_exclude.h"
@@ -34,6 +39,96 @@
 #define CSYNC_LOG_CATEGORY_NAME "csync.exclude"
 #include "csync_log.h"
 
+/*
+ * The exclude list is compiled into a matcher, which checks a path against
+ * all patterns without allocating memory:
+ *
+ * - patterns without wildcards are looked up in a sorted table,
+ * - patterns like "literal*" and "*literal" are compared against the
+ *   literals of the bucket of the first or last byte of the path,
+ * - other patterns are compiled into a token program, which is run with a
+ *   single backtracking point for the last star,
+ * - patterns using something only fnmatch() understands are left to it.
+ *
+ * The semantics are the ones of fnmatch() without flags: a star and a
+ * question mark also match a slash. A pattern excludes a path if it matches
+ * the path or its basename.
+ */
+
+#define CSYNC_EXCLUDE_JOURNAL ".csync_journal.db"
+
+enum csync_exclude_token_e {
+  CSYNC_EXCLUDE_TOKEN_CHAR,
+  CSYNC_EXCLUDE_TOKEN_ANY,
+  CSYNC_EXCLUDE_TOKEN_SET,
+  CSYNC_EXCLUDE_TOKEN_STAR
+};
+
+struct csync_exclude_token_s {
+  enum csync_exclude_token_e type;
+  unsigned char c;
+  /* bitmap of the bytes matched by a bracket expression */
+  const uint8_t *set;
+};
+
+struct csync_exclude_glob_s {
+  const struct csync_exclude_token_s *tokens;
+  size_t count;
+  /*
+   * '?' and bracket expressions match a character, which fnmatch() decodes
+   * from the locale, so paths which are not plain ASCII are left to it.
+   */
+  const char *pattern;
+  int bytewise;
+  /*
+   * Patterns with a slash only match paths, not basenames. If they are short
+   * enough, the walker tracks how far they got for every directory.
+   */
+  int path;
+};
+
+/* Progress of a pattern with a slash after a directory */
+struct csync_exclude_state_s {
+  size_t glob;
+  /* bitmap of the tokens reached, 0 to match the whole path */
+  uint64_t tokens;
+};
+
+struct csync_exclude_dir_s {
+  size_t pathlen;
+  /* patterns with a slash which can still match below the directory */
+  size_t count;
+  struct csync_exclude_state_s states[1];
+};
+
+struct csync_exclude_literal_s {
+  const char *str;
+  size_t len;
+};
+
+struct csync_exclude_s {
+  c_arena_t *arena;
+  /* a pattern only consisting of stars */
+  int all;
+  /* patterns without wildcards, sorted */
+  const char **literals;
+  size_t nliterals;
+  /* "literal*", bucketed by the first byte of the literal */
+  struct csync_exclude_literal_s *prefixes;
+  size_t nprefixes;
+  size_t prefix_index[257];
+  /* "*literal", bucketed by the last byte of the literal */
+  struct csync_exclude_literal_s *suffixes;
+  size_t nsuffixes;
+  size_t suffix_index[257];
+  struct csync_exclude_glob_s *globs;
+  size_t nglobs;
+  size_t npaths;
+  /* patterns left to fnmatch() */
+  const char **patterns;
+  size_t npatterns;
+};
+
 static int _csync_exclude_add(CSYNC *ctx, const char *string) {
     c_strlist_t *list;
 
@@ -55,6 +150,347 @@ static int _csync_exclude_add(CSYNC *ctx, const char *string) {
     return c_strlist_add(ctx->excludes, string);
 }
 
+/*
+ * Parse a bracket expression starting after the '['. Returns the length of
+ * the expression after the '[', 0 if the '[' has no closing ']' and matches
+ * itself, -1 if the expression has to be left to fnmatch().
+ */
+static int _csync_exclude_parse_set(const char *p, uint8_t *set) {
+  const char *start = p;
+  int negate = 0;
+  int first = 1;
+  unsigned char c, d;
+  int i;
+
+  if (*p == '!' || *p == '^') {
+    negate = 1;
+    p++;
+  }
+
+  while (*p != ']' || first) {
+    first = 0;
+    if (*p == '\0') {
+      return 0;
+    }
+    if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+      return -1;
+    }
+    if (*p == '\\') {
+      p++;
+      if (*p == '\0') {
+        return -1;
+      }
+    }
+    c = (unsigned char) *p++;
+    d = c;
+    if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+      p++;
+      if (*p == '\\') {
+        p++;
+        if (*p == '\0') {
+          return -1;
+        }
+      }
+      d = (unsigned char) *p++;
+    }
+    if (c >= 0x80 || d >= 0x80 || c > d) {
+      return -1;
+    }
+    for (i = c; i <= d; i++) {
+      set[i / 8] |= 1 << (i % 8);
+    }
+  }
+
+  if (negate) {
+    for (i = 0; i < 32; i++) {
+      set[i] = ~set[i];
+    }
+  }
+
+  return p + 1 - start;
+}
+
+/*
+ * Compile a pattern into tokens, tokens has to be big enough for one token
+ * per byte of the pattern. Returns the number of tokens, -1 if the pattern
+ * has to be left to fnmatch().
+ */
+static int _csync_exclude_tokenize(c_arena_t *arena, const char *pattern,
+    struct csync_exclude_token_s *tokens, int *bytewise) {
+  const char *p = pattern;
+  uint8_t *set;
+  int count = 0;
+  int n;
+
+  *bytewise = 1;
+
+  while (*p != '\0') {
+    if ((unsigned char) *p >= 0x80) {
+      return -1;
+    }
+
+    switch (*p) {
+      case '*':
+        if (count == 0 || tokens[count - 1].type != CSYNC_EXCLUDE_TOKEN_STAR) {
+          tokens[count++].type = CSYNC_EXCLUDE_TOKEN_STAR;
+        }
+        p++;
+        continue;
+      case '?':
+        tokens[count++].type = CSYNC_EXCLUDE_TOKEN_ANY;
+        *bytewise = 0;
+        p++;
+        continue;
+      case '[':
+        set = c_arena_alloc(arena, 32);
+        if (set == NULL) {
+          return -1;
+        }
+        n = _csync_exclude_parse_set(p + 1, set);
+        if (n < 0) {
+          return -1;
+        }
+        if (n > 0) {
+          tokens[count].type = CSYNC_EXCLUDE_TOKEN_SET;
+          tokens[count++].set = set;
+          *bytewise = 0;
+          p += n + 1;
+          continue;
+        }
+        break;
+      case '\\':
+        p++;
+        if (*p == '\0' || (unsigned char) *p >= 0x80) {
+          return -1;
+        }
+        break;
+      default:
+        break;
+    }
+
+    tokens[count].type = CSYNC_EXCLUDE_TOKEN_CHAR;
+    tokens[count++].c = (unsigned char) *p++;
+  }
+
+  return count;
+}
+
+/* Copy the characters of the given tokens into a string */
+static char *_csync_exclude_literal(c_arena_t *arena,
+    const struct csync_exclude_token_s *tokens, size_t count) {
+  char *str;
+  size_t i;
+
+  str = c_arena_alloc(arena, count + 1);
+  if (str == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < count; i++) {
+    str[i] = (char) tokens[i].c;
+  }
+
+  return str;
+}
+
+static int _csync_exclude_strcmp(const void *a, const void *b) {
+  return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+static unsigned char _csync_exclude_key(
+    const struct csync_exclude_literal_s *lit, int last) {
+  return (unsigned char) lit->str[last ? lit->len - 1 : 0];
+}
+
+static int _csync_exclude_first_cmp(const void *a, const void *b) {
+  return _csync_exclude_key(a, 0) - _csync_exclude_key(b, 0);
+}
+
+static int _csync_exclude_last_cmp(const void *a, const void *b) {
+  return _csync_exclude_key(a, 1) - _csync_exclude_key(b, 1);
+}
+
+/*
+ * Sort the literals into the buckets of their first or last byte, the
+ * literals of byte c are index[c] up to index[c + 1].
+ */
+static void _csync_exclude_bucket(struct csync_exclude_literal_s *list,
+    size_t count, size_t *index, int last) {
+  size_t i;
+
+  qsort(list, count, sizeof(struct csync_exclude_literal_s),
+      last ? _csync_exclude_last_cmp : _csync_exclude_first_cmp);
+
+  memset(index, 0, 257 * sizeof(size_t));
+  for (i = 0; i < count; i++) {
+    index[_csync_exclude_key(&list[i], last) + 1]++;
+  }
+  for (i = 0; i < 256; i++) {
+    index[i + 1] += index[i];
+  }
+}
+
+static int _csync_exclude_compile(CSYNC *ctx) {
+  struct csync_exclude_s *ex;
+  struct csync_exclude_token_s *tokens;
+  const char *pattern;
+  size_t count;
+  size_t len;
+  size_t i;
+  int bytewise;
+  int n;
+
+  csync_exclude_free(ctx->exclude);
+  ctx->exclude = NULL;
+
+  if (ctx->excludes == NULL || ctx->excludes->count == 0) {
+    return 0;
+  }
+  count = ctx->excludes->count;
+
+  ex = c_malloc(sizeof(struct csync_exclude_s));
+  if (ex == NULL) {
+    return -1;
+  }
+  ex->arena = c_arena_new(4096);
+  if (ex->arena == NULL) {
+    goto err;
+  }
+
+  /* every pattern fits into every table */
+  ex->literals = c_arena_alloc(ex->arena, count * sizeof(char *));
+  ex->prefixes = c_arena_alloc(ex->arena,
+      count * sizeof(struct csync_exclude_literal_s));
+  ex->suffixes = c_arena_alloc(ex->arena,
+      count * sizeof(struct csync_exclude_literal_s));
+  ex->globs = c_arena_alloc(ex->arena,
+      count * sizeof(struct csync_exclude_glob_s));
+  ex->patterns = c_arena_alloc(ex->arena, count * sizeof(char *));
+  if (ex->literals == NULL || ex->prefixes == NULL || ex->suffixes == NULL ||
+      ex->globs == NULL || ex->patterns == NULL) {
+    goto err;
+  }
+
+  for (i = 0; i < count; i++) {
+    pattern = ctx->excludes->vector[i];
+    len = strlen(pattern);
+    if (len == 0) {
+      continue;
+    }
+
+    tokens = c_arena_alloc(ex->arena,
+        len * sizeof(struct csync_exclude_token_s));
+    if (tokens == NULL) {
+      goto err;
+    }
+
+#ifdef HAVE_FNMATCH
+    n = _csync_exclude_tokenize(ex->arena, pattern, tokens, &bytewise);
+#else
+    /* PathMatchSpec() has semantics of its own */
+    n = -1;
+#endif
+    if (n < 0) {
+      ex->patterns[ex->npatterns] = c_arena_alloc(ex->arena, len + 1);
+      if (ex->patterns[ex->npatterns] == NULL) {
+        goto err;
+      }
+      memcpy((char *) ex->patterns[ex->npatterns++], pattern, len);
+      continue;
+    }
+
+    if (n == 1 && tokens[0].type == CSYNC_EXCLUDE_TOKEN_STAR) {
+      ex->all = 1;
+      continue;
+    }
+
+    /* check for literals with one leading or trailing star */
+    {
+      int first = -1;
+      int last = -1;
+      int other = 0;
+      int k;
+
+      for (k = 0; k < n; k++) {
+        if (tokens[k].type == CSYNC_EXCLUDE_TOKEN_STAR) {
+          if (first < 0) {
+            first = k;
+          }
+          last = k;
+        } else if (tokens[k].type != CSYNC_EXCLUDE_TOKEN_CHAR) {
+          other = 1;
+        }
+      }
+
+      if (! other && first < 0) {
+        ex->literals[ex->nliterals] =
+          _csync_exclude_literal(ex->arena, tokens, n);
+        if (ex->literals[ex->nliterals++] == NULL) {
+          goto err;
+        }
+        continue;
+      }
+      if (! other && first == last && first == n - 1) {
+        ex->prefixes[ex->nprefixes].str =
+          _csync_exclude_literal(ex->arena, tokens, n - 1);
+        ex->prefixes[ex->nprefixes].len = n - 1;
+        if (ex->prefixes[ex->nprefixes++].str == NULL) {
+          goto err;
+        }
+        continue;
+      }
+      if (! other && first == last && first == 0) {
+        ex->suffixes[ex->nsuffixes].str =
+          _csync_exclude_literal(ex->arena, tokens + 1, n - 1);
+        ex->suffixes[ex->nsuffixes].len = n - 1;
+        if (ex->suffixes[ex->nsuffixes++].str == NULL) {
+          goto err;
+        }
+        continue;
+      }
+    }
+
+    ex->globs[ex->nglobs].tokens = tokens;
+    ex->globs[ex->nglobs].count = n;
+    ex->globs[ex->nglobs].pattern = c_arena_alloc(ex->arena, len + 1);
+    ex->globs[ex->nglobs].bytewise = bytewise;
+    if (n < 64 && strchr(pattern, '/') != NULL) {
+      int k;
+
+      for (k = 0; k < n; k++) {
+        if (tokens[k].type == CSYNC_EXCLUDE_TOKEN_CHAR && tokens[k].c == '/') {
+          ex->globs[ex->nglobs].path = 1;
+          ex->npaths++;
+          break;
+        }
+      }
+    }
+    if (ex->globs[ex->nglobs].pattern == NULL) {
+      goto err;
+    }
+    memcpy((char *) ex->globs[ex->nglobs++].pattern, pattern, len);
+  }
+
+  qsort(ex->literals, ex->nliterals, sizeof(char *), _csync_exclude_strcmp);
+  _csync_exclude_bucket(ex->prefixes, ex->nprefixes,
+      ex->prefix_index, 0);
+  _csync_exclude_bucket(ex->suffixes, ex->nsuffixes,
+      ex->suffix_index, 1);
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "Compiled %zu exclude patterns: %zu literals, %zu prefixes, "
+      "%zu suffixes, %zu globs (%zu with a slash), %zu left to fnmatch",
+      count, ex->nliterals, ex->nprefixes, ex->nsuffixes,
+      ex->nglobs, ex->npaths, ex->npatterns);
+
+  ctx->exclude = ex;
+
+  return 0;
+err:
+  csync_exclude_free(ex);
+  errno = ENOMEM;
+  return -1;
+}
+
 int csync_exclude_load(CSYNC *ctx, const char *fname) {
   int fd = -1;
   int i = 0;
@@ -107,76 +543,423 @@ int csync_exclude_load(CSYNC *ctx, const char *fname) {
   }
   SAFE_FREE(buf);
 
-  rc = 0;
+  rc = _csync_exclude_compile(ctx);
 out:
   SAFE_FREE(buf);
   close(fd);
   return rc;
 }
 
+void csync_exclude_free(struct csync_exclude_s *ex) {
+  if (ex == NULL) {
+    return;
+  }
+  c_arena_free(ex->arena);
+  SAFE_FREE(ex);
+}
+
 void csync_exclude_destroy(CSYNC *ctx) {
+  csync_exclude_free(ctx->exclude);
+  ctx->exclude = NULL;
   c_strlist_destroy(ctx->excludes);
+  ctx->excludes = NULL;
 }
 
-int csync_excluded(CSYNC *ctx, const char *path) {
+static int _csync_exclude_glob_match(const struct csync_exclude_glob_s *glob,
+    const char *str, size_t len) {
+  const struct csync_exclude_token_s *tok;
+  size_t p = 0;
+  size_t t = 0;
+  size_t star = (size_t) -1;
+  size_t mark = 0;
+  unsigned char c;
+
+  while (t < len) {
+    if (p < glob->count) {
+      tok = &glob->tokens[p];
+      c = (unsigned char) str[t];
+
+      if (tok->type == CSYNC_EXCLUDE_TOKEN_STAR) {
+        /* a later star makes backtracking to an earlier one useless */
+        star = p++;
+        mark = t;
+        continue;
+      }
+      if (tok->type == CSYNC_EXCLUDE_TOKEN_ANY ||
+          (tok->type == CSYNC_EXCLUDE_TOKEN_CHAR && tok->c == c) ||
+          (tok->type == CSYNC_EXCLUDE_TOKEN_SET &&
+           (tok->set[c / 8] & (1 << (c % 8))))) {
+        p++;
+        t++;
+        continue;
+      }
+    }
+    if (star == (size_t) -1) {
+      return 0;
+    }
+    /* let the last star eat one more byte */
+    p = star + 1;
+    t = ++mark;
+  }
+
+  while (p < glob->count && glob->tokens[p].type == CSYNC_EXCLUDE_TOKEN_STAR) {
+    p++;
+  }
+
+  return p == glob->count;
+}
+
+static int _csync_exclude_has_prefix(const struct csync_exclude_s *ex,
+    const char *str, size_t len) {
+  const struct csync_exclude_literal_s *lit;
+  unsigned char c = (unsigned char) str[0];
   size_t i;
-  const char *p;
-  char *bname;
-  int rc;
-  int match = 0;
-
-  if (! ctx->options.unix_extensions) {
-    for (p = path; *p; p++) {
-      switch (*p) {
-        case '\\':
-        case ':':
-        case '?':
-        case '*':
-        case '"':
-        case '>':
-        case '<':
-        case '|':
+
+  for (i = ex->prefix_index[c]; i < ex->prefix_index[c + 1]; i++) {
+    lit = &ex->prefixes[i];
+    if (lit->len <= len && memcmp(str, lit->str, lit->len) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int _csync_exclude_has_suffix(const struct csync_exclude_s *ex,
+    const char *str, size_t len) {
+  const struct csync_exclude_literal_s *lit;
+  unsigned char c = (unsigned char) str[len - 1];
+  size_t i;
+
+  for (i = ex->suffix_index[c]; i < ex->suffix_index[c + 1]; i++) {
+    lit = &ex->suffixes[i];
+    if (lit->len <= len &&
+        memcmp(str + len - lit->len, lit->str, lit->len) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+#define CSYNC_EXCLUDE_BIT(p) ((uint64_t) 1 << (p))
+
+/* Add the tokens following a reached star, which may match nothing */
+static uint64_t _csync_exclude_glob_closure(
+    const struct csync_exclude_glob_s *glob, uint64_t state) {
+  size_t p;
+
+  for (p = 0; p < glob->count; p++) {
+    if ((state & CSYNC_EXCLUDE_BIT(p)) &&
+        glob->tokens[p].type == CSYNC_EXCLUDE_TOKEN_STAR) {
+      state |= CSYNC_EXCLUDE_BIT(p + 1);
+    }
+  }
+
+  return state;
+}
+
+/*
+ * Continue matching a pattern with all reachable tokens at once. Bit p of the
+ * state is set if the input so far can be followed by token p, bit count if
+ * the pattern matches the input so far.
+ */
+static uint64_t _csync_exclude_glob_step(const struct csync_exclude_glob_s *glob,
+    uint64_t state, const char *str, size_t len) {
+  const struct csync_exclude_token_s *tok;
+  uint64_t next;
+  unsigned char c;
+  size_t i, p;
+
+  for (i = 0; i < len && state != 0; i++) {
+    c = (unsigned char) str[i];
+    next = 0;
+    for (p = 0; p < glob->count; p++) {
+      if (! (state & CSYNC_EXCLUDE_BIT(p))) {
+        continue;
+      }
+      tok = &glob->tokens[p];
+      if (tok->type == CSYNC_EXCLUDE_TOKEN_STAR) {
+        next |= CSYNC_EXCLUDE_BIT(p);
+      } else if (tok->type == CSYNC_EXCLUDE_TOKEN_ANY ||
+          (tok->type == CSYNC_EXCLUDE_TOKEN_CHAR && tok->c == c) ||
+          (tok->type == CSYNC_EXCLUDE_TOKEN_SET &&
+           (tok->set[c / 8] & (1 << (c % 8))))) {
+        next |= CSYNC_EXCLUDE_BIT(p + 1);
+      }
+    }
+    state = _csync_exclude_glob_closure(glob, next);
+  }
+
+  return state;
+}
+
+/* Match a pattern against the whole path */
+static int _csync_exclude_glob_full(const struct csync_exclude_glob_s *glob,
+    const char *path, size_t len, int ascii) {
+  if (glob->bytewise || ascii) {
+    return _csync_exclude_glob_match(glob, path, len);
+  }
+
+  return csync_fnmatch(glob->pattern, path, 0) == 0;
+}
+
+static int _csync_exclude_match(const struct csync_exclude_s *ex,
+    const csync_exclude_dir_t *dir, const char *path, size_t len,
+    const char *bname, size_t blen, int ascii) {
+  const struct csync_exclude_glob_s *glob;
+  const struct csync_exclude_state_s *st;
+  const char *rest;
+  uint64_t state;
+  size_t i;
+
+  if (ex->all) {
+    return 1;
+  }
+
+  if (bsearch(&path, ex->literals, ex->nliterals, sizeof(char *),
+        _csync_exclude_strcmp) != NULL) {
+    return 1;
+  }
+  if (bname != path && bsearch(&bname, ex->literals, ex->nliterals,
+        sizeof(char *), _csync_exclude_strcmp) != NULL) {
+    return 1;
+  }
+
+  if (_csync_exclude_has_prefix(ex, path, len) ||
+      (bname != path && _csync_exclude_has_prefix(ex, bname, blen))) {
+    return 1;
+  }
+
+  /* the basename is a suffix of the path */
+  if (_csync_exclude_has_suffix(ex, path, len)) {
+    return 1;
+  }
+
+  for (i = 0; i < ex->nglobs; i++) {
+    glob = &ex->globs[i];
+    if (glob->path && dir != NULL) {
+      continue;
+    }
+    if (_csync_exclude_glob_full(glob, path, len, ascii) ||
+        (! glob->path && _csync_exclude_glob_full(glob, bname, blen, ascii))) {
+      return 1;
+    }
+  }
+
+  /* continue the patterns with a slash from where the directory left them */
+  if (dir != NULL) {
+    rest = path + dir->pathlen + 1;
+    for (i = 0; i < dir->count; i++) {
+      st = &dir->states[i];
+      glob = &ex->globs[st->glob];
+      if (st->tokens == 0 || ! (glob->bytewise || ascii)) {
+        if (_csync_exclude_glob_full(glob, path, len, ascii)) {
           return 1;
-        default:
-          break;
+        }
+        continue;
+      }
+      state = _csync_exclude_glob_step(glob, st->tokens, rest,
+          len - (rest - path));
+      if (state & CSYNC_EXCLUDE_BIT(glob->count)) {
+        return 1;
       }
     }
   }
 
-  rc = csync_fnmatch(".csync_journal.db*", path, 0);
-  if (rc == 0) {
+  for (i = 0; i < ex->npatterns; i++) {
+    if (csync_fnmatch(ex->patterns[i], path, 0) == 0 ||
+        csync_fnmatch(ex->patterns[i], bname, 0) == 0) {
       return 1;
+    }
   }
 
-  bname = c_basename(path);
-  if (bname == NULL) {
-      return 0;
+  return 0;
+}
+
+int csync_excluded_below(CSYNC *ctx, const csync_exclude_dir_t *dir,
+    const char *path) {
+  const char *bname = path;
+  const char *p;
+  int ascii = 1;
+
+  if (path[0] == '\0') {
+    return 0;
+  }
+
+  for (p = path; *p; p++) {
+    switch (*p) {
+      case '\\':
+      case ':':
+      case '?':
+      case '*':
+      case '"':
+      case '>':
+      case '<':
+      case '|':
+        if (! ctx->options.unix_extensions) {
+          return 1;
+        }
+        break;
+      case '/':
+        bname = p + 1;
+        break;
+      default:
+        if ((unsigned char) *p >= 0x80) {
+          ascii = 0;
+        }
+        break;
+    }
+  }
+
+  if (strncmp(path, CSYNC_EXCLUDE_JOURNAL, sizeof(CSYNC_EXCLUDE_JOURNAL) - 1) == 0 ||
+      strncmp(bname, CSYNC_EXCLUDE_JOURNAL, sizeof(CSYNC_EXCLUDE_JOURNAL) - 1) == 0) {
+    return 1;
   }
 
-  rc = csync_fnmatch(".csync_journal.db*", bname, 0);
-  if (rc == 0) {
-      match = 1;
-      goto out;
+  if (ctx->exclude == NULL) {
+    return 0;
   }
 
-  if (ctx->excludes == NULL) {
-      goto out;
+  return _csync_exclude_match(ctx->exclude, dir, path, p - path, bname,
+      p - bname, ascii);
+}
+
+int csync_excluded(CSYNC *ctx, const char *path) {
+  return csync_excluded_below(ctx, NULL, path);
+}
+
+int csync_exclude_dir_enter(CSYNC *ctx, const csync_exclude_dir_t *parent,
+    const char *path, csync_exclude_dir_t **dir) {
+  const struct csync_exclude_s *ex = ctx->exclude;
+  const struct csync_exclude_glob_s *glob;
+  csync_exclude_dir_t *d = NULL;
+  size_t len = strlen(path);
+  char buf[len + 2];
+  const char *rest = buf;
+  uint64_t state;
+  size_t count;
+  size_t i;
+  int ascii = 1;
+
+  *dir = NULL;
+
+  if (ex == NULL || len == 0) {
+    return 0;
+  }
+  if (ex->all) {
+    return 1;
   }
 
-  for (i = 0; match == 0 && i < ctx->excludes->count; i++) {
-      rc = csync_fnmatch(ctx->excludes->vector[i], path, 0);
-      if (rc == 0) {
-          match = 1;
+  for (i = 0; i < len; i++) {
+    if ((unsigned char) path[i] >= 0x80) {
+      ascii = 0;
+      break;
+    }
+  }
+
+  /*
+   * A pattern ending with a star matches every path below the directory if
+   * it matches the directory followed by a slash.
+   */
+  memcpy(buf, path, len);
+  buf[len] = '/';
+  buf[len + 1] = '\0';
+
+  if (_csync_exclude_has_prefix(ex, buf, len + 1)) {
+    return 1;
+  }
+
+  for (i = 0; i < ex->nglobs; i++) {
+    glob = &ex->globs[i];
+    if (! glob->path &&
+        glob->tokens[glob->count - 1].type == CSYNC_EXCLUDE_TOKEN_STAR &&
+        _csync_exclude_glob_full(glob, buf, len + 1, ascii)) {
+      return 1;
+    }
+  }
+
+  count = parent != NULL ? parent->count : ex->npaths;
+  d = c_malloc(sizeof(csync_exclude_dir_t) +
+      count * sizeof(struct csync_exclude_state_s));
+  if (d == NULL) {
+    return -1;
+  }
+  d->pathlen = len;
+
+  /* only the part below the parent is left to match */
+  if (parent != NULL) {
+    rest = buf + parent->pathlen + 1;
+  }
+
+  for (i = 0; i < (parent != NULL ? parent->count : ex->nglobs); i++) {
+    if (parent != NULL) {
+      glob = &ex->globs[parent->states[i].glob];
+      state = parent->states[i].tokens;
+    } else {
+      glob = &ex->globs[i];
+      if (! glob->path) {
+        continue;
       }
+      state = _csync_exclude_glob_closure(glob, 1);
+    }
 
-      rc = csync_fnmatch(ctx->excludes->vector[i], bname, 0);
-      if (rc == 0) {
-          match = 1;
+    if (state != 0 && (glob->bytewise || ascii)) {
+      state = _csync_exclude_glob_step(glob, state, rest,
+          len + 1 - (rest - buf));
+      if (state == 0) {
+        /* can't match anything below */
+        continue;
+      }
+      if ((state & CSYNC_EXCLUDE_BIT(glob->count - 1)) &&
+          glob->tokens[glob->count - 1].type == CSYNC_EXCLUDE_TOKEN_STAR) {
+        SAFE_FREE(d);
+        return 1;
+      }
+    } else {
+      /* leave it to fnmatch() on the whole path from now on */
+      state = 0;
+      if (glob->tokens[glob->count - 1].type == CSYNC_EXCLUDE_TOKEN_STAR &&
+          _csync_exclude_glob_full(glob, buf, len + 1, ascii)) {
+        SAFE_FREE(d);
+        return 1;
       }
+    }
+
+    d->states[d->count].glob = glob - ex->globs;
+    d->states[d->count].tokens = state;
+    d->count++;
   }
 
-out:
-  free(bname);
-  return match;
+  *dir = d;
+
+  return 0;
 }
 
+csync_exclude_dir_t *csync_exclude_dir_dup(const csync_exclude_dir_t *dir) {
+  csync_exclude_dir_t *d;
+  size_t size = sizeof(csync_exclude_dir_t) +
+    dir->count * sizeof(struct csync_exclude_state_s);
+
+  d = c_malloc(size);
+  if (d == NULL) {
+    return NULL;
+  }
+  memcpy(d, dir, size);
+
+  return d;
+}
+
+void csync_exclude_dir_free(csync_exclude_dir_t *dir) {
+  SAFE_FREE(dir);
+}
+
+int csync_excluded_dir(CSYNC *ctx, const char *path) {
+  csync_exclude_dir_t *dir = NULL;
+  int rc;
+
+  rc = csync_exclude_dir_enter(ctx, NULL, path, &dir);
+  csync_exclude_dir_free(dir);
+
+  return rc > 0;
+}
@@ -21,6 +21,11 @@
 #ifndef _CSYNC_EXCLUDE_H
 #define _CSYNC_EXCLUDE_H
 
+/**
+ * The exclude patterns which can still match below a directory of a walk.
+ */
+typedef struct csync_exclude_dir_s csync_exclude_dir_t;
+
 /**
  * @brief Load exclude list
  *
@@ -31,6 +36,13 @@
  */
 int csync_exclude_load(CSYNC *ctx, const char *fname);
 
+/**
+ * @brief Free a compiled exclude list.
+ *
+ * @param ex    The compiled list, may be NULL.
+ */
+void csync_exclude_free(struct csync_exclude_s *ex);
+
 /**
  * @brief Destroy the exclude list in memory.
  *
@@ -50,6 +62,70 @@ void csync_exclude_destroy(CSYNC *ctx);
  */
 int csync_excluded(CSYNC *ctx, const char *path);
 
+/**
+ * @brief Check if the given path below a directory should be excluded.
+ *
+ * Patterns containing a slash are only checked as far as they can still
+ * match below the directory.
+ *
+ * @param ctx   The synchronizer context.
+ * @param dir   The directory containing the path, returned by
+ *              csync_exclude_dir_enter(). NULL to check all patterns.
+ * @param path  The path to check.
+ *
+ * @return  1 if excluded, 0 if not.
+ */
+int csync_excluded_below(CSYNC *ctx, const csync_exclude_dir_t *dir,
+    const char *path);
+
+/**
+ * @brief Enter a directory in a walk.
+ *
+ * Continues the patterns containing a slash which can still match below the
+ * parent with the path of the directory, and drops the ones which can't
+ * match below the directory anymore.
+ *
+ * @param ctx     The synchronizer context.
+ * @param parent  The parent directory, NULL for the top directory.
+ * @param path    The path of the directory.
+ * @param dir     A pointer to store the directory, which has to be freed
+ *                with csync_exclude_dir_free(). It is set to NULL if there
+ *                are no patterns or everything below is excluded.
+ *
+ * @return  1 if all paths below the directory are excluded, 0 if not, -1 if
+ *          an error occured with errno set.
+ */
+int csync_exclude_dir_enter(CSYNC *ctx, const csync_exclude_dir_t *parent,
+    const char *path, csync_exclude_dir_t **dir);
+
+/**
+ * @brief Copy a directory returned by csync_exclude_dir_enter().
+ *
+ * @param dir   The directory to copy.
+ *
+ * @return  The copy, NULL if insufficient memory was available.
+ */
+csync_exclude_dir_t *csync_exclude_dir_dup(const csync_exclude_dir_t *dir);
+
+/**
+ * @brief Free a directory returned by csync_exclude_dir_enter().
+ *
+ * @param dir   The directory to free, may be NULL.
+ */
+void csync_exclude_dir_free(csync_exclude_dir_t *dir);
+
+/**
+ * @brief Check if everything below the given directory is excluded.
+ *
+ * The directory itself isn't checked, the walker doesn't need to read it.
+ *
+ * @param ctx   The synchronizer context.
+ * @param path  The path of the directory.
+ *
+ * @return  1 if all paths below are excluded, 0 if not.
+ */
+int csync_excluded_dir(CSYNC *ctx, const char *path);
+
 #endif /* _CSYNC_EXCLUDE_H */
 
 /* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -48,6 +48,12 @@
  */
 #define MAX_DEPTH 50
 
+/**
+ * Maximum number of threads of the update detection, the reconciler and the
+ * propagator
+ */
+#define MAX_THREADS 64
+
 /**
  * Maximum time difference between two replicas in seconds
  */
@@ -75,6 +81,20 @@ enum csync_replica_e {
   REMOTE_REPLICA
 };
 
+/* In-memory indexes of the statedb, see csync_statedb.c */
+struct csync_statedb_index_s;
+struct csync_statedb_inode_map_s;
+struct csync_statedb_checksums_s;
+struct csync_watch_journal_s;
+struct csync_exclude_s;
+struct csync_buffer_pool_s;
+
+/* Owner of files, the file stats refer to them by their index */
+struct csync_owner_s {
+  uid_t uid;
+  gid_t gid;
+};
+
 /**
  * @brief csync public structure
  */
@@ -82,24 +102,48 @@ struct csync_s {
   csync_auth_callback auth_callback;
   void *userdata;
   c_strlist_t *excludes;
+  /* the exclude list compiled by csync_exclude_load() */
+  struct csync_exclude_s *exclude;
 
   struct {
     char *file;
     sqlite3 *db;
+    struct csync_statedb_index_s *index;
+    struct csync_statedb_inode_map_s *inodes;
+    /* checksum cache, loaded if checksums are enabled */
+    struct csync_statedb_checksums_s *checksums;
     int exists;
     int disabled;
+
+    /* lookup counters */
+    struct {
+      size_t hash_lookups;
+      size_t hash_found;
+      size_t inode_lookups;
+      size_t inode_found;
+      size_t queries;
+      size_t checksum_lookups;
+      size_t checksum_hits;
+    } stats;
   } statedb;
 
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_htable_t *tree;
+    /* file stats of the tree, freed at once by csync_destroy() */
+    c_arena_t *arena;
     c_list_t *list;
     enum csync_replica_e type;
+    /* time update detection started */
+    time_t update_start;
+    /* changes recorded by the watcher */
+    struct csync_watch_journal_s *watch;
   } local;
 
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_htable_t *tree;
+    c_arena_t *arena;
     c_list_t *list;
     enum csync_replica_e type;
   } remote;
@@ -110,9 +154,22 @@ struct csync_s {
     csync_vio_method_finish_fn finish_fn;
   } module;
 
+  /* transfer buffers kept for the next files */
+  struct csync_buffer_pool_s *buffers;
+
   struct {
     int max_depth;
     int max_time_difference;
+    int update_threads;
+    int reconcile_threads;
+    int propagate_threads;
+    /* largest transfer buffer through the module in KB */
+    int transfer_buffer_size;
+    bool transfer_pipeline;
+    bool preload_statedb;
+    bool incremental_update;
+    bool concurrent_update;
+    bool checksum;
     int sync_symbolic_links;
     int unix_extensions;
     char *config_dir;
@@ -125,7 +182,16 @@ struct csync_s {
     uid_t euid;
   } pwd;
 
-  /* replica we are currently walking */
+  /* owners of the files in the trees and the statedb index */
+  struct {
+    struct csync_owner_s *list;
+    size_t count;
+    size_t size;
+    /* index of the last owner found */
+    size_t last;
+  } owners;
+
+  /* replica we are currently working on, the update detection uses csync_walk_t */
   enum csync_replica_e current;
 
   /* replica we want to work on */
@@ -143,19 +209,28 @@ enum csync_ftw_type_e {
 #ifdef _MSC_VER
 #pragma pack(1)
 #endif
+/*
+ * The path of a file is stored relative to the directory it's in. The full
+ * path is built from the names of its parents by csync_file_stat_path().
+ * Files whose directory isn't known, like the ones read from the statedb,
+ * have no parent and the whole path as name.
+ */
 struct csync_file_stat_s {
   uint64_t phash;   /* u64 */
   time_t modtime;   /* u64 */
+  time_t ctime;     /* u64 */
   off_t size;       /* u64 */
-  size_t pathlen;   /* u64 */
   ino_t inode;      /* u64 */
-  uid_t uid;        /* u32 */
-  gid_t gid;        /* u32 */
+  uint64_t checksum; /* u64, of the content, 0 if unknown */
+  const struct csync_file_stat_s *parent; /* u64 */
+  uint32_t pathlen; /* u32, length of the full path */
+  uint32_t owner;   /* u32, index into the owners of the context */
+  uint32_t mtime_nsec; /* u32 */
   mode_t mode;      /* u32 */
-  int nlink;        /* u32 */
-  int type;         /* u32 */
-  enum csync_instructions_e instruction; /* u32 */
-  char path[1]; /* u8 */
+  uint16_t instruction; /* u16, enum csync_instructions_e */
+  uint8_t type;     /* u8, enum csync_ftw_type_e */
+  uint8_t incomplete; /* u8, the walk skipped some files in the directory */
+  char name[1];     /* u8 */
 }
 #if !defined(__SUNPRO_C) && !defined(_MSC_VER)
 __attribute__ ((packed))
@@ -29,8 +29,16 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "csync_private.h"
+#include "csync_buffer.h"
+#include "csync_checksum.h"
 #include "csync_propagate.h"
+#include "csync_statedb.h"
+#include "csync_time.h"
 #include "vio/csync_vio.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.propagator"
@@ -43,9 +51,189 @@ static int _csync_cleanup_cmp(const void *a, const void *b) {
   st_a = (csync_file_stat_t *) a;
   st_b = (csync_file_stat_t *) b;
 
-  return strcmp(st_a->path, st_b->path);
+  /* sorted by length the subdirectories follow their parents */
+  return (st_a->pathlen > st_b->pathlen) - (st_a->pathlen < st_b->pathlen);
+}
+
+/* buffers of a pipelined transfer, the memory it takes */
+#define CSYNC_PIPELINE_BUFFERS 4
+
+#ifdef HAVE_PTHREAD
+/*
+ * A pipelined transfer. The reader thread fills the ring of buffers, the
+ * writer empties it in the same order. The buffers from tail to head are
+ * filled.
+ */
+struct _csync_pipeline_s {
+  CSYNC *ctx;
+  enum csync_replica_e srep;
+  enum csync_replica_e drep;
+  csync_vio_handle_t *sfp;
+  csync_vio_handle_t *dfp;
+  csync_checksum_t *cs;
+
+  char *bufs[CSYNC_PIPELINE_BUFFERS];
+  ssize_t len[CSYNC_PIPELINE_BUFFERS];
+  size_t bufsize;
+  size_t head;
+  size_t tail;
+  int eof;
+  int read_errno;
+  int write_errno;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* Only transfers through the module wait for round trips */
+static int _csync_pipeline_wanted(CSYNC *ctx, enum csync_replica_e srep,
+    enum csync_replica_e drep, int64_t size, size_t bufsize) {
+  if (! ctx->options.transfer_pipeline) {
+    return 0;
+  }
+
+  if (srep != REMOTE_REPLICA && drep != REMOTE_REPLICA) {
+    return 0;
+  }
+
+  /* a file in one buffer has nothing to overlap */
+  return size > (int64_t) bufsize;
 }
 
+static void *_csync_pipeline_reader(void *arg) {
+  struct _csync_pipeline_s *pl = arg;
+  ssize_t bread;
+  size_t i;
+  int stop;
+
+  for (;;) {
+    pthread_mutex_lock(&pl->lock);
+    while (pl->head - pl->tail == CSYNC_PIPELINE_BUFFERS &&
+        pl->write_errno == 0) {
+      pthread_cond_wait(&pl->cond, &pl->lock);
+    }
+    i = pl->head % CSYNC_PIPELINE_BUFFERS;
+    stop = pl->write_errno != 0;
+    pthread_mutex_unlock(&pl->lock);
+
+    /* the writer gave up */
+    if (stop) {
+      break;
+    }
+
+    bread = csync_vio_read_replica(pl->ctx, pl->srep, pl->sfp, pl->bufs[i],
+        pl->bufsize);
+
+    pthread_mutex_lock(&pl->lock);
+    if (bread < 0) {
+      pl->read_errno = errno ? errno : EIO;
+    } else if (bread == 0) {
+      pl->eof = 1;
+    } else {
+      pl->len[i] = bread;
+      pl->head++;
+    }
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+
+    if (bread <= 0) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Copy a file with the reads on a thread of their own, so the source replica
+ * reads the next buffers while the destination writes one. The data is
+ * written and checksummed in order on the calling thread.
+ *
+ * Returns the size of the file, -1 on error with errno set. The command
+ * which failed is "read" or "write", NULL if the transfer couldn't start and
+ * nothing was read yet.
+ */
+static off_t _csync_pipeline_copy(struct _csync_pipeline_s *pl,
+    const char **command) {
+  pthread_t reader;
+  off_t copied = 0;
+  ssize_t bwritten;
+  size_t i;
+  int n;
+
+  *command = NULL;
+
+  for (n = 0; n < CSYNC_PIPELINE_BUFFERS; n++) {
+    pl->bufs[n] = csync_buffer_get(pl->ctx->buffers, pl->bufsize);
+    if (pl->bufs[n] == NULL) {
+      copied = -1;
+      goto out;
+    }
+  }
+
+  pthread_mutex_init(&pl->lock, NULL);
+  pthread_cond_init(&pl->cond, NULL);
+  if (pthread_create(&reader, NULL, _csync_pipeline_reader, pl) != 0) {
+    copied = -1;
+    goto destroy;
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&pl->lock);
+    while (pl->head == pl->tail && ! pl->eof && pl->read_errno == 0) {
+      pthread_cond_wait(&pl->cond, &pl->lock);
+    }
+    if (pl->head == pl->tail) {
+      pthread_mutex_unlock(&pl->lock);
+      break;
+    }
+    i = pl->tail % CSYNC_PIPELINE_BUFFERS;
+    pthread_mutex_unlock(&pl->lock);
+
+    bwritten = csync_vio_write_replica(pl->ctx, pl->drep, pl->dfp,
+        pl->bufs[i], pl->len[i]);
+    if (bwritten < 0 || bwritten != pl->len[i]) {
+      pthread_mutex_lock(&pl->lock);
+      pl->write_errno = bwritten < 0 && errno ? errno : EIO;
+      pthread_cond_broadcast(&pl->cond);
+      pthread_mutex_unlock(&pl->lock);
+      break;
+    }
+    if (pl->cs != NULL) {
+      csync_checksum_update(pl->cs, pl->bufs[i], pl->len[i]);
+    }
+    copied += bwritten;
+
+    pthread_mutex_lock(&pl->lock);
+    pl->tail++;
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+  }
+
+  pthread_join(reader, NULL);
+
+  if (pl->write_errno != 0) {
+    *command = "write";
+    errno = pl->write_errno;
+    copied = -1;
+  } else if (pl->read_errno != 0) {
+    *command = "read";
+    errno = pl->read_errno;
+    copied = -1;
+  }
+
+destroy:
+  pthread_cond_destroy(&pl->cond);
+  pthread_mutex_destroy(&pl->lock);
+out:
+  for (n = 0; n < CSYNC_PIPELINE_BUFFERS; n++) {
+    csync_buffer_put(pl->ctx->buffers, pl->bufs[n], pl->bufsize);
+  }
+
+  return copied;
+}
+#endif /* HAVE_PTHREAD */
+
 static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   enum csync_replica_e srep = -1;
   enum csync_replica_e drep = -1;
@@ -60,12 +248,18 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   csync_vio_handle_t *dfp = NULL;
 
   csync_vio_file_stat_t *tstat = NULL;
+  csync_checksum_t cs;
 
   char errbuf[256] = {0};
-  char buf[MAX_XFER_BUF_SIZE] = {0};
+  char *buf = NULL;
+  size_t bufsize = 0;
   ssize_t bread = 0;
   ssize_t bwritten = 0;
+  off_t copied = -1;
+  int pipelined = 0;
   struct timeval times[2];
+  struct timespec start, finish;
+  double seconds;
 
   int rc = -1;
   int count = 0;
@@ -77,11 +271,11 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     case LOCAL_REPLICA:
       srep = ctx->local.type;
       drep = ctx->remote.type;
-      if (asprintf(&suri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->local.uri, &suri) < 0) {
         rc = -1;
         goto out;
       }
-      if (asprintf(&duri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->remote.uri, &duri) < 0) {
         rc = -1;
         goto out;
       }
@@ -89,11 +283,11 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     case REMOTE_REPLICA:
       srep = ctx->remote.type;
       drep = ctx->local.type;
-      if (asprintf(&suri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->remote.uri, &suri) < 0) {
         rc = -1;
         goto out;
       }
-      if (asprintf(&duri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->local.uri, &duri) < 0) {
         rc = -1;
         goto out;
       }
@@ -107,7 +301,7 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   flags = O_RDONLY|O_NOFOLLOW;
 #ifdef O_NOATIME
   /* O_NOATIME can only be set by the owner of the file or the superuser */
-  if (st->uid == ctx->pwd.uid || ctx->pwd.euid == 0) {
+  if (csync_owner_uid(ctx, st->owner) == ctx->pwd.uid || ctx->pwd.euid == 0) {
     flags |= O_NOATIME;
   }
 #endif
@@ -192,39 +386,111 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
 
   }
 
-  /* copy file */
-  for (;;) {
-    ctx->replica = srep;
-    bread = csync_vio_read(ctx, sfp, buf, MAX_XFER_BUF_SIZE);
+  /* the checksum is computed from the data transferred */
+  if (ctx->options.checksum) {
+    csync_checksum_init(&cs);
+  }
 
-    if (bread < 0) {
-      /* read error */
-      strerror_r(errno,  errbuf, sizeof(errbuf));
+  csync_gettime(&start);
+
+  /*
+   * Let the kernel copy the file if both replicas are local, the data doesn't
+   * go through our buffer then. It has to for the checksum.
+   */
+  if (! ctx->options.checksum) {
+    copied = csync_vio_copy(ctx, srep, sfp, drep, dfp);
+    if (copied < 0 && errno != ENOSYS) {
+      strerror_r(errno, errbuf, sizeof(errbuf));
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-          "file: %s, command: read, error: %s",
-          suri, errbuf);
+          "file: %s, command: copy, error: %s",
+          duri,
+          errbuf);
       rc = 1;
       goto out;
-    } else if (bread == 0) {
-      /* done */
-      break;
     }
+  }
 
-    ctx->replica = drep;
-    bwritten = csync_vio_write(ctx, dfp, buf, bread);
+  /* copy file, through buffers sized for the file and the replicas */
+  if (copied < 0) {
+    bufsize = csync_buffer_size(srep, drep, st->size,
+        (size_t) ctx->options.transfer_buffer_size * 1024);
+  }
 
-    if (bwritten < 0 || bread != bwritten) {
+#ifdef HAVE_PTHREAD
+  if (copied < 0 && _csync_pipeline_wanted(ctx, srep, drep, st->size, bufsize)) {
+    struct _csync_pipeline_s pl;
+    const char *command = NULL;
+
+    ZERO_STRUCT(pl);
+    pl.ctx = ctx;
+    pl.srep = srep;
+    pl.drep = drep;
+    pl.sfp = sfp;
+    pl.dfp = dfp;
+    pl.cs = ctx->options.checksum ? &cs : NULL;
+    pl.bufsize = bufsize;
+
+    copied = _csync_pipeline_copy(&pl, &command);
+    if (copied < 0 && command != NULL) {
       strerror_r(errno, errbuf, sizeof(errbuf));
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-          "file: %s, command: write, error: bread = %zu, bwritten = %zu - %s",
-          duri,
-          bread,
-          bwritten,
+          "file: %s, command: %s, error: %s",
+          strcmp(command, "read") == 0 ? suri : duri,
+          command,
           errbuf);
       rc = 1;
       goto out;
     }
+    pipelined = copied >= 0;
+  }
+#endif
+
+  /* or alternately read and write one buffer */
+  if (copied < 0) {
+    buf = csync_buffer_get(ctx->buffers, bufsize);
+    if (buf == NULL) {
+      rc = -1;
+      goto out;
+    }
+
+    for (;;) {
+      ctx->replica = srep;
+      bread = csync_vio_read(ctx, sfp, buf, bufsize);
+
+      if (bread < 0) {
+        /* read error */
+        strerror_r(errno,  errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+            "file: %s, command: read, error: %s",
+            suri, errbuf);
+        rc = 1;
+        goto out;
+      } else if (bread == 0) {
+        /* done */
+        break;
+      }
+
+      ctx->replica = drep;
+      bwritten = csync_vio_write(ctx, dfp, buf, bread);
+
+      if (bwritten < 0 || bread != bwritten) {
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+            "file: %s, command: write, error: bread = %zu, bwritten = %zu - %s",
+            duri,
+            bread,
+            bwritten,
+            errbuf);
+        rc = 1;
+        goto out;
+      }
+
+      if (ctx->options.checksum) {
+        csync_checksum_update(&cs, buf, bread);
+      }
+    }
   }
+  csync_gettime(&finish);
 
   ctx->replica = srep;
   if (csync_vio_close(ctx, sfp) < 0) {
@@ -342,7 +608,8 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
 
   /* set owner and group if possible */
   if (ctx->pwd.euid == 0) {
-    csync_vio_chown(ctx, duri, st->uid, st->gid);
+    csync_vio_chown(ctx, duri, csync_owner_uid(ctx, st->owner),
+        csync_owner_gid(ctx, st->owner));
   }
 
   /* sync time */
@@ -352,14 +619,40 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   ctx->replica = drep;
   csync_vio_utimes(ctx, duri, times);
 
+  if (ctx->options.checksum) {
+    st->checksum = csync_checksum_digest(&cs);
+  }
+
   /* set instruction for the statedb merger */
   st->instruction = CSYNC_INSTRUCTION_UPDATED;
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "PUSHED  file: %s", duri);
 
+  seconds = c_secdiff(finish, start);
+  if (pipelined) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "file: %s, %jd bytes in %.3f seconds (%.2f MB/s), buffers: %d x %zu KB",
+        duri, (intmax_t) st->size, seconds,
+        seconds > 0 ? st->size / seconds / (1024 * 1024) : 0.0,
+        CSYNC_PIPELINE_BUFFERS, bufsize / 1024);
+  } else if (bufsize > 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "file: %s, %jd bytes in %.3f seconds (%.2f MB/s), buffer: %zu KB",
+        duri, (intmax_t) st->size, seconds,
+        seconds > 0 ? st->size / seconds / (1024 * 1024) : 0.0,
+        bufsize / 1024);
+  } else {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "file: %s, %jd bytes in %.3f seconds (%.2f MB/s), kernel copy",
+        duri, (intmax_t) st->size, seconds,
+        seconds > 0 ? st->size / seconds / (1024 * 1024) : 0.0);
+  }
+
   rc = 0;
 
 out:
+  csync_buffer_put(ctx->buffers, buf, bufsize);
+
   ctx->replica = srep;
   csync_vio_close(ctx, sfp);
 
@@ -386,9 +679,10 @@ out:
   return rc;
 }
 
-static int _backup_path(char** duri, const char* uri, const char* path)
+static int _backup_path(char** duri, const char* uri, const csync_file_stat_t *st)
 {
 	int rc=0;
+	char path[st->pathlen + 1];
 	C_PATHINFO *info=NULL;
 
 	struct tm *curtime;
@@ -398,7 +692,7 @@ static int _backup_path(char** duri, const char* uri, const char* path)
 	curtime = localtime(&sec);
 	strftime(timestring, 16,   "%Y%m%d-%H%M%S",curtime);
 
-	info=c_split_path(path);
+	info=c_split_path(csync_file_stat_path(st, path));
 	CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"directory: %s",info->directory);
 	CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"filename : %s",info->filename);
 	CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"extension: %s",info->extension);
@@ -431,24 +725,24 @@ static int _csync_backup_file(CSYNC *ctx, csync_file_stat_t *st) {
 	switch (ctx->current) {
 		case LOCAL_REPLICA:
 		drep = ctx->remote.type;
-		if (asprintf(&suri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+		if (csync_file_stat_uri(st, ctx->remote.uri, &suri) < 0) {
 			rc = -1;
 			goto out;
 		}
 
-		if ( _backup_path(&duri, ctx->remote.uri,st->path) < 0) {
+		if ( _backup_path(&duri, ctx->remote.uri, st) < 0) {
 			rc = -1;
 			goto out;
 		}
 		break;
 		case REMOTE_REPLICA:
 		drep = ctx->local.type;
-		if (asprintf(&suri, "%s/%s", ctx->local.uri, st->path) < 0) {
+		if (csync_file_stat_uri(st, ctx->local.uri, &suri) < 0) {
 			rc = -1;
 			goto out;
 		}
 
-		if ( _backup_path(&duri, ctx->local.uri, st->path) < 0) {
+		if ( _backup_path(&duri, ctx->local.uri, st) < 0) {
 			rc = -1;
 			goto out;
 		}
@@ -539,6 +833,100 @@ static int _csync_conflict_file(CSYNC *ctx, csync_file_stat_t *st) {
   return rc;
 }
 
+/* the content is the same on both replicas, only sync the metadata */
+static int _csync_metadata_file(CSYNC *ctx, csync_file_stat_t *st) {
+  enum csync_replica_e dest = -1;
+  enum csync_replica_e replica_bak;
+  char errbuf[256] = {0};
+  char *uri = NULL;
+  struct timeval times[2];
+  int rc = -1;
+
+  replica_bak = ctx->replica;
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      dest = ctx->remote.type;
+      if (csync_file_stat_uri(st, ctx->remote.uri, &uri) < 0) {
+        return -1;
+      }
+      break;
+    case REMOTE_REPLICA:
+      dest = ctx->local.type;
+      if (csync_file_stat_uri(st, ctx->local.uri, &uri) < 0) {
+        return -1;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->replica = dest;
+
+  /* chmod is if it is not the default mode */
+  if ((st->mode & 07777) != C_FILE_MODE) {
+    if (csync_vio_chmod(ctx, uri, st->mode) < 0) {
+      switch (errno) {
+        case ENOMEM:
+          rc = -1;
+          break;
+        default:
+          rc = 1;
+          break;
+      }
+      strerror_r(errno, errbuf, sizeof(errbuf));
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+          "file: %s, command: chmod, error: %s",
+          uri,
+          errbuf);
+      goto out;
+    }
+  }
+
+  /* set owner and group if possible */
+  if (ctx->pwd.euid == 0) {
+    csync_vio_chown(ctx, uri, csync_owner_uid(ctx, st->owner),
+        csync_owner_gid(ctx, st->owner));
+  }
+
+  times[0].tv_sec = times[1].tv_sec = st->modtime;
+  times[0].tv_usec = times[1].tv_usec = 0;
+
+  if (csync_vio_utimes(ctx, uri, times) < 0) {
+    switch (errno) {
+      case ENOMEM:
+        rc = -1;
+        break;
+      default:
+        rc = 1;
+        break;
+    }
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "file: %s, command: utimes, error: %s",
+        uri,
+        errbuf);
+    goto out;
+  }
+
+  /* set instruction for the statedb merger */
+  st->instruction = CSYNC_INSTRUCTION_UPDATED;
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "SYNCED metadata file: %s", uri);
+
+  rc = 0;
+out:
+  ctx->replica = replica_bak;
+  SAFE_FREE(uri);
+
+  /* set instruction for the statedb merger */
+  if (rc != 0) {
+    st->instruction = CSYNC_INSTRUCTION_ERROR;
+  }
+
+  return rc;
+}
+
 static int _csync_remove_file(CSYNC *ctx, csync_file_stat_t *st) {
   char errbuf[256] = {0};
   char *uri = NULL;
@@ -546,12 +934,12 @@ static int _csync_remove_file(CSYNC *ctx, csync_file_stat_t *st) {
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->local.uri, &uri) < 0) {
         return -1;
       }
       break;
     case REMOTE_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->remote.uri, &uri) < 0) {
         return -1;
       }
       break;
@@ -594,6 +982,111 @@ out:
   return rc;
 }
 
+/*
+ * Move a renamed file on the other replica instead of transferring it again.
+ * If the move fails, the file is pushed and the old file removed.
+ */
+static int _csync_rename_file(CSYNC *ctx, csync_file_stat_t *st) {
+  enum csync_replica_e dest = -1;
+  enum csync_replica_e replica_bak;
+  csync_file_stat_t *old = NULL;
+  char errbuf[256] = {0};
+  char *olduri = NULL;
+  char *uri = NULL;
+  char *tdir = NULL;
+  int rc = -1;
+
+  replica_bak = ctx->replica;
+
+  old = csync_statedb_get_renamed(ctx, st->inode);
+  if (old == NULL) {
+    return _csync_push_file(ctx, st);
+  }
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      dest = ctx->remote.type;
+      if (csync_file_stat_uri(old, ctx->remote.uri, &olduri) < 0 ||
+          csync_file_stat_uri(st, ctx->remote.uri, &uri) < 0) {
+        goto out;
+      }
+      break;
+    case REMOTE_REPLICA:
+      dest = ctx->local.type;
+      if (csync_file_stat_uri(old, ctx->local.uri, &olduri) < 0 ||
+          csync_file_stat_uri(st, ctx->local.uri, &uri) < 0) {
+        goto out;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->replica = dest;
+  rc = csync_vio_rename(ctx, olduri, uri);
+  if (rc < 0 && errno == ENOENT) {
+    /* the new directory is created after the files */
+    tdir = c_dirname(uri);
+    if (tdir == NULL) {
+      rc = -1;
+      goto out;
+    }
+    if (csync_vio_mkdirs(ctx, tdir, C_DIR_MODE) < 0) {
+      strerror_r(errno, errbuf, sizeof(errbuf));
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+          "dir: %s, command: mkdirs, error: %s",
+          tdir, errbuf);
+    }
+    rc = csync_vio_rename(ctx, olduri, uri);
+  }
+
+  if (rc < 0) {
+    if (errno == ENOMEM) {
+      rc = -1;
+      goto out;
+    }
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "file: %s, command: rename, error: %s, pushing the file",
+        olduri,
+        errbuf);
+
+    ctx->replica = replica_bak;
+    rc = _csync_push_file(ctx, st);
+    if (rc == 0) {
+      ctx->replica = dest;
+      if (csync_vio_unlink(ctx, olduri) < 0) {
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+            "file: %s, command: unlink, error: %s",
+            olduri,
+            errbuf);
+      }
+    }
+    goto out;
+  }
+
+  /* set instruction for the statedb merger */
+  st->instruction = CSYNC_INSTRUCTION_UPDATED;
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "MOVED  file: %s -> %s", olduri, uri);
+
+  rc = 0;
+out:
+  ctx->replica = replica_bak;
+  SAFE_FREE(old);
+  SAFE_FREE(olduri);
+  SAFE_FREE(uri);
+  SAFE_FREE(tdir);
+
+  /* set instruction for the statedb merger */
+  if (rc != 0) {
+    st->instruction = CSYNC_INSTRUCTION_ERROR;
+  }
+
+  return rc;
+}
+
 static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
   enum csync_replica_e dest = -1;
   enum csync_replica_e replica_bak;
@@ -607,13 +1100,13 @@ static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
   switch (ctx->current) {
     case LOCAL_REPLICA:
       dest = ctx->remote.type;
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->remote.uri, &uri) < 0) {
         return -1;
       }
       break;
     case REMOTE_REPLICA:
       dest = ctx->local.type;
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->local.uri, &uri) < 0) {
         return -1;
       }
       break;
@@ -661,7 +1154,8 @@ static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
 
   /* set owner and group if possible */
   if (ctx->pwd.euid == 0) {
-    csync_vio_chown(ctx, uri, st->uid, st->gid);
+    csync_vio_chown(ctx, uri, csync_owner_uid(ctx, st->owner),
+        csync_owner_gid(ctx, st->owner));
   }
 
   times[0].tv_sec = times[1].tv_sec = st->modtime;
@@ -700,13 +1194,13 @@ static int _csync_sync_dir(CSYNC *ctx, csync_file_stat_t *st) {
   switch (ctx->current) {
     case LOCAL_REPLICA:
       dest = ctx->remote.type;
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->remote.uri, &uri) < 0) {
         return -1;
       }
       break;
     case REMOTE_REPLICA:
       dest = ctx->local.type;
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->local.uri, &uri) < 0) {
         return -1;
       }
       break;
@@ -738,7 +1232,8 @@ static int _csync_sync_dir(CSYNC *ctx, csync_file_stat_t *st) {
 
   /* set owner and group if possible */
   if (ctx->pwd.euid == 0) {
-    csync_vio_chown(ctx, uri, st->uid, st->gid);
+    csync_vio_chown(ctx, uri, csync_owner_uid(ctx, st->owner),
+        csync_owner_gid(ctx, st->owner));
   }
 
   times[0].tv_sec = times[1].tv_sec = st->modtime;
@@ -772,12 +1267,12 @@ static int _csync_remove_dir(CSYNC *ctx, csync_file_stat_t *st) {
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->local.uri, &uri) < 0) {
         return -1;
       }
       break;
     case REMOTE_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (csync_file_stat_uri(st, ctx->remote.uri, &uri) < 0) {
         return -1;
       }
       break;
@@ -845,6 +1340,104 @@ out:
   return rc;
 }
 
+/*
+ * Remove a directory with everything below it at once. If the backend can't,
+ * the files are removed one by one.
+ */
+static int _csync_remove_tree(CSYNC *ctx, csync_file_stat_t *st) {
+  char errbuf[256] = {0};
+  char *uri = NULL;
+  int rc = -1;
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      if (csync_file_stat_uri(st, ctx->local.uri, &uri) < 0) {
+        return -1;
+      }
+      break;
+    case REMOTE_REPLICA:
+      if (csync_file_stat_uri(st, ctx->remote.uri, &uri) < 0) {
+        return -1;
+      }
+      break;
+    default:
+      break;
+  }
+
+  if (csync_vio_rmdirs(ctx, uri) < 0) {
+    switch (errno) {
+      case ENOMEM:
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_FATAL,
+            "dir: %s, command: rmdirs, error: %s",
+            uri,
+            errbuf);
+        rc = -1;
+        goto out;
+      case ENOSYS:
+        break;
+      default:
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+            "dir: %s, command: rmdirs, error: %s",
+            uri,
+            errbuf);
+        break;
+    }
+    st->instruction = CSYNC_INSTRUCTION_REMOVE;
+    rc = 0;
+    goto out;
+  }
+
+  /* set instruction for the statedb merger */
+  st->instruction = CSYNC_INSTRUCTION_DELETED;
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "REMOVED tree: %s", uri);
+
+  rc = 0;
+out:
+  SAFE_FREE(uri);
+
+  return rc;
+}
+
+/* Check if a file has been removed with a directory above it */
+static int _csync_removed_with_tree(csync_file_stat_t *st) {
+  const csync_file_stat_t *p;
+
+  for (p = st->parent; p != NULL; p = p->parent) {
+    if (p->instruction == CSYNC_INSTRUCTION_DELETED) {
+      st->instruction = CSYNC_INSTRUCTION_DELETED;
+      return 1;
+    }
+    if (p->instruction != CSYNC_INSTRUCTION_REMOVE) {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/* Remove the subtrees first, the files in them are skipped afterwards */
+static int _csync_propagation_subtrees(CSYNC *ctx, c_htable_t *tree) {
+  csync_file_stat_t **files;
+  size_t i;
+
+  files = (csync_file_stat_t **) c_htable_sorted(tree);
+  if (files == NULL) {
+    return -1;
+  }
+
+  for (i = 0; files[i] != NULL; i++) {
+    if (files[i]->instruction == CSYNC_INSTRUCTION_REMOVE_TREE &&
+        _csync_remove_tree(ctx, files[i]) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 static int _csync_propagation_cleanup(CSYNC *ctx) {
   c_list_t *list = NULL;
   c_list_t *walk = NULL;
@@ -878,7 +1471,7 @@ static int _csync_propagation_cleanup(CSYNC *ctx) {
 
     st = (csync_file_stat_t *) walk->data;
 
-    if (asprintf(&dir, "%s/%s", uri, st->path) < 0) {
+    if (csync_file_stat_uri(st, uri, &dir) < 0) {
       return -1;
     }
 
@@ -898,10 +1491,10 @@ static int _csync_propagation_cleanup(CSYNC *ctx) {
 }
 
 static int _csync_propagation_file_visitor(void *obj, void *data) {
-  csync_file_stat_t *st = NULL;
+  csync_file_stat_t *st = (csync_file_stat_t *) obj;
   CSYNC *ctx = NULL;
+  char path[st->pathlen + 1];
 
-  st = (csync_file_stat_t *) obj;
   ctx = (CSYNC *) data;
 
   switch(st->type) {
@@ -920,12 +1513,26 @@ static int _csync_propagation_file_visitor(void *obj, void *data) {
           }
           break;
         case CSYNC_INSTRUCTION_REMOVE:
+          if (_csync_removed_with_tree(st)) {
+            break;
+          }
           if (_csync_remove_file(ctx, st) < 0) {
             goto err;
           }
           break;
+        case CSYNC_INSTRUCTION_RENAME:
+          if (_csync_rename_file(ctx, st) < 0) {
+            goto err;
+          }
+          break;
+        case CSYNC_INSTRUCTION_METADATA:
+          if (_csync_metadata_file(ctx, st) < 0) {
+            goto err;
+          }
+          break;
         case CSYNC_INSTRUCTION_CONFLICT:
-          CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"case CSYNC_INSTRUCTION_CONFLICT: %s",st->path);
+          CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"case CSYNC_INSTRUCTION_CONFLICT: %s",
+              csync_file_stat_path(st, path));
           if (_csync_conflict_file(ctx, st) < 0) {
             goto err;
           }
@@ -982,6 +1589,9 @@ static int _csync_propagation_dir_visitor(void *obj, void *data) {
           }
           break;
         case CSYNC_INSTRUCTION_REMOVE:
+          if (_csync_removed_with_tree(st)) {
+            break;
+          }
           if (_csync_remove_dir(ctx, st) < 0) {
             goto err;
           }
@@ -999,8 +1609,183 @@ err:
   return -1;
 }
 
+#ifdef HAVE_PTHREAD
+struct _csync_propagate_pool_s {
+  csync_file_stat_t **files;
+  size_t next;
+  int failed;
+  pthread_mutex_t lock;
+};
+
+struct _csync_propagate_worker_s {
+  struct _csync_propagate_pool_s *pool;
+  /* a copy, the propagation switches ctx->replica for every call */
+  CSYNC ctx;
+  pthread_t thread;
+  int started;
+  /* statistics */
+  size_t files;
+  size_t errors;
+  int64_t bytes;
+  double seconds;
+};
+
+/*
+ * Renames and conflicts are left for the walk after the workers, renames
+ * look up the statedb and the backup names use localtime().
+ */
+static int _csync_propagate_is_task(const csync_file_stat_t *st) {
+  if (st->type != CSYNC_FTW_TYPE_FILE) {
+    return 0;
+  }
+
+  switch (st->instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_SYNC:
+    case CSYNC_INSTRUCTION_METADATA:
+    case CSYNC_INSTRUCTION_REMOVE:
+      return 1;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+/*
+ * Get the number of propagation threads. The modules keep their session and
+ * buffers in global variables, a transfer through a module can't run next to
+ * another one, so a remote replica is synced with one thread.
+ */
+static int _csync_propagate_threads(CSYNC *ctx) {
+  int nthreads = ctx->options.propagate_threads;
+
+  if (nthreads > 1 && ctx->remote.type == REMOTE_REPLICA) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "propagate_threads = %d only works between local directories, "
+        "using 1 thread for the module", nthreads);
+    nthreads = 1;
+  }
+
+  return nthreads;
+}
+
+static void *_csync_propagate_worker(void *arg) {
+  struct _csync_propagate_worker_s *worker = arg;
+  struct _csync_propagate_pool_s *pool = worker->pool;
+  CSYNC *ctx = &worker->ctx;
+
+  for (;;) {
+    struct timespec start, finish;
+    csync_file_stat_t *st;
+    int transfer;
+    int rc;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->files[pool->next] != NULL &&
+           ! _csync_propagate_is_task(pool->files[pool->next])) {
+      pool->next++;
+    }
+    st = pool->failed ? NULL : pool->files[pool->next];
+    if (st != NULL) {
+      pool->next++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (st == NULL) {
+      break;
+    }
+
+    transfer = st->instruction == CSYNC_INSTRUCTION_NEW ||
+      st->instruction == CSYNC_INSTRUCTION_SYNC;
+
+    csync_gettime(&start);
+    rc = _csync_propagation_file_visitor(st, ctx);
+    csync_gettime(&finish);
+
+    worker->seconds += c_secdiff(finish, start);
+    worker->files++;
+    if (st->instruction == CSYNC_INSTRUCTION_ERROR) {
+      worker->errors++;
+    } else if (transfer && st->instruction == CSYNC_INSTRUCTION_UPDATED) {
+      worker->bytes += st->size;
+    }
+
+    if (rc < 0) {
+      pthread_mutex_lock(&pool->lock);
+      pool->failed = 1;
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Transfer, update and remove the files of the tree on several workers. The
+ * directories are still created, synced and removed after all the files, a
+ * file whose directory doesn't exist yet creates it, like with one thread.
+ */
+static int _csync_propagate_parallel(CSYNC *ctx, c_htable_t *tree,
+    int nthreads) {
+  struct _csync_propagate_pool_s pool;
+  struct _csync_propagate_worker_s *workers;
+  int i;
+
+  ZERO_STRUCT(pool);
+  pool.files = (csync_file_stat_t **) c_htable_sorted(tree);
+  if (pool.files == NULL) {
+    return -1;
+  }
+
+  workers = c_malloc(nthreads * sizeof(struct _csync_propagate_worker_s));
+  if (workers == NULL) {
+    return -1;
+  }
+  pthread_mutex_init(&pool.lock, NULL);
+
+  for (i = 0; i < nthreads; i++) {
+    workers[i].pool = &pool;
+    workers[i].ctx = *ctx;
+
+    /* the first worker runs on the calling thread */
+    if (i > 0 && pthread_create(&workers[i].thread, NULL,
+          _csync_propagate_worker, &workers[i]) == 0) {
+      workers[i].started = 1;
+    }
+  }
+
+  _csync_propagate_worker(&workers[0]);
+  for (i = 1; i < nthreads; i++) {
+    if (workers[i].started) {
+      pthread_join(workers[i].thread, NULL);
+    }
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    if (i > 0 && ! workers[i].started) {
+      continue;
+    }
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "Propagation worker %d: %zu files, %jd bytes, %zu errors, "
+        "busy %.2f seconds",
+        i, workers[i].files, (intmax_t) workers[i].bytes,
+        workers[i].errors, workers[i].seconds);
+  }
+
+  pthread_mutex_destroy(&pool.lock);
+  SAFE_FREE(workers);
+
+  return pool.failed ? -1 : 0;
+}
+#endif /* HAVE_PTHREAD */
+
 int csync_propagate_files(CSYNC *ctx) {
-  c_rbtree_t *tree = NULL;
+  c_htable_t *tree = NULL;
+#ifdef HAVE_PTHREAD
+  int nthreads;
+#endif
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
@@ -1013,11 +1798,23 @@ int csync_propagate_files(CSYNC *ctx) {
       break;
   }
 
-  if (c_rbtree_walk(tree, (void *) ctx, _csync_propagation_file_visitor) < 0) {
+  if (_csync_propagation_subtrees(ctx, tree) < 0) {
+    return -1;
+  }
+
+#ifdef HAVE_PTHREAD
+  nthreads = _csync_propagate_threads(ctx);
+  if (nthreads > 1 && _csync_propagate_parallel(ctx, tree, nthreads) < 0) {
+    return -1;
+  }
+#endif
+
+  /* the files left, all of them with one thread */
+  if (c_htable_walk(tree, (void *) ctx, _csync_propagation_file_visitor) < 0) {
     return -1;
   }
 
-  if (c_rbtree_walk(tree, (void *) ctx, _csync_propagation_dir_visitor) < 0) {
+  if (c_htable_walk(tree, (void *) ctx, _csync_propagation_dir_visitor) < 0) {
     return -1;
   }
 
@@ -20,13 +20,131 @@
 
 #include "config.h"
 
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "c_lib.h"
+
 #include "csync_private.h"
 #include "csync_reconcile.h"
+#include "csync_statedb.h"
 #include "csync_util.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.reconciler"
 #include "csync_log.h"
 
+/* files of both replicas a reconcile thread takes at least */
+#define CSYNC_RECONCILE_PARTITION_MIN 4096
+
+/* messages of a partition reconciled on a worker thread */
+struct _csync_reconcile_log_s {
+  char *buf;
+  size_t len;
+  size_t size;
+  /* priority and offset in buf of every message */
+  int *priorities;
+  size_t *offsets;
+  size_t count;
+  size_t max;
+  size_t dropped;
+};
+
+static void _csync_reconcile_log_add(struct _csync_reconcile_log_s *log,
+    int priority, const char *fmt, ...) PRINTF_ATTRIBUTE(3, 4);
+
+static void _csync_reconcile_log_add(struct _csync_reconcile_log_s *log,
+    int priority, const char *fmt, ...) {
+  va_list va;
+  int len;
+
+  va_start(va, fmt);
+  len = vsnprintf(NULL, 0, fmt, va);
+  va_end(va);
+  if (len < 0) {
+    log->dropped++;
+    return;
+  }
+
+  if (log->count == log->max) {
+    size_t max = log->max ? log->max * 2 : 256;
+    int *priorities;
+    size_t *offsets;
+
+    priorities = c_realloc(log->priorities, max * sizeof(int));
+    if (priorities == NULL) {
+      log->dropped++;
+      return;
+    }
+    log->priorities = priorities;
+    offsets = c_realloc(log->offsets, max * sizeof(size_t));
+    if (offsets == NULL) {
+      log->dropped++;
+      return;
+    }
+    log->offsets = offsets;
+    log->max = max;
+  }
+
+  if (log->len + len + 1 > log->size) {
+    size_t size = log->size ? log->size : 4096;
+    char *buf;
+
+    while (log->len + len + 1 > size) {
+      size *= 2;
+    }
+    buf = c_realloc(log->buf, size);
+    if (buf == NULL) {
+      log->dropped++;
+      return;
+    }
+    log->buf = buf;
+    log->size = size;
+  }
+
+  va_start(va, fmt);
+  vsnprintf(log->buf + log->len, len + 1, fmt, va);
+  va_end(va);
+
+  log->priorities[log->count] = priority;
+  log->offsets[log->count] = log->len;
+  log->count++;
+  log->len += len + 1;
+}
+
+#ifdef HAVE_PTHREAD
+/* Log the messages of a partition in the order they were added */
+static void _csync_reconcile_log_flush(struct _csync_reconcile_log_s *log) {
+  size_t i;
+
+  for (i = 0; i < log->count; i++) {
+    CSYNC_LOG(log->priorities[i], "%s", log->buf + log->offsets[i]);
+  }
+  if (log->dropped > 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "Out of memory, %zu reconcile messages were dropped", log->dropped);
+  }
+
+  SAFE_FREE(log->buf);
+  SAFE_FREE(log->priorities);
+  SAFE_FREE(log->offsets);
+}
+#endif /* HAVE_PTHREAD */
+
+/* messages of the merge go to the log of the partition, if there is one */
+#define _CSYNC_MERGE_LOG(log, priority, ...) \
+  do { \
+    if ((log) != NULL) { \
+      _csync_reconcile_log_add((log), (priority), __VA_ARGS__); \
+    } else { \
+      CSYNC_LOG((priority), __VA_ARGS__); \
+    } \
+  } while (0)
+
 /*
  * We merge replicas at the file level. The merged replica contains the
  * superset of files that are on the local machine and server copies of
@@ -40,31 +158,14 @@
  * (timestamp is newer), it is not overwritten. If both files, on the
  * source and the destination, have been changed, the newer file wins.
  */
-static int _csync_merge_algorithm_visitor(void *obj, void *data) {
-  csync_file_stat_t *cur = NULL;
-  csync_file_stat_t *other = NULL;
-  CSYNC *ctx = NULL;
-  c_rbtree_t *tree = NULL;
-  c_rbnode_t *node = NULL;
+static void _csync_merge_file(CSYNC *ctx, csync_file_stat_t *cur,
+    csync_file_stat_t *other, struct _csync_reconcile_log_s *log) {
+  char path[cur->pathlen + 1];
 
-  cur = (csync_file_stat_t *) obj;
-  ctx = (CSYNC *) data;
+  csync_file_stat_path(cur, path);
 
-  /* we need the opposite tree! */
-  switch (ctx->current) {
-    case LOCAL_REPLICA:
-      tree = ctx->remote.tree;
-      break;
-    case REMOTE_REPLICA:
-      tree = ctx->local.tree;
-      break;
-    default:
-      break;
-  }
-
-  node = c_rbtree_find(tree, &cur->phash);
   /* file only found on current replica */
-  if (node == NULL) {
+  if (other == NULL) {
     switch(cur->instruction) {
       /* file has been modified */
       case CSYNC_INSTRUCTION_EVAL:
@@ -72,10 +173,11 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         break;
       /* file has been removed on the opposite replica */
       case CSYNC_INSTRUCTION_NONE:
+      case CSYNC_INSTRUCTION_METADATA:
         cur->instruction = CSYNC_INSTRUCTION_REMOVE;
         break;
+      /* checked by _csync_reconcile_renames(), moved on the other replica */
       case CSYNC_INSTRUCTION_RENAME:
-        cur->instruction = CSYNC_INSTRUCTION_NEW;
         break;
       default:
         break;
@@ -84,8 +186,6 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
     /*
      * file found on the other replica
      */
-    other = (csync_file_stat_t *) node->data;
-
     switch (cur->instruction) {
       /* file on current replica is new */
       case CSYNC_INSTRUCTION_NEW:
@@ -96,7 +196,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"file new on both, cur is newer PATH=./%s",cur->path);
+				_CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,"file new on both, cur is newer PATH=./%s",path);
 				cur->instruction = CSYNC_INSTRUCTION_CONFLICT;
 				other->instruction = CSYNC_INSTRUCTION_NONE;
 			  }
@@ -110,7 +210,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"file new on both, other is newer PATH=./%s",cur->path);
+				_CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,"file new on both, other is newer PATH=./%s",path);
 				cur->instruction = CSYNC_INSTRUCTION_NONE;
 				other->instruction = CSYNC_INSTRUCTION_CONFLICT;
 			  }
@@ -133,7 +233,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"new on cur, modified on other, cur is newer PATH=./%s",cur->path);
+				_CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,"new on cur, modified on other, cur is newer PATH=./%s",path);
 				cur->instruction = CSYNC_INSTRUCTION_CONFLICT;
 			  }
 			  else
@@ -146,7 +246,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"new on cur, modified on other, other is newer PATH=./%s",cur->path);
+				_CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,"new on cur, modified on other, other is newer PATH=./%s",path);
 				cur->instruction = CSYNC_INSTRUCTION_NONE;
 			  }
 			  else
@@ -160,6 +260,11 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
           case CSYNC_INSTRUCTION_NONE:
             cur->instruction = CSYNC_INSTRUCTION_SYNC;
             break;
+          /* only the metadata changed, the content is replaced anyway */
+          case CSYNC_INSTRUCTION_METADATA:
+            cur->instruction = CSYNC_INSTRUCTION_SYNC;
+            other->instruction = CSYNC_INSTRUCTION_NONE;
+            break;
           default:
             break;
         }
@@ -173,7 +278,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"modified on cur, new on other, cur is newer PATH=./%s",cur->path);
+				_CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,"modified on cur, new on other, cur is newer PATH=./%s",path);
 				cur->instruction = CSYNC_INSTRUCTION_CONFLICT;
 			  }
 			  else
@@ -185,7 +290,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"modified on cur, new on other, other is newer PATH=./%s",cur->path);
+				_CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,"modified on cur, new on other, other is newer PATH=./%s",path);
 				cur->instruction = CSYNC_INSTRUCTION_NONE;
 			  }
 			  else
@@ -201,7 +306,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"both modified, cur is newer PATH=./%s",cur->path);
+				_CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,"both modified, cur is newer PATH=./%s",path);
 				cur->instruction = CSYNC_INSTRUCTION_CONFLICT;
 				other->instruction= CSYNC_INSTRUCTION_NONE;
 			  }
@@ -215,7 +320,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
-				CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"both modified, other is newer PATH=./%s",cur->path);
+				_CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,"both modified, other is newer PATH=./%s",path);
 				cur->instruction = CSYNC_INSTRUCTION_NONE;
 				other->instruction=CSYNC_INSTRUCTION_CONFLICT;
 			  }
@@ -229,6 +334,34 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
           case CSYNC_INSTRUCTION_NONE:
             cur->instruction = CSYNC_INSTRUCTION_SYNC;
             break;
+          /* only the metadata changed, the content is replaced anyway */
+          case CSYNC_INSTRUCTION_METADATA:
+            cur->instruction = CSYNC_INSTRUCTION_SYNC;
+            other->instruction = CSYNC_INSTRUCTION_NONE;
+            break;
+          default:
+            break;
+        }
+        break;
+      /* content of the file on current replica is unchanged */
+      case CSYNC_INSTRUCTION_METADATA:
+        switch (other->instruction) {
+          /* the content of the other replica is synced */
+          case CSYNC_INSTRUCTION_NEW:
+          case CSYNC_INSTRUCTION_EVAL:
+            cur->instruction = CSYNC_INSTRUCTION_NONE;
+            break;
+          /* the metadata changed on both replicas, the newer wins */
+          case CSYNC_INSTRUCTION_METADATA:
+            if (cur->modtime > other->modtime) {
+              other->instruction = CSYNC_INSTRUCTION_NONE;
+            } else if (cur->modtime < other->modtime) {
+              cur->instruction = CSYNC_INSTRUCTION_NONE;
+            } else {
+              cur->instruction = CSYNC_INSTRUCTION_NONE;
+              other->instruction = CSYNC_INSTRUCTION_NONE;
+            }
+            break;
           default:
             break;
         }
@@ -244,43 +377,148 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
   {
       if(cur->type == CSYNC_FTW_TYPE_DIR)
       {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+        _CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,
         "%-20s  dir: %s",
         csync_instruction_str(cur->instruction),
-        cur->path);
+        path);
       }
       else
       {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+        _CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_TRACE,
         "%-20s file: %s",
         csync_instruction_str(cur->instruction),
-        cur->path);   
+        path);   
       }
   }
   else
   {
       if(cur->type == CSYNC_FTW_TYPE_DIR)
       {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        _CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_DEBUG,
         "%-20s  dir: %s",
         csync_instruction_str(cur->instruction),
-        cur->path);
+        path);
       }
       else
       {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        _CSYNC_MERGE_LOG(log, CSYNC_LOG_PRIORITY_DEBUG,
         "%-20s file: %s",
         csync_instruction_str(cur->instruction),
-        cur->path);   
+        path);   
       }
   }
-  
+}
+
+/*
+ * A local file which has been renamed is moved on the remote replica if the
+ * remote file at the old path is unchanged and the content of the local file
+ * too. The remote file at the old path is ignored, it is moved away.
+ */
+static int _csync_reconcile_rename(CSYNC *ctx, csync_file_stat_t *cur) {
+  csync_file_stat_t *old = NULL;
+  csync_file_stat_t *other;
+  char path[cur->pathlen + 1];
+  uint64_t phash;
+  int rc = 0;
+
+  if (cur->type != CSYNC_FTW_TYPE_FILE || ! csync_get_statedb_exists(ctx)) {
+    goto out;
+  }
+
+  old = csync_statedb_get_renamed(ctx, cur->inode);
+  if (old == NULL || old->modtime != cur->modtime ||
+      (old->size >= 0 && old->size != cur->size)) {
+    goto out;
+  }
+
+  /* the old path is gone locally and the new one isn't taken remotely */
+  phash = csync_path_hash(old->name, old->pathlen);
+  if (csync_file_tree_find_path(ctx->local.tree, phash, old->name,
+        old->pathlen) != NULL ||
+      csync_file_tree_find(ctx->remote.tree, cur) != NULL) {
+    goto out;
+  }
+
+  other = csync_file_tree_find_path(ctx->remote.tree, phash, old->name,
+      old->pathlen);
+  if (other == NULL || other->type != CSYNC_FTW_TYPE_FILE ||
+      other->instruction != CSYNC_INSTRUCTION_NONE) {
+    goto out;
+  }
+
+  other->instruction = CSYNC_INSTRUCTION_IGNORE;
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "renamed file: %s -> %s", old->name,
+      csync_file_stat_path(cur, path));
+  rc = 1;
+
+out:
+  SAFE_FREE(old);
+
+  return rc;
+}
+
+/*
+ * Check the renamed local files, the ones which can't be moved are new.
+ * Renames are only detected on the local replica, if there are any on the
+ * remote one they are new files too.
+ */
+static int _csync_reconcile_renames(CSYNC *ctx) {
+  csync_file_stat_t **files;
+  size_t i;
+
+  files = (csync_file_stat_t **) c_htable_sorted(ctx->local.tree);
+  if (files == NULL) {
+    return -1;
+  }
+
+  for (i = 0; files[i] != NULL; i++) {
+    if (files[i]->instruction != CSYNC_INSTRUCTION_RENAME) {
+      continue;
+    }
+    if (_csync_reconcile_rename(ctx, files[i]) == 0) {
+      files[i]->instruction = CSYNC_INSTRUCTION_NEW;
+    }
+  }
+
+  files = (csync_file_stat_t **) c_htable_sorted(ctx->remote.tree);
+  if (files == NULL) {
+    return -1;
+  }
+
+  for (i = 0; files[i] != NULL; i++) {
+    if (files[i]->instruction == CSYNC_INSTRUCTION_RENAME) {
+      files[i]->instruction = CSYNC_INSTRUCTION_NEW;
+    }
+  }
+
+  return 0;
+}
+
+static int _csync_merge_algorithm_visitor(void *obj, void *data) {
+  csync_file_stat_t *cur = (csync_file_stat_t *) obj;
+  CSYNC *ctx = (CSYNC *) data;
+  c_htable_t *tree = NULL;
+
+  /* we need the opposite tree! */
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      tree = ctx->remote.tree;
+      break;
+    case REMOTE_REPLICA:
+      tree = ctx->local.tree;
+      break;
+    default:
+      break;
+  }
+
+  _csync_merge_file(ctx, cur, csync_file_tree_find(tree, cur), NULL);
+
   return 0;
 }
 
 int csync_reconcile_updates(CSYNC *ctx) {
   int rc;
-  c_rbtree_t *tree = NULL;
+  c_htable_t *tree = NULL;
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
@@ -293,8 +531,296 @@ int csync_reconcile_updates(CSYNC *ctx) {
       break;
   }
 
-  rc = c_rbtree_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
+  if (ctx->current == LOCAL_REPLICA && _csync_reconcile_renames(ctx) < 0) {
+    return -1;
+  }
+
+  rc = c_htable_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
+
+  return rc;
+}
+
+struct _csync_reconcile_list_s {
+  csync_file_stat_t **files;
+  size_t count;
+};
+
+/* The files of a tree in the order of the tree, kept by the tree */
+static int _csync_reconcile_collect(c_htable_t *tree,
+    struct _csync_reconcile_list_s *list) {
+  list->files = (csync_file_stat_t **) c_htable_sorted(tree);
+  if (list->files == NULL) {
+    return -1;
+  }
+  list->count = c_htable_size(tree);
+
+  return 0;
+}
+
+/* The order of the trees, by hash and path if the hashes collide */
+static int _csync_reconcile_cmp(const csync_file_stat_t *a,
+    const csync_file_stat_t *b) {
+  if (a->phash != b->phash) {
+    return a->phash < b->phash ? -1 : 1;
+  }
+
+  if (csync_file_stat_path_equal(a, b)) {
+    return 0;
+  } else {
+    char pa[a->pathlen + 1];
+    char pb[b->pathlen + 1];
+
+    return strcmp(csync_file_stat_path(a, pa), csync_file_stat_path(b, pb));
+  }
+}
+
+/*
+ * The trees are sorted the same way, so the files with the same path on both
+ * replicas are found by walking both at once. The merge algorithm only
+ * changes the instructions of the file and the file with the same path on
+ * the other replica. So reconciling both files of a pair, first the local
+ * one, gives the same result as reconciling the whole local replica first.
+ */
+static void _csync_reconcile_merge_range(CSYNC *ctx,
+    csync_file_stat_t **local, size_t nlocal,
+    csync_file_stat_t **remote, size_t nremote,
+    struct _csync_reconcile_log_s *log) {
+  size_t i = 0;
+  size_t j = 0;
+
+  while (i < nlocal || j < nremote) {
+    int cmp;
+
+    if (i == nlocal) {
+      cmp = 1;
+    } else if (j == nremote) {
+      cmp = -1;
+    } else {
+      cmp = _csync_reconcile_cmp(local[i], remote[j]);
+    }
+
+    if (cmp < 0) {
+      _csync_merge_file(ctx, local[i++], NULL, log);
+    } else if (cmp > 0) {
+      _csync_merge_file(ctx, remote[j++], NULL, log);
+    } else {
+      _csync_merge_file(ctx, local[i], remote[j], log);
+      _csync_merge_file(ctx, remote[j], local[i], log);
+      i++;
+      j++;
+    }
+  }
+}
+
+#ifdef HAVE_PTHREAD
+/* The index of the first file with a hash not lower than phash */
+static size_t _csync_reconcile_lower_bound(csync_file_stat_t **files,
+    size_t count, uint64_t phash) {
+  size_t lo = 0;
+  size_t hi = count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (files[mid]->phash < phash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+struct _csync_reconcile_part_s {
+  CSYNC *ctx;
+  csync_file_stat_t **local;
+  size_t nlocal;
+  csync_file_stat_t **remote;
+  size_t nremote;
+  struct _csync_reconcile_log_s log;
+  pthread_t thread;
+  int started;
+};
+
+static void *_csync_reconcile_thread(void *arg) {
+  struct _csync_reconcile_part_s *part = arg;
+
+  _csync_reconcile_merge_range(part->ctx, part->local, part->nlocal,
+      part->remote, part->nremote, &part->log);
+
+  return NULL;
+}
+
+/*
+ * Files with the same path have the same hash, so the pairs never cross the
+ * boundary of a hash range and the ranges are reconciled independently. The
+ * messages of every range are logged after all of them are done, in the
+ * order of the ranges, which is the order of the single threaded merge.
+ */
+static int _csync_reconcile_merge_parallel(CSYNC *ctx,
+    struct _csync_reconcile_list_s *local,
+    struct _csync_reconcile_list_s *remote, int nthreads) {
+  struct _csync_reconcile_part_s *parts;
+  size_t li = 0;
+  size_t ri = 0;
+  int i;
+
+  parts = c_malloc(nthreads * sizeof(struct _csync_reconcile_part_s));
+  if (parts == NULL) {
+    return -1;
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    struct _csync_reconcile_part_s *part = &parts[i];
+    size_t lend = local->count;
+    size_t rend = remote->count;
+
+    if (i < nthreads - 1) {
+      uint64_t bound = (UINT64_MAX / nthreads) * (i + 1);
+
+      lend = _csync_reconcile_lower_bound(local->files, local->count, bound);
+      rend = _csync_reconcile_lower_bound(remote->files, remote->count, bound);
+    }
+
+    part->ctx = ctx;
+    part->local = local->files + li;
+    part->nlocal = lend - li;
+    part->remote = remote->files + ri;
+    part->nremote = rend - ri;
+    li = lend;
+    ri = rend;
+
+    /* the first range is reconciled on the calling thread */
+    if (i > 0 &&
+        pthread_create(&part->thread, NULL, _csync_reconcile_thread, part) == 0) {
+      part->started = 1;
+    }
+  }
+
+  _csync_reconcile_thread(&parts[0]);
+  for (i = 1; i < nthreads; i++) {
+    if (parts[i].started) {
+      pthread_join(parts[i].thread, NULL);
+    } else {
+      _csync_reconcile_thread(&parts[i]);
+    }
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    _csync_reconcile_log_flush(&parts[i].log);
+  }
+  SAFE_FREE(parts);
+
+  return 0;
+}
+#endif /* HAVE_PTHREAD */
+
+/* Mark the removed directories of a tree whose whole subtree is removed */
+static int _csync_reconcile_subtrees(c_htable_t *tree) {
+  csync_file_stat_t **files;
+  size_t i;
+
+  files = (csync_file_stat_t **) c_htable_sorted(tree);
+  if (files == NULL) {
+    return -1;
+  }
+
+  /* the topmost removed directories */
+  for (i = 0; files[i] != NULL; i++) {
+    csync_file_stat_t *st = files[i];
+
+    if (st->type == CSYNC_FTW_TYPE_DIR &&
+        st->instruction == CSYNC_INSTRUCTION_REMOVE &&
+        (st->parent == NULL ||
+         (st->parent->instruction != CSYNC_INSTRUCTION_REMOVE &&
+          st->parent->instruction != CSYNC_INSTRUCTION_REMOVE_TREE))) {
+      st->instruction = CSYNC_INSTRUCTION_REMOVE_TREE;
+    }
+  }
+
+  /*
+   * A file which isn't removed keeps the directories above it. So does a
+   * directory with files the walk skipped, excluded ones for example, they
+   * would be removed with it.
+   */
+  for (i = 0; files[i] != NULL; i++) {
+    csync_file_stat_t *st = files[i];
+    const csync_file_stat_t *p;
+
+    if (st->incomplete) {
+      if (st->instruction == CSYNC_INSTRUCTION_REMOVE_TREE) {
+        st->instruction = CSYNC_INSTRUCTION_REMOVE;
+      }
+    } else if (st->instruction == CSYNC_INSTRUCTION_REMOVE ||
+        st->instruction == CSYNC_INSTRUCTION_REMOVE_TREE) {
+      continue;
+    }
+
+    for (p = st->parent; p != NULL; p = p->parent) {
+      if (p->instruction == CSYNC_INSTRUCTION_REMOVE_TREE) {
+        /* the parents are files of the tree too */
+        ((csync_file_stat_t *) p)->instruction = CSYNC_INSTRUCTION_REMOVE;
+        break;
+      }
+      if (p->instruction != CSYNC_INSTRUCTION_REMOVE) {
+        break;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int csync_reconcile_subtrees(CSYNC *ctx) {
+  if (_csync_reconcile_subtrees(ctx->local.tree) < 0 ||
+      _csync_reconcile_subtrees(ctx->remote.tree) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int csync_reconcile_merge(CSYNC *ctx) {
+  struct _csync_reconcile_list_s local;
+  struct _csync_reconcile_list_s remote;
+  size_t count;
+  int nthreads;
+  int rc = -1;
+
+  ZERO_STRUCT(local);
+  ZERO_STRUCT(remote);
+
+  if (_csync_reconcile_renames(ctx) < 0) {
+    goto out;
+  }
+
+  if (_csync_reconcile_collect(ctx->local.tree, &local) < 0 ||
+      _csync_reconcile_collect(ctx->remote.tree, &remote) < 0) {
+    goto out;
+  }
+
+  /* don't start threads for a handful of files */
+  count = local.count + remote.count;
+  nthreads = ctx->options.reconcile_threads;
+  if ((size_t) nthreads > count / CSYNC_RECONCILE_PARTITION_MIN) {
+    nthreads = count / CSYNC_RECONCILE_PARTITION_MIN;
+  }
+
+#ifdef HAVE_PTHREAD
+  if (nthreads > 1) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Reconciling %zu files with %d threads",
+        count, nthreads);
+    rc = _csync_reconcile_merge_parallel(ctx, &local, &remote, nthreads);
+    goto out;
+  }
+#endif
+
+  _csync_reconcile_merge_range(ctx, local.files, local.count,
+      remote.files, remote.count, NULL);
+  rc = 0;
 
+out:
   return rc;
 }
 
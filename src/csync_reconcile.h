@@ -52,6 +52,43 @@
  */
 int csync_reconcile_updates(CSYNC *ctx);
 
+/**
+ * @brief Reconcile the files of both replicas in one pass.
+ *
+ * The sorted snapshots of both trees are ordered by hash and path. The
+ * files with the same path are found by walking both snapshots at once,
+ * instead of looking up every file in the other tree. The result is the same
+ * as calling csync_reconcile_updates() for the local and then for the remote
+ * replica.
+ *
+ * With the reconcile_threads option the range of the path hashes is split
+ * between the threads. The messages are logged in the same order as with a
+ * single thread once all of them are done.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @return 0 on success, < 0 on error.
+ */
+int csync_reconcile_merge(CSYNC *ctx);
+
+/**
+ * @brief Find the directories which are removed with all their files.
+ *
+ * A removed directory is marked with CSYNC_INSTRUCTION_REMOVE_TREE if all
+ * the files and directories below it are removed too, so the propagator can
+ * remove it with one recursive delete instead of file by file. Only the
+ * topmost directory of such a subtree is marked, a subtree with a file which
+ * is kept, ignored, in conflict or synced isn't marked at all. Neither is a
+ * subtree with a directory the update detection didn't read completely, with
+ * excluded files, symbolic links or unreadable directories in it, which the
+ * recursive delete would remove too.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @return 0 on success, < 0 on error.
+ */
+int csync_reconcile_subtrees(CSYNC *ctx);
+
 /**
  * }@
  */
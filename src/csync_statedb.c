@@ -25,7 +25,9 @@
 #endif
 
 #include <sqlite3.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -33,6 +35,7 @@
 
 #include "c_lib.h"
 #include "csync_private.h"
+#include "csync_checksum.h"
 #include "csync_statedb.h"
 #include "csync_util.h"
 
@@ -41,6 +44,91 @@
 
 #define BUF_SIZE 16
 
+/*
+ * Version of the statedb, stored as user_version
+ *
+ * 0: phash is the c_jhash64 of the path
+ * 1: phash is the xxhash64 of the path, stored signed, the primary key is
+ *    the phash and the path
+ * 2: checksum of the content of the files, 0 if unknown
+ * 3: size, ctime and the nanoseconds of the mtime of the files, the size is
+ *    -1 and the ctime 0 if unknown
+ */
+#define CSYNC_STATEDB_VERSION 3
+
+/*
+ * In-memory index of the metadata table
+ *
+ * The records are stored back to back in one buffer, the two hash tables use
+ * open addressing with linear probing and point into that buffer.
+ */
+struct csync_statedb_index_s {
+  char *records;
+  size_t used;
+  size_t size;
+  size_t count;
+
+  const csync_file_stat_t **by_hash;
+  const csync_file_stat_t **by_inode;
+  size_t mask;
+
+  /* the children of the directories have been linked */
+  int children;
+};
+
+struct _csync_statedb_record_s {
+  struct _csync_statedb_record_s *child;
+  struct _csync_statedb_record_s *sibling;
+  /* number of children when the statedb was written, -1 if unknown */
+  int64_t childcount;
+  /* number of children in the index */
+  int64_t nchildren;
+  csync_file_stat_t st;
+};
+
+#define _CSYNC_STATEDB_RECORD(p) \
+  ((struct _csync_statedb_record_s *) \
+   ((char *) (p) - offsetof(struct _csync_statedb_record_s, st)))
+
+/*
+ * Map of inodes to rows of the metadata table
+ *
+ * It is used for rename detection if the statedb isn't loaded into memory.
+ * The entries are sorted by inode and rowid.
+ */
+struct csync_statedb_inode_map_s {
+  struct {
+    uint64_t inode;
+    sqlite3_int64 rowid;
+  } *entries;
+  size_t count;
+};
+
+/*
+ * Cache of the checksums of the local files
+ *
+ * A checksum is valid as long as the inode, size, mtime and ctime of the
+ * file are the ones it was computed for. The slots point to the entries by
+ * their index + 1, 0 is an empty slot.
+ */
+struct csync_statedb_checksums_s {
+  struct {
+    uint64_t inode;
+    int64_t size;
+    int64_t modtime;
+    int64_t ctime;
+    uint64_t checksum;
+  } *entries;
+  size_t count;
+
+  uint32_t *slots;
+  size_t mask;
+};
+
+/* records are 8 byte aligned */
+#define _CSYNC_STATEDB_RECORD_SIZE(len) \
+  ((sizeof(struct _csync_statedb_record_s) + (len) + 1 + 7) & ~((size_t) 7))
+
 void csync_set_statedb_exists(CSYNC *ctx, int val) {
   ctx->statedb.exists = val;
 }
@@ -105,6 +193,687 @@ static int _csync_statedb_is_empty(CSYNC *ctx) {
   return rc;
 }
 
+static inline size_t _csync_statedb_inode_slot(ino_t inode, size_t mask) {
+  uint64_t h = (uint64_t) inode * 0x9E3779B97F4A7C15ULL;
+
+  return (size_t) (h ^ (h >> 32)) & mask;
+}
+
+static void _csync_statedb_index_free(struct csync_statedb_index_s *index) {
+  if (index == NULL) {
+    return;
+  }
+
+  SAFE_FREE(index->records);
+  SAFE_FREE(index->by_hash);
+  SAFE_FREE(index->by_inode);
+  SAFE_FREE(index);
+}
+
+static int _csync_statedb_index_add(CSYNC *ctx, struct csync_statedb_index_s *index,
+    const char *path, size_t len, sqlite3_stmt *stmt) {
+  struct _csync_statedb_record_s *rec = NULL;
+  csync_file_stat_t *st = NULL;
+  size_t size = _CSYNC_STATEDB_RECORD_SIZE(len);
+  int owner;
+
+  owner = csync_owner_id(ctx, (uid_t) sqlite3_column_int64(stmt, 2),
+      (gid_t) sqlite3_column_int64(stmt, 3));
+  if (owner < 0) {
+    return -1;
+  }
+
+  if (index->used + size > index->size) {
+    size_t n = index->size ? index->size * 2 : 64 * 1024;
+    char *records;
+
+    while (index->used + size > n) {
+      n *= 2;
+    }
+    records = c_realloc(index->records, n);
+    if (records == NULL) {
+      return -1;
+    }
+    index->records = records;
+    index->size = n;
+  }
+
+  rec = (struct _csync_statedb_record_s *) (index->records + index->used);
+  memset(rec, 0, size);
+  st = &rec->st;
+
+  /*
+   * The phash column isn't reliable, values which don't fit into a signed
+   * 64bit integer are stored as floating point numbers. So recalculate it.
+   */
+  st->phash = csync_path_hash(path, len);
+  st->pathlen = len;
+  memcpy(st->name, path, len);
+  st->inode = (ino_t) sqlite3_column_int64(stmt, 1);
+  st->owner = owner;
+  st->mode = (mode_t) sqlite3_column_int64(stmt, 4);
+  st->modtime = (time_t) sqlite3_column_int64(stmt, 5);
+  st->checksum = (uint64_t) sqlite3_column_int64(stmt, 7);
+  st->size = (off_t) sqlite3_column_int64(stmt, 8);
+  st->ctime = (time_t) sqlite3_column_int64(stmt, 9);
+  st->mtime_nsec = (uint32_t) sqlite3_column_int64(stmt, 10);
+
+  if (sqlite3_column_type(stmt, 6) == SQLITE_NULL) {
+    rec->childcount = -1;
+  } else {
+    rec->childcount = sqlite3_column_int64(stmt, 6);
+  }
+
+  index->used += size;
+  index->count++;
+
+  return 0;
+}
+
+static int _csync_statedb_index_build(struct csync_statedb_index_s *index) {
+  size_t slots = 16;
+  size_t off;
+
+  while (slots < index->count * 2) {
+    slots *= 2;
+  }
+  index->mask = slots - 1;
+
+  index->by_hash = c_malloc(slots * sizeof(csync_file_stat_t *));
+  index->by_inode = c_malloc(slots * sizeof(csync_file_stat_t *));
+  if (index->by_hash == NULL || index->by_inode == NULL) {
+    return -1;
+  }
+
+  for (off = 0; off < index->used;) {
+    const csync_file_stat_t *st;
+    size_t i;
+
+    st = &((struct _csync_statedb_record_s *) (index->records + off))->st;
+    off += _CSYNC_STATEDB_RECORD_SIZE(st->pathlen);
+
+    /* paths with the same hash are all kept */
+    i = (size_t) st->phash & index->mask;
+    while (index->by_hash[i] != NULL) {
+      i = (i + 1) & index->mask;
+    }
+    index->by_hash[i] = st;
+
+    /*
+     * The rows are read by rowid, the first one with an inode is kept like
+     * in csync_statedb_get_stat_by_inode().
+     */
+    i = _csync_statedb_inode_slot(st->inode, index->mask);
+    while (index->by_inode[i] != NULL && index->by_inode[i]->inode != st->inode) {
+      i = (i + 1) & index->mask;
+    }
+    if (index->by_inode[i] == NULL) {
+      index->by_inode[i] = st;
+    }
+  }
+
+  return 0;
+}
+
+/* Find a record by hash, and by path if it isn't NULL */
+static const csync_file_stat_t *_csync_statedb_index_find(struct csync_statedb_index_s *index,
+    uint64_t phash, const char *path, size_t len) {
+  size_t i;
+
+  for (i = (size_t) phash & index->mask;
+       index->by_hash[i] != NULL;
+       i = (i + 1) & index->mask) {
+    const csync_file_stat_t *st = index->by_hash[i];
+
+    if (st->phash != phash) {
+      continue;
+    }
+    /* records have the whole path as name */
+    if (path == NULL ||
+        (st->pathlen == len && memcmp(st->name, path, len) == 0)) {
+      return st;
+    }
+  }
+
+  return NULL;
+}
+
+/* Link the records to the records of their parent directories */
+static void _csync_statedb_index_link_children(struct csync_statedb_index_s *index) {
+  size_t off;
+
+  for (off = 0; off < index->used;) {
+    struct _csync_statedb_record_s *rec;
+    struct _csync_statedb_record_s *parent;
+    const csync_file_stat_t *pst;
+    const char *slash;
+
+    rec = (struct _csync_statedb_record_s *) (index->records + off);
+    off += _CSYNC_STATEDB_RECORD_SIZE(rec->st.pathlen);
+
+    /* files in the top directory */
+    slash = strrchr(rec->st.name, '/');
+    if (slash == NULL) {
+      continue;
+    }
+
+    pst = _csync_statedb_index_find(index,
+        csync_path_hash(rec->st.name, slash - rec->st.name),
+        rec->st.name, slash - rec->st.name);
+    if (pst == NULL) {
+      continue;
+    }
+    parent = _CSYNC_STATEDB_RECORD(pst);
+    rec->sibling = parent->child;
+    parent->child = rec;
+    parent->nchildren++;
+  }
+
+  index->children = 1;
+}
+
+/* Read the whole metadata table into memory */
+static int _csync_statedb_index_load(CSYNC *ctx) {
+  struct csync_statedb_index_s *index = NULL;
+  sqlite3_stmt *stmt = NULL;
+  int rc = -1;
+  int err;
+
+  index = c_malloc(sizeof(struct csync_statedb_index_s));
+  if (index == NULL) {
+    return -1;
+  }
+
+  err = sqlite3_prepare_v2(ctx->statedb.db,
+      "SELECT path, inode, uid, gid, mode, modtime, childcount, checksum, "
+      "size, ctime, mtime_nsec FROM metadata;",
+      -1, &stmt, NULL);
+  if (err != SQLITE_OK) {
+    /* statedb written by an older version */
+    err = sqlite3_prepare_v2(ctx->statedb.db,
+        "SELECT path, inode, uid, gid, mode, modtime, NULL, 0, -1, 0, 0 "
+        "FROM metadata;",
+        -1, &stmt, NULL);
+  }
+  if (err != SQLITE_OK) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_prepare error: %s",
+        sqlite3_errmsg(ctx->statedb.db));
+    goto out;
+  }
+
+  while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char *path = (const char *) sqlite3_column_text(stmt, 0);
+    size_t len = sqlite3_column_bytes(stmt, 0);
+
+    if (path == NULL) {
+      continue;
+    }
+    if (_csync_statedb_index_add(ctx, index, path, len, stmt) < 0) {
+      goto out;
+    }
+  }
+
+  if (err != SQLITE_DONE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_step error: %s",
+        sqlite3_errmsg(ctx->statedb.db));
+    goto out;
+  }
+
+  if (_csync_statedb_index_build(index) < 0) {
+    goto out;
+  }
+
+  if (ctx->options.incremental_update) {
+    _csync_statedb_index_link_children(index);
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "Loaded %zu files of the statedb into memory (%zu bytes)",
+      index->count, index->used + 2 * (index->mask + 1) * sizeof(void *));
+
+  ctx->statedb.index = index;
+  index = NULL;
+  rc = 0;
+out:
+  sqlite3_finalize(stmt);
+  _csync_statedb_index_free(index);
+
+  return rc;
+}
+
+const csync_file_stat_t *csync_statedb_index_get_by_hash(CSYNC *ctx,
+    uint64_t phash) {
+  return csync_statedb_index_get_by_path(ctx, phash, NULL, 0);
+}
+
+const csync_file_stat_t *csync_statedb_index_get_by_path(CSYNC *ctx,
+    uint64_t phash, const char *path, size_t len) {
+  const csync_file_stat_t *st;
+
+  if (ctx->statedb.index == NULL) {
+    return NULL;
+  }
+
+  ctx->statedb.stats.hash_lookups++;
+  st = _csync_statedb_index_find(ctx->statedb.index, phash, path, len);
+  if (st != NULL) {
+    ctx->statedb.stats.hash_found++;
+  }
+
+  return st;
+}
+
+int csync_statedb_index_children_complete(CSYNC *ctx,
+    const csync_file_stat_t *dir) {
+  struct _csync_statedb_record_s *rec;
+
+  if (ctx->statedb.index == NULL || ! ctx->statedb.index->children) {
+    return 0;
+  }
+
+  rec = _CSYNC_STATEDB_RECORD(dir);
+  if (rec->childcount < 0) {
+    return 0;
+  }
+
+  return rec->childcount == rec->nchildren;
+}
+
+const csync_file_stat_t *csync_statedb_index_first_child(CSYNC *ctx,
+    const csync_file_stat_t *dir) {
+  struct _csync_statedb_record_s *rec;
+
+  if (ctx->statedb.index == NULL) {
+    return NULL;
+  }
+
+  rec = _CSYNC_STATEDB_RECORD(dir)->child;
+
+  return rec ? &rec->st : NULL;
+}
+
+const csync_file_stat_t *csync_statedb_index_next_child(CSYNC *ctx,
+    const csync_file_stat_t *child) {
+  struct _csync_statedb_record_s *rec;
+
+  if (ctx->statedb.index == NULL) {
+    return NULL;
+  }
+
+  rec = _CSYNC_STATEDB_RECORD(child)->sibling;
+
+  return rec ? &rec->st : NULL;
+}
+
+const csync_file_stat_t *csync_statedb_index_get_by_inode(CSYNC *ctx,
+    ino_t inode) {
+  struct csync_statedb_index_s *index = ctx->statedb.index;
+  size_t i;
+
+#ifdef _WIN32
+  /* no idea about inodes. */
+  return NULL;
+#endif
+
+  if (index == NULL) {
+    return NULL;
+  }
+
+  ctx->statedb.stats.inode_lookups++;
+  for (i = _csync_statedb_inode_slot(inode, index->mask);
+       index->by_inode[i] != NULL;
+       i = (i + 1) & index->mask) {
+    if (index->by_inode[i]->inode == inode) {
+      ctx->statedb.stats.inode_found++;
+      return index->by_inode[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void _csync_statedb_inode_map_free(struct csync_statedb_inode_map_s *map) {
+  if (map == NULL) {
+    return;
+  }
+
+  SAFE_FREE(map->entries);
+  SAFE_FREE(map);
+}
+
+/* Read the inodes of all rows of the metadata table in one pass */
+static struct csync_statedb_inode_map_s *_csync_statedb_inode_map_load(CSYNC *ctx) {
+  struct csync_statedb_inode_map_s *map = NULL;
+  sqlite3_stmt *stmt = NULL;
+  size_t size = 0;
+  int err;
+
+  map = c_malloc(sizeof(struct csync_statedb_inode_map_s));
+  if (map == NULL) {
+    return NULL;
+  }
+
+  err = sqlite3_prepare_v2(ctx->statedb.db,
+      "SELECT inode, rowid FROM metadata ORDER BY inode, rowid;",
+      -1, &stmt, NULL);
+  if (err != SQLITE_OK) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_prepare error: %s",
+        sqlite3_errmsg(ctx->statedb.db));
+    goto error;
+  }
+  ctx->statedb.stats.queries++;
+
+  while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (map->count == size) {
+      void *entries;
+
+      size = size ? size * 2 : 1024;
+      entries = c_realloc(map->entries, size * sizeof(map->entries[0]));
+      if (entries == NULL) {
+        goto error;
+      }
+      map->entries = entries;
+    }
+    map->entries[map->count].inode = (uint64_t) sqlite3_column_int64(stmt, 0);
+    map->entries[map->count].rowid = sqlite3_column_int64(stmt, 1);
+    map->count++;
+  }
+
+  if (err != SQLITE_DONE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_step error: %s",
+        sqlite3_errmsg(ctx->statedb.db));
+    goto error;
+  }
+  sqlite3_finalize(stmt);
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Loaded %zu inodes of the statedb",
+      map->count);
+
+  return map;
+error:
+  sqlite3_finalize(stmt);
+  _csync_statedb_inode_map_free(map);
+  return NULL;
+}
+
+/* Find the first row with the inode, 0 if there is none */
+static sqlite3_int64 _csync_statedb_inode_map_find(struct csync_statedb_inode_map_s *map,
+    uint64_t inode) {
+  size_t lo = 0;
+  size_t hi = map->count;
+
+  /* lower bound */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (map->entries[mid].inode < inode) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo < map->count && map->entries[lo].inode == inode) {
+    return map->entries[lo].rowid;
+  }
+
+  return 0;
+}
+
+static void _csync_statedb_checksums_free(struct csync_statedb_checksums_s *cache) {
+  if (cache == NULL) {
+    return;
+  }
+
+  SAFE_FREE(cache->entries);
+  SAFE_FREE(cache->slots);
+  SAFE_FREE(cache);
+}
+
+/* Read the checksum cache into memory, statedbs without it give an empty one */
+static int _csync_statedb_checksums_load(CSYNC *ctx) {
+  struct csync_statedb_checksums_s *cache = NULL;
+  sqlite3_stmt *stmt = NULL;
+  size_t size = 0;
+  size_t slots = 16;
+  size_t n;
+  int rc = -1;
+  int err;
+
+  cache = c_malloc(sizeof(struct csync_statedb_checksums_s));
+  if (cache == NULL) {
+    return -1;
+  }
+
+  err = sqlite3_prepare_v2(ctx->statedb.db,
+      "SELECT inode, size, modtime, ctime, checksum FROM checksum;",
+      -1, &stmt, NULL);
+  if (err == SQLITE_OK) {
+    ctx->statedb.stats.queries++;
+
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW) {
+      if (cache->count == size) {
+        void *entries;
+
+        size = size ? size * 2 : 1024;
+        entries = c_realloc(cache->entries, size * sizeof(cache->entries[0]));
+        if (entries == NULL) {
+          goto out;
+        }
+        cache->entries = entries;
+      }
+      n = cache->count++;
+      cache->entries[n].inode = (uint64_t) sqlite3_column_int64(stmt, 0);
+      cache->entries[n].size = sqlite3_column_int64(stmt, 1);
+      cache->entries[n].modtime = sqlite3_column_int64(stmt, 2);
+      cache->entries[n].ctime = sqlite3_column_int64(stmt, 3);
+      cache->entries[n].checksum = (uint64_t) sqlite3_column_int64(stmt, 4);
+    }
+
+    if (err != SQLITE_DONE) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "sqlite3_step error: %s",
+          sqlite3_errmsg(ctx->statedb.db));
+      goto out;
+    }
+  } else {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "statedb has no checksum cache");
+  }
+
+  while (slots < cache->count * 2) {
+    slots *= 2;
+  }
+  cache->mask = slots - 1;
+  cache->slots = c_malloc(slots * sizeof(uint32_t));
+  if (cache->slots == NULL) {
+    goto out;
+  }
+
+  /* the inode is the primary key of the table */
+  for (n = 0; n < cache->count; n++) {
+    size_t i = _csync_statedb_inode_slot(cache->entries[n].inode, cache->mask);
+
+    while (cache->slots[i] != 0) {
+      i = (i + 1) & cache->mask;
+    }
+    cache->slots[i] = n + 1;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Loaded %zu checksums of the statedb",
+      cache->count);
+
+  ctx->statedb.checksums = cache;
+  cache = NULL;
+  rc = 0;
+out:
+  sqlite3_finalize(stmt);
+  _csync_statedb_checksums_free(cache);
+
+  return rc;
+}
+
+int csync_statedb_checksum_get(CSYNC *ctx, const csync_file_stat_t *st,
+    uint64_t *checksum) {
+  struct csync_statedb_checksums_s *cache = ctx->statedb.checksums;
+  size_t i;
+
+  if (cache == NULL) {
+    return 0;
+  }
+
+  ctx->statedb.stats.checksum_lookups++;
+  for (i = _csync_statedb_inode_slot(st->inode, cache->mask);
+       cache->slots[i] != 0;
+       i = (i + 1) & cache->mask) {
+    const uint32_t n = cache->slots[i] - 1;
+
+    if (cache->entries[n].inode != (uint64_t) st->inode) {
+      continue;
+    }
+    /* the file changed since the checksum was computed */
+    if (cache->entries[n].size != (int64_t) st->size ||
+        cache->entries[n].modtime != (int64_t) st->modtime ||
+        cache->entries[n].ctime != (int64_t) st->ctime) {
+      return 0;
+    }
+    ctx->statedb.stats.checksum_hits++;
+    *checksum = cache->entries[n].checksum;
+    return 1;
+  }
+
+  return 0;
+}
+
+void csync_statedb_log_stats(CSYNC *ctx) {
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "statedb lookups: %zu by hash (%zu found), %zu by inode (%zu found), "
+      "%zu SQL queries",
+      ctx->statedb.stats.hash_lookups,
+      ctx->statedb.stats.hash_found,
+      ctx->statedb.stats.inode_lookups,
+      ctx->statedb.stats.inode_found,
+      ctx->statedb.stats.queries);
+
+  if (ctx->statedb.checksums != NULL) {
+    size_t lookups = ctx->statedb.stats.checksum_lookups;
+    size_t hits = ctx->statedb.stats.checksum_hits;
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "checksum cache: %zu lookups, %zu hits (%.1f%%)",
+        lookups, hits, lookups ? 100.0 * hits / lookups : 0.0);
+  }
+}
+
+/* sqlite function to recalculate the phash column */
+static void _csync_statedb_phash_func(sqlite3_context *sctx, int argc,
+    sqlite3_value **argv) {
+  const char *path = (const char *) sqlite3_value_text(argv[0]);
+
+  (void) argc;
+
+  if (path == NULL) {
+    sqlite3_result_null(sctx);
+    return;
+  }
+  sqlite3_result_int64(sctx,
+      (sqlite3_int64) csync_path_hash(path, sqlite3_value_bytes(argv[0])));
+}
+
+static int _csync_statedb_has_column(CSYNC *ctx, const char *column) {
+  sqlite3_stmt *stmt = NULL;
+  char *query;
+  int rc;
+
+  query = sqlite3_mprintf("SELECT %s FROM metadata LIMIT 0;", column);
+  if (query == NULL) {
+    return 0;
+  }
+  rc = sqlite3_prepare_v2(ctx->statedb.db, query, -1, &stmt, NULL);
+  sqlite3_finalize(stmt);
+  sqlite3_free(query);
+
+  return rc == SQLITE_OK;
+}
+
+/* Convert a statedb written by an older version */
+static int _csync_statedb_upgrade(CSYNC *ctx) {
+  static const struct {
+    int version;
+    const char *name;
+    const char *decl;
+  } columns[] = {
+    { 2, "childcount", "INTEGER DEFAULT -1" },
+    { 2, "checksum", "INTEGER(8) DEFAULT 0" },
+    { 3, "size", "INTEGER(8) DEFAULT -1" },
+    { 3, "ctime", "INTEGER(8) DEFAULT 0" },
+    { 3, "mtime_nsec", "INTEGER DEFAULT 0" },
+  };
+  c_strlist_t *result = NULL;
+  size_t i;
+  char *errmsg = NULL;
+  int version = 0;
+
+  result = csync_statedb_query(ctx, "PRAGMA user_version;");
+  if (result == NULL) {
+    return -1;
+  }
+  if (result->count > 0) {
+    version = atoi(result->vector[0]);
+  }
+  c_strlist_destroy(result);
+
+  if (version >= CSYNC_STATEDB_VERSION) {
+    return 0;
+  }
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "upgrading statedb from version %d to %d",
+      version, CSYNC_STATEDB_VERSION);
+
+  /* version 1: the phash is the xxhash64 of the path */
+  if (version < 1) {
+    if (sqlite3_create_function(ctx->statedb.db, "csync_phash", 1, SQLITE_UTF8,
+          NULL, _csync_statedb_phash_func, NULL, NULL) != SQLITE_OK) {
+      return -1;
+    }
+    if (sqlite3_exec(ctx->statedb.db,
+          "UPDATE metadata SET phash = csync_phash(path);",
+          NULL, NULL, &errmsg) != SQLITE_OK) {
+      goto err;
+    }
+  }
+
+  /* the columns added since, statedbs of version 1 may lack childcount */
+  for (i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+    char *stmt;
+    int err;
+
+    if (version >= columns[i].version ||
+        _csync_statedb_has_column(ctx, columns[i].name)) {
+      continue;
+    }
+    stmt = sqlite3_mprintf("ALTER TABLE metadata ADD COLUMN %s %s;",
+        columns[i].name, columns[i].decl);
+    if (stmt == NULL) {
+      return -1;
+    }
+    err = sqlite3_exec(ctx->statedb.db, stmt, NULL, NULL, &errmsg);
+    sqlite3_free(stmt);
+    if (err != SQLITE_OK) {
+      goto err;
+    }
+  }
+
+  if (sqlite3_exec(ctx->statedb.db,
+        "PRAGMA user_version = " CSYNC_STRINGIFY(CSYNC_STATEDB_VERSION) ";",
+        NULL, NULL, &errmsg) != SQLITE_OK) {
+    goto err;
+  }
+
+  return 0;
+err:
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "statedb upgrade failed: %s", errmsg);
+  sqlite3_free(errmsg);
+  return -1;
+}
+
 int csync_statedb_load(CSYNC *ctx, const char *statedb) {
   int rc = -1;
   c_strlist_t *result = NULL;
@@ -142,6 +911,22 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb) {
     csync_set_statedb_exists(ctx, 0);
   } else {
     csync_set_statedb_exists(ctx, 1);
+
+    if (_csync_statedb_upgrade(ctx) < 0) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+          "Unable to upgrade the statedb, ignoring it");
+      csync_set_statedb_exists(ctx, 0);
+    } else {
+      if (ctx->options.preload_statedb && _csync_statedb_index_load(ctx) < 0) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+            "Unable to load the statedb into memory, querying it instead");
+      }
+      /* loaded up front, the update threads only read it */
+      if (ctx->options.checksum && _csync_statedb_checksums_load(ctx) < 0) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+            "Unable to load the checksum cache, files are checksummed again");
+      }
+    }
   }
 
   /* optimization for speeding up SQLite */
@@ -180,6 +965,13 @@ int csync_statedb_close(CSYNC *ctx, const char *statedb, int jwritten) {
   /* close the temporary database */
   sqlite3_close(ctx->statedb.db);
 
+  _csync_statedb_index_free(ctx->statedb.index);
+  ctx->statedb.index = NULL;
+  _csync_statedb_inode_map_free(ctx->statedb.inodes);
+  ctx->statedb.inodes = NULL;
+  _csync_statedb_checksums_free(ctx->statedb.checksums);
+  ctx->statedb.checksums = NULL;
+
   if (asprintf(&statedb_tmp, "%s.ctmp", statedb) < 0) {
     return -1;
   }
@@ -215,7 +1007,12 @@ int csync_statedb_create_tables(CSYNC *ctx) {
       "gid INTEGER,"
       "mode INTEGER,"
       "modtime INTEGER(8),"
-      "PRIMARY KEY(phash)"
+      "childcount INTEGER DEFAULT -1,"
+      "checksum INTEGER(8) DEFAULT 0,"
+      "size INTEGER(8) DEFAULT -1,"
+      "ctime INTEGER(8) DEFAULT 0,"
+      "mtime_nsec INTEGER DEFAULT 0,"
+      "PRIMARY KEY(phash, path)"
       ");"
       );
 
@@ -234,7 +1031,41 @@ int csync_statedb_create_tables(CSYNC *ctx) {
       "gid INTEGER,"
       "mode INTEGER,"
       "modtime INTEGER(8),"
-      "PRIMARY KEY(phash)"
+      "childcount INTEGER DEFAULT -1,"
+      "checksum INTEGER(8) DEFAULT 0,"
+      "size INTEGER(8) DEFAULT -1,"
+      "ctime INTEGER(8) DEFAULT 0,"
+      "mtime_nsec INTEGER DEFAULT 0,"
+      "PRIMARY KEY(phash, path)"
+      ");"
+      );
+  if (result == NULL) {
+    return -1;
+  }
+  c_strlist_destroy(result);
+
+  /* checksums of the local files, see csync_statedb_checksum_get() */
+  result = csync_statedb_query(ctx,
+      "CREATE TEMPORARY TABLE IF NOT EXISTS checksum_temp("
+      "inode INTEGER(8) PRIMARY KEY,"
+      "size INTEGER(8),"
+      "modtime INTEGER(8),"
+      "ctime INTEGER(8),"
+      "checksum INTEGER(8)"
+      ");"
+      );
+  if (result == NULL) {
+    return -1;
+  }
+  c_strlist_destroy(result);
+
+  result = csync_statedb_query(ctx,
+      "CREATE TABLE IF NOT EXISTS checksum("
+      "inode INTEGER(8) PRIMARY KEY,"
+      "size INTEGER(8),"
+      "modtime INTEGER(8),"
+      "ctime INTEGER(8),"
+      "checksum INTEGER(8)"
       ");"
       );
   if (result == NULL) {
@@ -256,12 +1087,23 @@ int csync_statedb_create_tables(CSYNC *ctx) {
   }
   c_strlist_destroy(result);
 
+  result = csync_statedb_query(ctx,
+      "PRAGMA user_version = " CSYNC_STRINGIFY(CSYNC_STATEDB_VERSION) ";");
+  if (result == NULL) {
+    return -1;
+  }
+  c_strlist_destroy(result);
+
   return 0;
 }
 
 int csync_statedb_drop_tables(CSYNC *ctx) {
   c_strlist_t *result = NULL;
 
+  /* the rowids are gone with the table */
+  _csync_statedb_inode_map_free(ctx->statedb.inodes);
+  ctx->statedb.inodes = NULL;
+
   result = csync_statedb_query(ctx,
       "DROP TABLE IF EXISTS metadata;"
       );
@@ -270,17 +1112,218 @@ int csync_statedb_drop_tables(CSYNC *ctx) {
   }
   c_strlist_destroy(result);
 
+  result = csync_statedb_query(ctx,
+      "DROP TABLE IF EXISTS checksum;"
+      );
+  if (result == NULL) {
+    return -1;
+  }
+  c_strlist_destroy(result);
+
+  return 0;
+}
+
+/* A file of the local tree and the directory it is in */
+struct _csync_statedb_child_s {
+  uint64_t parent;
+  const csync_file_stat_t *st;
+  int written;
+};
+
+struct _csync_statedb_write_s {
+  CSYNC *ctx;
+  struct _csync_statedb_child_s *children;
+  size_t count;
+  size_t size;
+  int counted;
+};
+
+static int _csync_statedb_is_written(enum csync_instructions_e instruction) {
+  switch (instruction) {
+    case CSYNC_INSTRUCTION_NONE:
+    case CSYNC_INSTRUCTION_UPDATED:
+    case CSYNC_INSTRUCTION_CONFLICT:
+      return 1;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+static int _collect_children_visitor(void *obj, void *data) {
+  csync_file_stat_t *fs = (csync_file_stat_t *) obj;
+  struct _csync_statedb_write_s *w = (struct _csync_statedb_write_s *) data;
+  const char *slash = NULL;
+
+  /* files without a parent have their whole path as name */
+  if (fs->parent == NULL) {
+    slash = strrchr(fs->name, '/');
+    if (slash == NULL) {
+      return 0;
+    }
+  }
+
+  if (w->count == w->size) {
+    struct _csync_statedb_child_s *children;
+    size_t size = w->size ? w->size * 2 : 1024;
+
+    children = c_realloc(w->children, size * sizeof(struct _csync_statedb_child_s));
+    if (children == NULL) {
+      return -1;
+    }
+    w->children = children;
+    w->size = size;
+  }
+
+  if (fs->parent != NULL) {
+    w->children[w->count].parent = fs->parent->phash;
+  } else {
+    w->children[w->count].parent = csync_path_hash(fs->name,
+        slash - fs->name);
+  }
+  w->children[w->count].st = fs;
+  w->children[w->count].written = _csync_statedb_is_written(fs->instruction);
+  w->count++;
+
   return 0;
 }
 
+/* Check if a file is in a directory, its hash may only collide */
+static int _csync_statedb_is_child(const csync_file_stat_t *fs,
+    const csync_file_stat_t *dir) {
+  const char *slash;
+
+  if (fs->parent != NULL) {
+    return csync_file_stat_path_equal(fs->parent, dir);
+  }
+
+  slash = strrchr(fs->name, '/');
+
+  return csync_file_stat_path_is(dir, fs->name, slash - fs->name);
+}
+
+static int _csync_statedb_child_cmp(const void *a, const void *b) {
+  const struct _csync_statedb_child_s *x = a;
+  const struct _csync_statedb_child_s *y = b;
+
+  if (x->parent < y->parent) {
+    return -1;
+  } else if (x->parent > y->parent) {
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Get the number of children of a directory which can be trusted by the
+ * next incremental update detection, -1 if it can't be trusted.
+ */
+static int64_t _csync_statedb_childcount(struct _csync_statedb_write_s *w,
+    const csync_file_stat_t *fs) {
+  CSYNC *ctx = w->ctx;
+  const csync_file_stat_t *other = NULL;
+  size_t lo = 0;
+  size_t hi = w->count;
+  int64_t total = 0;
+  int64_t written = 0;
+
+  if (! w->counted || fs->type != CSYNC_FTW_TYPE_DIR) {
+    return -1;
+  }
+
+  /*
+   * A change in the same second as the update detection doesn't change the
+   * mtime of the directory.
+   */
+  if (fs->modtime + 1 >= ctx->local.update_start) {
+    return -1;
+  }
+
+  /* We have set the mtime of the directory */
+  other = csync_file_tree_find(ctx->remote.tree, fs);
+  if (other != NULL && other->instruction == CSYNC_INSTRUCTION_UPDATED) {
+    return -1;
+  }
+
+  /* lower bound */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (w->children[mid].parent < fs->phash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (; lo < w->count && w->children[lo].parent == fs->phash; lo++) {
+    if (! _csync_statedb_is_child(w->children[lo].st, fs)) {
+      continue;
+    }
+    total++;
+    written += w->children[lo].written;
+  }
+
+  return total == written ? written : -1;
+}
+
+/*
+ * Cache the checksum of a local file, even if it isn't written to the
+ * metadata table. Its content is checksummed again once it changes.
+ */
+static int _csync_statedb_insert_checksum(CSYNC *ctx, csync_file_stat_t *fs) {
+  char *stmt = NULL;
+  int rc;
+
+  if (fs->type != CSYNC_FTW_TYPE_FILE || fs->checksum == CSYNC_CHECKSUM_NONE) {
+    return 0;
+  }
+
+  switch (fs->instruction) {
+    case CSYNC_INSTRUCTION_DELETED:
+    case CSYNC_INSTRUCTION_REMOVE:
+    case CSYNC_INSTRUCTION_IGNORE:
+      return 0;
+    default:
+      break;
+  }
+
+  stmt = sqlite3_mprintf("INSERT OR REPLACE INTO checksum_temp "
+      "(inode, size, modtime, ctime, checksum) VALUES "
+      "(%lld, %lld, %lld, %lld, %lld);",
+      (long long int) fs->inode,
+      (long long int) fs->size,
+      (long long int) fs->modtime,
+      (long long int) fs->ctime,
+      (long long int) fs->checksum);
+  if (stmt == NULL) {
+    return -1;
+  }
+
+  rc = csync_statedb_insert(ctx, stmt);
+  sqlite3_free(stmt);
+
+  return rc > 0 ? 0 : -1;
+}
+
 static int _insert_metadata_visitor(void *obj, void *data) {
-  csync_file_stat_t *fs = NULL;
+  csync_file_stat_t *fs = (csync_file_stat_t *) obj;
+  struct _csync_statedb_write_s *w = NULL;
   CSYNC *ctx = NULL;
   char *stmt = NULL;
+  char path[fs->pathlen + 1];
+  int64_t childcount;
   int rc = -1;
 
-  fs = (csync_file_stat_t *) obj;
-  ctx = (CSYNC *) data;
+  w = (struct _csync_statedb_write_s *) data;
+  ctx = w->ctx;
+  csync_file_stat_path(fs, path);
+
+  if (ctx->options.checksum && _csync_statedb_insert_checksum(ctx, fs) < 0) {
+    return -1;
+  }
 
   switch (fs->instruction) {
     /*
@@ -296,33 +1339,48 @@ static int _insert_metadata_visitor(void *obj, void *data) {
     /* As we only sync the local tree we need this flag here */
     case CSYNC_INSTRUCTION_UPDATED:
     case CSYNC_INSTRUCTION_CONFLICT:
+      childcount = _csync_statedb_childcount(w, fs);
+
       CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
         "SQL statement: INSERT INTO metadata_temp \n"
-        "\t\t\t(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES \n"
-        "\t\t\t(%llu, %lu, %s, %llu, %u, %u, %u, %lu);",
-        (long long unsigned int) fs->phash,
+        "\t\t\t(phash, pathlen, path, inode, uid, gid, mode, modtime, childcount, checksum, "
+        "size, ctime, mtime_nsec) VALUES \n"
+        "\t\t\t(%lld, %lu, %s, %llu, %u, %u, %u, %lu, %lld, %lld, %lld, %lld, %u);",
+        (long long int) fs->phash,
         (long unsigned int) fs->pathlen,
-        fs->path,
+        path,
         (long long unsigned int) fs->inode,
-        fs->uid,
-        fs->gid,
+        csync_owner_uid(ctx, fs->owner),
+        csync_owner_gid(ctx, fs->owner),
         fs->mode,
-        fs->modtime);
+        fs->modtime,
+        (long long int) childcount,
+        (long long int) fs->checksum,
+        (long long int) fs->size,
+        (long long int) fs->ctime,
+        fs->mtime_nsec);
 
       /*
-       * The phash needs to be long long unsigned int or it segfaults on PPC
+       * The phash needs to be long long int or it segfaults on PPC. It is
+       * stored signed, sqlite would turn bigger numbers into floating point.
        */
       stmt = sqlite3_mprintf("INSERT INTO metadata_temp "
-        "(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES "
-        "(%llu, %lu, '%q', %llu, %u, %u, %u, %lu);",
-        (long long unsigned int) fs->phash,
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime, childcount, checksum, "
+        "size, ctime, mtime_nsec) VALUES "
+        "(%lld, %lu, '%q', %llu, %u, %u, %u, %lu, %lld, %lld, %lld, %lld, %u);",
+        (long long int) fs->phash,
         (long unsigned int) fs->pathlen,
-        fs->path,
+        path,
         (long long unsigned int) fs->inode,
-        fs->uid,
-        fs->gid,
+        csync_owner_uid(ctx, fs->owner),
+        csync_owner_gid(ctx, fs->owner),
         fs->mode,
-        fs->modtime);
+        fs->modtime,
+        (long long int) childcount,
+        (long long int) fs->checksum,
+        (long long int) fs->size,
+        (long long int) fs->ctime,
+        fs->mtime_nsec);
 
       if (stmt == NULL) {
         return -1;
@@ -335,7 +1393,7 @@ static int _insert_metadata_visitor(void *obj, void *data) {
     default:
       CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
           "file: %s, instruction: %s (%d), not added to statedb!",
-          fs->path, csync_instruction_str(fs->instruction), fs->instruction);
+          path, csync_instruction_str(fs->instruction), fs->instruction);
       rc = 1;
       break;
   }
@@ -344,9 +1402,29 @@ static int _insert_metadata_visitor(void *obj, void *data) {
 }
 
 int csync_statedb_insert_metadata(CSYNC *ctx) {
+  struct _csync_statedb_write_s w;
   c_strlist_t *result = NULL;
+  int rc;
 
-  if (c_rbtree_walk(ctx->local.tree, ctx, _insert_metadata_visitor) < 0) {
+  ZERO_STRUCT(w);
+  w.ctx = ctx;
+
+  /* count the children of the directories for incremental update detection */
+  if (ctx->options.incremental_update) {
+    if (c_htable_walk(ctx->local.tree, &w, _collect_children_visitor) < 0) {
+      SAFE_FREE(w.children);
+      return -1;
+    }
+    if (w.children != NULL) {
+      qsort(w.children, w.count, sizeof(struct _csync_statedb_child_s),
+          _csync_statedb_child_cmp);
+    }
+    w.counted = 1;
+  }
+
+  rc = c_htable_walk(ctx->local.tree, &w, _insert_metadata_visitor);
+  SAFE_FREE(w.children);
+  if (rc < 0) {
     return -1;
   }
 
@@ -361,112 +1439,192 @@ int csync_statedb_insert_metadata(CSYNC *ctx) {
 
   c_strlist_destroy(result);
 
+  if (csync_statedb_insert(ctx, "INSERT INTO checksum SELECT * FROM checksum_temp;") < 0) {
+    return -1;
+  }
+
+  result = csync_statedb_query(ctx, "DROP TABLE checksum_temp;");
+  if (result == NULL) {
+    return -1;
+  }
+
+  c_strlist_destroy(result);
+
   return 0;
 }
 
-/* caller must free the memory */
-csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx, uint64_t phash) {
+/* Create a file stat from a row of the metadata table */
+static csync_file_stat_t *_csync_statedb_stat_new(CSYNC *ctx,
+    c_strlist_t *result, const uint64_t *phash) {
   csync_file_stat_t *st = NULL;
-  c_strlist_t *result = NULL;
-  char *stmt = NULL;
-  size_t len = 0;
-
-  stmt = sqlite3_mprintf("SELECT * FROM metadata WHERE phash='%llu'",
-      (long long unsigned int) phash);
-  if (stmt == NULL) {
-    return NULL;
-  }
+  size_t len;
+  int owner;
 
-  result = csync_statedb_query(ctx, stmt);
-  sqlite3_free(stmt);
-  if (result == NULL) {
+  /*
+   * phash, pathlen, path, inode, uid, gid, mode, modtime, childcount,
+   * checksum, size, ctime, mtime_nsec
+   */
+  owner = csync_owner_id(ctx, atoi(result->vector[4]), atoi(result->vector[5]));
+  if (owner < 0) {
     return NULL;
   }
 
-  if (result->count <= 6) {
-    c_strlist_destroy(result);
-    return NULL;
-  }
-  /* phash, pathlen, path, inode, uid, gid, mode, modtime */
   len = strlen(result->vector[2]);
   st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
   if (st == NULL) {
-    c_strlist_destroy(result);
     return NULL;
   }
 
   /*
-   * FIXME:
-   * We use an INTEGER(8) which is signed to the phash in the sqlite3 db,
-   * but the phash is an uint64_t. So for some values we get a string like
-   * "1.66514565505016e+19". For such a string strtoull() returns 1.
-   * phash = 1
-   *
-   * st->phash = strtoull(result->vector[0], NULL, 10);
+   * Use the phash we queried for. Since version 1 of the statedb the column
+   * is reliable, before unsigned numbers which didn't fit into a signed
+   * 64bit integer were stored as floating point numbers.
    */
-
-   /* The query suceeded so use the phash we pass to the function. */
-  st->phash = phash;
-
+  if (phash != NULL) {
+    st->phash = *phash;
+  } else {
+    st->phash = (uint64_t) strtoll(result->vector[0], NULL, 10);
+  }
   st->pathlen = atoi(result->vector[1]);
-  memcpy(st->path, (len ? result->vector[2] : ""), len + 1);
+  memcpy(st->name, (len ? result->vector[2] : ""), len + 1);
   st->inode = atoi(result->vector[3]);
-  st->uid = atoi(result->vector[4]);
-  st->gid = atoi(result->vector[5]);
+  st->owner = owner;
   st->mode = atoi(result->vector[6]);
   st->modtime = strtoul(result->vector[7], NULL, 10);
+  if (result->count > 9 && result->vector[9] != NULL) {
+    st->checksum = (uint64_t) strtoll(result->vector[9], NULL, 10);
+  }
+  st->size = -1;
+  if (result->count > 12) {
+    if (result->vector[10] != NULL) {
+      st->size = (off_t) strtoll(result->vector[10], NULL, 10);
+    }
+    if (result->vector[11] != NULL) {
+      st->ctime = (time_t) strtoll(result->vector[11], NULL, 10);
+    }
+    if (result->vector[12] != NULL) {
+      st->mtime_nsec = (uint32_t) strtoul(result->vector[12], NULL, 10);
+    }
+  }
 
+  return st;
+}
+
+/* Query a file stat from the statedb, phash is NULL if it isn't known */
+static csync_file_stat_t *_csync_statedb_get_stat(CSYNC *ctx, char *stmt,
+    const uint64_t *phash) {
+  csync_file_stat_t *st = NULL;
+  c_strlist_t *result = NULL;
+
+  if (stmt == NULL) {
+    return NULL;
+  }
+
+  ctx->statedb.stats.queries++;
+  result = csync_statedb_query(ctx, stmt);
+  sqlite3_free(stmt);
+  if (result == NULL) {
+    return NULL;
+  }
+
+  if (result->count > 6) {
+    st = _csync_statedb_stat_new(ctx, result, phash);
+  }
   c_strlist_destroy(result);
 
   return st;
 }
 
+/* caller must free the memory */
+csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx, uint64_t phash) {
+  csync_file_stat_t *st = NULL;
+
+  ctx->statedb.stats.hash_lookups++;
+  st = _csync_statedb_get_stat(ctx,
+      sqlite3_mprintf("SELECT * FROM metadata WHERE phash=%lld",
+        (long long int) phash), &phash);
+  if (st != NULL) {
+    ctx->statedb.stats.hash_found++;
+  }
+
+  return st;
+}
+
+/* caller must free the memory */
+csync_file_stat_t *csync_statedb_get_stat_by_path(CSYNC *ctx, uint64_t phash,
+    const char *path) {
+  csync_file_stat_t *st = NULL;
+
+  ctx->statedb.stats.hash_lookups++;
+  st = _csync_statedb_get_stat(ctx,
+      sqlite3_mprintf("SELECT * FROM metadata WHERE phash=%lld AND path='%q'",
+        (long long int) phash, path), &phash);
+  if (st != NULL) {
+    ctx->statedb.stats.hash_found++;
+  }
+
+  return st;
+}
+
 /* caller must free the memory */
 csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx, ino_t inode) {
   csync_file_stat_t *st = NULL;
-  c_strlist_t *result = NULL;
   char *stmt = NULL;
-  size_t len = 0;
 
 #ifdef _WIN32
   /* no idea about inodes. */
   return st;
 #endif
 
-  stmt = sqlite3_mprintf("SELECT * FROM metadata WHERE inode='%llu'", inode);
-  if (stmt == NULL) {
-    return NULL;
+  ctx->statedb.stats.inode_lookups++;
+
+  /* most files are not renamed, so ask the inode map first */
+  if (ctx->statedb.inodes == NULL) {
+    ctx->statedb.inodes = _csync_statedb_inode_map_load(ctx);
   }
 
-  result = csync_statedb_query(ctx, stmt);
-  sqlite3_free(stmt);
-  if (result == NULL) {
-    return NULL;
+  if (ctx->statedb.inodes != NULL) {
+    sqlite3_int64 rowid;
+
+    rowid = _csync_statedb_inode_map_find(ctx->statedb.inodes, inode);
+    if (rowid == 0) {
+      return NULL;
+    }
+    stmt = sqlite3_mprintf("SELECT * FROM metadata WHERE rowid=%lld",
+        (long long int) rowid);
+  } else {
+    stmt = sqlite3_mprintf("SELECT * FROM metadata WHERE inode='%llu'", inode);
+  }
+
+  st = _csync_statedb_get_stat(ctx, stmt, NULL);
+  if (st != NULL) {
+    ctx->statedb.stats.inode_found++;
   }
 
-  if (result->count <= 6) {
-    c_strlist_destroy(result);
+  return st;
+}
+
+/* caller must free the memory */
+csync_file_stat_t *csync_statedb_get_renamed(CSYNC *ctx, ino_t inode) {
+  const csync_file_stat_t *rec;
+  csync_file_stat_t *st;
+
+  if (ctx->statedb.index == NULL) {
+    return csync_statedb_get_stat_by_inode(ctx, inode);
+  }
+
+  rec = csync_statedb_index_get_by_inode(ctx, inode);
+  if (rec == NULL) {
     return NULL;
   }
 
-  /* phash, pathlen, path, inode, uid, gid, mode, modtime */
-  len = strlen(result->vector[2]);
-  st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
+  /* records have the whole path as name */
+  st = c_malloc(sizeof(csync_file_stat_t) + rec->pathlen + 1);
   if (st == NULL) {
-    c_strlist_destroy(result);
     return NULL;
   }
-
-  st->phash = strtoull(result->vector[0], NULL, 10);
-  st->pathlen = atoi(result->vector[1]);
-  memcpy(st->path, (len ? result->vector[2] : ""), len + 1);
-  st->inode = atoi(result->vector[3]);
-  st->uid = atoi(result->vector[4]);
-  st->gid = atoi(result->vector[5]);
-  st->mode = atoi(result->vector[6]);
-  st->modtime = strtoul(result->vector[7], NULL, 10);
-
-  c_strlist_destroy(result);
+  memcpy(st, rec, sizeof(csync_file_stat_t) + rec->pathlen);
+  st->name[rec->pathlen] = '\0';
 
   return st;
 }
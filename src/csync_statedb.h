@@ -59,8 +59,171 @@ int csync_statedb_close(CSYNC *ctx, const char *statedb, int jwritten);
 
 csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx, uint64_t phash);
 
+/**
+ * @brief Query a file by its hash and path.
+ *
+ * Unlike csync_statedb_get_stat_by_hash() it doesn't return another file
+ * with the same hash.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param phash         The hash of the path, see csync_path_hash().
+ *
+ * @param path          The path of the file.
+ *
+ * @return The file stat, NULL if it isn't in the statedb. The caller has to
+ *         free it.
+ */
+csync_file_stat_t *csync_statedb_get_stat_by_path(CSYNC *ctx, uint64_t phash,
+    const char *path);
+
+/**
+ * @brief Look up a file in the in-memory index of the statedb.
+ *
+ * The index is built by csync_statedb_load() if the preload_statedb option
+ * is set and lives until csync_statedb_close().
+ *
+ * @param ctx           The csync context.
+ *
+ * @param phash         The hash of the path of the file.
+ *
+ * @return The record of the file, NULL if it isn't in the index or there is
+ *         no index. The memory is owned by the index.
+ */
+const csync_file_stat_t *csync_statedb_index_get_by_hash(CSYNC *ctx,
+    uint64_t phash);
+
+/**
+ * @brief Look up a file by its hash and path in the in-memory index.
+ *
+ * Like csync_statedb_index_get_by_hash(), but it doesn't return another
+ * file with the same hash.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param phash         The hash of the path, see csync_path_hash().
+ *
+ * @param path          The path of the file.
+ *
+ * @param len           The length of the path.
+ *
+ * @return The record of the file, NULL if it isn't in the index or there is
+ *         no index. The memory is owned by the index.
+ */
+const csync_file_stat_t *csync_statedb_index_get_by_path(CSYNC *ctx,
+    uint64_t phash, const char *path, size_t len);
+
+/**
+ * @brief Check if the index contains all children of a directory.
+ *
+ * The children of directories are only linked in the index if the
+ * incremental_update option is set.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param dir           The directory from the index.
+ *
+ * @return 1 if the index contains the same children as the directory had
+ *         when the statedb was written, 0 otherwise.
+ */
+int csync_statedb_index_children_complete(CSYNC *ctx,
+    const csync_file_stat_t *dir);
+
+/**
+ * @brief Get the first child of a directory in the index.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param dir           The directory from the index.
+ *
+ * @return The first child, NULL if there are no children.
+ */
+const csync_file_stat_t *csync_statedb_index_first_child(CSYNC *ctx,
+    const csync_file_stat_t *dir);
+
+/**
+ * @brief Get the next child of a directory in the index.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param child         The previous child from the index.
+ *
+ * @return The next child, NULL if there are no more children.
+ */
+const csync_file_stat_t *csync_statedb_index_next_child(CSYNC *ctx,
+    const csync_file_stat_t *child);
+
+/**
+ * @brief Look up a file by inode in the in-memory index of the statedb.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param inode         The inode of the file.
+ *
+ * @return The record of the file, NULL if it isn't in the index or there is
+ *         no index. The memory is owned by the index.
+ */
+const csync_file_stat_t *csync_statedb_index_get_by_inode(CSYNC *ctx,
+    ino_t inode);
+
+/**
+ * @brief Get the first file with the inode from the statedb.
+ *
+ * On the first call, a map of all inodes in the statedb is built in one
+ * pass. Inodes which are not in the map are answered without a query.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param inode         The inode of the file.
+ *
+ * @return A newly allocated file stat, NULL if not found. The caller must
+ *         free the memory.
+ */
 csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx, ino_t inode);
 
+/**
+ * @brief Get the record a renamed file had in the statedb.
+ *
+ * The file is looked up by inode in the index if the statedb is loaded into
+ * memory, else in the statedb, like in the update detection. The path of
+ * the record is the path before the file was renamed.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param inode         The inode of the renamed file.
+ *
+ * @return A newly allocated file stat, NULL if not found. The caller must
+ *         free the memory.
+ */
+csync_file_stat_t *csync_statedb_get_renamed(CSYNC *ctx, ino_t inode);
+
+/**
+ * @brief Get the cached checksum of a local file.
+ *
+ * The checksums of the local files are written to the statedb with the
+ * inode, size, mtime and ctime of the file. The cache is loaded with the
+ * statedb if checksums are enabled and never changed afterwards, so it can
+ * be used by several threads.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param st            The file stat of the local file.
+ *
+ * @param checksum      A pointer to store the checksum.
+ *
+ * @return 1 if the checksum is cached for the current inode, size, mtime and
+ *         ctime of the file, 0 if it has to be computed.
+ */
+int csync_statedb_checksum_get(CSYNC *ctx, const csync_file_stat_t *st,
+    uint64_t *checksum);
+
+/**
+ * @brief Log how many lookups were done in the statedb.
+ *
+ * @param ctx           The csync context.
+ */
+void csync_statedb_log_stats(CSYNC *ctx);
+
 /**
  * @brief A generic statedb query.
  *
@@ -24,63 +24,138 @@
 #define _GNU_SOURCE
 #endif
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "c_lib.h"
-#include "c_jhash.h"
 
 #include "csync_private.h"
+#include "csync_checksum.h"
 #include "csync_exclude.h"
 #include "csync_statedb.h"
 #include "csync_update.h"
 #include "csync_util.h"
+#ifndef _WIN32
+#include "csync_watch.h"
+#endif
 
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.updater"
 #include "csync_log.h"
 
-static int _csync_detect_update(CSYNC *ctx, const char *file,
+/*
+ * Quick check of a file against its record in the statedb. A newer mtime or
+ * another size is a change of the content. If only the ctime changed, the
+ * mode or owner may have changed, they are synced without the content.
+ *
+ * The statedb has the ctime and the nanoseconds of the mtime of the local
+ * files, the records written before they were added have no ctime.
+ */
+static enum csync_instructions_e _csync_detect_change(csync_walk_t *walk,
+    const csync_vio_file_stat_t *fs, const csync_file_stat_t *tmp,
+    enum csync_ftw_type_e type) {
+  CSYNC *ctx = walk->ctx;
+
+  if (fs->mtime > tmp->modtime) {
+    return CSYNC_INSTRUCTION_EVAL;
+  }
+  if (type != CSYNC_FTW_TYPE_FILE) {
+    return CSYNC_INSTRUCTION_NONE;
+  }
+  /* the size of files written before it was recorded is unknown */
+  if (tmp->size >= 0 && fs->size != tmp->size) {
+    return CSYNC_INSTRUCTION_EVAL;
+  }
+
+  if (walk->current != LOCAL_REPLICA || tmp->ctime == 0 || fs->ctime == 0) {
+    return CSYNC_INSTRUCTION_NONE;
+  }
+  /* modified in the second of the last synchronization */
+  if (fs->mtime == tmp->modtime && fs->mtime_nsec > (long) tmp->mtime_nsec) {
+    return CSYNC_INSTRUCTION_EVAL;
+  }
+  if (fs->ctime != tmp->ctime &&
+      (fs->mode != tmp->mode ||
+       fs->uid != csync_owner_uid(ctx, tmp->owner) ||
+       fs->gid != csync_owner_gid(ctx, tmp->owner))) {
+    return CSYNC_INSTRUCTION_METADATA;
+  }
+
+  return CSYNC_INSTRUCTION_NONE;
+}
+
+static int _csync_detect_update(csync_walk_t *walk, const char *file,
     const csync_vio_file_stat_t *fs, const int type) {
+  CSYNC *ctx = walk->ctx;
   uint64_t h = 0;
   size_t len = 0;
   size_t size = 0;
+  size_t dirlen = 0;
   const char *path = NULL;
+  const char *name = NULL;
+  const char *slash = NULL;
+  c_xxhash64_state_t hstate;
+  int owner;
+  const csync_file_stat_t *parent = NULL;
   csync_file_stat_t *st = NULL;
-  csync_file_stat_t *tmp = NULL;
+  const csync_file_stat_t *tmp = NULL;
+  csync_file_stat_t *dbst = NULL;
 
   if ((file == NULL) || (fs == NULL)) {
     errno = EINVAL;
     return -1;
   }
 
-  path = file;
-  switch (ctx->current) {
-    case LOCAL_REPLICA:
-      if (strlen(path) <= strlen(ctx->local.uri)) {
-        return -1;
-      }
-      path += strlen(ctx->local.uri) + 1;
-      break;
-    case REMOTE_REPLICA:
-      if (strlen(path) <= strlen(ctx->remote.uri)) {
-        return -1;
-      }
-      path += strlen(ctx->remote.uri) + 1;
-      break;
-    default:
-      path = NULL;
-      return -1;
-      break;
+  len = walk->urilen;
+  /* the uri is a prefix of the file, no need to look past it */
+  if (strnlen(file, len + 1) <= len) {
+    return -1;
   }
+  path = file + len + 1;
   len = strlen(path);
 
-  h = c_jhash64((uint8_t *) path, len, 0);
-  size = sizeof(csync_file_stat_t) + len + 1;
+  /*
+   * The files of a directory follow each other, continue from the hash of
+   * the directory of the last file if it's the same.
+   */
+  slash = strrchr(path, '/');
+  dirlen = slash != NULL ? (size_t) (slash - path) : 0;
+  parent = walk->parent;
+  if (parent != NULL && csync_file_stat_path_is(parent, path, dirlen)) {
+    hstate = walk->parent_state;
+  } else {
+    c_xxhash64_reset(&hstate, 0);
+    c_xxhash64_update(&hstate, path, dirlen);
+    parent = NULL;
+
+    /* only store the name if the directory is in the tree */
+    if (slash != NULL) {
+      parent = csync_file_tree_find_path(walk->tree,
+          c_xxhash64_digest(&hstate), path, dirlen);
+
+      if (parent != NULL) {
+        walk->parent = parent;
+        walk->parent_state = hstate;
+      }
+    }
+  }
+  c_xxhash64_update(&hstate, path + dirlen, len - dirlen);
+  h = c_xxhash64_digest(&hstate);
+
+  name = parent != NULL ? slash + 1 : path;
+  size = sizeof(csync_file_stat_t) + len - (name - path);
 
-  st = c_malloc(size);
+  st = c_arena_alloc(walk->arena, size);
   if (st == NULL) {
     return -1;
   }
@@ -89,6 +164,7 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
 
   /* Set instruction by default to none */
   st->instruction = CSYNC_INSTRUCTION_NONE;
+  st->checksum = CSYNC_CHECKSUM_NONE;
 
   /* check hardlink count */
   if (type == CSYNC_FTW_TYPE_FILE && fs->nlink > 1) {
@@ -98,19 +174,24 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
 
   /* Update detection */
   if (csync_get_statedb_exists(ctx)) {
-    tmp = csync_statedb_get_stat_by_hash(ctx, h);
-    if (tmp && tmp->phash == h) {
-      /* we have an update! */
-      if (fs->mtime > tmp->modtime) {
-        st->instruction = CSYNC_INSTRUCTION_EVAL;
-        goto out;
-      }
-      st->instruction = CSYNC_INSTRUCTION_NONE;
+    if (ctx->statedb.index != NULL) {
+      tmp = csync_statedb_index_get_by_path(ctx, h, path, len);
+    } else {
+      tmp = dbst = csync_statedb_get_stat_by_path(ctx, h, path);
+    }
+    if (tmp != NULL) {
+      /* kept for the statedb, compared if the file is modified */
+      st->checksum = tmp->checksum;
+      st->instruction = _csync_detect_change(walk, fs, tmp, type);
     } else {
       /* check if the file has been renamed */
-      if (ctx->current == LOCAL_REPLICA) {
-        free(tmp);
-        tmp = csync_statedb_get_stat_by_inode(ctx, fs->inode);
+      if (walk->current == LOCAL_REPLICA) {
+        SAFE_FREE(dbst);
+        if (ctx->statedb.index != NULL) {
+          tmp = csync_statedb_index_get_by_inode(ctx, fs->inode);
+        } else {
+          tmp = dbst = csync_statedb_get_stat_by_inode(ctx, fs->inode);
+        }
         if (tmp && tmp->inode == fs->inode) {
           /* inode found so the file has been renamed */
           st->instruction = CSYNC_INSTRUCTION_RENAME;
@@ -129,49 +210,87 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
   }
 
 out:
-  SAFE_FREE(tmp);
+  SAFE_FREE(dbst);
   st->inode = fs->inode;
   st->mode = fs->mode;
   st->size = fs->size;
   st->modtime = fs->mtime;
-  st->uid = fs->uid;
-  st->gid = fs->gid;
-  st->nlink = fs->nlink;
+  st->mtime_nsec = fs->mtime_nsec;
+  st->ctime = fs->ctime;
   st->type = type;
+  st->incomplete = 0;
+
+  owner = csync_owner_id(ctx, fs->uid, fs->gid);
+  if (owner < 0) {
+    return -1;
+  }
+  st->owner = owner;
 
   st->phash = h;
   st->pathlen = len;
-  memcpy(st->path, (len ? path : ""), len + 1);
+  st->parent = parent;
+  memcpy(st->name, name, len - (name - path));
 
-  switch (ctx->current) {
-    case LOCAL_REPLICA:
-      if (c_rbtree_insert(ctx->local.tree, (void *) st) < 0) {
-        SAFE_FREE(st);
-        return -1;
-      }
-      break;
-    case REMOTE_REPLICA:
-      if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
-        SAFE_FREE(st);
-        return -1;
-      }
-      break;
-    default:
-      break;
+  /* st is freed with the arena */
+  if (c_htable_insert(walk->tree, st->phash, st) < 0) {
+    return -1;
   }
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "file: %s, instruction: %s", st->path,
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "file: %s, instruction: %s", path,
       csync_instruction_str(st->instruction));
 
   return 0;
 }
 
-int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
-    enum csync_ftw_flags_e flag) {
+void csync_walk_init(csync_walk_t *walk, CSYNC *ctx,
+    enum csync_replica_e current) {
+  ZERO_STRUCTP(walk);
+
+  walk->ctx = ctx;
+  walk->current = current;
+  if (current == LOCAL_REPLICA) {
+    walk->replica = ctx->local.type;
+    walk->uri = ctx->local.uri;
+    walk->tree = ctx->local.tree;
+    walk->arena = ctx->local.arena;
+  } else {
+    walk->replica = ctx->remote.type;
+    walk->uri = ctx->remote.uri;
+    walk->tree = ctx->remote.tree;
+    walk->arena = ctx->remote.arena;
+  }
+  walk->urilen = walk->uri != NULL ? strlen(walk->uri) : 0;
+}
+
+/*
+ * Mark a directory of the tree whose contents have been skipped in part by
+ * the walk, so it isn't removed as a whole with the files in it. The root of
+ * the replica isn't in the tree. The walker lock has to be held.
+ */
+static void _csync_walk_incomplete(csync_walk_t *walk, const char *dir,
+    size_t len) {
+  csync_file_stat_t *st = NULL;
+  const char *path = NULL;
+
+  if (len <= walk->urilen) {
+    return;
+  }
+  path = dir + walk->urilen + 1;
+  len -= walk->urilen + 1;
+
+  st = csync_file_tree_find_path(walk->tree, csync_path_hash(path, len),
+      path, len);
+  if (st != NULL) {
+    st->incomplete = 1;
+  }
+}
+
+int csync_walker(csync_walk_t *walk, const char *file,
+    const csync_vio_file_stat_t *fs, enum csync_ftw_flags_e flag) {
   switch (flag) {
     case CSYNC_FTW_FLAG_FILE:
       CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "file: %s", file);
 
-      return _csync_detect_update(ctx, file, fs, CSYNC_FTW_TYPE_FILE);
+      return _csync_detect_update(walk, file, fs, CSYNC_FTW_TYPE_FILE);
       break;
     case CSYNC_FTW_FLAG_SLINK:
       /* FIXME: implement support for symlinks, see csync_propagate.c too */
@@ -179,14 +298,14 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
       if (ctx->options.sync_symbolic_links) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "symlink: %s", file);
 
-        return _csync_detect_update(ctx, file, fs, CSYNC_FTW_TYPE_SLINK);
+        return _csync_detect_update(walk, file, fs, CSYNC_FTW_TYPE_SLINK);
       }
 #endif
       break;
     case CSYNC_FTW_FLAG_DIR: /* enter directory */
       CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "directory: %s", file);
 
-      return _csync_detect_update(ctx, file, fs, CSYNC_FTW_TYPE_DIR);
+      return _csync_detect_update(walk, file, fs, CSYNC_FTW_TYPE_DIR);
     case CSYNC_FTW_FLAG_NSTAT: /* not statable file */
     case CSYNC_FTW_FLAG_DNR:
     case CSYNC_FTW_FLAG_DP:
@@ -196,18 +315,509 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
       break;
   }
 
+  /* the file isn't in the tree, but still in its directory */
+  _csync_walk_incomplete(walk, file, strrchr(file, '/') - file);
+
+  return 0;
+}
+
+/* Map the type of a directory entry to a walker flag */
+static int _csync_ftw_flag(const csync_vio_file_stat_t *fs) {
+  int flag;
+
+  switch (fs->type) {
+    case CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK:
+      flag = CSYNC_FTW_FLAG_SLINK;
+      break;
+    case CSYNC_VIO_FILE_TYPE_DIRECTORY:
+      flag = CSYNC_FTW_FLAG_DIR;
+      break;
+    case CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE:
+    case CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE:
+    case CSYNC_VIO_FILE_TYPE_SOCKET:
+      flag = CSYNC_FTW_FLAG_SPEC;
+      break;
+    case CSYNC_VIO_FILE_TYPE_FIFO:
+      flag = CSYNC_FTW_FLAG_SPEC;
+      break;
+    default:
+      flag = CSYNC_FTW_FLAG_FILE;
+      break;
+  };
+
+  return flag;
+}
+
+/* Stat a directory entry and map its type to a walker flag */
+static int _csync_ftw_stat(csync_walk_t *walk, const char *filename,
+    csync_vio_file_stat_t *fs) {
+  if (csync_vio_stat_replica(walk->ctx, walk->replica, filename, fs) < 0) {
+    return CSYNC_FTW_FLAG_NSTAT;
+  }
+
+  return _csync_ftw_flag(fs);
+}
+
+/* Check if readdir returned all the walker needs to know about an entry */
+static int _csync_ftw_dirent_complete(const csync_vio_file_stat_t *dirent) {
+  if (! (dirent->fields & CSYNC_VIO_FILE_STAT_FIELDS_TYPE)) {
+    return 0;
+  }
+
+  switch (dirent->type) {
+    case CSYNC_VIO_FILE_TYPE_REGULAR:
+    case CSYNC_VIO_FILE_TYPE_DIRECTORY:
+    case CSYNC_VIO_FILE_TYPE_UNKNOWN:
+      return (dirent->fields & CSYNC_VIO_FILE_STAT_FIELDS_UPDATE) ==
+        CSYNC_VIO_FILE_STAT_FIELDS_UPDATE;
+    default:
+      /* the walker function ignores it */
+      return 1;
+  }
+}
+
+/* Get the path relative to the replica we are walking */
+static const char *_csync_ftw_relpath(csync_walk_t *walk,
+    const char *filename) {
+  return filename + walk->urilen + 1;
+}
+
+/* Mark a directory whose contents are skipped in part, see csync_walker() */
+static void _csync_ftw_incomplete(csync_walk_t *walk, const char *dir,
+    size_t len) {
+#ifdef HAVE_PTHREAD
+  if (walk->lock != NULL) {
+    pthread_mutex_lock(walk->lock);
+  }
+#endif
+  _csync_walk_incomplete(walk, dir, len);
+#ifdef HAVE_PTHREAD
+  if (walk->lock != NULL) {
+    pthread_mutex_unlock(walk->lock);
+  }
+#endif
+}
+
+/*
+ * Check if the walk has to descend into an entry. Directories whose contents
+ * are excluded as a whole are not read at all. Otherwise dir is set to the
+ * exclude patterns which can still match in the directory.
+ */
+static int _csync_ftw_descend(csync_walk_t *walk,
+    const csync_exclude_dir_t *parent, const char *filename, int flag,
+    unsigned int depth, csync_exclude_dir_t **dir) {
+  int rc;
+
+  *dir = NULL;
+  if (flag != CSYNC_FTW_FLAG_DIR) {
+    return 0;
+  }
+  if (depth == 0) {
+    /* past the maximum depth */
+    _csync_ftw_incomplete(walk, filename, strlen(filename));
+    return 0;
+  }
+
+  rc = csync_exclude_dir_enter(walk->ctx, parent,
+      _csync_ftw_relpath(walk, filename), dir);
+  if (rc < 0) {
+    return -1;
+  }
+  if (rc > 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s: contents excluded",
+        _csync_ftw_relpath(walk, filename));
+    _csync_ftw_incomplete(walk, filename, strlen(filename));
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Check if a local directory is unchanged since the last synchronization, so
+ * the children recorded in the statedb can be used instead of reading it.
+ * The change journal of a running watcher takes precedence over the mtime.
+ */
+static const csync_file_stat_t *_csync_ftw_unchanged_dir(csync_walk_t *walk,
+    const char *filename, const csync_vio_file_stat_t *fs) {
+  CSYNC *ctx = walk->ctx;
+  const csync_file_stat_t *dir = NULL;
+  const char *path = NULL;
+  size_t len;
+  int changed = -1;
+
+  if (! ctx->options.incremental_update || walk->current != LOCAL_REPLICA ||
+      ctx->statedb.index == NULL) {
+    return NULL;
+  }
+
+  path = _csync_ftw_relpath(walk, filename);
+#ifndef _WIN32
+  changed = csync_watch_journal_changed(ctx, path);
+#endif
+  if (changed > 0) {
+    return NULL;
+  }
+
+  if (changed < 0 && ! (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_MTIME)) {
+    return NULL;
+  }
+
+  len = strlen(path);
+  dir = csync_statedb_index_get_by_path(ctx, csync_path_hash(path, len),
+      path, len);
+  if (dir == NULL || ! S_ISDIR(dir->mode)) {
+    return NULL;
+  }
+
+  if (changed < 0 && dir->modtime != fs->mtime) {
+    return NULL;
+  }
+
+  if (! csync_statedb_index_children_complete(ctx, dir)) {
+    return NULL;
+  }
+
+  return dir;
+}
+
+/*
+ * Call the walker function for an entry, with the lock shared with other
+ * walks held. If the entry is a directory, unchanged is set to its statedb
+ * record if it has not changed since the last synchronization.
+ */
+static int _csync_ftw_call(csync_walk_t *walk, csync_walker_fn fn,
+    const char *filename, const csync_vio_file_stat_t *fs, int flag,
+    const csync_file_stat_t **unchanged) {
+  int rc;
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "walk: %s", filename);
+
+#ifdef HAVE_PTHREAD
+  if (walk->lock != NULL) {
+    pthread_mutex_lock(walk->lock);
+  }
+#endif
+  rc = fn(walk, filename, fs, flag);
+  *unchanged = NULL;
+  if (rc == 0 && flag == CSYNC_FTW_FLAG_DIR) {
+    *unchanged = _csync_ftw_unchanged_dir(walk, filename, fs);
+  }
+#ifdef HAVE_PTHREAD
+  if (walk->lock != NULL) {
+    pthread_mutex_unlock(walk->lock);
+  }
+#endif
+
+  return rc;
+}
+
+/*
+ * Fill the stat of a file of an unchanged directory from the statedb.
+ * Directories are stat'ed, their mtime tells if they have changed.
+ */
+static int _csync_ftw_stat_record(csync_walk_t *walk, const char *filename,
+    const csync_file_stat_t *st, csync_vio_file_stat_t *fs) {
+  if (S_ISDIR(st->mode)) {
+    return _csync_ftw_stat(walk, filename, fs);
+  }
+
+  fs->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+  fs->mode = st->mode;
+  fs->inode = st->inode;
+  /* the owners grow while files are added, maybe by another walk */
+#ifdef HAVE_PTHREAD
+  if (walk->lock != NULL) {
+    pthread_mutex_lock(walk->lock);
+  }
+#endif
+  fs->uid = csync_owner_uid(walk->ctx, st->owner);
+  fs->gid = csync_owner_gid(walk->ctx, st->owner);
+#ifdef HAVE_PTHREAD
+  if (walk->lock != NULL) {
+    pthread_mutex_unlock(walk->lock);
+  }
+#endif
+  fs->mtime = st->modtime;
+  fs->mtime_nsec = st->mtime_nsec;
+  fs->ctime = st->ctime;
+  /* files with hardlinks are not written to the statedb */
+  fs->nlink = 1;
+  fs->fields = CSYNC_VIO_FILE_STAT_FIELDS_TYPE |
+    CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS |
+    CSYNC_VIO_FILE_STAT_FIELDS_INODE |
+    CSYNC_VIO_FILE_STAT_FIELDS_UID |
+    CSYNC_VIO_FILE_STAT_FIELDS_GID |
+    CSYNC_VIO_FILE_STAT_FIELDS_MTIME |
+    CSYNC_VIO_FILE_STAT_FIELDS_CTIME |
+    CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
+  if (st->size >= 0) {
+    fs->size = st->size;
+    fs->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+  }
+
+  return CSYNC_FTW_FLAG_FILE;
+}
+
+/* Walk the children of an unchanged directory recorded in the statedb */
+static int _csync_ftw_reuse(csync_walk_t *walk, const char *uri,
+    const csync_file_stat_t *dir, csync_walker_fn fn, unsigned int depth) {
+  CSYNC *ctx = walk->ctx;
+  csync_exclude_dir_t *exclude = walk->exclude;
+  const csync_file_stat_t *child = NULL;
+  const csync_file_stat_t *subdir = NULL;
+  csync_vio_file_stat_t *fs = NULL;
+  char *filename = NULL;
+  int flag;
+  int rc = 0;
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "unchanged directory: %s", uri);
+
+  for (child = csync_statedb_index_first_child(ctx, dir);
+       child != NULL;
+       child = csync_statedb_index_next_child(ctx, child)) {
+    /* Check if file is excluded */
+    if (csync_excluded_below(ctx, exclude, child->name)) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded", child->name);
+      _csync_ftw_incomplete(walk, uri, strlen(uri));
+      continue;
+    }
+
+    /* records of the statedb have the whole path as name */
+    if (asprintf(&filename, "%s/%s", uri, child->name + dir->pathlen + 1) < 0) {
+      return -1;
+    }
+
+    fs = csync_vio_file_stat_new();
+    if (fs == NULL) {
+      rc = -1;
+      break;
+    }
+    flag = _csync_ftw_stat_record(walk, filename, child, fs);
+
+    /* Call walker function for each file */
+    rc = _csync_ftw_call(walk, fn, filename, fs, flag, &subdir);
+    csync_vio_file_stat_destroy(fs);
+
+    if (rc < 0) {
+      break;
+    }
+
+    rc = _csync_ftw_descend(walk, exclude, filename, flag, depth,
+        &walk->exclude);
+    if (rc > 0) {
+      if (subdir != NULL) {
+        rc = _csync_ftw_reuse(walk, filename, subdir, fn, depth - 1);
+      } else {
+        rc = csync_ftw(walk, filename, fn, depth - 1);
+      }
+      csync_exclude_dir_free(walk->exclude);
+    }
+    walk->exclude = exclude;
+    if (rc < 0) {
+      break;
+    }
+    SAFE_FREE(filename);
+  }
+  SAFE_FREE(filename);
+
+  return rc;
+}
+
+#ifdef HAVE_FSTATAT
+/* Path of the entry visited by the local walker, reused for all entries */
+struct _csync_ftw_path_s {
+  char *buf;
+  size_t len;
+  size_t size;
+  /* length of the replica uri including the slash */
+  size_t base;
+};
+
+static int _csync_ftw_path_push(struct _csync_ftw_path_s *path,
+    const char *name) {
+  size_t len = strlen(name);
+
+  if (path->len + len + 2 > path->size) {
+    size_t size = path->size;
+    char *buf = NULL;
+
+    while (size < path->len + len + 2) {
+      size *= 2;
+    }
+    buf = c_realloc(path->buf, size);
+    if (buf == NULL) {
+      return -1;
+    }
+    path->buf = buf;
+    path->size = size;
+  }
+
+  path->buf[path->len++] = '/';
+  memcpy(path->buf + path->len, name, len + 1);
+  path->len += len;
+
   return 0;
 }
 
+static void _csync_ftw_path_pop(struct _csync_ftw_path_s *path, size_t len) {
+  path->len = len;
+  path->buf[len] = '\0';
+}
+
+/*
+ * Walk a local directory. Entries are stat'ed and subdirectories are opened
+ * relative to the open directory, so the kernel doesn't resolve the full path
+ * again for every entry. The path is only built for the walker function and
+ * the exclude list. Takes ownership of fd.
+ */
+static int _csync_ftw_local_dir(csync_walk_t *walk, int fd,
+    struct _csync_ftw_path_s *path, csync_walker_fn fn, unsigned int depth) {
+  CSYNC *ctx = walk->ctx;
+  csync_exclude_dir_t *exclude = walk->exclude;
+  char errbuf[256] = {0};
+  const csync_file_stat_t *subdir = NULL;
+  csync_vio_file_stat_t *fs = NULL;
+  struct dirent *dirent = NULL;
+  size_t len = path->len;
+  DIR *dh = NULL;
+  int rc = 0;
+
+  dh = fdopendir(fd);
+  if (dh == NULL) {
+    close(fd);
+    return -1;
+  }
+
+  while ((dirent = readdir(dh)) != NULL) {
+    const char *name = dirent->d_name;
+    int flag;
+
+    /* skip "." and ".." */
+    if (name[0] == '.' && (name[1] == '\0'
+          || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+
+    if (_csync_ftw_path_push(path, name) < 0) {
+      rc = -1;
+      break;
+    }
+
+    /* Check if file is excluded */
+    if (csync_excluded_below(ctx, exclude, path->buf + path->base)) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded",
+          path->buf + path->base);
+      _csync_ftw_incomplete(walk, path->buf, len);
+      _csync_ftw_path_pop(path, len);
+      continue;
+    }
+
+    fs = csync_vio_file_stat_new();
+    if (fs == NULL) {
+      rc = -1;
+      break;
+    }
+    if (csync_vio_local_readdir_stat(dirfd(dh), dirent, fs) < 0) {
+      flag = CSYNC_FTW_FLAG_NSTAT;
+    } else {
+      flag = _csync_ftw_flag(fs);
+    }
+
+    /* Call walker function for each file */
+    rc = _csync_ftw_call(walk, fn, path->buf, fs, flag, &subdir);
+    csync_vio_file_stat_destroy(fs);
+
+    if (rc < 0) {
+      break;
+    }
+
+    rc = _csync_ftw_descend(walk, exclude, path->buf, flag, depth,
+        &walk->exclude);
+    if (rc > 0) {
+      if (subdir != NULL) {
+        rc = _csync_ftw_reuse(walk, path->buf, subdir, fn, depth - 1);
+      } else if ((fd = csync_vio_local_opendirat(dirfd(dh), name)) >= 0) {
+        rc = _csync_ftw_local_dir(walk, fd, path, fn, depth - 1);
+      } else if (errno != EACCES) {
+        /* permission denied is skipped like in csync_ftw() */
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+            "opendir failed for %s - %s",
+            path->buf,
+            errbuf);
+        rc = -1;
+      } else {
+        _csync_ftw_incomplete(walk, path->buf, path->len);
+        rc = 0;
+      }
+      csync_exclude_dir_free(walk->exclude);
+    }
+    walk->exclude = exclude;
+    if (rc < 0) {
+      break;
+    }
+    _csync_ftw_path_pop(path, len);
+  }
+
+  closedir(dh);
+  _csync_ftw_path_pop(path, len);
+
+  return rc;
+}
+
+/* File tree walker for the local replica */
+static int _csync_ftw_local(csync_walk_t *walk, const char *uri,
+    csync_walker_fn fn, unsigned int depth) {
+  char errbuf[256] = {0};
+  struct _csync_ftw_path_s path;
+  int fd;
+  int rc;
+
+  fd = csync_vio_local_opendirat(AT_FDCWD, uri);
+  if (fd < 0) {
+    /* permission denied */
+    if (errno == EACCES) {
+      _csync_ftw_incomplete(walk, uri, strlen(uri));
+      return 0;
+    }
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "opendir failed for %s - %s",
+        uri,
+        errbuf);
+    return -1;
+  }
+
+  path.len = strlen(uri);
+  path.size = path.len + 256;
+  path.base = walk->urilen + 1;
+  path.buf = c_malloc(path.size);
+  if (path.buf == NULL) {
+    close(fd);
+    return -1;
+  }
+  memcpy(path.buf, uri, path.len + 1);
+
+  rc = _csync_ftw_local_dir(walk, fd, &path, fn, depth);
+  SAFE_FREE(path.buf);
+
+  return rc;
+}
+#endif /* HAVE_FSTATAT */
+
 /* File tree walker */
-int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+int csync_ftw(csync_walk_t *walk, const char *uri, csync_walker_fn fn,
     unsigned int depth) {
+  CSYNC *ctx = walk->ctx;
+  csync_exclude_dir_t *exclude = walk->exclude;
   char errbuf[256] = {0};
   char *filename = NULL;
   char *d_name = NULL;
   csync_vio_handle_t *dh = NULL;
   csync_vio_file_stat_t *dirent = NULL;
   csync_vio_file_stat_t *fs = NULL;
+  const csync_file_stat_t *subdir = NULL;
   int rc = 0;
 
   if (uri[0] == '\0') {
@@ -215,9 +825,16 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     goto error;
   }
 
-  if ((dh = csync_vio_opendir(ctx, uri)) == NULL) {
+#ifdef HAVE_FSTATAT
+  if (walk->replica == LOCAL_REPLICA) {
+    return _csync_ftw_local(walk, uri, fn, depth);
+  }
+#endif
+
+  if ((dh = csync_vio_opendir_replica(ctx, walk->replica, uri)) == NULL) {
     /* permission denied */
     if (errno == EACCES) {
+      _csync_ftw_incomplete(walk, uri, strlen(uri));
       return 0;
     } else {
       strerror_r(errno, errbuf, sizeof(errbuf));
@@ -229,7 +846,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     }
   }
 
-  while ((dirent = csync_vio_readdir(ctx, dh))) {
+  while ((dirent = csync_vio_readdir_replica(ctx, walk->replica, dh))) {
     const char *path = NULL;
     int flag;
 
@@ -253,73 +870,55 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     }
 
     /* Create relative path for checking the exclude list */
-    switch (ctx->current) {
-      case LOCAL_REPLICA:
-        path = filename + strlen(ctx->local.uri) + 1;
-        break;
-      case REMOTE_REPLICA:
-        path = filename + strlen(ctx->remote.uri) + 1;
-        break;
-      default:
-        break;
-    }
+    path = _csync_ftw_relpath(walk, filename);
 
     /* Check if file is excluded */
-    if (csync_excluded(ctx, path)) {
+    if (csync_excluded_below(ctx, exclude, path)) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded", path);
+      _csync_ftw_incomplete(walk, uri, strlen(uri));
       csync_vio_file_stat_destroy(dirent);
       dirent = NULL;
       continue;
     }
 
-    fs = csync_vio_file_stat_new();
-    if (csync_vio_stat(ctx, filename, fs) == 0) {
-      switch (fs->type) {
-        case CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK:
-          flag = CSYNC_FTW_FLAG_SLINK;
-          break;
-        case CSYNC_VIO_FILE_TYPE_DIRECTORY:
-          flag = CSYNC_FTW_FLAG_DIR;
-          break;
-        case CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE:
-        case CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE:
-        case CSYNC_VIO_FILE_TYPE_SOCKET:
-          flag = CSYNC_FTW_FLAG_SPEC;
-          break;
-        case CSYNC_VIO_FILE_TYPE_FIFO:
-          flag = CSYNC_FTW_FLAG_SPEC;
-          break;
-        default:
-          flag = CSYNC_FTW_FLAG_FILE;
-          break;
-      };
+    if (_csync_ftw_dirent_complete(dirent)) {
+      fs = dirent;
+      dirent = NULL;
+      flag = _csync_ftw_flag(fs);
     } else {
-      flag = CSYNC_FTW_FLAG_NSTAT;
+      fs = csync_vio_file_stat_new();
+      flag = _csync_ftw_stat(walk, filename, fs);
     }
 
-    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "walk: %s", filename);
-
     /* Call walker function for each file */
-    rc = fn(ctx, filename, fs, flag);
+    rc = _csync_ftw_call(walk, fn, filename, fs, flag, &subdir);
     csync_vio_file_stat_destroy(fs);
 
     if (rc < 0) {
-      csync_vio_closedir(ctx, dh);
+      csync_vio_closedir_replica(ctx, walk->replica, dh);
       goto done;
     }
 
-    if (flag == CSYNC_FTW_FLAG_DIR && depth) {
-      rc = csync_ftw(ctx, filename, fn, depth - 1);
-      if (rc < 0) {
-        csync_vio_closedir(ctx, dh);
-        goto done;
+    rc = _csync_ftw_descend(walk, exclude, filename, flag, depth,
+        &walk->exclude);
+    if (rc > 0) {
+      if (subdir != NULL) {
+        rc = _csync_ftw_reuse(walk, filename, subdir, fn, depth - 1);
+      } else {
+        rc = csync_ftw(walk, filename, fn, depth - 1);
       }
+      csync_exclude_dir_free(walk->exclude);
+    }
+    walk->exclude = exclude;
+    if (rc < 0) {
+      csync_vio_closedir_replica(ctx, walk->replica, dh);
+      goto done;
     }
     SAFE_FREE(filename);
     csync_vio_file_stat_destroy(dirent);
     dirent = NULL;
   }
-  csync_vio_closedir(ctx, dh);
+  csync_vio_closedir_replica(ctx, walk->replica, dh);
 
 done:
   csync_vio_file_stat_destroy(dirent);
@@ -327,10 +926,615 @@ done:
   return rc;
 error:
   if (dh != NULL) {
-    csync_vio_closedir(ctx, dh);
+    csync_vio_closedir_replica(ctx, walk->replica, dh);
   }
   SAFE_FREE(filename);
   return -1;
 }
 
+#ifdef HAVE_PTHREAD
+/*
+ * Parallel file tree walker
+ *
+ * Every worker owns a deque of jobs. A job is either a directory which still
+ * has to be read or a batch of entries of a directory which still have to be
+ * stat'ed. A worker pushes and pops jobs at the tail of its own deque, which
+ * keeps its walk depth first, and steals from the head of the other deques
+ * if its own one runs dry. The walker function is called with the walker lock
+ * held, so it doesn't need to be thread safe. If another walk runs at the
+ * same time, its lock is used instead.
+ */
+
+/* Number of directory entries stat'ed by one job */
+#define CSYNC_FTW_BATCH_SIZE 64
+
+struct _csync_ftw_job_s {
+  char *dir;
+  unsigned int depth;
+  /* statedb record of an unchanged directory */
+  const csync_file_stat_t *unchanged;
+  /* exclude patterns which can still match in the directory */
+  csync_exclude_dir_t *exclude;
+  /* entries to stat, NULL if the directory has to be read */
+  char **names;
+  /* statedb records of the entries of an unchanged directory */
+  const csync_file_stat_t **records;
+  /* complete stats returned by readdir, NULL if the entry has to be stat'ed */
+  csync_vio_file_stat_t **stats;
+  size_t count;
+};
+
+struct _csync_ftw_pool_s;
+
+struct _csync_ftw_worker_s {
+  struct _csync_ftw_pool_s *pool;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct _csync_ftw_job_s **jobs;
+  size_t head;
+  size_t tail;
+  size_t size;
+};
+
+struct _csync_ftw_pool_s {
+  csync_walk_t walk;
+  csync_walker_fn fn;
+
+  pthread_mutex_t walker_lock;
+
+  /* protects the counters below */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  /* jobs waiting in a deque */
+  size_t queued;
+  /* jobs waiting in a deque or being processed */
+  size_t pending;
+  int rc;
+
+  struct _csync_ftw_worker_s *workers;
+  int nworkers;
+};
+
+static void _csync_ftw_job_free(struct _csync_ftw_job_s *job) {
+  size_t i;
+
+  if (job == NULL) {
+    return;
+  }
+
+  if (job->names != NULL) {
+    for (i = 0; i < job->count; i++) {
+      SAFE_FREE(job->names[i]);
+    }
+    SAFE_FREE(job->names);
+  }
+  SAFE_FREE(job->records);
+  if (job->stats != NULL) {
+    for (i = 0; i < job->count; i++) {
+      csync_vio_file_stat_destroy(job->stats[i]);
+    }
+    SAFE_FREE(job->stats);
+  }
+  csync_exclude_dir_free(job->exclude);
+  SAFE_FREE(job->dir);
+  SAFE_FREE(job);
+}
+
+static int _csync_ftw_push(struct _csync_ftw_worker_s *w,
+    struct _csync_ftw_job_s *job) {
+  struct _csync_ftw_pool_s *pool = w->pool;
+  int rc = 0;
+
+  pthread_mutex_lock(&w->lock);
+  if (w->tail == w->size) {
+    if (w->head > 0) {
+      /* move the jobs to the front of the deque */
+      memmove(w->jobs, w->jobs + w->head,
+          (w->tail - w->head) * sizeof(struct _csync_ftw_job_s *));
+      w->tail -= w->head;
+      w->head = 0;
+    } else {
+      struct _csync_ftw_job_s **jobs;
+      size_t size = w->size ? w->size * 2 : 64;
+
+      jobs = c_realloc(w->jobs, size * sizeof(struct _csync_ftw_job_s *));
+      if (jobs == NULL) {
+        rc = -1;
+        goto out;
+      }
+      w->jobs = jobs;
+      w->size = size;
+    }
+  }
+
+  /* account the job before anybody is able to take it */
+  pthread_mutex_lock(&pool->lock);
+  pool->queued++;
+  pool->pending++;
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  w->jobs[w->tail++] = job;
+
+out:
+  pthread_mutex_unlock(&w->lock);
+  return rc;
+}
+
+static struct _csync_ftw_job_s *_csync_ftw_take(struct _csync_ftw_worker_s *w,
+    int steal) {
+  struct _csync_ftw_job_s *job = NULL;
+
+  pthread_mutex_lock(&w->lock);
+  if (w->head < w->tail) {
+    if (steal) {
+      job = w->jobs[w->head++];
+    } else {
+      job = w->jobs[--w->tail];
+    }
+    if (w->head == w->tail) {
+      w->head = w->tail = 0;
+    }
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return job;
+}
+
+static void _csync_ftw_set_error(struct _csync_ftw_pool_s *pool, int rc) {
+  pthread_mutex_lock(&pool->lock);
+  if (pool->rc == 0) {
+    pool->rc = rc;
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static int _csync_ftw_add_entry(char ***names,
+    const csync_file_stat_t ***records, csync_vio_file_stat_t ***stats,
+    size_t *count, size_t *size, const char *name,
+    const csync_file_stat_t *st, csync_vio_file_stat_t *fs) {
+  if (*count == *size) {
+    void *tmp;
+
+    *size = *size ? *size * 2 : CSYNC_FTW_BATCH_SIZE;
+    tmp = c_realloc(*names, *size * sizeof(char *));
+    if (tmp == NULL) {
+      return -1;
+    }
+    *names = tmp;
+    tmp = c_realloc(*records, *size * sizeof(csync_file_stat_t *));
+    if (tmp == NULL) {
+      return -1;
+    }
+    *records = tmp;
+    tmp = c_realloc(*stats, *size * sizeof(csync_vio_file_stat_t *));
+    if (tmp == NULL) {
+      return -1;
+    }
+    *stats = tmp;
+  }
+
+  (*names)[*count] = c_strdup(name);
+  if ((*names)[*count] == NULL) {
+    return -1;
+  }
+  (*records)[*count] = st;
+  (*stats)[*count] = fs;
+  (*count)++;
+
+  return 0;
+}
+
+/* Read a directory and queue batches of its entries */
+static int _csync_ftw_read_dir(struct _csync_ftw_worker_s *w,
+    struct _csync_ftw_job_s *job) {
+  csync_walk_t *walk = &w->pool->walk;
+  CSYNC *ctx = walk->ctx;
+  char errbuf[256] = {0};
+  char *filename = NULL;
+  csync_vio_handle_t *dh = NULL;
+  csync_vio_file_stat_t *dirent = NULL;
+  struct _csync_ftw_job_s *batch = NULL;
+  const csync_file_stat_t *child = NULL;
+  const csync_file_stat_t **records = NULL;
+  csync_vio_file_stat_t **stats = NULL;
+  char **names = NULL;
+  size_t count = 0;
+  size_t size = 0;
+  size_t i;
+  int rc = -1;
+
+  if (job->unchanged != NULL) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "unchanged directory: %s", job->dir);
+
+    for (child = csync_statedb_index_first_child(ctx, job->unchanged);
+         child != NULL;
+         child = csync_statedb_index_next_child(ctx, child)) {
+      /* Check if file is excluded */
+      if (csync_excluded_below(ctx, job->exclude, child->name)) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded", child->name);
+        _csync_ftw_incomplete(walk, job->dir, strlen(job->dir));
+        continue;
+      }
+
+      if (_csync_ftw_add_entry(&names, &records, &stats, &count, &size,
+            child->name + job->unchanged->pathlen + 1, child, NULL) < 0) {
+        goto out;
+      }
+    }
+    goto queue;
+  }
+
+  if ((dh = csync_vio_opendir_replica(ctx, walk->replica, job->dir)) == NULL) {
+    /* permission denied */
+    if (errno == EACCES) {
+      _csync_ftw_incomplete(walk, job->dir, strlen(job->dir));
+      return 0;
+    }
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "opendir failed for %s - %s",
+        job->dir,
+        errbuf);
+    return -1;
+  }
+
+  while ((dirent = csync_vio_readdir_replica(ctx, walk->replica, dh))) {
+    const char *d_name = dirent->name;
+
+    if (d_name == NULL) {
+      goto out;
+    }
+
+    /* skip "." and ".." */
+    if (d_name[0] == '.' && (d_name[1] == '\0'
+          || (d_name[1] == '.' && d_name[2] == '\0'))) {
+      csync_vio_file_stat_destroy(dirent);
+      continue;
+    }
+
+    if (asprintf(&filename, "%s/%s", job->dir, d_name) < 0) {
+      filename = NULL;
+      goto out;
+    }
+
+    /* Check if file is excluded */
+    if (csync_excluded_below(ctx, job->exclude,
+          _csync_ftw_relpath(walk, filename))) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded",
+          _csync_ftw_relpath(walk, filename));
+      _csync_ftw_incomplete(walk, job->dir, strlen(job->dir));
+      SAFE_FREE(filename);
+      csync_vio_file_stat_destroy(dirent);
+      continue;
+    }
+    SAFE_FREE(filename);
+
+    if (! _csync_ftw_dirent_complete(dirent)) {
+      if (_csync_ftw_add_entry(&names, &records, &stats, &count, &size,
+            d_name, NULL, NULL) < 0) {
+        goto out;
+      }
+      csync_vio_file_stat_destroy(dirent);
+    } else if (_csync_ftw_add_entry(&names, &records, &stats, &count, &size,
+          d_name, NULL, dirent) < 0) {
+      goto out;
+    }
+  }
+  dirent = NULL;
+
+queue:
+  /* split the entries into batches which can be stolen by other workers */
+  for (i = 0; i < count; i += CSYNC_FTW_BATCH_SIZE) {
+    size_t n = count - i;
+
+    if (n > CSYNC_FTW_BATCH_SIZE) {
+      n = CSYNC_FTW_BATCH_SIZE;
+    }
+
+    batch = c_malloc(sizeof(struct _csync_ftw_job_s));
+    if (batch == NULL) {
+      goto out;
+    }
+    batch->depth = job->depth;
+    batch->dir = c_strdup(job->dir);
+    batch->names = c_malloc(n * sizeof(char *));
+    if (batch->dir == NULL || batch->names == NULL) {
+      goto out;
+    }
+    if (job->exclude != NULL) {
+      batch->exclude = csync_exclude_dir_dup(job->exclude);
+      if (batch->exclude == NULL) {
+        goto out;
+      }
+    }
+    memcpy(batch->names, names + i, n * sizeof(char *));
+    memset(names + i, 0, n * sizeof(char *));
+    batch->count = n;
+
+    if (job->unchanged != NULL) {
+      batch->records = c_malloc(n * sizeof(csync_file_stat_t *));
+      if (batch->records == NULL) {
+        goto out;
+      }
+      memcpy(batch->records, records + i, n * sizeof(csync_file_stat_t *));
+    } else {
+      batch->stats = c_malloc(n * sizeof(csync_vio_file_stat_t *));
+      if (batch->stats == NULL) {
+        goto out;
+      }
+      memcpy(batch->stats, stats + i, n * sizeof(csync_vio_file_stat_t *));
+      memset(stats + i, 0, n * sizeof(csync_vio_file_stat_t *));
+    }
+
+    if (_csync_ftw_push(w, batch) < 0) {
+      goto out;
+    }
+    batch = NULL;
+  }
+
+  rc = 0;
+out:
+  if (dirent != NULL) {
+    csync_vio_file_stat_destroy(dirent);
+  }
+  if (dh != NULL) {
+    csync_vio_closedir_replica(ctx, walk->replica, dh);
+  }
+  _csync_ftw_job_free(batch);
+  for (i = 0; i < count; i++) {
+    SAFE_FREE(names[i]);
+    csync_vio_file_stat_destroy(stats[i]);
+  }
+  SAFE_FREE(names);
+  SAFE_FREE(records);
+  SAFE_FREE(stats);
+  SAFE_FREE(filename);
+
+  return rc;
+}
+
+/* Stat a batch of directory entries and call the walker function */
+static int _csync_ftw_stat_batch(struct _csync_ftw_worker_s *w,
+    struct _csync_ftw_job_s *job) {
+  struct _csync_ftw_pool_s *pool = w->pool;
+  struct _csync_ftw_job_s *subdir = NULL;
+  const csync_file_stat_t *unchanged = NULL;
+  csync_exclude_dir_t *exclude = NULL;
+  csync_vio_file_stat_t *fs = NULL;
+  char *filename = NULL;
+  size_t i;
+  int flag;
+  int rc = 0;
+
+  for (i = 0; i < job->count; i++) {
+    if (asprintf(&filename, "%s/%s", job->dir, job->names[i]) < 0) {
+      return -1;
+    }
+
+    if (job->stats != NULL && job->stats[i] != NULL) {
+      fs = job->stats[i];
+      job->stats[i] = NULL;
+      flag = _csync_ftw_flag(fs);
+      goto walk;
+    }
+
+    fs = csync_vio_file_stat_new();
+    if (fs == NULL) {
+      SAFE_FREE(filename);
+      return -1;
+    }
+    if (job->records != NULL) {
+      flag = _csync_ftw_stat_record(&pool->walk, filename, job->records[i], fs);
+    } else {
+      flag = _csync_ftw_stat(&pool->walk, filename, fs);
+    }
+
+walk:
+    /* Call walker function for each file */
+    rc = _csync_ftw_call(&pool->walk, pool->fn, filename, fs, flag,
+        &unchanged);
+    csync_vio_file_stat_destroy(fs);
+
+    if (rc < 0) {
+      SAFE_FREE(filename);
+      return rc;
+    }
+
+    rc = _csync_ftw_descend(&pool->walk, job->exclude, filename, flag,
+        job->depth, &exclude);
+    if (rc < 0) {
+      SAFE_FREE(filename);
+      return -1;
+    }
+    if (rc > 0) {
+      subdir = c_malloc(sizeof(struct _csync_ftw_job_s));
+      if (subdir == NULL) {
+        csync_exclude_dir_free(exclude);
+        SAFE_FREE(filename);
+        return -1;
+      }
+      subdir->dir = filename;
+      subdir->depth = job->depth - 1;
+      subdir->unchanged = unchanged;
+      subdir->exclude = exclude;
+      filename = NULL;
+
+      if (_csync_ftw_push(w, subdir) < 0) {
+        _csync_ftw_job_free(subdir);
+        return -1;
+      }
+    }
+    SAFE_FREE(filename);
+  }
+
+  return 0;
+}
+
+static struct _csync_ftw_job_s *_csync_ftw_next(struct _csync_ftw_worker_s *w) {
+  struct _csync_ftw_pool_s *pool = w->pool;
+  struct _csync_ftw_job_s *job = NULL;
+  int i;
+
+  for (;;) {
+    job = _csync_ftw_take(w, 0);
+
+    /* steal from the other workers */
+    for (i = 1; job == NULL && i < pool->nworkers; i++) {
+      int victim = (int) (w - pool->workers + i) % pool->nworkers;
+
+      job = _csync_ftw_take(&pool->workers[victim], 1);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (job != NULL) {
+      pool->queued--;
+      pthread_mutex_unlock(&pool->lock);
+      return job;
+    }
+
+    /* wait until new jobs get queued or the walk is done */
+    while (pool->queued == 0 && pool->pending > 0) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    if (pool->pending == 0) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+static void *_csync_ftw_worker(void *arg) {
+  struct _csync_ftw_worker_s *w = arg;
+  struct _csync_ftw_pool_s *pool = w->pool;
+  struct _csync_ftw_job_s *job;
+  int failed;
+  int rc;
+
+  while ((job = _csync_ftw_next(w)) != NULL) {
+    pthread_mutex_lock(&pool->lock);
+    failed = pool->rc;
+    pthread_mutex_unlock(&pool->lock);
+
+    /* drain the remaining jobs if the walk failed */
+    if (failed == 0) {
+      if (job->names == NULL) {
+        rc = _csync_ftw_read_dir(w, job);
+      } else {
+        rc = _csync_ftw_stat_batch(w, job);
+      }
+      if (rc < 0) {
+        _csync_ftw_set_error(pool, rc);
+      }
+    }
+    _csync_ftw_job_free(job);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending--;
+    if (pool->pending == 0) {
+      pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+int csync_ftw_parallel(csync_walk_t *walk, const char *uri, csync_walker_fn fn,
+    unsigned int depth, int nthreads) {
+  struct _csync_ftw_pool_s pool;
+  struct _csync_ftw_job_s *job = NULL;
+  int started = 0;
+  int i;
+
+  if (nthreads <= 1) {
+    return csync_ftw(walk, uri, fn, depth);
+  }
+
+  if (uri[0] == '\0') {
+    errno = ENOENT;
+    return -1;
+  }
+
+  ZERO_STRUCT(pool);
+  pool.walk = *walk;
+  pool.fn = fn;
+  pool.nworkers = nthreads;
+
+  pool.workers = c_malloc(nthreads * sizeof(struct _csync_ftw_worker_s));
+  if (pool.workers == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_init(&pool.walker_lock, NULL);
+  if (pool.walk.lock == NULL) {
+    pool.walk.lock = &pool.walker_lock;
+  }
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+  for (i = 0; i < nthreads; i++) {
+    pool.workers[i].pool = &pool;
+    pthread_mutex_init(&pool.workers[i].lock, NULL);
+  }
+
+  job = c_malloc(sizeof(struct _csync_ftw_job_s));
+  if (job == NULL) {
+    pool.rc = -1;
+    goto out;
+  }
+  job->dir = c_strdup(uri);
+  job->depth = depth;
+  if (job->dir == NULL || _csync_ftw_push(&pool.workers[0], job) < 0) {
+    _csync_ftw_job_free(job);
+    pool.rc = -1;
+    goto out;
+  }
+
+  for (started = 0; started < nthreads; started++) {
+    if (pthread_create(&pool.workers[started].thread, NULL,
+          _csync_ftw_worker, &pool.workers[started]) != 0) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+          "Unable to start walker thread %d", started);
+      break;
+    }
+  }
+
+  if (started == 0) {
+    /* walk on our own */
+    _csync_ftw_worker(&pool.workers[0]);
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(pool.workers[i].thread, NULL);
+  }
+
+out:
+  for (i = 0; i < nthreads; i++) {
+    struct _csync_ftw_worker_s *w = &pool.workers[i];
+
+    while (w->head < w->tail) {
+      _csync_ftw_job_free(w->jobs[w->head++]);
+    }
+    SAFE_FREE(w->jobs);
+    pthread_mutex_destroy(&w->lock);
+  }
+  SAFE_FREE(pool.workers);
+  pthread_cond_destroy(&pool.cond);
+  pthread_mutex_destroy(&pool.lock);
+  pthread_mutex_destroy(&pool.walker_lock);
+
+  return pool.rc;
+}
+#else
+int csync_ftw_parallel(csync_walk_t *walk, const char *uri, csync_walker_fn fn,
+    unsigned int depth, int nthreads) {
+  (void) nthreads;
+
+  return csync_ftw(walk, uri, fn, depth);
+}
+#endif /* HAVE_PTHREAD */
+
 /* vim: set ts=8 sw=2 et cindent: */
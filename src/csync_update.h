@@ -21,7 +21,13 @@
 #ifndef _CSYNC_UPDATE_H
 #define _CSYNC_UPDATE_H
 
-#include "csync.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "c_xxhash.h"
+#include "csync_private.h"
+#include "csync_exclude.h"
 #include "vio/csync_vio_file_stat.h"
 
 /**
@@ -52,13 +58,58 @@ enum csync_ftw_flags_e {
   CSYNC_FTW_FLAG_SLN		/* Symbolic link naming non-existing file.  */
 };
 
-typedef int (*csync_walker_fn) (CSYNC *ctx, const char *file,
+/**
+ * @brief The replica a file tree walk works on.
+ *
+ * The walk takes everything it needs to know about the replica from here
+ * instead of ctx->current and ctx->replica, so both replicas can be walked
+ * at the same time.
+ */
+typedef struct csync_walk_s {
+  CSYNC *ctx;
+  /* replica walked, selects the tree the files are added to */
+  enum csync_replica_e current;
+  /* backend to access the replica with */
+  enum csync_replica_e replica;
+  /* uri of the replica, the paths in the tree are relative to it */
+  const char *uri;
+  size_t urilen;
+  c_htable_t *tree;
+  /* arena the file stats of the tree are allocated from */
+  c_arena_t *arena;
+  /* directory of the last file added and the hash state of its path */
+  const csync_file_stat_t *parent;
+  c_xxhash64_state_t parent_state;
+  /* exclude patterns which can still match in the directory being read */
+  csync_exclude_dir_t *exclude;
+#ifdef HAVE_PTHREAD
+  /*
+   * Held while the walker function is called, if another walk runs at the
+   * same time. Both walks share the statedb.
+   */
+  pthread_mutex_t *lock;
+#endif
+} csync_walk_t;
+
+typedef int (*csync_walker_fn) (csync_walk_t *walk, const char *file,
     const csync_vio_file_stat_t *fs, enum csync_ftw_flags_e flag);
 
+/**
+ * @brief Prepare a walk of a replica.
+ *
+ * @param  walk         The walk to initialize.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  current      The replica to walk, LOCAL_REPLICA or REMOTE_REPLICA.
+ */
+void csync_walk_init(csync_walk_t *walk, CSYNC *ctx,
+    enum csync_replica_e current);
+
 /**
  * @brief The walker function to use in the file tree walker.
  *
- * @param  ctx          The used csync context.
+ * @param  walk         The walk the file has been found by.
  *
  * @param  file         The file we are researching.
  *
@@ -68,8 +119,8 @@ typedef int (*csync_walker_fn) (CSYNC *ctx, const char *file,
  *
  * @return 0 on success, < 0 on error.
  */
-int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
-    enum csync_ftw_flags_e flag);
+int csync_walker(csync_walk_t *walk, const char *file,
+    const csync_vio_file_stat_t *fs, enum csync_ftw_flags_e flag);
 
 /**
  * @brief The file tree walker.
@@ -79,7 +130,7 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
  * once for each entry in the tree. By default, directories are handled before
  * the files and subdirectories they contain (pre-order traversal).
  *
- * @param  ctx          The csync context to use.
+ * @param  walk         The replica to walk.
  *
  * @param  uri          The uri/path to the directory tree to walk.
  *
@@ -91,9 +142,41 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
  *         walk is terminated and the value returned by fn() is returned as the
  *         result.
  */
-int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
+int csync_ftw(csync_walk_t *walk, const char *uri, csync_walker_fn fn,
     unsigned int depth);
 
+/**
+ * @brief The parallel file tree walker.
+ *
+ * This function walks through the directory tree like csync_ftw(), but reads
+ * directories and stats their entries on a pool of worker threads. Idle
+ * workers steal pending directories from busy ones. The walker function is
+ * called with a lock held, so it is never called concurrently. Directories
+ * are still handled before the files and subdirectories they contain, but
+ * the order of the entries in a directory is not defined.
+ *
+ * This is only safe for replicas which can be accessed from several threads
+ * at once, like the local filesystem.
+ *
+ * @param  walk         The replica to walk.
+ *
+ * @param  uri          The uri/path to the directory tree to walk.
+ *
+ * @param  fn           The walker function to call once for each entry.
+ *
+ * @param  depth        The max depth to walk down the tree.
+ *
+ * @param  nthreads     The number of threads to use. If it is less than 2 or
+ *                      csync has been built without thread support, the tree
+ *                      is walked with csync_ftw().
+ *
+ * @return 0 on success, < 0 on error. If fn() returns a value < 0, then the
+ *         tree walk is terminated and the value returned by fn() is returned
+ *         as the result.
+ */
+int csync_ftw_parallel(csync_walk_t *walk, const char *uri, csync_walker_fn fn,
+    unsigned int depth, int nthreads);
+
 #endif /* _CSYNC_UPDATE_H */
 
 /* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
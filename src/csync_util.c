@@ -54,6 +54,8 @@ static const _instr_code_struct _instr[] =
   { "INSTRUCTION_ERROR", CSYNC_INSTRUCTION_ERROR },
   { "INSTRUCTION_DELETED", CSYNC_INSTRUCTION_DELETED },
   { "INSTRUCTION_UPDATED", CSYNC_INSTRUCTION_UPDATED },
+  { "INSTRUCTION_METADATA", CSYNC_INSTRUCTION_METADATA },
+  { "INSTRUCTION_REMOVE_TREE", CSYNC_INSTRUCTION_REMOVE_TREE },
   { NULL, CSYNC_INSTRUCTION_ERROR }
 };
 
@@ -82,11 +84,28 @@ const char *csync_instruction_str(enum csync_instructions_e instr)
 }
 
 
-void csync_memstat_check(void) {
+void csync_memstat_check(CSYNC *ctx) {
   int s = 0;
   struct csync_memstat_s m;
   FILE* fp;
 
+  /* memory of the trees */
+  if (ctx != NULL) {
+    size_t lcount = c_htable_size(ctx->local.tree);
+    size_t rcount = c_htable_size(ctx->remote.tree);
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO,
+        "Memory: %zuK used of %zuK local tree, %zuK used of %zuK remote tree",
+        c_arena_used(ctx->local.arena) / 1024,
+        c_arena_size(ctx->local.arena) / 1024,
+        c_arena_used(ctx->remote.arena) / 1024,
+        c_arena_size(ctx->remote.arena) / 1024);
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO,
+        "Memory: %zu bytes per file local tree, %zu bytes per file remote tree",
+        lcount ? c_arena_used(ctx->local.arena) / lcount : 0,
+        rcount ? c_arena_used(ctx->remote.arena) / rcount : 0);
+  }
+
   /* get process memory stats */
   fp = fopen("/proc/self/statm","r");
   if (fp == NULL) {
@@ -103,16 +122,208 @@ void csync_memstat_check(void) {
                  m.size * 4, m.resident * 4, m.shared * 4);
 }
 
+char *csync_file_stat_path(const csync_file_stat_t *st, char *buf) {
+  buf[st->pathlen] = '\0';
+
+  for (; st->parent != NULL; st = st->parent) {
+    size_t off = st->parent->pathlen + 1;
+
+    memcpy(buf + off, st->name, st->pathlen - off);
+    buf[off - 1] = '/';
+  }
+  memcpy(buf, st->name, st->pathlen);
+
+  return buf;
+}
+
+int csync_file_stat_uri(const csync_file_stat_t *st, const char *uri, char **dst) {
+  size_t len = strlen(uri);
+  char *buf;
+
+  buf = c_malloc(len + st->pathlen + 2);
+  if (buf == NULL) {
+    return -1;
+  }
+  memcpy(buf, uri, len);
+  buf[len] = '/';
+  csync_file_stat_path(st, buf + len + 1);
+
+  *dst = buf;
+
+  return len + st->pathlen + 1;
+}
+
+int csync_file_stat_path_is(const csync_file_stat_t *st, const char *path,
+    size_t len) {
+  if (st->pathlen != len) {
+    return 0;
+  }
+
+  for (; st->parent != NULL; st = st->parent) {
+    size_t off = st->parent->pathlen + 1;
+
+    if (path[off - 1] != '/' ||
+        memcmp(path + off, st->name, st->pathlen - off) != 0) {
+      return 0;
+    }
+  }
+
+  return memcmp(path, st->name, st->pathlen) == 0;
+}
+
+int csync_file_stat_path_equal(const csync_file_stat_t *a,
+    const csync_file_stat_t *b) {
+  /* compare the names up to a common parent */
+  while (a != b) {
+    if (a->pathlen != b->pathlen) {
+      return 0;
+    }
+    if (a->parent == NULL) {
+      return csync_file_stat_path_is(b, a->name, a->pathlen);
+    }
+    if (b->parent == NULL) {
+      return csync_file_stat_path_is(a, b->name, b->pathlen);
+    }
+    if (a->parent->pathlen != b->parent->pathlen ||
+        memcmp(a->name, b->name, a->pathlen - a->parent->pathlen - 1) != 0) {
+      return 0;
+    }
+    a = a->parent;
+    b = b->parent;
+  }
+
+  return 1;
+}
+
+int csync_file_stat_cmp(const void *a, const void *b) {
+  const csync_file_stat_t *x = a;
+  const csync_file_stat_t *y = b;
+
+  if (x->phash < y->phash) {
+    return -1;
+  } else if (x->phash > y->phash) {
+    return 1;
+  }
+
+  /* different paths with the same hash are both kept, ordered by path */
+  if (csync_file_stat_path_equal(x, y)) {
+    return 0;
+  } else {
+    char px[x->pathlen + 1];
+    char py[y->pathlen + 1];
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "hash collision: %s and %s",
+        csync_file_stat_path(x, px), csync_file_stat_path(y, py));
+
+    return strcmp(px, py);
+  }
+}
+
+struct _csync_file_match_s {
+  const csync_file_stat_t *st;
+  const char *path;
+  size_t len;
+};
+
+static int _csync_file_match(const csync_file_stat_t *st,
+    const struct _csync_file_match_s *m) {
+  if (m->st != NULL) {
+    return csync_file_stat_path_equal(st, m->st);
+  }
+
+  return csync_file_stat_path_is(st, m->path, m->len);
+}
+
+/* The files with the same hash are found one by one by the lookup */
+static csync_file_stat_t *_csync_file_tree_find(c_htable_t *tree,
+    uint64_t phash, const struct _csync_file_match_s *m) {
+  csync_file_stat_t *st;
+  c_htable_iter_t it;
+
+  for (st = c_htable_find(tree, phash, &it); st != NULL;
+       st = c_htable_find_next(tree, &it)) {
+    if (_csync_file_match(st, m)) {
+      return st;
+    }
+  }
+
+  return NULL;
+}
+
+csync_file_stat_t *csync_file_tree_find(c_htable_t *tree,
+    const csync_file_stat_t *st) {
+  struct _csync_file_match_s m = { st, NULL, 0 };
+
+  return _csync_file_tree_find(tree, st->phash, &m);
+}
+
+csync_file_stat_t *csync_file_tree_find_path(c_htable_t *tree, uint64_t phash,
+    const char *path, size_t len) {
+  struct _csync_file_match_s m = { NULL, path, len };
+
+  return _csync_file_tree_find(tree, phash, &m);
+}
+
+int csync_owner_id(CSYNC *ctx, uid_t uid, gid_t gid) {
+  struct csync_owner_s *owner;
+  size_t i;
+
+  /* most files in a directory have the same owner */
+  if (ctx->owners.last < ctx->owners.count) {
+    owner = &ctx->owners.list[ctx->owners.last];
+    if (owner->uid == uid && owner->gid == gid) {
+      return ctx->owners.last;
+    }
+  }
+
+  for (i = 0; i < ctx->owners.count; i++) {
+    owner = &ctx->owners.list[i];
+    if (owner->uid == uid && owner->gid == gid) {
+      ctx->owners.last = i;
+      return i;
+    }
+  }
+
+  if (ctx->owners.count == ctx->owners.size) {
+    size_t size = ctx->owners.size ? ctx->owners.size * 2 : 16;
+
+    owner = c_realloc(ctx->owners.list, size * sizeof(struct csync_owner_s));
+    if (owner == NULL) {
+      return -1;
+    }
+    ctx->owners.list = owner;
+    ctx->owners.size = size;
+  }
+
+  owner = &ctx->owners.list[ctx->owners.count];
+  owner->uid = uid;
+  owner->gid = gid;
+  ctx->owners.last = ctx->owners.count++;
+
+  return ctx->owners.last;
+}
+
+/* -1 is an unknown owner, chown() leaves it unchanged */
+uid_t csync_owner_uid(CSYNC *ctx, uint32_t owner) {
+  return owner < ctx->owners.count ? ctx->owners.list[owner].uid : (uid_t) -1;
+}
+
+gid_t csync_owner_gid(CSYNC *ctx, uint32_t owner) {
+  return owner < ctx->owners.count ? ctx->owners.list[owner].gid : (gid_t) -1;
+}
+
 static int _merge_file_trees_visitor(void *obj, void *data) {
   csync_file_stat_t *fs = NULL;
   csync_vio_file_stat_t *vst = NULL;
 
   CSYNC *ctx = NULL;
-  c_rbtree_t *tree = NULL;
-  c_rbnode_t *node = NULL;
+  c_htable_t *tree = NULL;
+  c_arena_t *arena = NULL;
+  csync_file_stat_t *found = NULL;
 
   char errbuf[256] = {0};
   char *uri = NULL;
+  int owner;
   int rc = -1;
 
   fs = (csync_file_stat_t *) obj;
@@ -127,54 +338,54 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
   switch (ctx->current) {
     case LOCAL_REPLICA:
       tree = ctx->local.tree;
+      arena = ctx->local.arena;
       break;
     case REMOTE_REPLICA:
       tree = ctx->remote.tree;
+      arena = ctx->remote.arena;
       break;
     default:
       break;
   }
 
   /* check if the file is new or has been synced */
-  node = c_rbtree_find(tree, &fs->phash);
-  if (node == NULL) {
+  found = csync_file_tree_find(tree, fs);
+  if (found == NULL) {
     csync_file_stat_t *new = NULL;
+    /* the parent of the copy stays in the other tree */
+    size_t size = sizeof(csync_file_stat_t) + strlen(fs->name);
 
-    new = c_malloc(sizeof(csync_file_stat_t) + fs->pathlen + 1);
+    new = c_arena_alloc(arena, size);
     if (new == NULL) {
       strerror_r(errno, errbuf, sizeof(errbuf));
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
           "file: %s, merge malloc, error: %s",
-          fs->path,
+          fs->name,
           errbuf);
       rc = -1;
       goto out;
     }
-    new = memcpy(new, fs, sizeof(csync_file_stat_t) + fs->pathlen + 1);
+    new = memcpy(new, fs, size);
 
-    if (c_rbtree_insert(tree, new) < 0) {
+    if (c_htable_insert(tree, new->phash, new) < 0) {
       strerror_r(errno, errbuf, sizeof(errbuf));
-      SAFE_FREE(new);
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-          "file: %s, rb tree insert, error: %s",
-          fs->path,
+          "file: %s, tree insert, error: %s",
+          fs->name,
           errbuf);
       rc = -1;
       goto out;
     }
-
-    node = c_rbtree_find(tree, &fs->phash);
-    if (node == NULL) {
-      rc = -1;
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Unable to find node");
-      goto out;
-    }
+    fs = new;
+  } else {
+    /* the content is the one transferred */
+    found->checksum = fs->checksum;
+    fs = found;
   }
-  fs = c_rbtree_node_data(node);
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, fs->path) < 0) {
+      if (csync_file_stat_uri(fs, ctx->local.uri, &uri) < 0) {
         rc = -1;
         strerror_r(errno, errbuf, sizeof(errbuf));
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "file uri alloc failed: %s",
@@ -183,7 +394,7 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
       }
       break;
     case REMOTE_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, fs->path) < 0) {
+      if (csync_file_stat_uri(fs, ctx->remote.uri, &uri) < 0) {
         rc = -1;
         strerror_r(errno, errbuf, sizeof(errbuf));
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "file uri alloc failed: %s",
@@ -207,9 +418,19 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
     goto out;
   }
 
-  /* update file stat */
+  /* update file stat, the statedb has the stat of the local file */
+  owner = csync_owner_id(ctx, vst->uid, vst->gid);
+  if (owner < 0) {
+    rc = -1;
+    goto out;
+  }
+  fs->owner = owner;
   fs->inode = vst->inode;
+  fs->mode = vst->mode;
   fs->modtime = vst->mtime;
+  fs->mtime_nsec = vst->mtime_nsec;
+  fs->ctime = vst->ctime;
+  fs->size = vst->size;
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "file: %s, instruction: UPDATED", uri);
 
@@ -238,7 +459,7 @@ int csync_merge_file_trees(CSYNC *ctx) {
   ctx->current = LOCAL_REPLICA;
   ctx->replica = ctx->local.type;
 
-  rc = c_rbtree_walk(ctx->remote.tree, ctx, _merge_file_trees_visitor);
+  rc = c_htable_walk(ctx->remote.tree, ctx, _merge_file_trees_visitor);
   if (rc < 0) {
     goto out;
   }
@@ -250,7 +471,7 @@ int csync_merge_file_trees(CSYNC *ctx) {
   ctx->current = REMOTE_REPLICA;
   ctx->replica = ctx->remote.type;
 
-  rc = c_rbtree_walk(ctx->local.tree, ctx, _merge_file_trees_visitor);
+  rc = c_htable_walk(ctx->local.tree, ctx, _merge_file_trees_visitor);
   if (rc < 0) {
     goto out;
   }
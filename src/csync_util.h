@@ -23,14 +23,115 @@
 
 #include <stdint.h>
 
+#include "c_xxhash.h"
 #include "csync_private.h"
 
 const char *csync_instruction_str(enum csync_instructions_e instr);
 
-void csync_memstat_check(void);
+void csync_memstat_check(CSYNC *ctx);
 
 int csync_merge_file_trees(CSYNC *ctx);
 
+/**
+ * @brief Build the path of a file from the names of its parents.
+ *
+ * @param st      The file stat.
+ *
+ * @param buf     The buffer to write the path to, it has to hold
+ *                st->pathlen + 1 bytes.
+ *
+ * @return  buf
+ */
+char *csync_file_stat_path(const csync_file_stat_t *st, char *buf);
+
+/**
+ * @brief Build the uri of a file on a replica.
+ *
+ * Like asprintf(dst, "%s/%s", uri, path) but without building the path first.
+ *
+ * @param st      The file stat.
+ *
+ * @param uri     The uri of the replica.
+ *
+ * @param dst     A pointer to store the allocated uri, the caller has to free
+ *                it.
+ *
+ * @return  The length of the uri, -1 if no memory was available.
+ */
+int csync_file_stat_uri(const csync_file_stat_t *st, const char *uri, char **dst);
+
+/**
+ * @brief Hash a path relative to a replica, the key of the trees.
+ *
+ * The same as c_xxhash64() with the seed 0. A path can be hashed in pieces
+ * with the c_xxhash64 streaming functions.
+ */
+#define csync_path_hash(path, len) c_xxhash64((path), (len), 0)
+
+/**
+ * @brief Check if a file stat has a path.
+ *
+ * @return  1 if the path is the one of the file, 0 if not.
+ */
+int csync_file_stat_path_is(const csync_file_stat_t *st, const char *path,
+    size_t len);
+
+/**
+ * @brief Check if two file stats have the same path.
+ *
+ * Files with the same hash may still have different paths.
+ *
+ * @return  1 if the paths are the same, 0 if not.
+ */
+int csync_file_stat_path_equal(const csync_file_stat_t *a,
+    const csync_file_stat_t *b);
+
+/**
+ * @brief Compare two file stats by path hash and path, the order of the trees.
+ *
+ * @return  An integer less than, equal to, or greater than zero, zero if
+ *          the paths are the same.
+ */
+int csync_file_stat_cmp(const void *a, const void *b);
+
+/**
+ * @brief Find the file with the path of another file in a tree.
+ *
+ * Unlike c_htable_find() with the hash it doesn't mix up files with the
+ * same hash.
+ *
+ * @return  The file, NULL if it isn't in the tree.
+ */
+csync_file_stat_t *csync_file_tree_find(c_htable_t *tree,
+    const csync_file_stat_t *st);
+
+/**
+ * @brief Find a file by its path in a tree.
+ *
+ * @param tree    The tree to search.
+ *
+ * @param phash   The hash of the path, see csync_path_hash().
+ *
+ * @param path    The path relative to the replica.
+ *
+ * @param len     The length of the path.
+ *
+ * @return  The file, NULL if it isn't in the tree.
+ */
+csync_file_stat_t *csync_file_tree_find_path(c_htable_t *tree, uint64_t phash,
+    const char *path, size_t len);
+
+/**
+ * @brief Get the index of an owner, adding it if it is new.
+ *
+ * @return  The index, -1 if no memory was available.
+ */
+int csync_owner_id(CSYNC *ctx, uid_t uid, gid_t gid);
+
+uid_t csync_owner_uid(CSYNC *ctx, uint32_t owner);
+
+gid_t csync_owner_gid(CSYNC *ctx, uint32_t owner);
+
 int csync_unix_extensions(CSYNC *ctx);
 
 #endif /* _CSYNC_UTIL_H */
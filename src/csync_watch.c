@@ -0,0 +1,695 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008      by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "c_lib.h"
+
+#include "csync_private.h"
+#include "csync_exclude.h"
+#include "csync_util.h"
+#include "csync_watch.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.watch"
+#include "csync_log.h"
+
+/* changes loaded from the journal */
+struct csync_watch_journal_s {
+  unsigned long long generation;
+  /* end of the last complete record */
+  off_t end;
+  int valid;
+  uint64_t *changed;
+  size_t count;
+};
+
+static char *_csync_watch_journal_file(CSYNC *ctx) {
+  char *file = NULL;
+
+  if (asprintf(&file, "%s/%s", ctx->local.uri, CSYNC_WATCH_JOURNAL) < 0) {
+    return NULL;
+  }
+
+  return file;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define CSYNC_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+    IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW | IN_ONLYDIR)
+
+struct csync_watch_s {
+  CSYNC *ctx;
+  /* inotify instance */
+  int fd;
+  /* locked journal */
+  int journal;
+  unsigned long long generation;
+  /* relative path of the directory by watch descriptor */
+  char **paths;
+  size_t size;
+  /* last directory recorded for the current batch of events */
+  char *last;
+};
+
+static int _csync_watch_write(csync_watch_t *w, const char *fmt, ...)
+    PRINTF_ATTRIBUTE(2, 3);
+
+/* Start a new generation of the journal */
+static int _csync_watch_reset(csync_watch_t *w, char type) {
+  if (ftruncate(w->journal, 0) < 0) {
+    return -1;
+  }
+  SAFE_FREE(w->last);
+  w->generation++;
+
+  return _csync_watch_write(w, "%c %llu\n", type, w->generation);
+}
+
+static int _csync_watch_write(csync_watch_t *w, const char *fmt, ...) {
+  va_list ap;
+  char *line = NULL;
+  ssize_t len;
+  off_t size;
+  int rc;
+
+  va_start(ap, fmt);
+  len = vasprintf(&line, fmt, ap);
+  va_end(ap);
+  if (len < 0) {
+    return -1;
+  }
+
+  rc = write(w->journal, line, len) == len ? 0 : -1;
+  SAFE_FREE(line);
+  if (rc < 0) {
+    return -1;
+  }
+
+  size = lseek(w->journal, 0, SEEK_END);
+  if (size > CSYNC_WATCH_JOURNAL_MAX_SIZE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "Change journal exceeds %d bytes, truncating it",
+        CSYNC_WATCH_JOURNAL_MAX_SIZE);
+    return _csync_watch_reset(w, 'O');
+  }
+
+  return 0;
+}
+
+/* Record a changed directory, once per batch of events */
+static int _csync_watch_changed(csync_watch_t *w, const char *path) {
+  if (w->last != NULL && c_streq(w->last, path)) {
+    return 0;
+  }
+
+  if (_csync_watch_write(w, "D %s\n", path) < 0) {
+    return -1;
+  }
+
+  SAFE_FREE(w->last);
+  w->last = c_strdup(path);
+
+  return 0;
+}
+
+/* Watch a directory and all directories below */
+static int _csync_watch_add(csync_watch_t *w, const char *path, int record) {
+  char errbuf[256] = {0};
+  char *uri = NULL;
+  char *child = NULL;
+  DIR *dh = NULL;
+  struct dirent *dirent = NULL;
+  struct stat sb;
+  int wd;
+  int rc = -1;
+
+  if (path[0] == '\0') {
+    uri = c_strdup(w->ctx->local.uri);
+  } else if (asprintf(&uri, "%s/%s", w->ctx->local.uri, path) < 0) {
+    uri = NULL;
+  }
+  if (uri == NULL) {
+    return -1;
+  }
+
+  wd = inotify_add_watch(w->fd, uri, CSYNC_WATCH_MASK);
+  if (wd < 0) {
+    /* removed again or not a directory anymore */
+    if (errno == ENOENT || errno == ENOTDIR || errno == EACCES) {
+      rc = 0;
+      goto out;
+    }
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Unable to watch %s - %s%s", uri,
+        errbuf, errno == ENOSPC ? " (raise fs.inotify.max_user_watches)" : "");
+    goto out;
+  }
+
+  if ((size_t) wd >= w->size) {
+    size_t size = w->size ? w->size : 64;
+    char **paths = NULL;
+
+    while (size <= (size_t) wd) {
+      size *= 2;
+    }
+    paths = c_realloc(w->paths, size * sizeof(char *));
+    if (paths == NULL) {
+      goto out;
+    }
+    memset(paths + w->size, 0, (size - w->size) * sizeof(char *));
+    w->paths = paths;
+    w->size = size;
+  }
+
+  /* a directory moved within the replica keeps its watch descriptor */
+  SAFE_FREE(w->paths[wd]);
+  w->paths[wd] = c_strdup(path);
+  if (w->paths[wd] == NULL) {
+    goto out;
+  }
+
+  /* files may have been created before the watch was added */
+  if (record && _csync_watch_changed(w, path) < 0) {
+    goto out;
+  }
+
+  dh = opendir(uri);
+  if (dh == NULL) {
+    rc = 0;
+    goto out;
+  }
+
+  while ((dirent = readdir(dh)) != NULL) {
+    const char *name = dirent->d_name;
+
+    if (name[0] == '.' && (name[1] == '\0' ||
+          (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+
+    if (path[0] == '\0') {
+      child = c_strdup(name);
+    } else if (asprintf(&child, "%s/%s", path, name) < 0) {
+      child = NULL;
+    }
+    if (child == NULL) {
+      goto out;
+    }
+
+    if (dirent->d_type == DT_UNKNOWN) {
+      char *filename = NULL;
+
+      if (asprintf(&filename, "%s/%s", uri, name) < 0) {
+        goto out;
+      }
+      if (lstat(filename, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+        dirent->d_type = DT_DIR;
+      }
+      SAFE_FREE(filename);
+    }
+
+    if (dirent->d_type == DT_DIR && ! csync_excluded(w->ctx, child)) {
+      if (_csync_watch_add(w, child, record) < 0) {
+        goto out;
+      }
+    }
+    SAFE_FREE(child);
+  }
+
+  rc = 0;
+out:
+  if (dh != NULL) {
+    closedir(dh);
+  }
+  SAFE_FREE(child);
+  SAFE_FREE(uri);
+  return rc;
+}
+
+static int _csync_watch_event(csync_watch_t *w,
+    const struct inotify_event *ev) {
+  const char *dir = NULL;
+  char *path = NULL;
+  int rc = 0;
+
+  if (ev->mask & IN_Q_OVERFLOW) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Event queue overflowed");
+    return _csync_watch_reset(w, 'O');
+  }
+
+  if (ev->wd < 0 || (size_t) ev->wd >= w->size || w->paths[ev->wd] == NULL) {
+    return 0;
+  }
+  dir = w->paths[ev->wd];
+
+  if (ev->mask & IN_IGNORED) {
+    SAFE_FREE(w->paths[ev->wd]);
+    return 0;
+  }
+
+  if (ev->len > 0 && ev->name[0] != '\0') {
+    /* the journal can't record it */
+    if (strchr(ev->name, '\n') != NULL) {
+      return _csync_watch_reset(w, 'O');
+    }
+
+    if (dir[0] == '\0') {
+      path = c_strdup(ev->name);
+    } else if (asprintf(&path, "%s/%s", dir, ev->name) < 0) {
+      path = NULL;
+    }
+    if (path == NULL) {
+      return -1;
+    }
+
+    if (csync_excluded(w->ctx, path)) {
+      SAFE_FREE(path);
+      return 0;
+    }
+
+    if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+      rc = _csync_watch_add(w, path, 1);
+    }
+    SAFE_FREE(path);
+    /* the watch table may have been resized */
+    dir = w->paths[ev->wd];
+    if (rc < 0 || dir == NULL) {
+      return rc;
+    }
+  }
+
+  return _csync_watch_changed(w, dir);
+}
+
+csync_watch_t *csync_watch_start(CSYNC *ctx) {
+  csync_watch_t *w = NULL;
+  char *file = NULL;
+
+  if (ctx == NULL) {
+    errno = EBADF;
+    return NULL;
+  }
+
+  w = c_malloc(sizeof(csync_watch_t));
+  if (w == NULL) {
+    return NULL;
+  }
+  w->ctx = ctx;
+  w->journal = -1;
+  w->generation = (unsigned long long) time(NULL) * 1000;
+
+  w->fd = inotify_init();
+  if (w->fd < 0) {
+    goto error;
+  }
+  fcntl(w->fd, F_SETFD, FD_CLOEXEC);
+
+  file = _csync_watch_journal_file(ctx);
+  if (file == NULL) {
+    goto error;
+  }
+
+  w->journal = open(file, O_RDWR | O_CREAT | O_APPEND, 0600);
+  if (w->journal < 0) {
+    goto error;
+  }
+  fcntl(w->journal, F_SETFD, FD_CLOEXEC);
+
+  if (flock(w->journal, LOCK_EX | LOCK_NB) < 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "%s is locked by another watcher",
+        file);
+    errno = EBUSY;
+    goto error;
+  }
+
+  /* nothing recorded so far is valid */
+  if (ftruncate(w->journal, 0) < 0) {
+    goto error;
+  }
+
+  if (_csync_watch_add(w, "", 0) < 0) {
+    goto error;
+  }
+
+  /* the journal becomes usable once all directories are watched */
+  if (_csync_watch_write(w, "B %llu\n", w->generation) < 0) {
+    goto error;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO, "Watching %s", ctx->local.uri);
+  SAFE_FREE(file);
+
+  return w;
+error:
+  SAFE_FREE(file);
+  csync_watch_stop(w);
+  return NULL;
+}
+
+int csync_watch_poll(csync_watch_t *w, int timeout) {
+  char buf[64 * 1024]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct pollfd pfd;
+  const struct inotify_event *ev = NULL;
+  ssize_t len;
+  char *p = NULL;
+  int count = 0;
+  int rc;
+
+  if (w == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  pfd.fd = w->fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  rc = poll(&pfd, 1, timeout);
+  if (rc <= 0) {
+    return (rc < 0 && errno != EINTR) ? -1 : 0;
+  }
+
+  len = read(w->fd, buf, sizeof(buf));
+  if (len < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+
+  /* don't record the same directory twice for the events read at once */
+  SAFE_FREE(w->last);
+
+  for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+    ev = (const struct inotify_event *) p;
+    if (_csync_watch_event(w, ev) < 0) {
+      return -1;
+    }
+    count++;
+  }
+
+  return count;
+}
+
+void csync_watch_stop(csync_watch_t *w) {
+  size_t i;
+
+  if (w == NULL) {
+    return;
+  }
+
+  if (w->fd >= 0) {
+    close(w->fd);
+  }
+  if (w->journal >= 0) {
+    close(w->journal);
+  }
+
+  for (i = 0; i < w->size; i++) {
+    SAFE_FREE(w->paths[i]);
+  }
+  SAFE_FREE(w->paths);
+  SAFE_FREE(w->last);
+  SAFE_FREE(w);
+}
+
+#else /* HAVE_SYS_INOTIFY_H */
+
+csync_watch_t *csync_watch_start(CSYNC *ctx) {
+  (void) ctx;
+  errno = ENOSYS;
+  return NULL;
+}
+
+int csync_watch_poll(csync_watch_t *w, int timeout) {
+  (void) w;
+  (void) timeout;
+  errno = ENOSYS;
+  return -1;
+}
+
+void csync_watch_stop(csync_watch_t *w) {
+  (void) w;
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
+static int _csync_watch_hash_cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Find the records of the current generation not synchronized yet */
+static int _csync_watch_journal_parse(struct csync_watch_journal_s *j,
+    const char *buf, size_t len) {
+  unsigned long long sync_generation = 0;
+  unsigned long long sync_offset = 0;
+  size_t generation_end = 0;
+  int have_generation = 0;
+  int have_sync = 0;
+  const char *line = NULL;
+  const char *nl = NULL;
+  size_t size = 0;
+
+  /* ignore a record which is still being written */
+  for (line = buf; (nl = memchr(line, '\n', len - (line - buf))) != NULL;
+       line = nl + 1) {
+    switch (line[0]) {
+      case 'B':
+      case 'O':
+        j->generation = strtoull(line + 2, NULL, 10);
+        generation_end = nl + 1 - buf;
+        have_generation = 1;
+        have_sync = 0;
+        break;
+      case 'S':
+        if (sscanf(line + 2, "%llu %llu", &sync_generation,
+              &sync_offset) == 2) {
+          have_sync = 1;
+        }
+        break;
+      default:
+        break;
+    }
+    j->end = nl + 1 - buf;
+  }
+
+  if (! have_generation) {
+    return 0;
+  }
+
+  if (! have_sync || sync_generation != j->generation ||
+      sync_offset < generation_end || sync_offset > (size_t) j->end) {
+    return 0;
+  }
+
+  for (line = buf; line < buf + j->end; line = nl + 1) {
+    nl = memchr(line, '\n', j->end - (line - buf));
+    if (line[0] != 'D' || nl - line < 2 ||
+        (size_t) (line - buf) < sync_offset) {
+      continue;
+    }
+
+    if (j->count == size) {
+      uint64_t *changed = NULL;
+
+      size = size ? size * 2 : 64;
+      changed = c_realloc(j->changed, size * sizeof(uint64_t));
+      if (changed == NULL) {
+        return -1;
+      }
+      j->changed = changed;
+    }
+    j->changed[j->count++] = csync_path_hash(line + 2, nl - line - 2);
+  }
+
+  qsort(j->changed, j->count, sizeof(uint64_t), _csync_watch_hash_cmp);
+  j->valid = 1;
+
+  return 0;
+}
+
+int csync_watch_journal_load(CSYNC *ctx) {
+  struct csync_watch_journal_s *j = NULL;
+  struct stat sb;
+  char *file = NULL;
+  char *buf = NULL;
+  size_t len = 0;
+  ssize_t n;
+  int fd = -1;
+  int rc = 0;
+
+  csync_watch_journal_free(ctx);
+
+  file = _csync_watch_journal_file(ctx);
+  if (file == NULL) {
+    goto out;
+  }
+
+  fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    goto out;
+  }
+
+  /* the watcher keeps the journal locked */
+  if (flock(fd, LOCK_SH | LOCK_NB) == 0 || errno != EWOULDBLOCK) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO,
+        "No watcher running for %s, ignoring the change journal",
+        ctx->local.uri);
+    goto out;
+  }
+
+  if (fstat(fd, &sb) < 0 || sb.st_size > 2 * CSYNC_WATCH_JOURNAL_MAX_SIZE) {
+    goto out;
+  }
+
+  buf = c_malloc(sb.st_size + 1);
+  if (buf == NULL) {
+    goto out;
+  }
+
+  while (len < (size_t) sb.st_size &&
+      (n = read(fd, buf + len, sb.st_size - len)) > 0) {
+    len += n;
+  }
+
+  j = c_malloc(sizeof(struct csync_watch_journal_s));
+  if (j == NULL) {
+    goto out;
+  }
+
+  if (_csync_watch_journal_parse(j, buf, len) < 0) {
+    SAFE_FREE(j->changed);
+    SAFE_FREE(j);
+    goto out;
+  }
+
+  if (j->valid) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "Change journal lists %zu changes since the last synchronization",
+        j->count);
+    rc = 1;
+  } else {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO,
+        "Change journal is incomplete, walking the whole local replica");
+  }
+  ctx->local.watch = j;
+
+out:
+  if (fd >= 0) {
+    close(fd);
+  }
+  SAFE_FREE(buf);
+  SAFE_FREE(file);
+  return rc;
+}
+
+int csync_watch_journal_changed(CSYNC *ctx, const char *path) {
+  struct csync_watch_journal_s *j = ctx->local.watch;
+  uint64_t h;
+
+  if (j == NULL || ! j->valid) {
+    return -1;
+  }
+
+  h = csync_path_hash(path, strlen(path));
+
+  return bsearch(&h, j->changed, j->count, sizeof(uint64_t),
+      _csync_watch_hash_cmp) != NULL;
+}
+
+int csync_watch_journal_commit(CSYNC *ctx) {
+  struct csync_watch_journal_s *j = ctx->local.watch;
+  char *file = NULL;
+  char *line = NULL;
+  int fd = -1;
+  int len;
+  int rc = -1;
+
+  /* the watcher didn't start a generation yet */
+  if (j == NULL || j->generation == 0) {
+    return 0;
+  }
+
+  file = _csync_watch_journal_file(ctx);
+  if (file == NULL) {
+    goto out;
+  }
+
+  fd = open(file, O_WRONLY | O_APPEND);
+  if (fd < 0) {
+    goto out;
+  }
+
+  len = asprintf(&line, "S %llu %llu\n", j->generation,
+      (unsigned long long) j->end);
+  if (len < 0) {
+    line = NULL;
+    goto out;
+  }
+
+  if (write(fd, line, len) != len) {
+    goto out;
+  }
+
+  rc = 0;
+out:
+  if (fd >= 0) {
+    close(fd);
+  }
+  SAFE_FREE(line);
+  SAFE_FREE(file);
+  return rc;
+}
+
+void csync_watch_journal_free(CSYNC *ctx) {
+  if (ctx->local.watch == NULL) {
+    return;
+  }
+
+  SAFE_FREE(ctx->local.watch->changed);
+  SAFE_FREE(ctx->local.watch);
+}
+
+/* vim: set ts=8 sw=2 et cindent: */
@@ -0,0 +1,136 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2008      by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _CSYNC_WATCH_H
+#define _CSYNC_WATCH_H
+
+#include "csync.h"
+
+/**
+ * @file csync_watch.h
+ *
+ * @brief Change journal of the local replica
+ *
+ * A watcher process records the directories of the local replica in which
+ * something has been created, modified, removed or moved into a journal next
+ * to the statedb. The update detection only reads these directories and takes
+ * the content of all other directories from the statedb.
+ *
+ * The journal is a text file with one record per line:
+ *
+ *   B <generation>           watcher started
+ *   O <generation>           journal overflowed and has been truncated
+ *   D <path>                 something changed in the directory <path>
+ *   S <generation> <offset>  synchronized with the changes up to <offset>
+ *
+ * The journal is only used if the watcher is still running and the last
+ * synchronization happened within the current generation. Otherwise the
+ * whole local replica is walked.
+ *
+ * @defgroup csyncWatchInternals csync change journal internals
+ * @ingroup csyncInternalAPI
+ *
+ * @{
+ */
+
+#define CSYNC_WATCH_JOURNAL ".csync_journal.db.watch"
+
+/* truncate the journal and force a full scan if it grows bigger */
+#define CSYNC_WATCH_JOURNAL_MAX_SIZE (8 * 1024 * 1024)
+
+typedef struct csync_watch_s csync_watch_t;
+
+/**
+ * @brief Start watching the local replica.
+ *
+ * This adds a watch for every directory of the local replica and starts a new
+ * generation of the journal. The journal stays locked till the watcher is
+ * stopped.
+ *
+ * @param ctx           The csync context.
+ *
+ * @return  The watcher, NULL on error with errno set. EBUSY if another
+ *          watcher is running, ENOSYS if the platform is not supported.
+ */
+csync_watch_t *csync_watch_start(CSYNC *ctx);
+
+/**
+ * @brief Wait for changes and record them in the journal.
+ *
+ * @param w             The watcher.
+ *
+ * @param timeout       Milliseconds to wait for changes, -1 to wait forever.
+ *
+ * @return  The number of events processed, -1 on error with errno set.
+ */
+int csync_watch_poll(csync_watch_t *w, int timeout);
+
+/**
+ * @brief Stop watching and unlock the journal.
+ *
+ * @param w             The watcher to free.
+ */
+void csync_watch_stop(csync_watch_t *w);
+
+/**
+ * @brief Load the changes recorded since the last synchronization.
+ *
+ * @param ctx           The csync context.
+ *
+ * @return  1 if the journal can be used, 0 if the local replica has to be
+ *          walked completely.
+ */
+int csync_watch_journal_load(CSYNC *ctx);
+
+/**
+ * @brief Check if a directory of the local replica has changed.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param path          The path of the directory relative to the replica.
+ *
+ * @return  1 if the directory has changed, 0 if not and -1 if there is no
+ *          usable journal.
+ */
+int csync_watch_journal_changed(CSYNC *ctx, const char *path);
+
+/**
+ * @brief Mark the loaded changes as synchronized.
+ *
+ * Call this after the statedb has been written.
+ *
+ * @param ctx           The csync context.
+ *
+ * @return  0 on success, less than 0 if an error occured with errno set.
+ */
+int csync_watch_journal_commit(CSYNC *ctx);
+
+/**
+ * @brief Free the loaded changes.
+ *
+ * @param ctx           The csync context.
+ */
+void csync_watch_journal_free(CSYNC *ctx);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_WATCH_H */
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -0,0 +1,134 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008 by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ts=2 sw=2 et cindent
+ */
+
+#include <errno.h>
+
+#include "c_macro.h"
+#include "c_alloc.h"
+#include "c_arena.h"
+
+#define C_ARENA_ALIGN 16
+#define C_ARENA_ALIGNED(x) (((x) + C_ARENA_ALIGN - 1) & ~((size_t) C_ARENA_ALIGN - 1))
+
+struct c_arena_block_s {
+  struct c_arena_block_s *next;
+  size_t size;
+  size_t used;
+};
+
+/* the block header is followed by the memory handed out */
+#define C_ARENA_HEADER C_ARENA_ALIGNED(sizeof(struct c_arena_block_s))
+
+struct c_arena_s {
+  /* block allocations are taken from, the others follow it */
+  struct c_arena_block_s *head;
+  size_t block_size;
+  size_t size;
+  size_t used;
+};
+
+static struct c_arena_block_s *_c_arena_block_new(size_t size) {
+  struct c_arena_block_s *block;
+
+  /* c_malloc() zeroes the memory, allocations don't need to */
+  block = c_malloc(C_ARENA_HEADER + size);
+  if (block == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  block->size = size;
+
+  return block;
+}
+
+c_arena_t *c_arena_new(size_t block_size) {
+  c_arena_t *arena;
+
+  arena = c_malloc(sizeof(c_arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->block_size = C_ARENA_ALIGNED(block_size ? block_size : C_ARENA_BLOCK_SIZE);
+
+  return arena;
+}
+
+void *c_arena_alloc(c_arena_t *arena, size_t size) {
+  struct c_arena_block_s *block;
+
+  if (arena == NULL || size == 0) {
+    return NULL;
+  }
+  size = C_ARENA_ALIGNED(size);
+
+  block = arena->head;
+  if (block == NULL || block->used + size > block->size) {
+    if (size > arena->block_size / 4) {
+      /* a block of its own, keep filling the current one */
+      block = _c_arena_block_new(size);
+      if (block == NULL) {
+        return NULL;
+      }
+      if (arena->head != NULL) {
+        block->next = arena->head->next;
+        arena->head->next = block;
+      } else {
+        arena->head = block;
+      }
+    } else {
+      block = _c_arena_block_new(arena->block_size);
+      if (block == NULL) {
+        return NULL;
+      }
+      block->next = arena->head;
+      arena->head = block;
+    }
+    arena->size += block->size;
+  }
+
+  block->used += size;
+  arena->used += size;
+
+  return (char *) block + C_ARENA_HEADER + block->used - size;
+}
+
+void c_arena_free(c_arena_t *arena) {
+  struct c_arena_block_s *block;
+
+  if (arena == NULL) {
+    return;
+  }
+
+  while ((block = arena->head) != NULL) {
+    arena->head = block->next;
+    SAFE_FREE(block);
+  }
+  SAFE_FREE(arena);
+}
+
+size_t c_arena_size(const c_arena_t *arena) {
+  return arena != NULL ? arena->size : 0;
+}
+
+size_t c_arena_used(const c_arena_t *arena) {
+  return arena != NULL ? arena->used : 0;
+}
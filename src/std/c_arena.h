@@ -0,0 +1,105 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008 by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ts=2 sw=2 et cindent
+ */
+
+/**
+ * @file c_arena.h
+ *
+ * @brief Interface of the cynapses libc arena allocator
+ *
+ * An arena hands out memory from big blocks and releases all of it at once.
+ * Single allocations can't be freed. This avoids the overhead and the heap
+ * fragmentation of a lot of small allocations living till the same point.
+ *
+ * An arena is not thread safe.
+ *
+ * @defgroup cynArenaInternals cynapses libc arena functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+
+#ifndef _C_ARENA_H
+#define _C_ARENA_H
+
+#include <stdlib.h>
+
+/**
+ * Default size of the blocks of an arena.
+ */
+#define C_ARENA_BLOCK_SIZE (256 * 1024)
+
+typedef struct c_arena_s c_arena_t;
+
+/**
+ * @brief Create an arena.
+ *
+ * @param block_size  Size of the blocks to allocate from the system, 0 to use
+ *                    C_ARENA_BLOCK_SIZE.
+ *
+ * @return  The arena, NULL if insufficient memory was available.
+ */
+c_arena_t *c_arena_new(size_t block_size);
+
+/**
+ * @brief Allocate memory from an arena.
+ *
+ * The memory is set to zero and aligned for any kind of variable. Requests
+ * bigger than a quarter of the block size get a block of their own.
+ *
+ * @param arena   The arena to allocate from.
+ *
+ * @param size    Size in bytes to allocate.
+ *
+ * @return  A pointer to the memory, which stays valid till the arena is
+ *          freed. NULL if size is 0 or insufficient memory was available.
+ */
+void *c_arena_alloc(c_arena_t *arena, size_t size);
+
+/**
+ * @brief Free an arena and all memory allocated from it.
+ *
+ * @param arena   The arena to free, may be NULL.
+ */
+void c_arena_free(c_arena_t *arena);
+
+/**
+ * @brief Get the memory an arena allocated from the system.
+ *
+ * @param arena   The arena to check.
+ *
+ * @return  The size of all blocks in bytes.
+ */
+size_t c_arena_size(const c_arena_t *arena);
+
+/**
+ * @brief Get the memory handed out by an arena.
+ *
+ * @param arena   The arena to check.
+ *
+ * @return  The size of all allocations in bytes, including alignment.
+ */
+size_t c_arena_used(const c_arena_t *arena);
+
+/**
+ * }@
+ */
+#endif /* _C_ARENA_H */
@@ -36,6 +36,17 @@
 
 #include "c_private.h"
 
+#ifdef HAVE_FICLONE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+/* the largest chunk copy_file_range() and sendfile() copy at once */
+#define C_COPY_CHUNK_SIZE 0x7ffff000
+
 /* check if path is a file */
 int c_isfile(const char *path) {
   csync_stat_t sb;
@@ -55,6 +66,79 @@ int c_isfile(const char *path) {
   return 0;
 }
 
+/* errors of a kernel copy which mean it doesn't work for these files */
+static int _c_copy_unsupported(int err) {
+  switch (err) {
+    case ENOSYS:
+    case EXDEV:
+    case EINVAL:
+    case EBADF:
+#ifdef EOPNOTSUPP
+    case EOPNOTSUPP:
+#endif
+#if defined(ENOTSUP) && ENOTSUP != EOPNOTSUPP
+    case ENOTSUP:
+#endif
+    case ENOTTY:
+      return 1;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+off_t c_copy_fd(int srcfd, int dstfd) {
+  off_t copied = 0;
+  ssize_t n = -1;
+
+#ifdef HAVE_FICLONE
+  {
+    csync_stat_t sb;
+
+    /* the whole file shares its blocks, only from the start */
+    if (lseek(srcfd, 0, SEEK_CUR) == 0 && fstat(srcfd, &sb) == 0 &&
+        ioctl(dstfd, FICLONE, srcfd) == 0) {
+      if (lseek(srcfd, sb.st_size, SEEK_SET) < 0 ||
+          lseek(dstfd, sb.st_size, SEEK_SET) < 0) {
+        return -1;
+      }
+      return sb.st_size;
+    }
+  }
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+  while ((n = copy_file_range(srcfd, NULL, dstfd, NULL,
+          C_COPY_CHUNK_SIZE, 0)) > 0) {
+    copied += n;
+  }
+  if (n == 0) {
+    return copied;
+  }
+  if (copied > 0 || ! _c_copy_unsupported(errno)) {
+    return -1;
+  }
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+  while ((n = sendfile(dstfd, srcfd, NULL, C_COPY_CHUNK_SIZE)) > 0) {
+    copied += n;
+  }
+  if (n == 0) {
+    return copied;
+  }
+  if (copied > 0 || ! _c_copy_unsupported(errno)) {
+    return -1;
+  }
+#endif
+
+  (void) n;
+  errno = ENOSYS;
+
+  return -1;
+}
+
 /* copy file from src to dst, overwrites dst */
 int c_copy(const char* src, const char *dst, mode_t mode) {
   int srcfd = -1;
@@ -109,6 +193,14 @@ int c_copy(const char* src, const char *dst, mode_t mode) {
     goto out;
   }
 
+  /* let the kernel copy the data if it can */
+  if (c_copy_fd(srcfd, dstfd) >= 0) {
+    goto done;
+  } else if (errno != ENOSYS) {
+    rc = -1;
+    goto out;
+  }
+
   for (;;) {
     bread = read(srcfd, buf, sizeof(buf));
     if (bread == 0) {
@@ -134,6 +226,7 @@ int c_copy(const char* src, const char *dst, mode_t mode) {
     }
   }
 
+done:
 #ifdef __unix__
   fsync(dstfd);
 #endif
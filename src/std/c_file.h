@@ -63,6 +63,23 @@ int c_isfile(const char *path);
  */
 int c_copy(const char *src, const char *dst, mode_t mode);
 
+/**
+ * @brief Copy the data of a file to another one in the kernel.
+ *
+ * The data is shared with a reflink (FICLONE) if the filesystem supports
+ * it, else it is copied with copy_file_range() or sendfile(), whatever
+ * works for the two files. The data is copied from the current offset of
+ * the source to its end, the destination should be empty.
+ *
+ * @param srcfd  The file descriptor of the source file.
+ * @param dstfd  The file descriptor of the destination file.
+ *
+ * @return       The number of bytes copied, -1 on error with errno set.
+ *               ENOSYS if the kernel can't copy between the files, nothing
+ *               has been copied then.
+ */
+off_t c_copy_fd(int srcfd, int dstfd);
+
 /**
  * }@
  */
@@ -0,0 +1,515 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008 by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ts=2 sw=2 et cindent
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "c_macro.h"
+#include "c_alloc.h"
+#include "c_htable.h"
+
+#define C_HTABLE_GROUP 16
+
+/* control bytes of the slots without an entry, a full slot has the seven
+ * bits of the hash of its key */
+#define C_HTABLE_EMPTY ((uint8_t) 0x80)
+#define C_HTABLE_DELETED ((uint8_t) 0xfe)
+
+struct c_htable_entry_s {
+  uint64_t key;
+  void *data;
+};
+
+struct c_htable_s {
+  /* one byte per slot */
+  uint8_t *ctrl;
+  struct c_htable_entry_s *entries;
+  /* slots, a power of two and a multiple of the group size */
+  size_t capacity;
+  size_t size;
+  size_t deleted;
+  c_htable_compare_func *data_compare;
+
+  /* changes with every insert and remove */
+  unsigned long version;
+  /* the sorted snapshot and the version it was made of */
+  void **sorted;
+  unsigned long sorted_version;
+};
+
+/* the keys are often hashes already, but maybe not good ones */
+static inline uint64_t _c_htable_hash(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+
+  return key;
+}
+
+#ifdef __SSE2__
+/* bit i is set if control byte i of the group is b */
+static inline unsigned int _c_htable_match(const uint8_t *ctrl, uint8_t b) {
+  __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) b)));
+}
+
+/* bit i is set if slot i of the group is empty or deleted */
+static inline unsigned int _c_htable_match_free(const uint8_t *ctrl) {
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+}
+#else
+static inline unsigned int _c_htable_match(const uint8_t *ctrl, uint8_t b) {
+  unsigned int mask = 0;
+  int i;
+
+  for (i = 0; i < C_HTABLE_GROUP; i++) {
+    if (ctrl[i] == b) {
+      mask |= 1u << i;
+    }
+  }
+
+  return mask;
+}
+
+static inline unsigned int _c_htable_match_free(const uint8_t *ctrl) {
+  unsigned int mask = 0;
+  int i;
+
+  for (i = 0; i < C_HTABLE_GROUP; i++) {
+    if (ctrl[i] & 0x80) {
+      mask |= 1u << i;
+    }
+  }
+
+  return mask;
+}
+#endif
+
+static inline int _c_htable_ctz(unsigned int mask) {
+#ifdef __GNUC__
+  return __builtin_ctz(mask);
+#else
+  int i = 0;
+
+  while ((mask & 1) == 0) {
+    mask >>= 1;
+    i++;
+  }
+
+  return i;
+#endif
+}
+
+/*
+ * The groups are probed with triangular steps, which visit every group of a
+ * power of two number of groups.
+ */
+static size_t _c_htable_free_slot(const uint8_t *ctrl, size_t capacity,
+    uint64_t hash) {
+  size_t mask = capacity / C_HTABLE_GROUP - 1;
+  size_t group = hash & mask;
+  size_t step = 0;
+  unsigned int match;
+
+  for (;;) {
+    match = _c_htable_match_free(ctrl + group * C_HTABLE_GROUP);
+    if (match != 0) {
+      return group * C_HTABLE_GROUP + _c_htable_ctz(match);
+    }
+    step++;
+    group = (group + step) & mask;
+  }
+}
+
+static int _c_htable_resize(c_htable_t *htable, size_t capacity) {
+  struct c_htable_entry_s *entries;
+  uint8_t *ctrl;
+  size_t i;
+
+  ctrl = c_malloc(capacity);
+  entries = c_malloc(capacity * sizeof(struct c_htable_entry_s));
+  if (ctrl == NULL || entries == NULL) {
+    SAFE_FREE(ctrl);
+    SAFE_FREE(entries);
+    errno = ENOMEM;
+    return -1;
+  }
+  memset(ctrl, C_HTABLE_EMPTY, capacity);
+
+  for (i = 0; i < htable->capacity; i++) {
+    if ((htable->ctrl[i] & 0x80) == 0) {
+      uint64_t hash = _c_htable_hash(htable->entries[i].key);
+      size_t slot = _c_htable_free_slot(ctrl, capacity, hash);
+
+      ctrl[slot] = hash >> 57;
+      entries[slot] = htable->entries[i];
+    }
+  }
+
+  SAFE_FREE(htable->ctrl);
+  SAFE_FREE(htable->entries);
+  htable->ctrl = ctrl;
+  htable->entries = entries;
+  htable->capacity = capacity;
+  htable->deleted = 0;
+
+  return 0;
+}
+
+int c_htable_create(c_htable_t **htable, c_htable_compare_func *data_compare) {
+  c_htable_t *ht;
+
+  if (htable == NULL || data_compare == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ht = c_malloc(sizeof(c_htable_t));
+  if (ht == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  ht->data_compare = data_compare;
+
+  *htable = ht;
+
+  return 0;
+}
+
+int c_htable_free(c_htable_t *htable) {
+  if (htable == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  SAFE_FREE(htable->ctrl);
+  SAFE_FREE(htable->entries);
+  SAFE_FREE(htable->sorted);
+  SAFE_FREE(htable);
+
+  return 0;
+}
+
+int c_htable_insert(c_htable_t *htable, uint64_t key, void *data) {
+  c_htable_iter_t it;
+  uint64_t hash;
+  size_t slot;
+  void *d;
+
+  if (htable == NULL || data == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (d = c_htable_find(htable, key, &it); d != NULL;
+       d = c_htable_find_next(htable, &it)) {
+    if (htable->data_compare(data, d) == 0) {
+      return 1;
+    }
+  }
+
+  /*
+   * Keep the load including the deleted slots below 7/8, a table which is
+   * mostly deleted slots is cleaned up without growing.
+   */
+  if ((htable->size + htable->deleted + 1) * 8 > htable->capacity * 7) {
+    size_t capacity = htable->capacity ? htable->capacity : C_HTABLE_GROUP;
+
+    while (htable->size + 1 > capacity / 2) {
+      capacity *= 2;
+    }
+    if (_c_htable_resize(htable, capacity) < 0) {
+      return -1;
+    }
+  }
+
+  hash = _c_htable_hash(key);
+  slot = _c_htable_free_slot(htable->ctrl, htable->capacity, hash);
+  if (htable->ctrl[slot] == C_HTABLE_DELETED) {
+    htable->deleted--;
+  }
+  htable->ctrl[slot] = hash >> 57;
+  htable->entries[slot].key = key;
+  htable->entries[slot].data = data;
+  htable->size++;
+  htable->version++;
+
+  return 0;
+}
+
+void *c_htable_find(c_htable_t *htable, uint64_t key, c_htable_iter_t *it) {
+  uint64_t hash;
+
+  if (htable == NULL || it == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (htable->size == 0) {
+    return NULL;
+  }
+
+  hash = _c_htable_hash(key);
+  it->key = key;
+  it->h2 = hash >> 57;
+  it->group = hash & (htable->capacity / C_HTABLE_GROUP - 1);
+  it->step = 0;
+  it->match = _c_htable_match(htable->ctrl + it->group * C_HTABLE_GROUP,
+      it->h2);
+
+  return c_htable_find_next(htable, it);
+}
+
+void *c_htable_find_next(c_htable_t *htable, c_htable_iter_t *it) {
+  size_t mask;
+
+  if (htable == NULL || it == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (htable->size == 0) {
+    return NULL;
+  }
+  mask = htable->capacity / C_HTABLE_GROUP - 1;
+
+  for (;;) {
+    while (it->match != 0) {
+      size_t slot = it->group * C_HTABLE_GROUP + _c_htable_ctz(it->match);
+
+      it->match &= it->match - 1;
+      if (htable->entries[slot].key == it->key &&
+          htable->ctrl[slot] == it->h2) {
+        it->slot = slot;
+        return htable->entries[slot].data;
+      }
+    }
+
+    /* an insert would have used the empty slot, the key isn't further on */
+    if (_c_htable_match(htable->ctrl + it->group * C_HTABLE_GROUP,
+          C_HTABLE_EMPTY) != 0 || it->step == mask) {
+      return NULL;
+    }
+
+    it->step++;
+    it->group = (it->group + it->step) & mask;
+    it->match = _c_htable_match(htable->ctrl + it->group * C_HTABLE_GROUP,
+        it->h2);
+  }
+}
+
+static void *_c_htable_scan(c_htable_t *htable, c_htable_iter_t *it,
+    size_t slot) {
+  for (; slot < htable->capacity; slot++) {
+    if ((htable->ctrl[slot] & 0x80) == 0) {
+      it->slot = slot;
+      return htable->entries[slot].data;
+    }
+  }
+  it->slot = htable->capacity;
+
+  return NULL;
+}
+
+void *c_htable_first(c_htable_t *htable, c_htable_iter_t *it) {
+  if (htable == NULL || it == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return _c_htable_scan(htable, it, 0);
+}
+
+void *c_htable_next(c_htable_t *htable, c_htable_iter_t *it) {
+  if (htable == NULL || it == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return _c_htable_scan(htable, it, it->slot + 1);
+}
+
+int c_htable_remove(c_htable_t *htable, c_htable_iter_t *it) {
+  size_t group;
+
+  if (htable == NULL || it == NULL || it->slot >= htable->capacity ||
+      (htable->ctrl[it->slot] & 0x80) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /*
+   * Lookups stop at a group with an empty slot, so none goes past this
+   * group if it has one and the slot can be emptied.
+   */
+  group = it->slot / C_HTABLE_GROUP * C_HTABLE_GROUP;
+  if (_c_htable_match(htable->ctrl + group, C_HTABLE_EMPTY) != 0) {
+    htable->ctrl[it->slot] = C_HTABLE_EMPTY;
+  } else {
+    htable->ctrl[it->slot] = C_HTABLE_DELETED;
+    htable->deleted++;
+  }
+  htable->size--;
+  htable->version++;
+
+  return 0;
+}
+
+size_t c_htable_size(const c_htable_t *htable) {
+  return htable != NULL ? htable->size : 0;
+}
+
+static inline int _c_htable_entry_cmp(const c_htable_t *htable,
+    const struct c_htable_entry_s *a, const struct c_htable_entry_s *b) {
+  if (a->key != b->key) {
+    return a->key < b->key ? -1 : 1;
+  }
+
+  return htable->data_compare(a->data, b->data);
+}
+
+/* Bottom up merge sort, the result ends up in either of the arrays */
+static struct c_htable_entry_s *_c_htable_sort(const c_htable_t *htable,
+    struct c_htable_entry_s *a, struct c_htable_entry_s *tmp, size_t n) {
+  struct c_htable_entry_s *src = a;
+  struct c_htable_entry_s *dst = tmp;
+  size_t width;
+
+  for (width = 1; width < n; width *= 2) {
+    struct c_htable_entry_s *t;
+    size_t lo;
+
+    for (lo = 0; lo < n; lo += 2 * width) {
+      size_t mid = lo + width < n ? lo + width : n;
+      size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+      size_t i = lo;
+      size_t j = mid;
+      size_t k = lo;
+
+      while (i < mid && j < hi) {
+        if (_c_htable_entry_cmp(htable, &src[j], &src[i]) < 0) {
+          dst[k++] = src[j++];
+        } else {
+          dst[k++] = src[i++];
+        }
+      }
+      while (i < mid) {
+        dst[k++] = src[i++];
+      }
+      while (j < hi) {
+        dst[k++] = src[j++];
+      }
+    }
+
+    t = src;
+    src = dst;
+    dst = t;
+  }
+
+  return src;
+}
+
+void **c_htable_sorted(c_htable_t *htable) {
+  struct c_htable_entry_s *entries;
+  struct c_htable_entry_s *sorted;
+  void **data;
+  size_t i, n = 0;
+
+  if (htable == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (htable->sorted != NULL && htable->sorted_version == htable->version) {
+    return htable->sorted;
+  }
+
+  entries = c_malloc(2 * htable->size * sizeof(struct c_htable_entry_s) + 1);
+  data = c_realloc(htable->sorted, (htable->size + 1) * sizeof(void *));
+  if (entries == NULL || data == NULL) {
+    SAFE_FREE(entries);
+    if (data != NULL) {
+      htable->sorted = data;
+    }
+    errno = ENOMEM;
+    return NULL;
+  }
+  htable->sorted = data;
+
+  for (i = 0; i < htable->capacity; i++) {
+    if ((htable->ctrl[i] & 0x80) == 0) {
+      entries[n++] = htable->entries[i];
+    }
+  }
+
+  sorted = _c_htable_sort(htable, entries, entries + n, n);
+  for (i = 0; i < n; i++) {
+    data[i] = sorted[i].data;
+  }
+  data[n] = NULL;
+  htable->sorted_version = htable->version;
+
+  SAFE_FREE(entries);
+
+  return data;
+}
+
+int c_htable_walk(c_htable_t *htable, void *data, c_htable_visit_func *visitor) {
+  unsigned long version;
+  void **sorted;
+  size_t i;
+  int rc = 0;
+
+  if (htable == NULL || data == NULL || visitor == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  sorted = c_htable_sorted(htable);
+  if (sorted == NULL) {
+    return -1;
+  }
+
+  /* take the snapshot, the visitor may change the table */
+  version = htable->version;
+  htable->sorted = NULL;
+
+  for (i = 0; sorted[i] != NULL; i++) {
+    if (visitor(sorted[i], data) < 0) {
+      rc = -1;
+      break;
+    }
+  }
+
+  if (htable->sorted == NULL && htable->version == version) {
+    htable->sorted = sorted;
+  } else {
+    SAFE_FREE(sorted);
+  }
+
+  return rc;
+}
@@ -0,0 +1,211 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008 by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ft=c.doxygen ts=2 sw=2 et cindent
+ */
+
+/**
+ * @file c_htable.h
+ *
+ * @brief Interface of the cynapses libc hash table implementation
+ *
+ * An open addressing hash table of data pointers with 64 bit keys, laid out
+ * like the Swiss tables of Abseil. The slots are stored in two flat arrays,
+ * one control byte per slot and the key and data of the slots. The control
+ * bytes are probed in groups of 16, with SSE2 a group is compared in a few
+ * instructions, and the entries are only looked at if seven bits of the hash
+ * of their key match. There is no allocation per entry and a lookup touches
+ * about two cache lines.
+ *
+ * Several entries can have the same key, the data compare function tells
+ * them apart. It also orders them in the sorted snapshot used to walk the
+ * table, which is ordered by key first.
+ *
+ * http://abseil.io/blog/20180927-swisstables
+ *
+ * @defgroup cynHTableInternals cynapses libc hash table functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+
+#ifndef _C_HTABLE_H
+#define _C_HTABLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+struct c_htable_s; typedef struct c_htable_s c_htable_t;
+
+/**
+ * @brief Callback function to compare the data of two entries with the same
+ *        key.
+ *
+ * @return  An integer less than, equal to, or greater than zero, like
+ *          strcmp(). Zero means the entries are duplicates.
+ */
+typedef int c_htable_compare_func(const void *a, const void *b);
+
+/**
+ * @brief Visit function for the c_htable_walk() function.
+ *
+ * @param obj    The data of the entry.
+ * @param data   Generic data pointer.
+ *
+ * @return 0 on success, < 0 on error. You should set errno.
+ */
+typedef int c_htable_visit_func(void *obj, void *data);
+
+/**
+ * Position of a lookup or an iteration, it is filled in by c_htable_find()
+ * and c_htable_first().
+ */
+typedef struct c_htable_iter_s {
+  uint64_t key;
+  size_t group;
+  size_t step;
+  size_t slot;
+  unsigned int match;
+  uint8_t h2;
+} c_htable_iter_t;
+
+/**
+ * @brief Create a hash table.
+ *
+ * @param htable        The pointer to assign the allocated table.
+ *
+ * @param data_compare  Callback function to compare the data of two
+ *                      entries with the same key.
+ *
+ * @return  0 on success, -1 if an error occured with errno set.
+ */
+int c_htable_create(c_htable_t **htable, c_htable_compare_func *data_compare);
+
+/**
+ * @brief Free a hash table.
+ *
+ * The data of the entries isn't freed.
+ *
+ * @param htable  The table to free.
+ *
+ * @return  0 on success, -1 if the table is NULL.
+ */
+int c_htable_free(c_htable_t *htable);
+
+/**
+ * @brief Insert data into a hash table.
+ *
+ * @param htable  The table to insert the data into.
+ * @param key     The key of the data, usually a hash of it.
+ * @param data    The data to insert.
+ *
+ * @return  0 on success, 1 if an entry with the key compares equal to the
+ *          data and < 0 if an error occured with errno set.
+ */
+int c_htable_insert(c_htable_t *htable, uint64_t key, void *data);
+
+/**
+ * @brief Find the first entry with a key.
+ *
+ * @param htable  The table to search.
+ * @param key     The key to search for.
+ * @param it      The position of the lookup, for c_htable_find_next().
+ *
+ * @return  The data of the entry, NULL if there is no entry with the key.
+ */
+void *c_htable_find(c_htable_t *htable, uint64_t key, c_htable_iter_t *it);
+
+/**
+ * @brief Find the next entry with the key of a lookup.
+ *
+ * @param htable  The table to search.
+ * @param it      The position of the lookup started by c_htable_find().
+ *
+ * @return  The data of the entry, NULL if there are no more entries.
+ */
+void *c_htable_find_next(c_htable_t *htable, c_htable_iter_t *it);
+
+/**
+ * @brief Start iterating over all entries of a hash table.
+ *
+ * The entries are returned in no particular order, use c_htable_sorted()
+ * for an ordered iteration.
+ *
+ * @param htable  The table to iterate over.
+ * @param it      The position of the iteration.
+ *
+ * @return  The data of the first entry, NULL if the table is empty.
+ */
+void *c_htable_first(c_htable_t *htable, c_htable_iter_t *it);
+
+/**
+ * @brief Get the next entry of an iteration.
+ *
+ * @return  The data of the next entry, NULL at the end.
+ */
+void *c_htable_next(c_htable_t *htable, c_htable_iter_t *it);
+
+/**
+ * @brief Remove the entry last returned by a lookup or an iteration.
+ *
+ * The lookup or iteration can go on afterwards.
+ *
+ * @param htable  The table to remove the entry from.
+ * @param it      The position of the lookup or iteration.
+ *
+ * @return  0 on success, -1 if there is no entry to remove.
+ */
+int c_htable_remove(c_htable_t *htable, c_htable_iter_t *it);
+
+/**
+ * @brief Get the number of entries of a hash table.
+ */
+size_t c_htable_size(const c_htable_t *htable);
+
+/**
+ * @brief Get the entries sorted by key and data.
+ *
+ * The array is kept by the table until it changes, getting it again is
+ * free. It must not be freed or used after the table changed.
+ *
+ * @param htable  The table to sort.
+ *
+ * @return  The data of the c_htable_size() entries followed by NULL, NULL
+ *          if an error occured with errno set.
+ */
+void **c_htable_sorted(c_htable_t *htable);
+
+/**
+ * @brief Call a function for every entry in sorted order.
+ *
+ * The visitor may change the table, the entries are the ones of the table
+ * when the walk started.
+ *
+ * @param htable   The table to walk.
+ * @param data     Generic data pointer passed to the visitor.
+ * @param visitor  The function to call for every entry.
+ *
+ * @return  0 on success, -1 if an error occured or the visitor failed.
+ */
+int c_htable_walk(c_htable_t *htable, void *data, c_htable_visit_func *visitor);
+
+/**
+ * }@
+ */
+#endif /* _C_HTABLE_H */
@@ -0,0 +1,173 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008 by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ts=2 sw=2 et cindent
+ */
+
+#include <string.h>
+
+#include "c_xxhash.h"
+
+#define C_XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define C_XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define C_XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define C_XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define C_XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define C_XXH_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* the hash is defined on little endian words, compilers turn this into a load */
+static inline uint64_t _c_xxh_read64(const uint8_t *p) {
+  return (uint64_t) p[0] | (uint64_t) p[1] << 8 |
+    (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 |
+    (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 |
+    (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static inline uint32_t _c_xxh_read32(const uint8_t *p) {
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 |
+    (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline uint64_t _c_xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * C_XXH_PRIME64_2;
+  acc = C_XXH_ROTL64(acc, 31);
+  acc *= C_XXH_PRIME64_1;
+
+  return acc;
+}
+
+static inline uint64_t _c_xxh_merge(uint64_t acc, uint64_t val) {
+  acc ^= _c_xxh_round(0, val);
+  acc = acc * C_XXH_PRIME64_1 + C_XXH_PRIME64_4;
+
+  return acc;
+}
+
+/* Consume the complete stripes of 32 bytes, returns the bytes consumed */
+static size_t _c_xxh_stripes(uint64_t v[4], const uint8_t *p, size_t len) {
+  const uint8_t *start = p;
+  const uint8_t *end = p + len;
+
+  while (end - p >= 32) {
+    v[0] = _c_xxh_round(v[0], _c_xxh_read64(p));
+    v[1] = _c_xxh_round(v[1], _c_xxh_read64(p + 8));
+    v[2] = _c_xxh_round(v[2], _c_xxh_read64(p + 16));
+    v[3] = _c_xxh_round(v[3], _c_xxh_read64(p + 24));
+    p += 32;
+  }
+
+  return p - start;
+}
+
+static uint64_t _c_xxh_finish(const uint64_t v[4], uint64_t seed,
+    uint64_t total, const uint8_t *p, size_t len) {
+  uint64_t h;
+
+  if (total >= 32) {
+    h = C_XXH_ROTL64(v[0], 1) + C_XXH_ROTL64(v[1], 7) +
+      C_XXH_ROTL64(v[2], 12) + C_XXH_ROTL64(v[3], 18);
+    h = _c_xxh_merge(h, v[0]);
+    h = _c_xxh_merge(h, v[1]);
+    h = _c_xxh_merge(h, v[2]);
+    h = _c_xxh_merge(h, v[3]);
+  } else {
+    h = seed + C_XXH_PRIME64_5;
+  }
+  h += total;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    h ^= _c_xxh_round(0, _c_xxh_read64(p));
+    h = C_XXH_ROTL64(h, 27) * C_XXH_PRIME64_1 + C_XXH_PRIME64_4;
+  }
+  if (len >= 4) {
+    h ^= (uint64_t) _c_xxh_read32(p) * C_XXH_PRIME64_1;
+    h = C_XXH_ROTL64(h, 23) * C_XXH_PRIME64_2 + C_XXH_PRIME64_3;
+    p += 4;
+    len -= 4;
+  }
+  for (; len > 0; p++, len--) {
+    h ^= *p * C_XXH_PRIME64_5;
+    h = C_XXH_ROTL64(h, 11) * C_XXH_PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= C_XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= C_XXH_PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+void c_xxhash64_reset(c_xxhash64_state_t *state, uint64_t seed) {
+  memset(state, 0, sizeof(c_xxhash64_state_t));
+  state->seed = seed;
+  state->v[0] = seed + C_XXH_PRIME64_1 + C_XXH_PRIME64_2;
+  state->v[1] = seed + C_XXH_PRIME64_2;
+  state->v[2] = seed;
+  state->v[3] = seed - C_XXH_PRIME64_1;
+}
+
+void c_xxhash64_update(c_xxhash64_state_t *state, const void *data, size_t len) {
+  const uint8_t *p = data;
+  size_t n;
+
+  state->total += len;
+
+  /* fill up a stripe started by the last update */
+  if (state->buflen > 0) {
+    n = sizeof(state->buf) - state->buflen;
+
+    if (len < n) {
+      memcpy(state->buf + state->buflen, p, len);
+      state->buflen += len;
+      return;
+    }
+    memcpy(state->buf + state->buflen, p, n);
+    _c_xxh_stripes(state->v, state->buf, sizeof(state->buf));
+    state->buflen = 0;
+    p += n;
+    len -= n;
+  }
+
+  n = _c_xxh_stripes(state->v, p, len);
+  memcpy(state->buf, p + n, len - n);
+  state->buflen = len - n;
+}
+
+uint64_t c_xxhash64_digest(const c_xxhash64_state_t *state) {
+  return _c_xxh_finish(state->v, state->seed, state->total, state->buf,
+      state->buflen);
+}
+
+uint64_t c_xxhash64(const void *data, size_t len, uint64_t seed) {
+  const uint8_t *p = data;
+  uint64_t v[4];
+  size_t n;
+
+  v[0] = seed + C_XXH_PRIME64_1 + C_XXH_PRIME64_2;
+  v[1] = seed + C_XXH_PRIME64_2;
+  v[2] = seed;
+  v[3] = seed - C_XXH_PRIME64_1;
+
+  n = _c_xxh_stripes(v, p, len);
+
+  return _c_xxh_finish(v, seed, len, p + n, len - n);
+}
@@ -0,0 +1,106 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2008 by Andreas Schneider <mail@cynapses.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ts=2 sw=2 et cindent
+ */
+
+/**
+ * @file c_xxhash.h
+ *
+ * @brief Interface of the cynapses xxHash implementation
+ *
+ * XXH64 by Yann Collet, see http://cyan4973.github.io/xxHash/
+ *
+ * It hashes 32 bytes per round in four independent lanes, which is a lot
+ * faster than the byte by byte Jenkins hash on long input. The streaming
+ * functions allow to hash a prefix once and continue from its state for
+ * several suffixes. The result is the same as hashing the whole input at
+ * once.
+ *
+ * @defgroup cynXXHashInternals cynapses libc xxhash functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+
+#ifndef _C_XXHASH_H
+#define _C_XXHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * State of a hash calculation, it can be copied.
+ */
+typedef struct c_xxhash64_state_s {
+  uint64_t total;
+  uint64_t seed;
+  uint64_t v[4];
+  uint8_t buf[32];
+  size_t buflen;
+} c_xxhash64_state_t;
+
+/**
+ * @brief Start a hash calculation.
+ *
+ * @param state   The state to initialize.
+ *
+ * @param seed    The seed of the hash.
+ */
+void c_xxhash64_reset(c_xxhash64_state_t *state, uint64_t seed);
+
+/**
+ * @brief Add data to a hash calculation.
+ *
+ * @param state   The state of the calculation.
+ *
+ * @param data    The data to add.
+ *
+ * @param len     The length of the data.
+ */
+void c_xxhash64_update(c_xxhash64_state_t *state, const void *data, size_t len);
+
+/**
+ * @brief Get the hash of the data added so far.
+ *
+ * The state isn't changed, more data can be added afterwards.
+ *
+ * @param state   The state of the calculation.
+ *
+ * @return  The hash.
+ */
+uint64_t c_xxhash64_digest(const c_xxhash64_state_t *state);
+
+/**
+ * @brief Hash a block of memory.
+ *
+ * @param data    The data to hash.
+ *
+ * @param len     The length of the data.
+ *
+ * @param seed    The seed of the hash.
+ *
+ * @return  The hash.
+ */
+uint64_t c_xxhash64(const void *data, size_t len, uint64_t seed);
+
+/**
+ * }@
+ */
+#endif /* _C_XXHASH_H */
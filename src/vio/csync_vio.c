@@ -215,6 +215,16 @@ int csync_vio_close(CSYNC *ctx, csync_vio_handle_t *fhandle) {
 }
 
 ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_t count) {
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  return csync_vio_read_replica(ctx, ctx->replica, fhandle, buf, count);
+}
+
+ssize_t csync_vio_read_replica(CSYNC *ctx, enum csync_replica_e replica,
+    csync_vio_handle_t *fhandle, void *buf, size_t count) {
   ssize_t rs = 0;
 
   if (fhandle == NULL) {
@@ -222,7 +232,7 @@ ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_
     return -1;
   }
 
-  switch(ctx->replica) {
+  switch(replica) {
     case REMOTE_REPLICA:
       rs = ctx->module.method->read(fhandle->method_handle, buf, count);
       break;
@@ -237,6 +247,16 @@ ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_
 }
 
 ssize_t csync_vio_write(CSYNC *ctx, csync_vio_handle_t *fhandle, const void *buf, size_t count) {
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  return csync_vio_write_replica(ctx, ctx->replica, fhandle, buf, count);
+}
+
+ssize_t csync_vio_write_replica(CSYNC *ctx, enum csync_replica_e replica,
+    csync_vio_handle_t *fhandle, const void *buf, size_t count) {
   ssize_t rs = 0;
 
   if (fhandle == NULL) {
@@ -244,7 +264,7 @@ ssize_t csync_vio_write(CSYNC *ctx, csync_vio_handle_t *fhandle, const void *buf
     return -1;
   }
 
-  switch(ctx->replica) {
+  switch(replica) {
     case REMOTE_REPLICA:
       rs = ctx->module.method->write(fhandle->method_handle, buf, count);
       break;
@@ -275,11 +295,34 @@ off_t csync_vio_lseek(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t offset, int
   return ro;
 }
 
+off_t csync_vio_copy(CSYNC *ctx, enum csync_replica_e srep, csync_vio_handle_t *sfp,
+    enum csync_replica_e drep, csync_vio_handle_t *dfp) {
+  (void) ctx;
+
+  if (sfp == NULL || dfp == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  /* the module only moves data through buffers */
+  if (srep != LOCAL_REPLICA || drep != LOCAL_REPLICA) {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  return csync_vio_local_copy(sfp->method_handle, dfp->method_handle);
+}
+
 csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
+  return csync_vio_opendir_replica(ctx, ctx->replica, name);
+}
+
+csync_vio_handle_t *csync_vio_opendir_replica(CSYNC *ctx,
+    enum csync_replica_e replica, const char *name) {
   csync_vio_handle_t *h = NULL;
   csync_vio_method_handle_t *mh = NULL;
 
-  switch(ctx->replica) {
+  switch(replica) {
     case REMOTE_REPLICA:
       mh = ctx->module.method->opendir(name);
       break;
@@ -299,6 +342,16 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
 }
 
 int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
+  if (dhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  return csync_vio_closedir_replica(ctx, ctx->replica, dhandle);
+}
+
+int csync_vio_closedir_replica(CSYNC *ctx, enum csync_replica_e replica,
+    csync_vio_handle_t *dhandle) {
   int rc = -1;
 
   if (dhandle == NULL) {
@@ -306,7 +359,7 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
     return -1;
   }
 
-  switch(ctx->replica) {
+  switch(replica) {
     case REMOTE_REPLICA:
       rc = ctx->module.method->closedir(dhandle->method_handle);
       break;
@@ -324,9 +377,14 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
 }
 
 csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
+  return csync_vio_readdir_replica(ctx, ctx->replica, dhandle);
+}
+
+csync_vio_file_stat_t *csync_vio_readdir_replica(CSYNC *ctx,
+    enum csync_replica_e replica, csync_vio_handle_t *dhandle) {
   csync_vio_file_stat_t *fs = NULL;
 
-  switch(ctx->replica) {
+  switch(replica) {
     case REMOTE_REPLICA:
       fs = ctx->module.method->readdir(dhandle->method_handle);
       break;
@@ -436,10 +494,36 @@ int csync_vio_rmdir(CSYNC *ctx, const char *uri) {
   return rc;
 }
 
-int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf) {
+int csync_vio_rmdirs(CSYNC *ctx, const char *uri) {
   int rc = -1;
 
   switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      if (! VIO_METHOD_HAS_FUNC(ctx->module.method, rmdirs)) {
+        errno = ENOSYS;
+        return -1;
+      }
+      rc = ctx->module.method->rmdirs(uri);
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_rmdirs(uri);
+      break;
+    default:
+      break;
+  }
+
+  return rc;
+}
+
+int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf) {
+  return csync_vio_stat_replica(ctx, ctx->replica, uri, buf);
+}
+
+int csync_vio_stat_replica(CSYNC *ctx, enum csync_replica_e replica,
+    const char *uri, csync_vio_file_stat_t *buf) {
+  int rc = -1;
+
+  switch(replica) {
     case REMOTE_REPLICA:
       rc = ctx->module.method->stat(uri, buf);
       break;
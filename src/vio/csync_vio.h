@@ -27,6 +27,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "c_private.h"
+#include "csync_private.h"
 #include "vio/csync_vio_handle.h"
 #include "vio/csync_vio_file_stat.h"
 
@@ -39,14 +40,35 @@ int csync_vio_close(CSYNC *ctx, csync_vio_handle_t *handle);
 ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_t count);
 ssize_t csync_vio_write(CSYNC *ctx, csync_vio_handle_t *fhandle, const void *buf, size_t count);
 off_t csync_vio_lseek(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t offset, int whence);
+/*
+ * Copy the rest of a file to another one in the kernel, without reading it
+ * into a buffer. Only files of local replicas can be copied so, it fails with
+ * ENOSYS for other files and if the kernel can't copy them.
+ */
+off_t csync_vio_copy(CSYNC *ctx, enum csync_replica_e srep, csync_vio_handle_t *sfp,
+    enum csync_replica_e drep, csync_vio_handle_t *dfp);
 
 csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name);
 int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle);
 csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle);
 
+/*
+ * The same as above, but on the given replica instead of ctx->replica. The
+ * update detection uses them to walk both replicas at the same time.
+ */
+csync_vio_handle_t *csync_vio_opendir_replica(CSYNC *ctx, enum csync_replica_e replica, const char *name);
+int csync_vio_closedir_replica(CSYNC *ctx, enum csync_replica_e replica, csync_vio_handle_t *dhandle);
+csync_vio_file_stat_t *csync_vio_readdir_replica(CSYNC *ctx, enum csync_replica_e replica, csync_vio_handle_t *dhandle);
+int csync_vio_stat_replica(CSYNC *ctx, enum csync_replica_e replica, const char *uri, csync_vio_file_stat_t *buf);
+/* the pipelined transfer reads and writes a file on two threads */
+ssize_t csync_vio_read_replica(CSYNC *ctx, enum csync_replica_e replica, csync_vio_handle_t *fhandle, void *buf, size_t count);
+ssize_t csync_vio_write_replica(CSYNC *ctx, enum csync_replica_e replica, csync_vio_handle_t *fhandle, const void *buf, size_t count);
+
 int csync_vio_mkdir(CSYNC *ctx, const char *uri, mode_t mode);
 int csync_vio_mkdirs(CSYNC *ctx, const char *uri, mode_t mode);
 int csync_vio_rmdir(CSYNC *ctx, const char *uri);
+/* fails with ENOSYS if the module can't remove a directory recursively */
+int csync_vio_rmdirs(CSYNC *ctx, const char *uri);
 
 int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf);
 int csync_vio_rename(CSYNC *ctx, const char *olduri, const char *newuri);
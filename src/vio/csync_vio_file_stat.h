@@ -73,6 +73,20 @@ enum csync_vio_file_stat_fields_e {
   CSYNC_VIO_FILE_STAT_FIELDS_GID = 1 << 16,
 };
 
+/*
+ * Fields the update detection needs. If readdir returns an entry with all of
+ * them the walker uses it as is and doesn't stat the entry. Entries which are
+ * neither a regular file nor a directory only need the type.
+ */
+#define CSYNC_VIO_FILE_STAT_FIELDS_UPDATE (CSYNC_VIO_FILE_STAT_FIELDS_TYPE | \
+    CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS | \
+    CSYNC_VIO_FILE_STAT_FIELDS_INODE | \
+    CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT | \
+    CSYNC_VIO_FILE_STAT_FIELDS_SIZE | \
+    CSYNC_VIO_FILE_STAT_FIELDS_MTIME | \
+    CSYNC_VIO_FILE_STAT_FIELDS_UID | \
+    CSYNC_VIO_FILE_STAT_FIELDS_GID)
+
 
 struct csync_vio_file_stat_s {
   union {
@@ -89,6 +103,8 @@ struct csync_vio_file_stat_s {
   time_t atime;
   time_t mtime;
   time_t ctime;
+  /* nanoseconds of the mtime, 0 if the backend doesn't know them */
+  long mtime_nsec;
 
   off_t size;
   off_t blksize;
@@ -20,6 +20,8 @@
  * vim: ts=2 sw=2 et cindent
  */
 
+#include "config.h"
+
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -35,6 +37,33 @@ typedef struct fhandle_s {
   int fd;
 } fhandle_t;
 
+static enum csync_vio_file_type_e _csync_vio_local_file_type(mode_t mode) {
+  switch(mode & S_IFMT) {
+    case S_IFBLK:
+      return CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
+    case S_IFCHR:
+      return CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
+    case S_IFDIR:
+      return CSYNC_VIO_FILE_TYPE_DIRECTORY;
+    case S_IFIFO:
+      return CSYNC_VIO_FILE_TYPE_FIFO;
+#ifndef _WIN32
+    case S_IFLNK:
+      return CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+#endif
+    case S_IFREG:
+      return CSYNC_VIO_FILE_TYPE_REGULAR;
+#ifndef _WIN32
+    case S_IFSOCK:
+      return CSYNC_VIO_FILE_TYPE_SOCKET;
+#endif
+    default:
+      break;
+  }
+
+  return CSYNC_VIO_FILE_TYPE_UNKNOWN;
+}
+
 csync_vio_method_handle_t *csync_vio_local_open(const char *durl, int flags, mode_t mode) {
   fhandle_t *handle = NULL;
   int fd = -1;
@@ -133,6 +162,15 @@ off_t csync_vio_local_lseek(csync_vio_method_handle_t *fhandle, off_t offset, in
   return lseek(handle->fd, offset, whence);
 }
 
+off_t csync_vio_local_copy(csync_vio_method_handle_t *src, csync_vio_method_handle_t *dst) {
+  if (src == NULL || dst == NULL) {
+    errno = EBADF;
+    return (off_t) -1;
+  }
+
+  return c_copy_fd(((fhandle_t *) src)->fd, ((fhandle_t *) dst)->fd);
+}
+
 /*
  * directory functions
  */
@@ -205,26 +243,10 @@ csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_method_handle_t *dhandl
   file_stat->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
 
 #ifndef _WIN32
-  switch (dirent->d_type) {
-    case DT_FIFO:
-    case DT_SOCK:
-    case DT_CHR:
-    case DT_BLK:
-      break;
-    case DT_DIR:
-    case DT_REG:
-      file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-      if (dirent->d_type == DT_DIR) {
-        file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      } else {
-        file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      }
-      break;
-    case DT_UNKNOWN:
-      file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-      file_stat->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
-    default:
-      break;
+  /* the walker doesn't need to stat entries it ignores anyway */
+  if (dirent->d_type != DT_UNKNOWN) {
+    file_stat->type = _csync_vio_local_file_type(DTTOIF(dirent->d_type));
+    file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
   }
 #endif
 
@@ -244,53 +266,28 @@ int csync_vio_local_rmdir(const char *uri) {
   return rmdir(uri);
 }
 
-int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
-  csync_stat_t sb;
-
-  if (lstat(uri, &sb) < 0) {
+int csync_vio_local_rmdirs(const char *uri) {
+  if (c_rmdirs(uri) < 0) {
     return -1;
   }
 
-  buf->name = c_basename(uri);
-  if (buf->name == NULL) {
-    csync_vio_file_stat_destroy(buf);
+  /* c_rmdirs() gives up on some errors without telling */
+  if (c_isdir(uri)) {
+    errno = ENOTEMPTY;
     return -1;
   }
+
+  return 0;
+}
+
+static void _csync_vio_local_fill_stat(const csync_stat_t *sb,
+    csync_vio_file_stat_t *buf) {
   buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
 
-  switch(sb.st_mode & S_IFMT) {
-    case S_IFBLK:
-      buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
-      break;
-    case S_IFCHR:
-      buf->type = CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
-      break;
-    case S_IFDIR:
-      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      break;
-    case S_IFIFO:
-      buf->type = CSYNC_VIO_FILE_TYPE_FIFO;
-      break;
-#ifndef _WIN32
-    case S_IFLNK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-      break;
-#endif
-    case S_IFREG:
-      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      break;
-#ifndef _WIN32
-    case S_IFSOCK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-#endif
-      break;
-    default:
-      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
-      break;
-  }
+  buf->type = _csync_vio_local_file_type(sb->st_mode);
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
 
-  buf->mode = sb.st_mode;
+  buf->mode = sb->st_mode;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
 
   if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
@@ -301,44 +298,183 @@ int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
   }
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
 
-  buf->device = sb.st_dev;
+  buf->device = sb->st_dev;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DEVICE;
 
-  buf->inode = sb.st_ino;
+  buf->inode = sb->st_ino;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
 
-  buf->nlink = sb.st_nlink;
+  buf->nlink = sb->st_nlink;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
 
-  buf->uid = sb.st_uid;
+  buf->uid = sb->st_uid;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
 
-  buf->gid = sb.st_gid;
+  buf->gid = sb->st_gid;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
 
-  buf->size = sb.st_size;
+  buf->size = sb->st_size;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
 
 #ifndef _WIN32
-  buf->blksize = sb.st_blksize;
+  buf->blksize = sb->st_blksize;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_BLOCK_SIZE;
 
-  buf->blkcount = sb.st_blocks;
+  buf->blkcount = sb->st_blocks;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_BLOCK_COUNT;
 #endif
 
-  buf->atime = sb.st_atime;
+  buf->atime = sb->st_atime;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
 
-  buf->mtime = sb.st_mtime;
+  buf->mtime = sb->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  buf->mtime_nsec = sb->st_mtim.tv_nsec;
+#endif
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
 
-  buf->ctime = sb.st_ctime;
+  buf->ctime = sb->st_ctime;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+}
+
+int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
+  csync_stat_t sb;
+
+  if (lstat(uri, &sb) < 0) {
+    return -1;
+  }
+
+  buf->name = c_basename(uri);
+  if (buf->name == NULL) {
+    csync_vio_file_stat_destroy(buf);
+    return -1;
+  }
+  _csync_vio_local_fill_stat(&sb, buf);
 
   return 0;
 }
 
+#ifdef HAVE_FSTATAT
+int csync_vio_local_opendirat(int dirfd, const char *name) {
+  return openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+#ifdef HAVE_STATX
+/*
+ * Only request what the update detection uses, see
+ * CSYNC_VIO_FILE_STAT_FIELDS_UPDATE, and the ctime for its quick check
+ */
+#define CSYNC_VIO_LOCAL_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | \
+    STATX_UID | STATX_GID | STATX_MTIME | STATX_CTIME | STATX_INO | STATX_SIZE)
+
+static void _csync_vio_local_fill_statx(const struct statx *stx,
+    csync_vio_file_stat_t *buf) {
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+
+  if (stx->stx_mask & STATX_TYPE) {
+    buf->type = _csync_vio_local_file_type(stx->stx_mode);
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+
+    if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
+      buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
+    } else {
+      buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
+    }
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
+  }
+
+  if (stx->stx_mask & STATX_MODE) {
+    buf->mode = stx->stx_mode;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
+  }
+
+  if (stx->stx_mask & STATX_INO) {
+    buf->inode = stx->stx_ino;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
+  }
+
+  if (stx->stx_mask & STATX_NLINK) {
+    buf->nlink = stx->stx_nlink;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
+  }
+
+  if (stx->stx_mask & STATX_UID) {
+    buf->uid = stx->stx_uid;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
+  }
+
+  if (stx->stx_mask & STATX_GID) {
+    buf->gid = stx->stx_gid;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
+  }
+
+  if (stx->stx_mask & STATX_SIZE) {
+    buf->size = stx->stx_size;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+  }
+
+  if (stx->stx_mask & STATX_MTIME) {
+    buf->mtime = stx->stx_mtime.tv_sec;
+    buf->mtime_nsec = stx->stx_mtime.tv_nsec;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+  }
+
+  if (stx->stx_mask & STATX_CTIME) {
+    buf->ctime = stx->stx_ctime.tv_sec;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+  }
+}
+#endif
+
+int csync_vio_local_fstatat(int dirfd, const char *name,
+    csync_vio_file_stat_t *buf) {
+#ifdef HAVE_STATX
+  struct statx stx;
+
+  if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+        CSYNC_VIO_LOCAL_STATX_MASK, &stx) < 0) {
+    return -1;
+  }
+#else
+  csync_stat_t sb;
+
+  if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+    return -1;
+  }
+#endif
+
+  buf->name = c_strdup(name);
+  if (buf->name == NULL) {
+    return -1;
+  }
+#ifdef HAVE_STATX
+  _csync_vio_local_fill_statx(&stx, buf);
+#else
+  _csync_vio_local_fill_stat(&sb, buf);
+#endif
+
+  return 0;
+}
+
+int csync_vio_local_readdir_stat(int dirfd, const struct dirent *dirent,
+    csync_vio_file_stat_t *buf) {
+  if (dirent->d_type == DT_UNKNOWN || dirent->d_type == DT_REG ||
+      dirent->d_type == DT_DIR) {
+    return csync_vio_local_fstatat(dirfd, dirent->d_name, buf);
+  }
+
+  /* the type is all the walker needs to know to skip it */
+  buf->name = c_strdup(dirent->d_name);
+  if (buf->name == NULL) {
+    return -1;
+  }
+  buf->type = _csync_vio_local_file_type(DTTOIF(dirent->d_type));
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+
+  return 0;
+}
+#endif
+
 int csync_vio_local_rename(const char *olduri, const char *newuri) {
 #ifdef _WIN32
   if(olduri && newuri) {
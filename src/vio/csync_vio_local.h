@@ -25,6 +25,7 @@
 
 #include "vio/csync_vio_method.h"
 #include <sys/time.h>
+#include <dirent.h>
 
 csync_vio_method_handle_t *csync_vio_local_open(const char *durl, int flags, mode_t mode);
 csync_vio_method_handle_t *csync_vio_local_creat(const char *durl, mode_t mode);
@@ -32,6 +33,7 @@ int csync_vio_local_close(csync_vio_method_handle_t *fhandle);
 ssize_t csync_vio_local_read(csync_vio_method_handle_t *fhandle, void *buf, size_t count);
 ssize_t csync_vio_local_write(csync_vio_method_handle_t *fhandle, const void *buf, size_t count);
 off_t csync_vio_local_lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence);
+off_t csync_vio_local_copy(csync_vio_method_handle_t *src, csync_vio_method_handle_t *dst);
 
 csync_vio_method_handle_t *csync_vio_local_opendir(const char *name);
 int csync_vio_local_closedir(csync_vio_method_handle_t *dhandle);
@@ -39,8 +41,16 @@ csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_method_handle_t *dhandl
 
 int csync_vio_local_mkdir(const char *uri, mode_t mode);
 int csync_vio_local_rmdir(const char *uri);
+int csync_vio_local_rmdirs(const char *uri);
 
 int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf);
+#ifdef HAVE_FSTATAT
+/* stat and open directories relative to an open directory */
+int csync_vio_local_opendirat(int dirfd, const char *name);
+int csync_vio_local_fstatat(int dirfd, const char *name, csync_vio_file_stat_t *buf);
+/* stat a directory entry only if its type doesn't tell enough */
+int csync_vio_local_readdir_stat(int dirfd, const struct dirent *dirent, csync_vio_file_stat_t *buf);
+#endif
 int csync_vio_local_rename(const char *olduri, const char *newuri);
 int csync_vio_local_unlink(const char *uri);
 
@@ -52,6 +52,8 @@ typedef csync_vio_file_stat_t *(*csync_method_readdir_fn)(csync_vio_method_handl
 
 typedef int (*csync_method_mkdir_fn)(const char *uri, mode_t mode);
 typedef int (*csync_method_rmdir_fn)(const char *uri);
+/* remove a directory with everything in it, optional */
+typedef int (*csync_method_rmdirs_fn)(const char *uri);
 
 typedef int (*csync_method_stat_fn)(const char *uri, csync_vio_file_stat_t *buf);
 typedef int (*csync_method_rename_fn)(const char *olduri, const char *newuri);
@@ -81,6 +83,7 @@ struct csync_vio_method_s {
         csync_method_chmod_fn chmod;
         csync_method_chown_fn chown;
         csync_method_utimes_fn utimes;
+        csync_method_rmdirs_fn rmdirs;
 };
 
 #endif /* _CSYNC_VIO_H */
@@ -0,0 +1,86 @@
+#include "torture.h"
+
+#include "csync_buffer.c"
+
+static void check_csync_buffer_size(void **state)
+{
+    (void) state; /* unused */
+
+    /* small files get the smallest buffer */
+    assert_int_equal(csync_buffer_size(LOCAL_REPLICA, LOCAL_REPLICA, 0,
+          CSYNC_BUFFER_MAX_SIZE), CSYNC_BUFFER_MIN_SIZE);
+    assert_int_equal(csync_buffer_size(LOCAL_REPLICA, REMOTE_REPLICA, 1000,
+          CSYNC_BUFFER_MAX_SIZE), CSYNC_BUFFER_MIN_SIZE);
+
+    /* a power of two growing with the file */
+    assert_int_equal(csync_buffer_size(LOCAL_REPLICA, LOCAL_REPLICA,
+          16 * 100 * 1024, CSYNC_BUFFER_MAX_SIZE), 128 * 1024);
+    assert_int_equal(csync_buffer_size(REMOTE_REPLICA, LOCAL_REPLICA,
+          4 * 100 * 1024, CSYNC_BUFFER_MAX_SIZE), 128 * 1024);
+
+    /* up to the limits of the replicas */
+    assert_int_equal(csync_buffer_size(LOCAL_REPLICA, LOCAL_REPLICA,
+          INT64_C(1) << 40, CSYNC_BUFFER_MAX_SIZE), CSYNC_BUFFER_LOCAL_MAX_SIZE);
+    assert_int_equal(csync_buffer_size(LOCAL_REPLICA, REMOTE_REPLICA,
+          INT64_C(1) << 40, CSYNC_BUFFER_MAX_SIZE), CSYNC_BUFFER_MAX_SIZE);
+    assert_int_equal(csync_buffer_size(LOCAL_REPLICA, REMOTE_REPLICA,
+          INT64_C(1) << 40, 100 * 1024), 64 * 1024);
+    assert_int_equal(csync_buffer_size(LOCAL_REPLICA, REMOTE_REPLICA,
+          INT64_C(1) << 40, (size_t) -1), 64 * 1024 * 1024);
+}
+
+static void check_csync_buffer_pool(void **state)
+{
+    csync_buffer_pool_t *pool;
+    void *bufs[CSYNC_BUFFER_KEEP + 1];
+    void *buf;
+    int i;
+
+    (void) state; /* unused */
+
+    pool = csync_buffer_pool_new();
+    assert_non_null(pool);
+
+    /* only the sizes of the classes */
+    assert_null(csync_buffer_get(pool, 1000));
+
+    buf = csync_buffer_get(pool, CSYNC_BUFFER_MIN_SIZE);
+    assert_non_null(buf);
+    csync_buffer_put(pool, buf, CSYNC_BUFFER_MIN_SIZE);
+
+    /* the buffer is reused for the same size only */
+    assert_true(csync_buffer_get(pool, CSYNC_BUFFER_MIN_SIZE) == buf);
+    csync_buffer_put(pool, buf, CSYNC_BUFFER_MIN_SIZE);
+    buf = csync_buffer_get(pool, 2 * CSYNC_BUFFER_MIN_SIZE);
+    assert_non_null(buf);
+    csync_buffer_put(pool, buf, 2 * CSYNC_BUFFER_MIN_SIZE);
+    assert_int_equal(pool->allocated, 2);
+    assert_int_equal(pool->reused, 1);
+
+    /* a few of them are kept */
+    for (i = 0; i < CSYNC_BUFFER_KEEP + 1; i++) {
+        bufs[i] = csync_buffer_get(pool, CSYNC_BUFFER_MIN_SIZE);
+        assert_non_null(bufs[i]);
+    }
+    for (i = 0; i < CSYNC_BUFFER_KEEP + 1; i++) {
+        csync_buffer_put(pool, bufs[i], CSYNC_BUFFER_MIN_SIZE);
+    }
+    assert_int_equal(pool->count[0], CSYNC_BUFFER_KEEP);
+
+    csync_buffer_pool_free(pool);
+
+    /* without a pool they are allocated and freed */
+    buf = csync_buffer_get(NULL, CSYNC_BUFFER_MIN_SIZE);
+    assert_non_null(buf);
+    csync_buffer_put(NULL, buf, CSYNC_BUFFER_MIN_SIZE);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test(check_csync_buffer_size),
+        unit_test(check_csync_buffer_pool),
+    };
+
+    return run_tests(tests);
+}
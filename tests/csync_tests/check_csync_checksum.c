@@ -0,0 +1,192 @@
+#include <string.h>
+
+#include "torture.h"
+
+#include "csync_checksum.c"
+
+#define TESTFILE "/tmp/check_csync1/file"
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = system("echo 'It is a rainy day' > " TESTFILE);
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+static csync_file_stat_t *new_file(CSYNC *ctx, const char *path,
+    enum csync_instructions_e instruction, uint64_t checksum)
+{
+    csync_file_stat_t *st;
+
+    st = c_arena_alloc(ctx->local.arena, sizeof(csync_file_stat_t) + strlen(path));
+    assert_non_null(st);
+    memset(st, 0, sizeof(csync_file_stat_t));
+    strcpy(st->name, path);
+    st->pathlen = strlen(path);
+    st->phash = csync_path_hash(path, strlen(path));
+    st->type = CSYNC_FTW_TYPE_FILE;
+    st->instruction = instruction;
+    st->checksum = checksum;
+
+    assert_int_equal(c_htable_insert(ctx->local.tree, st->phash, st), 0);
+
+    return st;
+}
+
+static void check_csync_checksum_file(void **state)
+{
+    const char *content = "It is a rainy day\n";
+    uint64_t checksum = CSYNC_CHECKSUM_NONE;
+    csync_checksum_t cs;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = csync_checksum_file(TESTFILE, &checksum);
+    assert_int_equal(rc, 0);
+    assert_true(checksum == c_xxhash64(content, strlen(content), 0));
+
+    /* the checksum of the parts is the checksum of the whole content */
+    csync_checksum_init(&cs);
+    csync_checksum_update(&cs, content, 5);
+    csync_checksum_update(&cs, content + 5, strlen(content) - 5);
+    assert_true(csync_checksum_digest(&cs) == checksum);
+
+    rc = csync_checksum_file("/tmp/check_csync1/nonexistent", &checksum);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOENT);
+}
+
+static void check_csync_checksum_detect(void **state)
+{
+    CSYNC *csync = *state;
+    const char *content = "It is a rainy day\n";
+    uint64_t checksum = c_xxhash64(content, strlen(content), 0);
+    csync_file_stat_t *unchanged, *modified, *unknown;
+    csync_walk_t walk;
+    int rc;
+
+    system("cp " TESTFILE " /tmp/check_csync1/modified");
+    system("cp " TESTFILE " /tmp/check_csync1/unknown");
+    unchanged = new_file(csync, "file", CSYNC_INSTRUCTION_EVAL, checksum);
+    modified = new_file(csync, "modified", CSYNC_INSTRUCTION_EVAL, 42);
+    unknown = new_file(csync, "unknown", CSYNC_INSTRUCTION_EVAL,
+        CSYNC_CHECKSUM_NONE);
+
+    ZERO_STRUCT(walk);
+    walk.ctx = csync;
+    walk.current = LOCAL_REPLICA;
+    walk.replica = LOCAL_REPLICA;
+    walk.uri = csync->local.uri;
+    walk.urilen = strlen(csync->local.uri);
+    walk.tree = csync->local.tree;
+    walk.arena = csync->local.arena;
+
+    /* nothing is read if it is disabled */
+    rc = csync_checksum_detect(&walk);
+    assert_int_equal(rc, 0);
+    assert_int_equal(unchanged->instruction, CSYNC_INSTRUCTION_EVAL);
+
+    csync->options.checksum = true;
+    rc = csync_checksum_detect(&walk);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(unchanged->instruction, CSYNC_INSTRUCTION_METADATA);
+    assert_true(unchanged->checksum == checksum);
+    assert_int_equal(modified->instruction, CSYNC_INSTRUCTION_EVAL);
+    assert_true(modified->checksum == checksum);
+    /* files without a checksum in the statedb are not read */
+    assert_int_equal(unknown->instruction, CSYNC_INSTRUCTION_EVAL);
+    assert_true(unknown->checksum == CSYNC_CHECKSUM_NONE);
+}
+
+/* files with a cached checksum are not read */
+static void check_csync_checksum_detect_cached(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *st;
+    csync_walk_t walk;
+    int rc;
+
+    csync->options.checksum = true;
+
+    /* cached with a checksum other than the one of the content */
+    st = new_file(csync, "file", CSYNC_INSTRUCTION_NONE, 42);
+    st->inode = 23;
+    st->size = 42;
+    rc = csync_statedb_write(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_statedb_close(csync, csync->statedb.file, 1);
+    assert_int_equal(rc, 0);
+    rc = csync_statedb_load(csync, csync->statedb.file);
+    assert_int_equal(rc, 0);
+    assert_non_null(csync->statedb.checksums);
+
+    st->instruction = CSYNC_INSTRUCTION_EVAL;
+
+    ZERO_STRUCT(walk);
+    walk.ctx = csync;
+    walk.current = LOCAL_REPLICA;
+    walk.replica = LOCAL_REPLICA;
+    walk.uri = csync->local.uri;
+    walk.urilen = strlen(csync->local.uri);
+    walk.tree = csync->local.tree;
+    walk.arena = csync->local.arena;
+
+    rc = csync_checksum_detect(&walk);
+    assert_int_equal(rc, 0);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_METADATA);
+    assert_int_equal(csync->statedb.stats.checksum_hits, 1);
+
+    /* the file changed */
+    st->instruction = CSYNC_INSTRUCTION_EVAL;
+    st->size = 18;
+    rc = csync_checksum_detect(&walk);
+    assert_int_equal(rc, 0);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_EVAL);
+    assert_int_equal(csync->statedb.stats.checksum_hits, 1);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_checksum_file, setup, teardown),
+        unit_test_setup_teardown(check_csync_checksum_detect, setup, teardown),
+        unit_test_setup_teardown(check_csync_checksum_detect_cached, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -54,11 +54,29 @@ static void check_csync_config_load(void **state)
     assert_int_equal(rc, 0);
 }
 
+/* absurd numbers of threads are clamped */
+static void check_csync_config_threads(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("printf '[global]\\nupdate_threads = 100000\\n"
+        "reconcile_threads = -3\\npropagate_threads = 8\\n' > " TESTCONF);
+    assert_int_equal(rc, 0);
+
+    rc = csync_config_load(csync, TESTCONF);
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync->options.update_threads, MAX_THREADS);
+    assert_int_equal(csync->options.reconcile_threads, 1);
+    assert_int_equal(csync->options.propagate_threads, 8);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test_setup_teardown(check_csync_config_copy_default, setup, teardown),
         unit_test_setup_teardown(check_csync_config_load, setup, teardown),
+        unit_test_setup_teardown(check_csync_config_threads, setup, teardown),
     };
 
     return run_tests(tests);
@@ -100,12 +100,194 @@ static void check_csync_excluded(void **state)
     assert_int_equal(rc, 1);
 }
 
+/* the compiled list has to agree with fnmatch() on the path or basename */
+static void check_csync_excluded_compiled(void **state)
+{
+    CSYNC *csync = *state;
+    const char *patterns[] = {
+        "foo", "*.o", "~$*", ".kde*/cache-*", "a?c", "[abc]x", "[!a-c]y",
+        "x[", "\\*lit", "b*c*d", "[[:digit:]]z", "a]b", "[]]q", "*.tmp*",
+        NULL
+    };
+    const char *paths[] = {
+        "foo", "dir/foo", "foobar", "x.o", "dir/x.o", "x.oo", "~$doc",
+        "d/~$doc", ".kde4/cache-x/y", ".kde/tmp", "abc", "a/c", "axc", "ax",
+        "bx", "dx", "qy", "by", "x[", "*lit", "d/*lit", "bxcxd", "b/c/d",
+        "bcx", "]q", "a]b", "1z", "d/2z", "zz", "a.tmp.1", "d/e.tmp",
+        "\xc3\xa9.o", "a\xc3\xa9" "c", "d/\xc3\xa9x", "\xc3\xa9y",
+        NULL
+    };
+    const char *bname;
+    int expected;
+    int rc;
+    int i, j;
+
+    csync->options.unix_extensions = 1;
+
+    for (i = 0; patterns[i] != NULL; i++) {
+        rc = _csync_exclude_add(csync, patterns[i]);
+        assert_int_equal(rc, 0);
+    }
+    rc = _csync_exclude_compile(csync);
+    assert_int_equal(rc, 0);
+    assert_non_null(csync->exclude);
+
+    for (j = 0; paths[j] != NULL; j++) {
+        bname = strrchr(paths[j], '/');
+        bname = bname ? bname + 1 : paths[j];
+
+        expected = 0;
+        for (i = 0; patterns[i] != NULL; i++) {
+            if (csync_fnmatch(patterns[i], paths[j], 0) == 0 ||
+                csync_fnmatch(patterns[i], bname, 0) == 0) {
+                expected = 1;
+            }
+        }
+
+        rc = csync_excluded(csync, paths[j]);
+        if (rc != expected) {
+            printf("%s: expected %d\n", paths[j], expected);
+        }
+        assert_int_equal(rc, expected);
+    }
+
+    /* a single star excludes everything */
+    rc = _csync_exclude_add(csync, "**");
+    assert_int_equal(rc, 0);
+    rc = _csync_exclude_compile(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_excluded(csync, "zz");
+    assert_int_equal(rc, 1);
+}
+
+static void check_csync_excluded_dir(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = _csync_exclude_add(csync, "build*");
+    assert_int_equal(rc, 0);
+    rc = _csync_exclude_add(csync, "foo/*");
+    assert_int_equal(rc, 0);
+    rc = _csync_exclude_add(csync, "*.o");
+    assert_int_equal(rc, 0);
+    rc = _csync_exclude_compile(csync);
+    assert_int_equal(rc, 0);
+
+    /* the directory itself is kept, but not what is below it */
+    rc = csync_excluded(csync, "foo");
+    assert_int_equal(rc, 0);
+    rc = csync_excluded_dir(csync, "foo");
+    assert_int_equal(rc, 1);
+    rc = csync_excluded_dir(csync, "bar/foo");
+    assert_int_equal(rc, 0);
+    rc = csync_excluded_dir(csync, "foo/bar");
+    assert_int_equal(rc, 1);
+
+    rc = csync_excluded_dir(csync, "build");
+    assert_int_equal(rc, 1);
+    rc = csync_excluded_dir(csync, "src");
+    assert_int_equal(rc, 0);
+    rc = csync_excluded_dir(csync, "src.o");
+    assert_int_equal(rc, 0);
+
+    /* patterns of the default list */
+    rc = csync_exclude_load(csync, BINARYDIR "/config/" CSYNC_EXCLUDE_FILE);
+    assert_int_equal(rc, 0);
+    rc = csync_excluded_dir(csync, ".kde4");
+    assert_int_equal(rc, 0);
+    rc = csync_excluded_dir(csync, ".kde4/cache-maximegalon");
+    assert_int_equal(rc, 1);
+    rc = csync_excluded_dir(csync, ".mozilla/firefox/default");
+    assert_int_equal(rc, 0);
+}
+
+/* only the patterns which can still match are carried into a directory */
+static void check_csync_exclude_dir_enter(void **state)
+{
+    CSYNC *csync = *state;
+    csync_exclude_dir_t *top = NULL;
+    csync_exclude_dir_t *dir = NULL;
+    const char *children[] = {
+        "Cache", "cache-x", "tmp-1", "file", "a?c", NULL
+    };
+    const char *dirs[] = {
+        "src", ".mozilla", ".kde4", "a", "a/b", NULL
+    };
+    char path[64];
+    int rc;
+    int i, j;
+
+    csync->options.unix_extensions = 1;
+
+    rc = _csync_exclude_add(csync, "a/*/a?c");
+    assert_int_equal(rc, 0);
+    rc = csync_exclude_load(csync, BINARYDIR "/config/" CSYNC_EXCLUDE_FILE);
+    assert_int_equal(rc, 0);
+
+    rc = csync_exclude_dir_enter(csync, NULL, "src", &top);
+    assert_int_equal(rc, 0);
+    assert_int_equal(top->count, 0);
+    csync_exclude_dir_free(top);
+
+    rc = csync_exclude_dir_enter(csync, NULL, ".kde4", &top);
+    assert_int_equal(rc, 0);
+    assert_int_equal(top->count, 3);
+    rc = csync_exclude_dir_enter(csync, top, ".kde4/cache-x", &dir);
+    assert_int_equal(rc, 1);
+    assert_null(dir);
+    /* a star also matches a slash */
+    rc = csync_exclude_dir_enter(csync, top, ".kde4/share", &dir);
+    assert_int_equal(rc, 0);
+    assert_int_equal(dir->count, 3);
+    csync_exclude_dir_free(dir);
+    csync_exclude_dir_free(top);
+
+    rc = csync_exclude_dir_enter(csync, NULL, ".mozilla", &top);
+    assert_int_equal(rc, 0);
+    assert_int_equal(top->count, 1);
+    rc = csync_exclude_dir_enter(csync, top, ".mozilla/firefox", &dir);
+    assert_int_equal(rc, 0);
+    assert_int_equal(dir->count, 1);
+    csync_exclude_dir_free(dir);
+    csync_exclude_dir_free(top);
+
+    /* the result is the same as checking all patterns */
+    for (i = 0; dirs[i] != NULL; i++) {
+        const char *slash = strrchr(dirs[i], '/');
+
+        top = NULL;
+        if (slash != NULL) {
+            snprintf(path, sizeof(path), "%.*s", (int) (slash - dirs[i]),
+                     dirs[i]);
+            rc = csync_exclude_dir_enter(csync, NULL, path, &top);
+            assert_int_equal(rc, 0);
+        }
+        rc = csync_exclude_dir_enter(csync, top, dirs[i], &dir);
+        assert_int_equal(rc, 0);
+
+        for (j = 0; children[j] != NULL; j++) {
+            snprintf(path, sizeof(path), "%s/%s", dirs[i], children[j]);
+            assert_int_equal(csync_excluded_below(csync, dir, path),
+                             csync_excluded(csync, path));
+        }
+        csync_exclude_dir_free(dir);
+        csync_exclude_dir_free(top);
+    }
+
+    rc = csync_excluded(csync, "a/b/a?c");
+    assert_int_equal(rc, 1);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test_setup_teardown(check_csync_exclude_add, setup, teardown),
         unit_test_setup_teardown(check_csync_exclude_load, setup, teardown),
         unit_test_setup_teardown(check_csync_excluded, setup_init, teardown),
+        unit_test_setup_teardown(check_csync_excluded_compiled, setup, teardown),
+        unit_test_setup_teardown(check_csync_excluded_dir, setup, teardown),
+        unit_test_setup_teardown(check_csync_exclude_dir_enter, setup, teardown),
     };
 
     return run_tests(tests);
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "csync_propagate.c"
+
+static void setup(void **state)
+{
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+}
+
+static void teardown(void **state)
+{
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+}
+
+static void sync_threads(int nthreads)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_init(csync), 0);
+    csync->options.propagate_threads = nthreads;
+
+    assert_int_equal(csync_update(csync), 0);
+    assert_int_equal(csync_reconcile(csync), 0);
+    assert_int_equal(csync_propagate(csync), 0);
+    assert_int_equal(csync_destroy(csync), 0);
+}
+
+/* files in directories which don't exist yet, from several workers */
+static void check_csync_propagate_parallel(void **state)
+{
+    char cmd[256];
+    int rc;
+    int i;
+
+    (void) state; /* unused */
+
+    for (i = 0; i < 200; i++) {
+        snprintf(cmd, sizeof(cmd),
+            "mkdir -p /tmp/check_csync1/dir%d/sub%d && "
+            "head -c %d /dev/urandom > /tmp/check_csync1/dir%d/sub%d/file%d",
+            i % 7, i % 3, i * 997, i % 7, i % 3, i);
+        rc = system(cmd);
+        assert_int_equal(rc, 0);
+    }
+
+    sync_threads(4);
+    rc = system("diff -r -x '.csync_journal.db*' "
+        "/tmp/check_csync1 /tmp/check_csync2 > /dev/null");
+    assert_int_equal(rc, 0);
+
+    /* changes and removals on both replicas */
+    rc = system("rm -rf /tmp/check_csync1/dir1 /tmp/check_csync2/dir2/sub0 && "
+        "echo changed > /tmp/check_csync1/dir3/sub0/file3 && "
+        "touch -d '+1 hour' /tmp/check_csync1/dir3/sub0/file3 && "
+        "echo changed > /tmp/check_csync2/dir4/sub1/file4 && "
+        "touch -d '+1 hour' /tmp/check_csync2/dir4/sub1/file4");
+    assert_int_equal(rc, 0);
+
+    sync_threads(4);
+    rc = system("diff -r -x '.csync_journal.db*' "
+        "/tmp/check_csync1 /tmp/check_csync2 > /dev/null");
+    assert_int_equal(rc, 0);
+    rc = system("test ! -e /tmp/check_csync2/dir1 && "
+        "test ! -e /tmp/check_csync1/dir2/sub0 && "
+        "grep -q changed /tmp/check_csync2/dir3/sub0/file3 && "
+        "grep -q changed /tmp/check_csync1/dir4/sub1/file4");
+    assert_int_equal(rc, 0);
+}
+
+/* with checksums the files go through the buffers of the pool */
+static void check_csync_propagate_buffers(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("mkdir -p /tmp/check_csync1/dir && "
+        "head -c 10 /dev/urandom > /tmp/check_csync1/dir/small && "
+        "head -c 100000 /dev/urandom > /tmp/check_csync1/dir/medium && "
+        "head -c 5000000 /dev/urandom > /tmp/check_csync1/dir/large");
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_init(csync), 0);
+    csync->options.checksum = true;
+
+    assert_int_equal(csync_update(csync), 0);
+    assert_int_equal(csync_reconcile(csync), 0);
+    assert_int_equal(csync_propagate(csync), 0);
+    rc = system("diff -r -x '.csync_journal.db*' "
+        "/tmp/check_csync1 /tmp/check_csync2 > /dev/null");
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_destroy(csync), 0);
+}
+
+#ifdef HAVE_PTHREAD
+/* the reader thread runs ahead of the writer, the data stays in order */
+static void check_csync_propagate_pipeline(void **state)
+{
+    struct _csync_pipeline_s pl;
+    const char *command;
+    csync_checksum_t cs;
+    uint64_t checksum;
+    CSYNC *csync;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("head -c 1000000 /dev/urandom > /tmp/check_csync1/file");
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    csync->replica = LOCAL_REPLICA;
+
+    /* only through the module and for files of several buffers */
+    assert_int_equal(_csync_pipeline_wanted(csync, LOCAL_REPLICA,
+          REMOTE_REPLICA, 1000000, 16384), 1);
+    assert_int_equal(_csync_pipeline_wanted(csync, LOCAL_REPLICA,
+          REMOTE_REPLICA, 16384, 16384), 0);
+    assert_int_equal(_csync_pipeline_wanted(csync, LOCAL_REPLICA,
+          LOCAL_REPLICA, 1000000, 16384), 0);
+
+    ZERO_STRUCT(pl);
+    pl.ctx = csync;
+    pl.srep = LOCAL_REPLICA;
+    pl.drep = LOCAL_REPLICA;
+    pl.sfp = csync_vio_open(csync, "/tmp/check_csync1/file", O_RDONLY, 0);
+    assert_non_null(pl.sfp);
+    pl.dfp = csync_vio_open(csync, "/tmp/check_csync2/file",
+        O_CREAT|O_WRONLY, 0644);
+    assert_non_null(pl.dfp);
+    pl.bufsize = CSYNC_BUFFER_MIN_SIZE;
+    csync_checksum_init(&cs);
+    pl.cs = &cs;
+
+    assert_int_equal(_csync_pipeline_copy(&pl, &command), 1000000);
+    csync_vio_close(csync, pl.sfp);
+    csync_vio_close(csync, pl.dfp);
+
+    rc = system("cmp -s /tmp/check_csync1/file /tmp/check_csync2/file");
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_checksum_file("/tmp/check_csync1/file", &checksum), 0);
+    assert_true(csync_checksum_digest(&cs) == checksum);
+
+    /* a failed read stops the writer */
+    ZERO_STRUCT(pl);
+    pl.ctx = csync;
+    pl.srep = LOCAL_REPLICA;
+    pl.drep = LOCAL_REPLICA;
+    pl.sfp = csync_vio_open(csync, "/tmp/check_csync1/file", O_WRONLY, 0);
+    assert_non_null(pl.sfp);
+    pl.dfp = csync_vio_open(csync, "/tmp/check_csync2/file2",
+        O_CREAT|O_WRONLY, 0644);
+    assert_non_null(pl.dfp);
+    pl.bufsize = CSYNC_BUFFER_MIN_SIZE;
+
+    assert_int_equal(_csync_pipeline_copy(&pl, &command), -1);
+    assert_string_equal(command, "read");
+    assert_int_equal(errno, EBADF);
+    csync_vio_close(csync, pl.sfp);
+    csync_vio_close(csync, pl.dfp);
+
+    assert_int_equal(csync_destroy(csync), 0);
+}
+
+/* a remote replica is synced with one thread, its module isn't thread safe */
+static void check_csync_propagate_threads(void **state)
+{
+    CSYNC *csync;
+    csync_file_stat_t st;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    memset(&st, 0, sizeof(st));
+    st.type = CSYNC_FTW_TYPE_FILE;
+
+    csync->options.propagate_threads = 4;
+    csync->remote.type = REMOTE_REPLICA;
+    assert_int_equal(_csync_propagate_threads(csync), 1);
+
+    csync->remote.type = LOCAL_REPLICA;
+    assert_int_equal(_csync_propagate_threads(csync), 4);
+
+    /* renames and conflicts are left for one thread */
+    st.instruction = CSYNC_INSTRUCTION_RENAME;
+    assert_int_equal(_csync_propagate_is_task(&st), 0);
+    st.instruction = CSYNC_INSTRUCTION_CONFLICT;
+    assert_int_equal(_csync_propagate_is_task(&st), 0);
+    st.instruction = CSYNC_INSTRUCTION_METADATA;
+    assert_int_equal(_csync_propagate_is_task(&st), 1);
+
+    assert_int_equal(csync_destroy(csync), 0);
+}
+#endif
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_propagate_parallel, setup, teardown),
+        unit_test_setup_teardown(check_csync_propagate_buffers, setup, teardown),
+#ifdef HAVE_PTHREAD
+        unit_test_setup_teardown(check_csync_propagate_pipeline, setup, teardown),
+        unit_test_setup_teardown(check_csync_propagate_threads, setup, teardown),
+#endif
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,513 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "torture.h"
+
+#include "csync_reconcile.c"
+#include "csync_time.h"
+
+struct file_spec {
+    csync_file_stat_t *local;
+    csync_file_stat_t *remote;
+    enum csync_instructions_e local_instruction;
+    enum csync_instructions_e remote_instruction;
+};
+
+static const enum csync_instructions_e instructions[] = {
+    CSYNC_INSTRUCTION_NONE,
+    CSYNC_INSTRUCTION_EVAL,
+    CSYNC_INSTRUCTION_NEW,
+    CSYNC_INSTRUCTION_RENAME,
+    CSYNC_INSTRUCTION_METADATA,
+};
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+static csync_file_stat_t *new_file(c_htable_t *tree, c_arena_t *arena,
+    const char *path, uint64_t phash, time_t modtime)
+{
+    csync_file_stat_t *st;
+
+    st = c_arena_alloc(arena, sizeof(csync_file_stat_t) + strlen(path));
+    assert_non_null(st);
+    memset(st, 0, sizeof(csync_file_stat_t));
+    strcpy(st->name, path);
+    st->pathlen = strlen(path);
+    st->phash = phash;
+    st->type = CSYNC_FTW_TYPE_FILE;
+    st->modtime = modtime;
+
+    assert_int_equal(c_htable_insert(tree, phash, st), 0);
+
+    return st;
+}
+
+/*
+ * Fill both trees with random files, some only on one replica. Every 64th
+ * file has the hash of the file before it.
+ */
+static struct file_spec *create_files(CSYNC *csync, size_t count)
+{
+    struct file_spec *files;
+    uint64_t phash = 0;
+    char path[64];
+    size_t i;
+
+    files = c_malloc(count * sizeof(struct file_spec));
+    assert_non_null(files);
+
+    srand(42);
+    for (i = 0; i < count; i++) {
+        int where = rand() % 8;
+
+        snprintf(path, sizeof(path), "dir%zu/file%zu", i % 100, i);
+        if (i % 64 != 1) {
+            phash = csync_path_hash(path, strlen(path));
+        }
+
+        if (where != 1) {
+            files[i].local = new_file(csync->local.tree, csync->local.arena,
+                path, phash, rand() % 3);
+            files[i].local_instruction = instructions[rand() % 5];
+        }
+        if (where != 2) {
+            files[i].remote = new_file(csync->remote.tree, csync->remote.arena,
+                path, phash, rand() % 3);
+            files[i].remote_instruction = instructions[rand() % 5];
+        }
+    }
+
+    return files;
+}
+
+static void reset_files(struct file_spec *files, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (files[i].local != NULL) {
+            files[i].local->instruction = files[i].local_instruction;
+        }
+        if (files[i].remote != NULL) {
+            files[i].remote->instruction = files[i].remote_instruction;
+        }
+    }
+}
+
+static void reconcile_by_lookup(CSYNC *csync)
+{
+    csync->current = LOCAL_REPLICA;
+    assert_int_equal(csync_reconcile_updates(csync), 0);
+    csync->current = REMOTE_REPLICA;
+    assert_int_equal(csync_reconcile_updates(csync), 0);
+}
+
+/* the merge gives the same instructions as the lookups */
+static void check_csync_reconcile_merge(void **state)
+{
+    CSYNC *csync = *state;
+    struct file_spec *files;
+    uint16_t *expected;
+    size_t count = 2000;
+    size_t i;
+    int conflicts;
+
+    files = create_files(csync, count);
+    expected = c_malloc(2 * count * sizeof(uint16_t));
+    assert_non_null(expected);
+
+    for (conflicts = 0; conflicts < 2; conflicts++) {
+        csync->options.with_conflict_copys = conflicts;
+
+        reset_files(files, count);
+        reconcile_by_lookup(csync);
+        for (i = 0; i < count; i++) {
+            expected[2 * i] = files[i].local ? files[i].local->instruction : 0;
+            expected[2 * i + 1] = files[i].remote ? files[i].remote->instruction : 0;
+        }
+
+        reset_files(files, count);
+        assert_int_equal(csync_reconcile_merge(csync), 0);
+        for (i = 0; i < count; i++) {
+            if (files[i].local != NULL) {
+                assert_int_equal(files[i].local->instruction, expected[2 * i]);
+            }
+            if (files[i].remote != NULL) {
+                assert_int_equal(files[i].remote->instruction, expected[2 * i + 1]);
+            }
+        }
+    }
+
+    free(expected);
+    free(files);
+}
+
+/* redirect stdout, where the log goes without log4c, to a file */
+static int redirect_stdout(const char *path)
+{
+    int fd, saved;
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert_true(saved >= 0 && fd >= 0);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    return saved;
+}
+
+static void restore_stdout(int saved)
+{
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+/* the threads give the same instructions and the same log as one thread */
+static void check_csync_reconcile_parallel(void **state)
+{
+    CSYNC *csync = *state;
+    struct file_spec *files;
+    uint16_t *expected;
+    size_t count = 20000;
+    size_t i;
+    int saved;
+    int rc;
+
+    files = create_files(csync, count);
+    expected = c_malloc(2 * count * sizeof(uint16_t));
+    assert_non_null(expected);
+
+    /* sorting the trees logs the hash collisions, do it before */
+    assert_non_null(c_htable_sorted(csync->local.tree));
+    assert_non_null(c_htable_sorted(csync->remote.tree));
+
+    reset_files(files, count);
+    csync->options.reconcile_threads = 1;
+    saved = redirect_stdout("/tmp/check_csync/serial.log");
+    rc = csync_reconcile_merge(csync);
+    restore_stdout(saved);
+    assert_int_equal(rc, 0);
+    for (i = 0; i < count; i++) {
+        expected[2 * i] = files[i].local ? files[i].local->instruction : 0;
+        expected[2 * i + 1] = files[i].remote ? files[i].remote->instruction : 0;
+    }
+
+    reset_files(files, count);
+    csync->options.reconcile_threads = 4;
+    saved = redirect_stdout("/tmp/check_csync/parallel.log");
+    rc = csync_reconcile_merge(csync);
+    restore_stdout(saved);
+    assert_int_equal(rc, 0);
+    for (i = 0; i < count; i++) {
+        if (files[i].local != NULL) {
+            assert_int_equal(files[i].local->instruction, expected[2 * i]);
+        }
+        if (files[i].remote != NULL) {
+            assert_int_equal(files[i].remote->instruction, expected[2 * i + 1]);
+        }
+    }
+
+    /* apart from the line about the threads */
+    rc = system("grep -v 'Reconciling .* files with 4 threads' "
+        "/tmp/check_csync/parallel.log | cmp -s - /tmp/check_csync/serial.log");
+    assert_int_equal(rc, 0);
+
+    free(expected);
+    free(files);
+}
+
+static void sync_once(void)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_init(csync), 0);
+    assert_int_equal(csync_update(csync), 0);
+    assert_int_equal(csync_reconcile(csync), 0);
+    assert_int_equal(csync_propagate(csync), 0);
+    assert_int_equal(csync_destroy(csync), 0);
+}
+
+/* a renamed file is moved on the remote replica, not copied again */
+static void check_csync_reconcile_rename(void **state)
+{
+    struct stat sb;
+    ino_t inode;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync /tmp/check_csync1/dir /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = system("echo moved > /tmp/check_csync1/dir/a");
+    assert_int_equal(rc, 0);
+
+    sync_once();
+    assert_int_equal(stat("/tmp/check_csync2/dir/a", &sb), 0);
+    inode = sb.st_ino;
+
+    /* into a directory which doesn't exist on the remote replica */
+    rc = system("mkdir /tmp/check_csync1/new && "
+        "mv /tmp/check_csync1/dir/a /tmp/check_csync1/new/b");
+    assert_int_equal(rc, 0);
+
+    sync_once();
+    assert_int_equal(stat("/tmp/check_csync2/new/b", &sb), 0);
+    assert_true(sb.st_ino == inode);
+    assert_int_equal(stat("/tmp/check_csync2/dir/a", &sb), -1);
+
+    /* the statedb has the new path, nothing happens anymore */
+    sync_once();
+    assert_int_equal(stat("/tmp/check_csync2/new/b", &sb), 0);
+    assert_true(sb.st_ino == inode);
+    assert_int_equal(stat("/tmp/check_csync1/dir/a", &sb), -1);
+    assert_int_equal(stat("/tmp/check_csync1/new/b", &sb), 0);
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+}
+
+static enum csync_instructions_e remote_instruction(CSYNC *csync,
+    const char *path)
+{
+    csync_file_stat_t *st;
+
+    st = csync_file_tree_find_path(csync->remote.tree,
+        csync_path_hash(path, strlen(path)), path, strlen(path));
+    assert_non_null(st);
+
+    return st->instruction;
+}
+
+/* a directory removed with everything in it is removed at once */
+static void check_csync_reconcile_subtree(void **state)
+{
+    CSYNC *csync;
+    struct stat sb;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync /tmp/check_csync2 "
+        "/tmp/check_csync1/tree/sub /tmp/check_csync1/kept/sub && "
+        "echo a > /tmp/check_csync1/tree/a && "
+        "echo b > /tmp/check_csync1/tree/sub/b && "
+        "echo c > /tmp/check_csync1/kept/sub/c");
+    assert_int_equal(rc, 0);
+
+    sync_once();
+
+    /* a file in kept is changed on the remote replica */
+    rc = system("rm -rf /tmp/check_csync1/tree /tmp/check_csync1/kept && "
+        "echo changed > /tmp/check_csync2/kept/sub/c && "
+        "touch -d '+1 hour' /tmp/check_csync2/kept/sub/c");
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_init(csync), 0);
+    assert_int_equal(csync_update(csync), 0);
+    assert_int_equal(csync_reconcile(csync), 0);
+
+    assert_int_equal(remote_instruction(csync, "tree"),
+        CSYNC_INSTRUCTION_REMOVE_TREE);
+    assert_int_equal(remote_instruction(csync, "tree/sub"),
+        CSYNC_INSTRUCTION_REMOVE);
+    assert_int_equal(remote_instruction(csync, "kept"),
+        CSYNC_INSTRUCTION_REMOVE);
+    assert_int_equal(remote_instruction(csync, "kept/sub"),
+        CSYNC_INSTRUCTION_REMOVE);
+    assert_int_equal(remote_instruction(csync, "kept/sub/c"),
+        CSYNC_INSTRUCTION_NEW);
+
+    assert_int_equal(csync_propagate(csync), 0);
+    assert_int_equal(remote_instruction(csync, "tree"),
+        CSYNC_INSTRUCTION_DELETED);
+    assert_int_equal(remote_instruction(csync, "tree/sub/b"),
+        CSYNC_INSTRUCTION_DELETED);
+    assert_int_equal(csync_destroy(csync), 0);
+
+    assert_int_equal(stat("/tmp/check_csync2/tree", &sb), -1);
+    assert_int_equal(stat("/tmp/check_csync1/kept/sub/c", &sb), 0);
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+}
+
+/* a removed directory with files which aren't synced isn't removed at once */
+static void check_csync_reconcile_subtree_excluded(void **state)
+{
+    CSYNC *csync;
+    struct stat sb;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync /tmp/check_csync2 "
+        "/tmp/check_csync1/tree/sub /tmp/check_csync1/other && "
+        "echo '*.swp' > /tmp/check_csync/csync_exclude.conf && "
+        "echo a > /tmp/check_csync1/tree/a && "
+        "echo b > /tmp/check_csync1/tree/sub/b && "
+        "echo c > /tmp/check_csync1/other/c");
+    assert_int_equal(rc, 0);
+
+    sync_once();
+
+    /* only on the remote replica, neither is synced */
+    rc = system("rm -rf /tmp/check_csync1/tree /tmp/check_csync1/other && "
+        "echo swap > /tmp/check_csync2/tree/sub/.b.swp && "
+        "ln -s c /tmp/check_csync2/other/link");
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_init(csync), 0);
+    assert_int_equal(csync_update(csync), 0);
+    assert_int_equal(csync_reconcile(csync), 0);
+
+    assert_int_equal(remote_instruction(csync, "tree"),
+        CSYNC_INSTRUCTION_REMOVE);
+    assert_int_equal(remote_instruction(csync, "tree/sub"),
+        CSYNC_INSTRUCTION_REMOVE);
+    assert_int_equal(remote_instruction(csync, "tree/sub/b"),
+        CSYNC_INSTRUCTION_REMOVE);
+    assert_int_equal(remote_instruction(csync, "other"),
+        CSYNC_INSTRUCTION_REMOVE);
+
+    assert_int_equal(csync_propagate(csync), 0);
+    assert_int_equal(csync_destroy(csync), 0);
+
+    assert_int_equal(stat("/tmp/check_csync2/tree/a", &sb), -1);
+    assert_int_equal(stat("/tmp/check_csync2/tree/sub/b", &sb), -1);
+    assert_int_equal(stat("/tmp/check_csync2/other/c", &sb), -1);
+    assert_int_equal(stat("/tmp/check_csync2/tree/sub/.b.swp", &sb), 0);
+    assert_int_equal(lstat("/tmp/check_csync2/other/link", &sb), 0);
+
+    rc = system("rm -rf /tmp/check_csync /tmp/check_csync1 /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+}
+
+/*
+ * Compare the time of both on CSYNC_BENCH_FILES files, 100000 by default.
+ * The log of every file goes to /dev/null while they run.
+ */
+static void check_csync_reconcile_benchmark(void **state)
+{
+    CSYNC *csync = *state;
+    struct file_spec *files;
+    struct timespec start, finish;
+    double lookup, merge, parallel;
+    const char *env;
+    size_t count = 100000;
+    int fd, devnull;
+
+    env = getenv("CSYNC_BENCH_FILES");
+    if (env != NULL && atol(env) > 0) {
+        count = atol(env);
+    }
+    files = create_files(csync, count);
+
+    fflush(stdout);
+    fd = dup(STDOUT_FILENO);
+    devnull = open("/dev/null", O_WRONLY);
+    assert_true(fd >= 0 && devnull >= 0);
+    dup2(devnull, STDOUT_FILENO);
+
+    reset_files(files, count);
+    csync_gettime(&start);
+    reconcile_by_lookup(csync);
+    csync_gettime(&finish);
+    lookup = c_secdiff(finish, start);
+
+    reset_files(files, count);
+    csync_gettime(&start);
+    assert_int_equal(csync_reconcile_merge(csync), 0);
+    csync_gettime(&finish);
+    merge = c_secdiff(finish, start);
+
+    reset_files(files, count);
+    csync->options.reconcile_threads = 4;
+    csync_gettime(&start);
+    assert_int_equal(csync_reconcile_merge(csync), 0);
+    csync_gettime(&finish);
+    parallel = c_secdiff(finish, start);
+
+    fflush(stdout);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    close(devnull);
+
+    printf("reconcile %zu files: lookups %.3f seconds, merge %.3f seconds, "
+        "4 threads %.3f seconds\n", count, lookup, merge, parallel);
+
+    free(files);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_reconcile_merge, setup, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_parallel, setup, teardown),
+        unit_test(check_csync_reconcile_rename),
+        unit_test(check_csync_reconcile_subtree),
+        unit_test(check_csync_reconcile_subtree_excluded),
+        unit_test_setup_teardown(check_csync_reconcile_benchmark, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -210,7 +210,7 @@ static void check_csync_statedb_insert_metadata(void **state)
         st = c_malloc(sizeof(csync_file_stat_t));
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_htable_insert(csync->local.tree, st->phash, st);
         assert_int_equal(rc, 0);
     }
 
@@ -228,7 +228,7 @@ static void check_csync_statedb_write(void **state)
         st = c_malloc(sizeof(csync_file_stat_t));
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_htable_insert(csync->local.tree, st->phash, st);
         assert_int_equal(rc, 0);
     }
 
@@ -236,6 +236,134 @@ static void check_csync_statedb_write(void **state)
     assert_int_equal(rc, 0);
 }
 
+static csync_file_stat_t *new_file(CSYNC *ctx, const char *path, ino_t inode,
+    uint64_t checksum)
+{
+    csync_file_stat_t *st;
+
+    st = c_arena_alloc(ctx->local.arena, sizeof(csync_file_stat_t) + strlen(path));
+    assert_non_null(st);
+    memset(st, 0, sizeof(csync_file_stat_t));
+    strcpy(st->name, path);
+    st->pathlen = strlen(path);
+    st->phash = csync_path_hash(path, strlen(path));
+    st->type = CSYNC_FTW_TYPE_FILE;
+    st->inode = inode;
+    st->size = 42;
+    st->modtime = 42;
+    st->ctime = 42;
+    st->checksum = checksum;
+
+    assert_int_equal(c_htable_insert(ctx->local.tree, st->phash, st), 0);
+
+    return st;
+}
+
+static csync_file_stat_t *new_entry(CSYNC *ctx, const char *name,
+    const csync_file_stat_t *parent, uint64_t phash, int type,
+    enum csync_instructions_e instruction)
+{
+    csync_file_stat_t *st;
+
+    st = c_arena_alloc(ctx->local.arena, sizeof(csync_file_stat_t) + strlen(name));
+    assert_non_null(st);
+    memset(st, 0, sizeof(csync_file_stat_t));
+    strcpy(st->name, name);
+    st->parent = parent;
+    st->pathlen = parent ? parent->pathlen + 1 + strlen(name) : strlen(name);
+    st->phash = phash;
+    st->type = type;
+    st->modtime = 42;
+    st->instruction = instruction;
+
+    return st;
+}
+
+/* the children of a directory whose hash collides aren't counted */
+static void check_csync_statedb_childcount_collision(void **state)
+{
+    CSYNC *csync = *state;
+    struct _csync_statedb_write_s w;
+    csync_file_stat_t *a, *b;
+    uint64_t phash = csync_path_hash("a", 1);
+    size_t i;
+
+    /* the directories a and b have the same hash */
+    a = new_entry(csync, "a", NULL, phash, CSYNC_FTW_TYPE_DIR,
+        CSYNC_INSTRUCTION_NONE);
+    b = new_entry(csync, "b", NULL, phash, CSYNC_FTW_TYPE_DIR,
+        CSYNC_INSTRUCTION_NONE);
+    csync->local.update_start = 1000;
+
+    ZERO_STRUCT(w);
+    w.ctx = csync;
+    assert_int_equal(_collect_children_visitor(
+          new_entry(csync, "x", a, 1, CSYNC_FTW_TYPE_FILE,
+            CSYNC_INSTRUCTION_NONE), &w), 0);
+    assert_int_equal(_collect_children_visitor(
+          new_entry(csync, "a/y", NULL, 2, CSYNC_FTW_TYPE_FILE,
+            CSYNC_INSTRUCTION_UPDATED), &w), 0);
+    /* not written, so b can't be trusted */
+    assert_int_equal(_collect_children_visitor(
+          new_entry(csync, "z", b, 3, CSYNC_FTW_TYPE_FILE,
+            CSYNC_INSTRUCTION_NEW), &w), 0);
+    qsort(w.children, w.count, sizeof(struct _csync_statedb_child_s),
+        _csync_statedb_child_cmp);
+    w.counted = 1;
+
+    assert_int_equal(_csync_statedb_childcount(&w, a), 2);
+    assert_int_equal(_csync_statedb_childcount(&w, b), -1);
+
+    for (i = 0; i < w.count; i++) {
+        assert_true(w.children[i].parent == phash);
+    }
+    SAFE_FREE(w.children);
+}
+
+static void check_csync_statedb_checksum_cache(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *a, *b;
+    uint64_t checksum;
+    int rc;
+
+    csync->options.checksum = true;
+    a = new_file(csync, "a", 23, 1);
+    b = new_file(csync, "b", 24, (uint64_t) -1);
+    new_file(csync, "c", 25, CSYNC_CHECKSUM_NONE);
+    /* modified files are cached too, they are checksummed already */
+    b->instruction = CSYNC_INSTRUCTION_ERROR;
+
+    rc = csync_statedb_write(csync);
+    assert_int_equal(rc, 0);
+
+    rc = _csync_statedb_checksums_load(csync);
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync->statedb.checksums->count, 2);
+
+    rc = csync_statedb_checksum_get(csync, a, &checksum);
+    assert_int_equal(rc, 1);
+    assert_true(checksum == 1);
+    rc = csync_statedb_checksum_get(csync, b, &checksum);
+    assert_int_equal(rc, 1);
+    assert_true(checksum == (uint64_t) -1);
+
+    /* any change of the file invalidates the checksum */
+    a->ctime++;
+    rc = csync_statedb_checksum_get(csync, a, &checksum);
+    assert_int_equal(rc, 0);
+    b->size++;
+    rc = csync_statedb_checksum_get(csync, b, &checksum);
+    assert_int_equal(rc, 0);
+    b->size--;
+    b->inode = 666;
+    rc = csync_statedb_checksum_get(csync, b, &checksum);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(csync->statedb.stats.checksum_lookups, 5);
+    assert_int_equal(csync->statedb.stats.checksum_hits, 2);
+}
+
 static void check_csync_statedb_get_stat_by_hash(void **state)
 {
     CSYNC *csync = *state;
@@ -259,6 +387,125 @@ static void check_csync_statedb_get_stat_by_hash_not_found(void **state)
     assert_null(tmp);
 }
 
+/* files with the same hash are told apart by their path */
+static void check_csync_statedb_get_stat_by_path(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *tmp;
+    char *stmt = NULL;
+    int rc;
+
+    stmt = sqlite3_mprintf("INSERT INTO metadata"
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES"
+        "(%lu, %d, '%q', %d, %d, %d, %d, %lu);",
+        42,
+        5,
+        "sunny",
+        24,
+        42,
+        42,
+        42,
+        42);
+    rc = csync_statedb_insert(csync, stmt);
+    sqlite3_free(stmt);
+    assert_true(rc > 0);
+
+    tmp = csync_statedb_get_stat_by_path(csync, (uint64_t) 42, "sunny");
+    assert_non_null(tmp);
+    assert_int_equal(tmp->inode, 24);
+    free(tmp);
+
+    tmp = csync_statedb_get_stat_by_path(csync, (uint64_t) 42, "It's a rainy day");
+    assert_non_null(tmp);
+    assert_int_equal(tmp->inode, 23);
+    free(tmp);
+
+    tmp = csync_statedb_get_stat_by_path(csync, (uint64_t) 42, "cloudy");
+    assert_null(tmp);
+}
+
+/* statedbs of version 0 have the c_jhash64 of the path as phash */
+static void check_csync_statedb_upgrade(void **state)
+{
+    CSYNC *csync = *state;
+    const char *path = "It's a rainy day";
+    csync_file_stat_t *tmp;
+    c_strlist_t *result;
+    uint64_t h;
+    int rc;
+
+    result = csync_statedb_query(csync, "PRAGMA user_version = 0;");
+    assert_non_null(result);
+    c_strlist_destroy(result);
+
+    rc = _csync_statedb_upgrade(csync);
+    assert_int_equal(rc, 0);
+
+    result = csync_statedb_query(csync, "PRAGMA user_version;");
+    assert_non_null(result);
+    assert_int_equal(atoi(result->vector[0]), CSYNC_STATEDB_VERSION);
+    c_strlist_destroy(result);
+
+    h = csync_path_hash(path, strlen(path));
+    tmp = csync_statedb_get_stat_by_inode(csync, (ino_t) 23);
+    assert_non_null(tmp);
+    assert_true(tmp->phash == h);
+    free(tmp);
+
+    tmp = csync_statedb_get_stat_by_path(csync, h, path);
+    assert_non_null(tmp);
+    free(tmp);
+
+    /* nothing to do anymore */
+    rc = _csync_statedb_upgrade(csync);
+    assert_int_equal(rc, 0);
+}
+
+/* statedbs of version 1 have no checksum column */
+static void check_csync_statedb_upgrade_checksum(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *tmp;
+    c_strlist_t *result;
+    int rc;
+
+    rc = sqlite3_exec(csync->statedb.db,
+        "DROP TABLE metadata;"
+        "CREATE TABLE metadata(phash INTEGER(8), pathlen INTEGER,"
+        "path VARCHAR(4096), inode INTEGER, uid INTEGER, gid INTEGER,"
+        "mode INTEGER, modtime INTEGER(8), PRIMARY KEY(phash, path));"
+        "INSERT INTO metadata VALUES(42, 5, 'rainy', 23, 42, 42, 42, 42);"
+        "PRAGMA user_version = 1;", NULL, NULL, NULL);
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = _csync_statedb_upgrade(csync);
+    assert_int_equal(rc, 0);
+    assert_true(_csync_statedb_has_column(csync, "childcount"));
+    assert_true(_csync_statedb_has_column(csync, "checksum"));
+    assert_true(_csync_statedb_has_column(csync, "size"));
+    assert_true(_csync_statedb_has_column(csync, "ctime"));
+    assert_true(_csync_statedb_has_column(csync, "mtime_nsec"));
+
+    tmp = csync_statedb_get_stat_by_inode(csync, (ino_t) 23);
+    assert_non_null(tmp);
+    assert_true(tmp->checksum == 0);
+    /* unknown */
+    assert_int_equal(tmp->size, -1);
+    assert_int_equal(tmp->ctime, 0);
+    free(tmp);
+
+    result = csync_statedb_query(csync,
+        "UPDATE metadata SET checksum = -2 WHERE inode = 23;");
+    assert_non_null(result);
+    c_strlist_destroy(result);
+
+    /* checksums are stored signed */
+    tmp = csync_statedb_get_stat_by_inode(csync, (ino_t) 23);
+    assert_non_null(tmp);
+    assert_true(tmp->checksum == (uint64_t) -2);
+    free(tmp);
+}
+
 static void check_csync_statedb_get_stat_by_inode(void **state)
 {
     CSYNC *csync = *state;
@@ -282,6 +529,112 @@ static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
     assert_null(tmp);
 }
 
+static void check_csync_statedb_index(void **state)
+{
+    CSYNC *csync = *state;
+    const char *path = "It's a rainy day";
+    const csync_file_stat_t *tmp;
+    uint64_t h;
+    int rc;
+
+    h = csync_path_hash(path, strlen(path));
+
+    /* no index loaded yet */
+    tmp = csync_statedb_index_get_by_hash(csync, h);
+    assert_null(tmp);
+
+    rc = _csync_statedb_index_load(csync);
+    assert_int_equal(rc, 0);
+
+    tmp = csync_statedb_index_get_by_hash(csync, h);
+    assert_non_null(tmp);
+    assert_true(tmp->phash == h);
+    assert_int_equal(tmp->inode, 23);
+    assert_int_equal(tmp->modtime, 42);
+    assert_string_equal(tmp->name, path);
+
+    tmp = csync_statedb_index_get_by_hash(csync, (uint64_t) 666);
+    assert_null(tmp);
+
+    tmp = csync_statedb_index_get_by_inode(csync, (ino_t) 23);
+    assert_non_null(tmp);
+    assert_true(tmp->phash == h);
+
+    tmp = csync_statedb_index_get_by_inode(csync, (ino_t) 666);
+    assert_null(tmp);
+}
+
+/* the first row with an inode is found, like with the query */
+static void check_csync_statedb_index_inode(void **state)
+{
+    CSYNC *csync = *state;
+    const csync_file_stat_t *tmp;
+    char *stmt = NULL;
+    int rc;
+
+    stmt = sqlite3_mprintf("INSERT INTO metadata"
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES"
+        "(%lu, %d, '%q', %d, %d, %d, %d, %lu);",
+        43,
+        5,
+        "sunny",
+        23,
+        42,
+        42,
+        42,
+        42);
+    rc = csync_statedb_insert(csync, stmt);
+    sqlite3_free(stmt);
+    assert_true(rc > 0);
+
+    rc = _csync_statedb_index_load(csync);
+    assert_int_equal(rc, 0);
+
+    tmp = csync_statedb_index_get_by_inode(csync, (ino_t) 23);
+    assert_non_null(tmp);
+    assert_string_equal(tmp->name, "It's a rainy day");
+}
+
+static void check_csync_statedb_inode_map(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *tmp;
+    char *stmt = NULL;
+    int rc;
+
+    stmt = sqlite3_mprintf("INSERT INTO metadata"
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime) VALUES"
+        "(%lu, %d, '%q', %d, %d, %d, %d, %lu);",
+        43,
+        5,
+        "sunny",
+        23,
+        42,
+        42,
+        42,
+        42);
+    rc = csync_statedb_insert(csync, stmt);
+    sqlite3_free(stmt);
+    assert_true(rc > 0);
+
+    tmp = csync_statedb_get_stat_by_inode(csync, (ino_t) 666);
+    assert_null(tmp);
+    assert_non_null(csync->statedb.inodes);
+    assert_int_equal(csync->statedb.inodes->count, 2);
+
+    /* the first row with the inode is returned */
+    tmp = csync_statedb_get_stat_by_inode(csync, (ino_t) 23);
+    assert_non_null(tmp);
+    assert_int_equal(tmp->phash, 42);
+    assert_string_equal(tmp->name, "It's a rainy day");
+    free(tmp);
+
+    /* one query to build the map and one to get the row */
+    assert_int_equal(csync->statedb.stats.inode_lookups, 2);
+    assert_int_equal(csync->statedb.stats.inode_found, 1);
+    assert_int_equal(csync->statedb.stats.queries, 2);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -294,10 +647,18 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_statedb_drop_tables, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_insert_metadata, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_write, setup, teardown),
+        unit_test_setup_teardown(check_csync_statedb_checksum_cache, setup, teardown),
+        unit_test_setup_teardown(check_csync_statedb_childcount_collision, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_not_found, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_get_stat_by_path, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_upgrade, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_upgrade_checksum, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode_not_found, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_index, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_index_inode, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_inode_map, setup_db, teardown),
     };
 
     return run_tests(tests);
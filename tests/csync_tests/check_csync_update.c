@@ -44,6 +44,62 @@ static void setup_ftw(void **state)
     *state = csync;
 }
 
+static void setup_walk(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync1/a/b/c /tmp/check_csync1/d/e");
+    assert_int_equal(rc, 0);
+    rc = system("for i in $(seq 1 150); do "
+                "touch /tmp/check_csync1/file$i /tmp/check_csync1/a/b/file$i; "
+                "done");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/b/c/file /tmp/check_csync1/d/e/file");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void setup_incremental(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("printf '[global]\\nincremental_update = true\\n' "
+                "> /tmp/check_csync/csync.conf");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync1/a/b /tmp/check_csync1/d/e");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/b/file /tmp/check_csync1/d/e/file");
+    assert_int_equal(rc, 0);
+    rc = system("touch -d 2010-01-01 /tmp/check_csync1/a /tmp/check_csync1/a/b "
+                "/tmp/check_csync1/d /tmp/check_csync1/d/e");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
 static void teardown(void **state)
 {
     CSYNC *csync = *state;
@@ -144,12 +200,12 @@ static csync_vio_file_stat_t* create_fstat(const char *name,
     return fs;
 }
 
-static int failing_fn(CSYNC *ctx,
+static int failing_fn(csync_walk_t *walk,
                       const char *file,
                       const csync_vio_file_stat_t *fs,
                       enum csync_ftw_flags_e flag)
 {
-  (void) ctx;
+  (void) walk;
   (void) file;
   (void) fs;
   (void) flag;
@@ -161,6 +217,7 @@ static int failing_fn(CSYNC *ctx,
 static void check_csync_detect_update(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     csync_file_stat_t *st;
     csync_vio_file_stat_t *fs;
     int rc;
@@ -168,14 +225,15 @@ static void check_csync_detect_update(void **state)
     fs = create_fstat("file.txt", 0, 1, 1217597845);
     assert_non_null(fs);
 
-    rc = _csync_detect_update(csync,
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = _csync_detect_update(&walk,
                               "/tmp/check_csync1/file.txt",
                               fs,
                               CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_htable_sorted(csync->local.tree)[0];
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* set the instruction to UPDATED that it gets written to the statedb */
@@ -190,6 +248,7 @@ static void check_csync_detect_update(void **state)
 static void check_csync_detect_update_db_none(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     csync_file_stat_t *st;
     csync_vio_file_stat_t *fs;
     int rc;
@@ -197,14 +256,15 @@ static void check_csync_detect_update_db_none(void **state)
     fs = create_fstat("file.txt", 0, 1, 1217597845);
     assert_non_null(fs);
 
-    rc = _csync_detect_update(csync,
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = _csync_detect_update(&walk,
                               "/tmp/check_csync1/file.txt",
                               fs,
                               CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_htable_sorted(csync->local.tree)[0];
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NONE);
 
     /* set the instruction to UPDATED that it gets written to the statedb */
@@ -219,6 +279,7 @@ static void check_csync_detect_update_db_none(void **state)
 static void check_csync_detect_update_db_eval(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     csync_file_stat_t *st;
     csync_vio_file_stat_t *fs;
     int rc;
@@ -226,14 +287,15 @@ static void check_csync_detect_update_db_eval(void **state)
     fs = create_fstat("file.txt", 0, 1, 0);
     assert_non_null(fs);
 
-    rc = _csync_detect_update(csync,
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = _csync_detect_update(&walk,
                               "/tmp/check_csync1/file.txt",
                               fs,
                               CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_htable_sorted(csync->local.tree)[0];
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_EVAL);
 
     /* set the instruction to UPDATED that it gets written to the statedb */
@@ -248,6 +310,7 @@ static void check_csync_detect_update_db_eval(void **state)
 static void check_csync_detect_update_db_rename(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     csync_file_stat_t *st;
     csync_vio_file_stat_t *fs;
     int rc;
@@ -255,14 +318,15 @@ static void check_csync_detect_update_db_rename(void **state)
     fs = create_fstat("wurst.txt", 0, 1, 0);
     assert_non_null(fs);
 
-    rc = _csync_detect_update(csync,
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = _csync_detect_update(&walk,
                               "/tmp/check_csync1/wurst.txt",
                               fs,
                               CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to rename */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_htable_sorted(csync->local.tree)[0];
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_RENAME);
 
     /* set the instruction to UPDATED that it gets written to the statedb */
@@ -277,6 +341,7 @@ static void check_csync_detect_update_db_rename(void **state)
 static void check_csync_detect_update_db_new(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     csync_file_stat_t *st;
     csync_vio_file_stat_t *fs;
     int rc;
@@ -284,14 +349,15 @@ static void check_csync_detect_update_db_new(void **state)
     fs = create_fstat("file.txt", 42000, 1, 0);
     assert_non_null(fs);
 
-    rc = _csync_detect_update(csync,
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = _csync_detect_update(&walk,
                               "/tmp/check_csync1/file.txt",
                               fs,
                               CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_htable_sorted(csync->local.tree)[0];
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* set the instruction to UPDATED that it gets written to the statedb */
@@ -303,9 +369,83 @@ static void check_csync_detect_update_db_new(void **state)
     csync_vio_file_stat_destroy(fs);
 }
 
+/* the quick check against the statedb record of a file */
+static void check_csync_detect_change(void **state)
+{
+    CSYNC *csync = *state;
+    csync_walk_t walk;
+    csync_file_stat_t tmp;
+    csync_vio_file_stat_t *fs;
+
+    fs = create_fstat("file.txt", 0, 1, 1217597845);
+    assert_non_null(fs);
+    fs->mtime_nsec = 500;
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.modtime = fs->mtime;
+    tmp.mtime_nsec = 500;
+    tmp.ctime = fs->ctime;
+    tmp.size = fs->size;
+    tmp.mode = fs->mode;
+    tmp.owner = csync_owner_id(csync, fs->uid, fs->gid);
+
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_NONE);
+
+    /* the content changed but the mtime was kept */
+    fs->size++;
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_EVAL);
+    /* unless the size is unknown */
+    tmp.size = -1;
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_NONE);
+    tmp.size = fs->size;
+
+    /* modified in the same second */
+    fs->mtime_nsec = 600;
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_EVAL);
+    fs->mtime_nsec = 500;
+
+    /* only the mode changed */
+    fs->ctime++;
+    fs->mode = 0600;
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_METADATA);
+    fs->mode = 0644;
+    fs->gid = 1001;
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_METADATA);
+    fs->gid = 1000;
+    /* another change of the inode, like a new link */
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_NONE);
+
+    /* the ctime is only recorded for the local replica */
+    fs->mode = 0600;
+    csync_walk_init(&walk, csync, REMOTE_REPLICA);
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_NONE);
+
+    /* records written before it was recorded */
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    tmp.ctime = 0;
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_NONE);
+
+    fs->mtime++;
+    assert_int_equal(_csync_detect_change(&walk, fs, &tmp, CSYNC_FTW_TYPE_FILE),
+        CSYNC_INSTRUCTION_EVAL);
+
+    csync_vio_file_stat_destroy(fs);
+}
+
 static void check_csync_detect_update_nlink(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     csync_file_stat_t *st;
     csync_vio_file_stat_t *fs;
     int rc;
@@ -315,14 +455,15 @@ static void check_csync_detect_update_nlink(void **state)
     assert_non_null(fs);
 
     /* add it to local tree */
-    rc = _csync_detect_update(csync,
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = _csync_detect_update(&walk,
                               "/tmp/check_csync1/file.txt",
                               fs,
                               CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to ignore */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_htable_sorted(csync->local.tree)[0];
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_IGNORE);
 
     csync_vio_file_stat_destroy(fs);
@@ -331,19 +472,21 @@ static void check_csync_detect_update_nlink(void **state)
 static void check_csync_detect_update_null(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     csync_vio_file_stat_t *fs;
     int rc;
 
     fs = create_fstat("file.txt", 0, 1, 0);
     assert_non_null(fs);
 
-    rc = _csync_detect_update(csync,
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = _csync_detect_update(&walk,
                               NULL,
                               fs,
                               CSYNC_FTW_TYPE_FILE);
     assert_int_equal(rc, -1);
 
-    rc = _csync_detect_update(csync,
+    rc = _csync_detect_update(&walk,
                               "/tmp/check_csync1/file.txt",
                               NULL,
                               CSYNC_FTW_TYPE_FILE);
@@ -355,30 +498,441 @@ static void check_csync_detect_update_null(void **state)
 static void check_csync_ftw(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     int rc;
 
-    rc = csync_ftw(csync, "/tmp", csync_walker, MAX_DEPTH);
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw(&walk, "/tmp", csync_walker, MAX_DEPTH);
     assert_int_equal(rc, 0);
 }
 
 static void check_csync_ftw_empty_uri(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
     int rc;
 
-    rc = csync_ftw(csync, "", csync_walker, MAX_DEPTH);
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw(&walk, "", csync_walker, MAX_DEPTH);
     assert_int_equal(rc, -1);
 }
 
 static void check_csync_ftw_failing_fn(void **state)
 {
     CSYNC *csync = *state;
+    csync_walk_t walk;
+    int rc;
+
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw(&walk, "/tmp", failing_fn, MAX_DEPTH);
+    assert_int_equal(rc, -1);
+}
+
+static void check_csync_ftw_parallel(void **state)
+{
+    CSYNC *csync = *state;
+    csync_walk_t walk;
+    c_htable_t *tree = NULL;
+    void **a, **b;
+    int rc;
+
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+
+    rc = csync_ftw(&walk, csync->local.uri, csync_walker, MAX_DEPTH);
+    assert_int_equal(rc, 0);
+
+    tree = csync->local.tree;
+    rc = c_htable_create(&csync->local.tree, csync_file_stat_cmp);
+    assert_int_equal(rc, 0);
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+
+    rc = csync_ftw_parallel(&walk, csync->local.uri, csync_walker, MAX_DEPTH, 4);
+    assert_int_equal(rc, 0);
+
+    /* 5 directories and 302 files */
+    assert_int_equal(c_htable_size(tree), 307);
+    assert_int_equal(c_htable_size(csync->local.tree), 307);
+
+    for (a = c_htable_sorted(tree), b = c_htable_sorted(csync->local.tree);
+         *a != NULL && *b != NULL;
+         a++, b++) {
+        csync_file_stat_t *sa = *a;
+        csync_file_stat_t *sb = *b;
+        char pa[sa->pathlen + 1];
+        char pb[sb->pathlen + 1];
+
+        assert_true(sa->phash == sb->phash);
+        assert_string_equal(csync_file_stat_path(sa, pa),
+                            csync_file_stat_path(sb, pb));
+        assert_int_equal(sa->type, sb->type);
+        assert_int_equal(sa->instruction, sb->instruction);
+    }
+    assert_null(*a);
+    assert_null(*b);
+
+    c_htable_free(tree);
+}
+
+/* Layout of the file stats when they stored the whole path */
+struct legacy_file_stat_s {
+    uint64_t phash;
+    time_t modtime;
+    off_t size;
+    size_t pathlen;
+    ino_t inode;
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+    int nlink;
+    int type;
+    enum csync_instructions_e instruction;
+    char path[1];
+} __attribute__ ((packed));
+
+#define ALIGN16(x) (((x) + 15) & ~((size_t) 15))
+
+/* Compare the memory of the file stats of a deep tree with the old layout */
+static void check_csync_update_compact(void **state)
+{
+    CSYNC *csync = *state;
+    csync_walk_t walk;
+    void **files;
+    size_t before = 0;
+    size_t after = 0;
+    size_t count = 0;
+    size_t linked = 0;
+    int rc;
+
+    rc = system("cd /tmp/check_csync1 && "
+                "d=documents/projects/2012/csync/src/std/tests/data/fixtures/deep && "
+                "mkdir -p $d && "
+                "for i in $(seq 1 200); do touch $d/testfile_$i.txt; done");
+    assert_int_equal(rc, 0);
+
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw(&walk, csync->local.uri, csync_walker, MAX_DEPTH);
+    assert_int_equal(rc, 0);
+
+    for (files = c_htable_sorted(csync->local.tree); *files != NULL; files++) {
+        csync_file_stat_t *st = *files;
+        char path[st->pathlen + 1];
+
+        csync_file_stat_path(st, path);
+        assert_int_equal(strlen(path), st->pathlen);
+        assert_true(st->phash == csync_path_hash(path, st->pathlen));
+        assert_int_equal(csync_owner_uid(csync, st->owner), getuid());
+
+        if (st->parent != NULL) {
+            linked++;
+        }
+        before += ALIGN16(sizeof(struct legacy_file_stat_s) + st->pathlen + 1);
+        after += ALIGN16(sizeof(csync_file_stat_t) + strlen(st->name));
+        count++;
+    }
+    /* 5 + 10 directories and 302 + 200 files, only the top level has no parent */
+    assert_int_equal(count, 517);
+    assert_int_equal(linked, count - 153);
+
+    printf("file stats: %zu bytes per file before, %zu bytes per file after\n",
+           before / count, after / count);
+    assert_true(after < before);
+}
+
+static csync_file_stat_t *new_file(CSYNC *ctx, const char *path, uint64_t phash)
+{
+    csync_file_stat_t *st;
+
+    st = c_arena_alloc(ctx->local.arena, sizeof(csync_file_stat_t) + strlen(path));
+    assert_non_null(st);
+    memset(st, 0, sizeof(csync_file_stat_t));
+    strcpy(st->name, path);
+    st->pathlen = strlen(path);
+    st->phash = phash;
+
+    return st;
+}
+
+/* files with the same hash are both kept and found by their path */
+static void check_csync_update_collision(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *a = new_file(csync, "a/b", 42);
+    csync_file_stat_t *b = new_file(csync, "c", 42);
+    csync_file_stat_t *c = new_file(csync, "d", 43);
+    csync_file_stat_t *d = new_file(csync, "a/b", 42);
+    csync_file_stat_t *found;
+    int rc;
+
+    rc = c_htable_insert(csync->local.tree, a->phash, a);
+    assert_int_equal(rc, 0);
+    rc = c_htable_insert(csync->local.tree, b->phash, b);
+    assert_int_equal(rc, 0);
+    rc = c_htable_insert(csync->local.tree, c->phash, c);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_htable_size(csync->local.tree), 3);
+
+    /* the same path again */
+    rc = c_htable_insert(csync->local.tree, d->phash, d);
+    assert_int_equal(rc, 1);
+
+    found = csync_file_tree_find_path(csync->local.tree, 42, "c", 1);
+    assert_true(found == b);
+    found = csync_file_tree_find_path(csync->local.tree, 42, "a/b", 3);
+    assert_true(found == a);
+    found = csync_file_tree_find(csync->local.tree, d);
+    assert_true(found == a);
+    found = csync_file_tree_find_path(csync->local.tree, 42, "d", 1);
+    assert_null(found);
+}
+
+static void check_csync_ftw_parallel_failing_fn(void **state)
+{
+    CSYNC *csync = *state;
+    csync_walk_t walk;
+    int rc;
+
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw_parallel(&walk, "/tmp/check_csync1", failing_fn, MAX_DEPTH, 4);
+    assert_int_equal(rc, -1);
+}
+
+static void check_csync_ftw_parallel_empty_uri(void **state)
+{
+    CSYNC *csync = *state;
+    csync_walk_t walk;
     int rc;
 
-    rc = csync_ftw(csync, "/tmp", failing_fn, MAX_DEPTH);
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw_parallel(&walk, "", csync_walker, MAX_DEPTH, 4);
     assert_int_equal(rc, -1);
 }
 
+static int set_updated_visitor(void *obj, void *data)
+{
+    csync_file_stat_t *st = obj;
+
+    (void) data;
+    st->instruction = CSYNC_INSTRUCTION_UPDATED;
+
+    return 0;
+}
+
+static csync_file_stat_t *find_file(c_htable_t *tree, const char *path)
+{
+    uint64_t h = csync_path_hash(path, strlen(path));
+
+    return csync_file_tree_find_path(tree, h, path, strlen(path));
+}
+
+/* the path buffer of the local walker grows with the depth */
+static void check_csync_ftw_long_path(void **state)
+{
+    CSYNC *csync = *state;
+    csync_walk_t walk;
+    char name[121];
+    char *dir = NULL;
+    char *cmd = NULL;
+    char *path = NULL;
+    int i;
+    int rc;
+
+    memset(name, 'x', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+
+    dir = c_strdup(name);
+    for (i = 1; i < 4; i++) {
+        char *tmp = dir;
+
+        rc = asprintf(&dir, "%s/%s", tmp, name);
+        assert_true(rc > 0);
+        free(tmp);
+    }
+    rc = asprintf(&cmd, "mkdir -p /tmp/check_csync1/%s && touch /tmp/check_csync1/%s/file",
+                  dir, dir);
+    assert_true(rc > 0);
+    rc = system(cmd);
+    assert_int_equal(rc, 0);
+
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw(&walk, csync->local.uri, csync_walker, MAX_DEPTH);
+    assert_int_equal(rc, 0);
+
+    rc = asprintf(&path, "%s/file", dir);
+    assert_true(rc > 0);
+    assert_int_equal(c_htable_size(csync->local.tree), 5);
+    assert_non_null(find_file(csync->local.tree, path));
+    assert_non_null(find_file(csync->local.tree, dir));
+
+    free(path);
+    free(cmd);
+    free(dir);
+}
+
+/* entries the walker ignores are not stat'ed but still skipped */
+static void check_csync_ftw_special(void **state)
+{
+    CSYNC *csync = *state;
+    csync_walk_t walk;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1/dir && "
+                "touch /tmp/check_csync1/dir/file && "
+                "mkfifo /tmp/check_csync1/dir/fifo && "
+                "ln -s file /tmp/check_csync1/dir/link");
+    assert_int_equal(rc, 0);
+
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw(&walk, csync->local.uri, csync_walker, MAX_DEPTH);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_htable_size(csync->local.tree), 2);
+    assert_non_null(find_file(csync->local.tree, "dir/file"));
+
+    c_htable_free(csync->local.tree);
+    rc = c_htable_create(&csync->local.tree, csync_file_stat_cmp);
+    assert_int_equal(rc, 0);
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+
+    rc = csync_ftw_parallel(&walk, csync->local.uri, csync_walker, MAX_DEPTH, 4);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_htable_size(csync->local.tree), 2);
+    assert_non_null(find_file(csync->local.tree, "dir/file"));
+}
+
+/* both replicas are walked at the same time */
+static void check_csync_update_concurrent(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync2/x && "
+                "touch /tmp/check_csync2/x/file /tmp/check_csync2/file");
+    assert_int_equal(rc, 0);
+
+    csync->options.concurrent_update = true;
+    csync->options.update_threads = 4;
+
+    rc = csync_update(csync);
+    assert_int_equal(rc, 0);
+
+    /* 5 directories and 302 files */
+    assert_int_equal(c_htable_size(csync->local.tree), 307);
+    assert_non_null(find_file(csync->local.tree, "a/b/c/file"));
+    assert_int_equal(c_htable_size(csync->remote.tree), 3);
+    assert_non_null(find_file(csync->remote.tree, "x/file"));
+}
+
+static void check_csync_update_incremental(void **state)
+{
+    CSYNC *csync = *state;
+    csync_walk_t walk;
+    csync_file_stat_t *st;
+    int rc;
+
+    assert_true(csync->options.incremental_update);
+
+    /* first run, write all files to the statedb */
+    rc = csync_update(csync);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_htable_size(csync->local.tree), 6);
+
+    rc = c_htable_walk(csync->local.tree, csync, set_updated_visitor);
+    assert_int_equal(rc, 0);
+    csync_set_status(csync, 0xFFFF);
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    /* a file created behind the back of an unchanged directory */
+    rc = system("touch /tmp/check_csync1/a/b/hidden && "
+                "touch -d 2010-01-01 /tmp/check_csync1/a/b");
+    assert_int_equal(rc, 0);
+    /* a file in a changed directory */
+    rc = system("touch /tmp/check_csync1/d/e/new");
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    *state = csync;
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    rc = csync_update(csync);
+    assert_int_equal(rc, 0);
+
+    /* the children of a/b have been taken from the statedb */
+    st = find_file(csync->local.tree, "a/b/file");
+    assert_non_null(st);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_null(find_file(csync->local.tree, "a/b/hidden"));
+
+    /* d/e has been read */
+    st = find_file(csync->local.tree, "d/e/new");
+    assert_non_null(st);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
+
+    /* the same with the parallel walker */
+    c_htable_free(csync->local.tree);
+    rc = c_htable_create(&csync->local.tree, csync_file_stat_cmp);
+    assert_int_equal(rc, 0);
+    csync_walk_init(&walk, csync, LOCAL_REPLICA);
+    rc = csync_ftw_parallel(&walk, csync->local.uri, csync_walker, MAX_DEPTH, 4);
+    assert_int_equal(rc, 0);
+    assert_non_null(find_file(csync->local.tree, "a/b/file"));
+    assert_null(find_file(csync->local.tree, "a/b/hidden"));
+    assert_non_null(find_file(csync->local.tree, "d/e/new"));
+}
+
+static void check_csync_update_watch(void **state)
+{
+    CSYNC *csync = *state;
+    csync_watch_t *w;
+    csync_file_stat_t *st;
+    int rc;
+
+    w = csync_watch_start(csync);
+    assert_non_null(w);
+
+    /* first run, the journal has no synchronization yet */
+    rc = csync_update(csync);
+    assert_int_equal(rc, 0);
+    assert_false(csync_watch_journal_changed(csync, "a/b") >= 0);
+
+    rc = c_htable_walk(csync->local.tree, csync, set_updated_visitor);
+    assert_int_equal(rc, 0);
+    csync_set_status(csync, 0xFFFF);
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    /* modified in place, the directory mtime doesn't change */
+    rc = system("echo change >> /tmp/check_csync1/a/b/file && "
+                "touch -d 2030-01-01 /tmp/check_csync1/a/b/file");
+    assert_int_equal(rc, 0);
+    while (csync_watch_poll(w, 100) > 0);
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    *state = csync;
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    rc = csync_update(csync);
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_watch_journal_changed(csync, "a/b"), 1);
+    assert_int_equal(csync_watch_journal_changed(csync, "d/e"), 0);
+
+    st = find_file(csync->local.tree, "a/b/file");
+    assert_non_null(st);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_EVAL);
+    st = find_file(csync->local.tree, "d/e/file");
+    assert_non_null(st);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NONE);
+
+    csync_watch_stop(w);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -387,12 +941,23 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_detect_update_db_eval, setup, teardown),
         unit_test_setup_teardown(check_csync_detect_update_db_rename, setup, teardown),
         unit_test_setup_teardown(check_csync_detect_update_db_new, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_detect_change, setup, teardown_rm),
         unit_test_setup_teardown(check_csync_detect_update_nlink, setup, teardown_rm),
         unit_test_setup_teardown(check_csync_detect_update_null, setup, teardown_rm),
 
         unit_test_setup_teardown(check_csync_ftw, setup_ftw, teardown_rm),
         unit_test_setup_teardown(check_csync_ftw_empty_uri, setup_ftw, teardown_rm),
         unit_test_setup_teardown(check_csync_ftw_failing_fn, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_parallel, setup_walk, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_parallel_failing_fn, setup_walk, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_parallel_empty_uri, setup_walk, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_long_path, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_special, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_update_compact, setup_walk, teardown_rm),
+        unit_test_setup_teardown(check_csync_update_collision, setup, teardown_rm),
+        unit_test_setup_teardown(check_csync_update_concurrent, setup_walk, teardown_rm),
+        unit_test_setup_teardown(check_csync_update_incremental, setup_incremental, teardown_rm),
+        unit_test_setup_teardown(check_csync_update_watch, setup_incremental, teardown_rm),
     };
 
     return run_tests(tests);
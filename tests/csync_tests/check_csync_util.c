@@ -15,17 +15,121 @@ static void check_csync_instruction_str(void **state)
   assert_string_equal(str, "ERROR!");
 }
 
+static void check_csync_file_stat_path(void **state)
+{
+  csync_file_stat_t *dir;
+  csync_file_stat_t *st;
+  char path[16];
+  char *uri = NULL;
+  int rc;
+
+  (void) state; /* unused */
+
+  /* files without a parent have the whole path as name */
+  dir = c_malloc(sizeof(csync_file_stat_t) + 3);
+  assert_non_null(dir);
+  strcpy(dir->name, "a/b");
+  dir->pathlen = 3;
+
+  st = c_malloc(sizeof(csync_file_stat_t) + 4);
+  assert_non_null(st);
+  strcpy(st->name, "file");
+  st->pathlen = 8;
+  st->parent = dir;
+
+  assert_string_equal(csync_file_stat_path(dir, path), "a/b");
+  assert_string_equal(csync_file_stat_path(st, path), "a/b/file");
+
+  rc = csync_file_stat_uri(st, "/tmp", &uri);
+  assert_int_equal(rc, 13);
+  assert_string_equal(uri, "/tmp/a/b/file");
+
+  SAFE_FREE(uri);
+  SAFE_FREE(st);
+  SAFE_FREE(dir);
+}
+
+static void check_csync_file_stat_path_is(void **state)
+{
+  csync_file_stat_t *dir;
+  csync_file_stat_t *st;
+  csync_file_stat_t *other;
+
+  (void) state; /* unused */
+
+  dir = c_malloc(sizeof(csync_file_stat_t) + 3);
+  assert_non_null(dir);
+  strcpy(dir->name, "a/b");
+  dir->pathlen = 3;
+
+  st = c_malloc(sizeof(csync_file_stat_t) + 4);
+  assert_non_null(st);
+  strcpy(st->name, "file");
+  st->pathlen = 8;
+  st->parent = dir;
+
+  other = c_malloc(sizeof(csync_file_stat_t) + 8);
+  assert_non_null(other);
+  strcpy(other->name, "a/b/file");
+  other->pathlen = 8;
+
+  assert_true(csync_file_stat_path_is(st, "a/b/file", 8));
+  assert_true(csync_file_stat_path_is(dir, "a/b/file", 3));
+  assert_false(csync_file_stat_path_is(st, "a/c/file", 8));
+  assert_false(csync_file_stat_path_is(st, "a/b/fild", 8));
+  assert_false(csync_file_stat_path_is(st, "a/b/file", 7));
+
+  assert_true(csync_file_stat_path_equal(st, other));
+  assert_false(csync_file_stat_path_equal(dir, other));
+  strcpy(other->name, "a/x/file");
+  assert_false(csync_file_stat_path_equal(st, other));
+
+  SAFE_FREE(other);
+  SAFE_FREE(st);
+  SAFE_FREE(dir);
+}
+
+static void check_csync_owner(void **state)
+{
+  CSYNC *csync;
+
+  (void) state; /* unused */
+
+  csync = c_malloc(sizeof(CSYNC));
+  assert_non_null(csync);
+
+  assert_int_equal(csync_owner_id(csync, 1000, 100), 0);
+  assert_int_equal(csync_owner_id(csync, 0, 0), 1);
+  assert_int_equal(csync_owner_id(csync, 1000, 1000), 2);
+  assert_int_equal(csync_owner_id(csync, 1000, 100), 0);
+  assert_int_equal(csync_owner_id(csync, 0, 0), 1);
+
+  assert_int_equal(csync_owner_uid(csync, 2), 1000);
+  assert_int_equal(csync_owner_gid(csync, 2), 1000);
+  assert_int_equal(csync_owner_gid(csync, 0), 100);
+
+  /* unknown owners are left alone by chown() */
+  assert_true(csync_owner_uid(csync, 3) == (uid_t) -1);
+  assert_true(csync_owner_gid(csync, 3) == (gid_t) -1);
+
+  SAFE_FREE(csync->owners.list);
+  SAFE_FREE(csync);
+}
+
 static void check_csync_memstat(void **state)
 {
   (void) state; /* unused */
 
-  csync_memstat_check();
+  csync_memstat_check(NULL);
 }
 
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test(check_csync_instruction_str),
+        unit_test(check_csync_file_stat_path),
+        unit_test(check_csync_file_stat_path_is),
+        unit_test(check_csync_owner),
         unit_test(check_csync_memstat),
     };
 
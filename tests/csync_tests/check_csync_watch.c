@@ -0,0 +1,187 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "torture.h"
+
+#define CSYNC_TEST 1
+#include "csync_watch.c"
+
+#define TESTJOURNAL "/tmp/check_csync1/" CSYNC_WATCH_JOURNAL
+
+static void setup(void **state) {
+    CSYNC *csync;
+    int rc;
+
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+
+    rc = system("mkdir -p /tmp/check_csync1/a/b /tmp/check_csync1/d");
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+
+    free(csync->options.config_dir);
+    csync->options.config_dir = c_strdup("/tmp/check_csync1/");
+
+    *state = csync;
+}
+
+static void teardown(void **state) {
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+/* Write a journal and lock it like a running watcher */
+static int write_journal(const char *content) {
+    int fd;
+
+    fd = open(TESTJOURNAL, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert_true(fd >= 0);
+    assert_int_equal(write(fd, content, strlen(content)), strlen(content));
+    assert_int_equal(flock(fd, LOCK_EX), 0);
+
+    return fd;
+}
+
+static void check_csync_watch_journal_load(void **state)
+{
+    CSYNC *csync = *state;
+    int fd;
+    int rc;
+
+    /* "B 1\n" ends at 4, "D a\n" at 8 */
+    fd = write_journal("B 1\nD a\nS 1 8\nD a/b\nD \n");
+
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 1);
+    assert_int_equal(csync->local.watch->count, 2);
+    assert_int_equal(csync->local.watch->end, 23);
+
+    assert_int_equal(csync_watch_journal_changed(csync, "a/b"), 1);
+    assert_int_equal(csync_watch_journal_changed(csync, ""), 1);
+    assert_int_equal(csync_watch_journal_changed(csync, "a"), 0);
+    assert_int_equal(csync_watch_journal_changed(csync, "d/e"), 0);
+
+    rc = csync_watch_journal_commit(csync);
+    assert_int_equal(rc, 0);
+
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 1);
+    assert_int_equal(csync->local.watch->count, 0);
+
+    close(fd);
+}
+
+static void check_csync_watch_journal_invalid(void **state)
+{
+    CSYNC *csync = *state;
+    int fd;
+    int rc;
+
+    /* never synchronized */
+    fd = write_journal("B 1\nD a\n");
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_watch_journal_changed(csync, "a"), -1);
+    close(fd);
+
+    /* overflow after the synchronization */
+    fd = write_journal("O 2\nD a\nS 1 8\n");
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 0);
+    close(fd);
+
+    /* overflow after the changes loaded for the synchronization */
+    fd = write_journal("B 1\nD a\nS 1 8\nO 2\nD a\n");
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 0);
+    close(fd);
+
+    /* a record which is still being written is ignored */
+    fd = write_journal("B 1\nS 1 4\nD a");
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 1);
+    assert_int_equal(csync->local.watch->count, 0);
+    assert_int_equal(csync->local.watch->end, 10);
+    close(fd);
+
+    /* no watcher */
+    fd = write_journal("B 1\nS 1 4\n");
+    close(fd);
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 0);
+    assert_null(csync->local.watch);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void check_csync_watch(void **state)
+{
+    CSYNC *csync = *state;
+    csync_watch_t *w;
+    int rc;
+
+    w = csync_watch_start(csync);
+    assert_non_null(w);
+
+    /* a second watcher is refused */
+    assert_null(csync_watch_start(csync));
+    assert_int_equal(errno, EBUSY);
+
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_watch_journal_commit(csync);
+    assert_int_equal(rc, 0);
+
+    rc = system("touch /tmp/check_csync1/a/b/file && "
+                "mkdir -p /tmp/check_csync1/d/e/f");
+    assert_int_equal(rc, 0);
+    while (csync_watch_poll(w, 100) > 0);
+
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 1);
+    assert_int_equal(csync_watch_journal_changed(csync, "a/b"), 1);
+    assert_int_equal(csync_watch_journal_changed(csync, "a"), 0);
+    assert_int_equal(csync_watch_journal_changed(csync, "d"), 1);
+    assert_int_equal(csync_watch_journal_changed(csync, "d/e"), 1);
+
+    /* the new directory is watched */
+    rc = csync_watch_journal_commit(csync);
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/d/e/f/file");
+    assert_int_equal(rc, 0);
+    while (csync_watch_poll(w, 100) > 0);
+
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 1);
+    assert_int_equal(csync_watch_journal_changed(csync, "d/e/f"), 1);
+    assert_int_equal(csync_watch_journal_changed(csync, "a/b"), 0);
+
+    csync_watch_stop(w);
+
+    rc = csync_watch_journal_load(csync);
+    assert_int_equal(rc, 0);
+}
+#endif
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_watch_journal_load, setup, teardown),
+        unit_test_setup_teardown(check_csync_watch_journal_invalid, setup, teardown),
+#ifdef HAVE_SYS_INOTIFY_H
+        unit_test_setup_teardown(check_csync_watch, setup, teardown),
+#endif
+    };
+
+    return run_tests(tests);
+}
+
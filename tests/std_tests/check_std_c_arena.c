@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "std/c_arena.h"
+
+static void setup(void **state)
+{
+  c_arena_t *arena;
+
+  arena = c_arena_new(1024);
+  assert_non_null(arena);
+
+  *state = arena;
+}
+
+static void teardown(void **state)
+{
+  c_arena_free(*state);
+
+  *state = NULL;
+}
+
+static void check_c_arena_alloc(void **state)
+{
+  c_arena_t *arena = *state;
+  char *a, *b;
+
+  a = c_arena_alloc(arena, 3);
+  assert_non_null(a);
+  memcpy(a, "ab", 3);
+
+  b = c_arena_alloc(arena, 24);
+  assert_non_null(b);
+  assert_int_equal((uintptr_t) b % 16, 0);
+  assert_int_equal(b[0], 0);
+  assert_true(b >= a + 3);
+
+  assert_string_equal(a, "ab");
+  assert_int_equal(c_arena_size(arena), 1024);
+  assert_int_equal(c_arena_used(arena), 48);
+}
+
+static void check_c_arena_alloc_zero(void **state)
+{
+  c_arena_t *arena = *state;
+
+  assert_null(c_arena_alloc(arena, 0));
+  assert_null(c_arena_alloc(NULL, 16));
+}
+
+static void check_c_arena_blocks(void **state)
+{
+  c_arena_t *arena = *state;
+  char *p[100];
+  char *big;
+  int i;
+
+  for (i = 0; i < 100; i++) {
+    p[i] = c_arena_alloc(arena, 32);
+    assert_non_null(p[i]);
+    memset(p[i], i, 32);
+  }
+  assert_int_equal(c_arena_used(arena), 100 * 32);
+  assert_int_equal(c_arena_size(arena), 4 * 1024);
+
+  /* a big allocation gets a block of its own */
+  big = c_arena_alloc(arena, 4000);
+  assert_non_null(big);
+  memset(big, 0xff, 4000);
+  assert_int_equal(c_arena_size(arena), 4 * 1024 + 4000);
+
+  /* the current block is still used */
+  assert_non_null(c_arena_alloc(arena, 32));
+  assert_int_equal(c_arena_size(arena), 4 * 1024 + 4000);
+
+  for (i = 0; i < 100; i++) {
+    assert_int_equal(p[i][0], (char) i);
+    assert_int_equal(p[i][31], (char) i);
+  }
+}
+
+static void check_c_arena_free_null(void **state)
+{
+  (void) state; /* unused */
+
+  c_arena_free(NULL);
+  assert_int_equal(c_arena_size(NULL), 0);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test_setup_teardown(check_c_arena_alloc, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_alloc_zero, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_blocks, setup, teardown),
+      unit_test(check_c_arena_free_null),
+  };
+
+  return run_tests(tests);
+}
+
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -61,6 +62,51 @@ static void check_c_copy(void **state)
     assert_int_equal(rc, 0);
 }
 
+/* a file larger than the copy buffers, with the kernel copy if it works */
+static void check_c_copy_large(void **state)
+{
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("head -c 3000000 /dev/urandom > /tmp/check/large.bin");
+    assert_int_equal(rc, 0);
+
+    rc = c_copy("/tmp/check/large.bin", check_dst_file, 0644);
+    assert_int_equal(rc, 0);
+    rc = system("cmp -s /tmp/check/large.bin /tmp/check/bar.txt");
+    assert_int_equal(rc, 0);
+}
+
+static void check_c_copy_fd(void **state)
+{
+    int srcfd, dstfd;
+    off_t n;
+    int rc;
+
+    (void) state; /* unused */
+
+    srcfd = open(check_src_file, O_RDONLY);
+    assert_true(srcfd >= 0);
+    dstfd = open(check_dst_file, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+    assert_true(dstfd >= 0);
+
+    /* copied or left for a read and write loop */
+    n = c_copy_fd(srcfd, dstfd);
+    if (n < 0) {
+        assert_int_equal(errno, ENOSYS);
+    } else {
+        assert_int_equal(n, 3);
+    }
+    close(srcfd);
+    close(dstfd);
+
+    if (n >= 0) {
+        rc = system("cmp -s /tmp/check/foo.txt /tmp/check/bar.txt");
+        assert_int_equal(rc, 0);
+    }
+}
+
 static void check_c_copy_same_file(void **state)
 {
     int rc;
@@ -89,6 +135,8 @@ int torture_run_tests(void)
 {
   const UnitTest tests[] = {
       unit_test_setup_teardown(check_c_copy, setup, teardown),
+      unit_test_setup_teardown(check_c_copy_large, setup, teardown),
+      unit_test_setup_teardown(check_c_copy_fd, setup, teardown),
       unit_test(check_c_copy_same_file),
       unit_test_setup_teardown(check_c_copy_isdir, setup, teardown),
   };
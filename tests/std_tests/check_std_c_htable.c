@@ -0,0 +1,429 @@
+#include <errno.h>
+#include <time.h>
+
+#include "torture.h"
+
+#include "std/c_alloc.h"
+#include "std/c_htable.h"
+
+typedef struct test_s {
+    int key;
+    int number;
+} test_t;
+
+static int data_cmp(const void *a, const void *b) {
+    const test_t *x = a;
+    const test_t *y = b;
+
+    if (x->number < y->number) {
+        return -1;
+    } else if (x->number > y->number) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int visitor(void *obj, void *data) {
+    test_t *a;
+    test_t *b;
+
+    a = (test_t *) obj;
+    b = (test_t *) data;
+
+    if (a->key == b->key) {
+        a->number = 42;
+    }
+
+    return 0;
+}
+
+/* the walk is in sorted order */
+static int order_visitor(void *obj, void *data) {
+    test_t *a = obj;
+    test_t **last = data;
+
+    if (*last != NULL && (*last)->key > a->key) {
+        return -1;
+    }
+    *last = a;
+
+    return 0;
+}
+
+static void destroy(c_htable_t *table) {
+    c_htable_iter_t it;
+    test_t *testdata;
+
+    for (testdata = c_htable_first(table, &it); testdata != NULL;
+         testdata = c_htable_next(table, &it)) {
+        SAFE_FREE(testdata);
+    }
+    c_htable_free(table);
+}
+
+static void setup(void **state) {
+    c_htable_t *table = NULL;
+    int rc;
+
+    rc = c_htable_create(&table, data_cmp);
+    assert_int_equal(rc, 0);
+
+    *state = table;
+}
+
+static void setup_complete_table(void **state) {
+    c_htable_t *table = NULL;
+    int i = 0;
+    int rc;
+
+    rc = c_htable_create(&table, data_cmp);
+    assert_int_equal(rc, 0);
+
+    for (i = 0; i < 100; i++) {
+        test_t *testdata = NULL;
+
+        testdata = c_malloc(sizeof(test_t));
+        assert_non_null(testdata);
+
+        testdata->key = i;
+
+        rc = c_htable_insert(table, i, testdata);
+        assert_int_equal(rc, 0);
+    }
+
+    *state = table;
+}
+
+static void teardown(void **state) {
+    destroy(*state);
+
+    *state = NULL;
+}
+
+static void check_c_htable_create_free(void **state)
+{
+    c_htable_t *table = NULL;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = c_htable_create(&table, data_cmp);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_htable_size(table), 0);
+
+    rc = c_htable_free(table);
+    assert_int_equal(rc, 0);
+}
+
+static void check_c_htable_create_null(void **state)
+{
+    c_htable_t *table = NULL;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = c_htable_create(NULL, data_cmp);
+    assert_int_equal(rc, -1);
+
+    rc = c_htable_create(&table, NULL);
+    assert_int_equal(rc, -1);
+}
+
+static void check_c_htable_free_null(void **state)
+{
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = c_htable_free(NULL);
+    assert_int_equal(rc, -1);
+}
+
+static void check_c_htable_insert_remove(void **state)
+{
+    c_htable_t *table = NULL;
+    c_htable_iter_t it;
+    test_t *testdata = NULL;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = c_htable_create(&table, data_cmp);
+    assert_int_equal(rc, 0);
+
+    testdata = malloc(sizeof(test_t));
+    testdata->key = 42;
+    testdata->number = 0;
+
+    rc = c_htable_insert(table, 42, testdata);
+    assert_int_equal(rc, 0);
+
+    testdata = c_htable_first(table, &it);
+    assert_non_null(testdata);
+    assert_int_equal(testdata->key, 42);
+
+    SAFE_FREE(testdata);
+    rc = c_htable_remove(table, &it);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_htable_size(table), 0);
+    assert_null(c_htable_find(table, 42, &it));
+
+    c_htable_free(table);
+}
+
+static void check_c_htable_insert_random(void **state)
+{
+    c_htable_t *table = *state;
+    c_htable_iter_t it;
+    int i = 0, rc;
+
+    srand(time(NULL));
+    for (i = 0; i < 10000; i++) {
+        test_t *testdata = NULL;
+
+        testdata = malloc(sizeof(test_t));
+        assert_non_null(testdata);
+
+        testdata->key = rand();
+        testdata->number = i;
+
+        rc = c_htable_insert(table, testdata->key, testdata);
+        assert_int_equal(rc, 0);
+    }
+    assert_int_equal(c_htable_size(table), 10000);
+
+    /* every entry is found by its key */
+    for (i = 0; i < 10000; i++) {
+        test_t *testdata = NULL;
+        test_t *found;
+        int n = 0;
+
+        testdata = i ? c_htable_next(table, &it) : c_htable_first(table, &it);
+        assert_non_null(testdata);
+        {
+            c_htable_iter_t lookup;
+
+            for (found = c_htable_find(table, testdata->key, &lookup);
+                 found != NULL && found != testdata;
+                 found = c_htable_find_next(table, &lookup)) {
+                n++;
+            }
+        }
+        assert_true(found == testdata);
+        assert_true(n < 10);
+    }
+    assert_null(c_htable_next(table, &it));
+}
+
+static void check_c_htable_insert_duplicate(void **state)
+{
+    c_htable_t *table = *state;
+    c_htable_iter_t it;
+    test_t *testdata;
+    int rc;
+
+    testdata = malloc(sizeof(test_t));
+    assert_non_null(testdata);
+
+    testdata->key = 42;
+    testdata->number = 1;
+
+    rc = c_htable_insert(table, 42, testdata);
+    assert_int_equal(rc, 0);
+
+    /* add again */
+    testdata = malloc(sizeof(test_t));
+    assert_non_null(testdata);
+
+    testdata->key = 42;
+    testdata->number = 1;
+
+    /* check for duplicate */
+    rc = c_htable_insert(table, 42, testdata);
+    assert_int_equal(rc, 1);
+
+    /* same key, different data */
+    testdata->number = 2;
+    rc = c_htable_insert(table, 42, testdata);
+    assert_int_equal(rc, 0);
+
+    assert_non_null(c_htable_find(table, 42, &it));
+    assert_non_null(c_htable_find_next(table, &it));
+    assert_null(c_htable_find_next(table, &it));
+}
+
+static void check_c_htable_find(void **state)
+{
+    c_htable_t *table = *state;
+    c_htable_iter_t it;
+    test_t *testdata;
+
+    /* find the entry with the key 42 */
+    testdata = c_htable_find(table, 42, &it);
+    assert_non_null(testdata);
+    assert_int_equal(testdata->key, 42);
+    assert_null(c_htable_find_next(table, &it));
+
+    assert_null(c_htable_find(table, 100, &it));
+}
+
+static void check_c_htable_remove(void **state)
+{
+    c_htable_t *table = *state;
+    c_htable_iter_t it;
+    test_t *freedata = NULL;
+    int rc, i;
+
+    freedata = c_htable_find(table, 42, &it);
+    assert_non_null(freedata);
+
+    free(freedata);
+    rc = c_htable_remove(table, &it);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_htable_size(table), 99);
+
+    /* only once */
+    rc = c_htable_remove(table, &it);
+    assert_int_equal(rc, -1);
+
+    assert_null(c_htable_find(table, 42, &it));
+    for (i = 0; i < 100; i++) {
+        if (i != 42) {
+            assert_non_null(c_htable_find(table, i, &it));
+        }
+    }
+}
+
+/* removing and inserting over and over reuses the deleted slots */
+static void check_c_htable_remove_insert(void **state)
+{
+    c_htable_t *table = *state;
+    c_htable_iter_t it;
+    test_t *testdata;
+    int rc, i;
+
+    for (i = 0; i < 100000; i++) {
+        testdata = c_htable_find(table, i, &it);
+        assert_non_null(testdata);
+        rc = c_htable_remove(table, &it);
+        assert_int_equal(rc, 0);
+
+        testdata->key = i + 100;
+        rc = c_htable_insert(table, i + 100, testdata);
+        assert_int_equal(rc, 0);
+    }
+    assert_int_equal(c_htable_size(table), 100);
+
+    for (i = 100000; i < 100100; i++) {
+        testdata = c_htable_find(table, i, &it);
+        assert_non_null(testdata);
+        assert_int_equal(testdata->key, i);
+    }
+}
+
+static void check_c_htable_walk(void **state)
+{
+    c_htable_t *table = *state;
+    c_htable_iter_t it;
+    test_t *testdata;
+    test_t *last = NULL;
+    int rc;
+
+    testdata = (test_t *) c_malloc(sizeof(test_t));
+    testdata->key = 42;
+
+    rc = c_htable_walk(table, testdata, visitor);
+    assert_int_equal(rc, 0);
+    free(testdata);
+
+    /* find the entry with the key 42 */
+    testdata = c_htable_find(table, 42, &it);
+    assert_non_null(testdata);
+    assert_int_equal(testdata->number, 42);
+
+    rc = c_htable_walk(table, &last, order_visitor);
+    assert_int_equal(rc, 0);
+    assert_int_equal(last->key, 99);
+}
+
+static void check_c_htable_walk_null(void **state)
+{
+    c_htable_t *table = *state;
+    c_htable_iter_t it;
+    test_t *testdata;
+    int rc;
+
+    testdata = (test_t *) malloc(sizeof(test_t));
+    testdata->key = 42;
+
+    rc = c_htable_walk(NULL, testdata, visitor);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    rc = c_htable_walk(table, NULL, visitor);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    rc = c_htable_walk(table, testdata, NULL);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    /* find the entry with the key 42 */
+    assert_non_null(c_htable_find(table, 42, &it));
+
+    free(testdata);
+}
+
+static void check_c_htable_sorted(void **state)
+{
+    c_htable_t *table = *state;
+    test_t *testdata;
+    void **sorted;
+    int rc, i;
+
+    sorted = c_htable_sorted(table);
+    assert_non_null(sorted);
+    for (i = 0; i < 100; i++) {
+        assert_int_equal(((test_t *) sorted[i])->key, i);
+    }
+    assert_null(sorted[100]);
+
+    /* the snapshot is kept while the table doesn't change */
+    assert_true(c_htable_sorted(table) == sorted);
+
+    /* entries with the same key are ordered by the data */
+    testdata = c_malloc(sizeof(test_t));
+    assert_non_null(testdata);
+    testdata->key = 50;
+    testdata->number = -1;
+    rc = c_htable_insert(table, 50, testdata);
+    assert_int_equal(rc, 0);
+
+    sorted = c_htable_sorted(table);
+    assert_non_null(sorted);
+    assert_true(sorted[50] == testdata);
+    assert_int_equal(((test_t *) sorted[51])->key, 50);
+    assert_int_equal(((test_t *) sorted[51])->number, 0);
+    assert_int_equal(((test_t *) sorted[100])->key, 99);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test(check_c_htable_create_free),
+      unit_test(check_c_htable_create_null),
+      unit_test(check_c_htable_free_null),
+      unit_test(check_c_htable_insert_remove),
+      unit_test_setup_teardown(check_c_htable_insert_random, setup, teardown),
+      unit_test_setup_teardown(check_c_htable_insert_duplicate, setup, teardown),
+      unit_test_setup_teardown(check_c_htable_find, setup_complete_table, teardown),
+      unit_test_setup_teardown(check_c_htable_remove, setup_complete_table, teardown),
+      unit_test_setup_teardown(check_c_htable_remove_insert, setup_complete_table, teardown),
+      unit_test_setup_teardown(check_c_htable_walk, setup_complete_table, teardown),
+      unit_test_setup_teardown(check_c_htable_walk_null, setup_complete_table, teardown),
+      unit_test_setup_teardown(check_c_htable_sorted, setup_complete_table, teardown),
+  };
+
+  return run_tests(tests);
+}
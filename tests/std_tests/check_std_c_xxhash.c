@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "std/c_xxhash.h"
+
+static void check_c_xxhash64_vectors(void **state)
+{
+  const char *s = "Nobody inspects the spammish repetition";
+
+  (void) state; /* unused */
+
+  assert_true(c_xxhash64("", 0, 0) == 0xEF46DB3751D8E999ULL);
+  assert_true(c_xxhash64("a", 1, 0) == 0xD24EC4F1A98C6E5BULL);
+  assert_true(c_xxhash64("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+  assert_true(c_xxhash64(s, strlen(s), 0) == 0xFBCEA83C8A378BF1ULL);
+
+  assert_false(c_xxhash64("abc", 3, 1) == c_xxhash64("abc", 3, 0));
+}
+
+/* every split of the input into two updates gives the one shot hash */
+static void check_c_xxhash64_stream(void **state)
+{
+  c_xxhash64_state_t st;
+  uint8_t buf[100];
+  size_t len, i;
+
+  (void) state; /* unused */
+
+  for (i = 0; i < sizeof(buf); i++) {
+    buf[i] = (uint8_t) (i * 7 + 3);
+  }
+
+  for (len = 0; len <= sizeof(buf); len++) {
+    uint64_t h = c_xxhash64(buf, len, 42);
+
+    for (i = 0; i <= len; i++) {
+      c_xxhash64_state_t prefix;
+
+      c_xxhash64_reset(&prefix, 42);
+      c_xxhash64_update(&prefix, buf, i);
+
+      st = prefix;
+      c_xxhash64_update(&st, buf + i, len - i);
+      assert_true(c_xxhash64_digest(&st) == h);
+    }
+  }
+
+  /* the digest doesn't change the state */
+  c_xxhash64_reset(&st, 0);
+  c_xxhash64_update(&st, "a/b", 3);
+  assert_true(c_xxhash64_digest(&st) == c_xxhash64("a/b", 3, 0));
+  c_xxhash64_update(&st, "/c", 2);
+  assert_true(c_xxhash64_digest(&st) == c_xxhash64("a/b/c", 5, 0));
+}
+
+/* the hash mustn't depend on the alignment of the input */
+static void check_c_xxhash64_alignment(void **state)
+{
+  uint8_t buf[80];
+  uint64_t h;
+  size_t i;
+
+  (void) state; /* unused */
+
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, "This is the time for all good men to come to the aid", 52);
+  h = c_xxhash64(buf, 52, 0);
+
+  for (i = 1; i < 8; i++) {
+    memmove(buf + i, buf + i - 1, 52);
+    assert_true(c_xxhash64(buf + i, 52, 0) == h);
+  }
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test(check_c_xxhash64_vectors),
+      unit_test(check_c_xxhash64_stream),
+      unit_test(check_c_xxhash64_alignment),
+  };
+
+  return run_tests(tests);
+}